@@ -168,6 +168,12 @@ process_spawnattr(const posix_spawnattr_t sa)
 	 * are mentioned.
 	 */
 
+	/* Create new session */
+	if (sa->sa_flags & POSIX_SPAWN_SETSID) {
+		if (setsid() < 0)
+			return (errno);
+	}
+
 	/* Set process group */
 	if (sa->sa_flags & POSIX_SPAWN_SETPGROUP) {
 		if (setpgid(0, sa->sa_pgroup) != 0)
@@ -292,6 +298,47 @@ extern int __posix_spawn_fork (void **proc);
 extern int __posix_spawn_execvpe (const char *path, char * const *argv,
 				  char *const *envp, void *sem,
 				  int use_env_path);
+extern int __posix_spawn_nofork (pid_t *pid, const char *path,
+				 const posix_spawn_file_actions_t *fa,
+				 const posix_spawnattr_t *sa,
+				 char * const argv[], char * const envp[],
+				 int use_env_path);
+
+/* Called from __posix_spawn_nofork to fetch the file actions one by one.
+   *cookie must be NULL on the first call.  Returns 0 after the last entry. */
+int
+__posix_spawn_file_actions_next(const posix_spawn_file_actions_t *fa,
+	void **cookie, int *action, int *fildes, int *newfildes,
+	const char **path, int *oflag, mode_t *mode)
+{
+	posix_spawn_file_actions_entry_t *fae = *cookie;
+
+	fae = fae ? STAILQ_NEXT(fae, fae_list) : STAILQ_FIRST(&(*fa)->fa_list);
+	*cookie = fae;
+	if (fae == NULL)
+		return (0);
+	*action = fae->fae_action;
+	*fildes = fae->fae_fildes;
+	switch (fae->fae_action) {
+	case FAE_OPEN:
+		*path = fae->fae_path;
+		*oflag = fae->fae_oflag;
+		*mode = fae->fae_mode;
+		break;
+	case FAE_DUP2:
+		*newfildes = fae->fae_newfildes;
+		break;
+	case FAE_CHDIR:
+		*path = fae->fae_dir;
+		break;
+	case FAE_FCHDIR:
+		*fildes = fae->fae_dirfd;
+		break;
+	default:
+		break;
+	}
+	return (1);
+}
 
 
 static int
@@ -304,6 +351,13 @@ do_posix_spawn(pid_t *pid, const char *path,
 	void *sem, *proc;
 	pid_t p;
 
+	/* Try to start the child without forking first.  This returns -1 if
+	   the file actions or attributes require a forked child. */
+	error = __posix_spawn_nofork(pid, path, fa, sa, argv, envp,
+				     use_env_path);
+	if (error >= 0)
+		return (error);
+
 	error = __posix_spawn_sem_create(&sem);
 	if (error)
 		return error;
@@ -473,6 +473,40 @@ vm_object_deallocate (vm_object_t object)
     CloseHandle (object);
 }
 
+/*
+ * Sections shared with the clients by semaphore sets and message queues.
+ * Unlike shared memory segments they are only handed out after checking
+ * the access rights of the client, and they are mapped by cygserver for
+ * their whole lifetime.  Returns the view, or NULL on failure.
+ */
+void *
+ipc_shared_alloc (size_t size, vm_object_t *object)
+{
+  void *view = NULL;
+
+  *object = CreateFileMapping (INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+			       0, size, NULL);
+  if (*object)
+    {
+      view = MapViewOfFile (*object, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0);
+      if (!view)
+	{
+	  CloseHandle (*object);
+	  *object = NULL;
+	}
+    }
+  if (!view)
+    log (LOG_ERR, "failed to create IPC section, error = %u", GetLastError ());
+  return view;
+}
+
+void
+ipc_shared_free (vm_object_t object, void *view)
+{
+  UnmapViewOfFile (view);
+  CloseHandle (object);
+}
+
 /*
  * Tunable parameters are read from a system wide cygserver.conf file.
  * On the first call to tunable_int_fetch, the file is read and the
@@ -548,6 +582,7 @@ static tun_struct tunable_params[] =
   { "kern.srv.cleanup_threads", TUN_INT, {0}, {1}, {32}, default_tun_check},
   { "kern.srv.request_threads", TUN_INT, {0}, {1}, {310}, default_tun_check},
   { "kern.srv.process_cache_size", TUN_INT, {0}, {1}, {310}, default_tun_check},
+  { "kern.srv.connections", TUN_INT, {0}, {1}, {1024}, default_tun_check},
   { "kern.srv.sharedmem", TUN_BOOL, {TUN_UNDEF}, {TUN_FALSE}, {TUN_TRUE}, default_tun_check},
   { "kern.srv.msgqueues", TUN_BOOL, {TUN_UNDEF}, {TUN_FALSE}, {TUN_TRUE}, default_tun_check},
   { "kern.srv.semaphores", TUN_BOOL, {TUN_UNDEF}, {TUN_FALSE}, {TUN_TRUE}, default_tun_check},
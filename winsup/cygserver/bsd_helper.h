@@ -57,6 +57,9 @@ vm_object_t _vm_pager_allocate (int, int);
 vm_object_t vm_object_duplicate (class thread *td, vm_object_t object);
 void vm_object_deallocate (vm_object_t object);
 
+void *ipc_shared_alloc (size_t, vm_object_t *);
+void ipc_shared_free (vm_object_t, void *);
+
 void tunable_param_init (const char *, bool);
 void tunable_int_fetch (const char *, int32_t *);
 void tunable_bool_fetch (const char *, tun_bool_t *);
@@ -28,9 +28,23 @@ details. */
 
 #include "cygserver.h"
 #include "transport.h"
+#include "transport_mux.h"
+
+#ifdef __INSIDE_CYGWIN__
+#include "security.h"
+#include "path.h"
+#include "fhandler.h"
+#include "dtable.h"
+#include "cygheap.h"
+#include "tls_pbuf.h"
+#endif
 
 int cygserver_running = CYGSERVER_UNKNOWN; // Nb: inherited by children.
 
+#ifdef __INSIDE_CYGWIN__
+static NO_COPY mux_connection cygserver_mux;
+#endif
+
 client_request_get_version::client_request_get_version ()
   : client_request (CYGSERVER_REQUEST_GET_VERSION, &version, sizeof (version))
 {
@@ -72,6 +86,25 @@ client_request_get_version::check_version () const
   return ok;
 }
 
+client_request_multiplex::client_request_multiplex ()
+  : client_request (CYGSERVER_REQUEST_MULTIPLEX)
+{
+}
+
+/*
+ * client_request_multiplex::start ()
+ *
+ * Sent on a fresh connection.  Cygserver versions not supporting
+ * multiplexed connections drop the connection on the floor.
+ */
+
+bool
+client_request_multiplex::start (transport_layer_base *const conn)
+{
+  send (conn);
+  return !error_code ();
+}
+
 client_request_attach_tty::client_request_attach_tty (DWORD nmaster_pid,
 						      HANDLE nfrom_master,
 						      HANDLE nto_master)
@@ -221,6 +254,11 @@ client_request_attach_tty::client_request_attach_tty ()
 {
 }
 
+client_request_multiplex::client_request_multiplex ()
+  : client_request (CYGSERVER_REQUEST_MULTIPLEX)
+{
+}
+
 /*
  * client_request::handle_request ()
  *
@@ -230,6 +268,9 @@ client_request_attach_tty::client_request_attach_tty ()
  * reads the incoming request header and, based on its request code,
  * creates an instance of the appropriate class.
  *
+ * Returns true if the client successfully asked to keep the connection
+ * as its multiplexed connection.
+ *
  * FIXME: If the incoming packet is malformed, the server drops it on
  * the floor.  Should it try and generate some sort of reply for the
  * client?  As it is, the client will simply get a broken connection.
@@ -237,7 +278,7 @@ client_request_attach_tty::client_request_attach_tty ()
  * FIXME: also check write and read result for -1.
  */
 
-/* static */ void
+/* static */ bool
 client_request::handle_request (transport_layer_base *const conn,
 				process_cache *const cache)
 {
@@ -255,7 +296,7 @@ client_request::handle_request (transport_layer_base *const conn,
 			 "error = %d(%u)"),
 			count, sizeof (header),
 			errno, GetLastError ());
-	return;
+	return false;
       }
   }
 
@@ -287,10 +328,13 @@ client_request::handle_request (transport_layer_base *const conn,
     case CYGSERVER_REQUEST_PWDGRP:
       req = new client_request_pwdgrp;
       break;
+    case CYGSERVER_REQUEST_MULTIPLEX:
+      req = new client_request_multiplex;
+      break;
     default:
       syscall_printf ("unknown request code %d received: request ignored",
 		      header.request_code);
-      return;
+      return false;
     }
 
   assert (req);
@@ -298,7 +342,12 @@ client_request::handle_request (transport_layer_base *const conn,
   req->msglen (header.msglen);
   req->handle (conn, cache);
 
+  const bool multiplex = (header.request_code == CYGSERVER_REQUEST_MULTIPLEX
+			  && !req->error_code ());
+
   delete req;
+
+  return multiplex;
 }
 
 /*
@@ -454,6 +503,18 @@ client_request::make_request ()
       return -1;
     }
 
+  /* The multiplexed connection carries the security context it has been
+     opened with, so don't use it while impersonating. */
+  if (!cygheap->user.issetuid ())
+    switch (send_multiplexed ())
+      {
+      case 0:
+	return 0;
+      case -1:
+	error_code (errno ?: ENOSYS);
+	return -1;
+      }
+
   transport_layer_base *const transport = create_server_transport ();
 
   assert (transport);
@@ -477,6 +538,65 @@ client_request::make_request ()
   return 0;
 }
 
+/*
+ * client_request::send_multiplexed ()
+ *
+ * Send the request over the multiplexed connection of the process, which
+ * is opened on first use.  Returns 0 if the request has been sent, -1 if
+ * cygserver can't be reached, and 1 if the request has to be sent on a
+ * connection of its own, because cygserver doesn't support multiplexing
+ * or the request is too big.
+ */
+
+int
+client_request::send_multiplexed ()
+{
+  if (cygserver_mux.unavailable ()
+      || sizeof (mux_frame_t) + sizeof (_header) + _buflen > MUX_MAX_FRAME)
+    return 1;
+
+  const header_t header = _header;
+
+  /* Retry once if the connection turns out to be broken, e.g. because
+     cygserver has been restarted. */
+  for (int tries = 0; tries < 2; ++tries)
+    {
+      if (!cygserver_mux.attached ())
+	{
+	  transport_layer_base *const transport =
+	    create_server_transport (true);
+	  assert (transport);
+
+	  if (transport->connect () == -1)
+	    {
+	      delete transport;
+	      return -1;
+	    }
+
+	  client_request_multiplex req;
+	  if (!req.start (transport))
+	    {
+	      debug_printf ("cygserver doesn't support multiplexing: %d",
+			    req.error_code ());
+	      cygserver_mux.set_unavailable ();
+	      delete transport;
+	      return 1;
+	    }
+	  if (!cygserver_mux.attach (transport))
+	    delete transport;
+	}
+
+      tmp_pathbuf tp;
+      transport_layer_mux conn (&cygserver_mux, tp.c_get (), MUX_MAX_FRAME);
+      send (&conn);
+      if (!conn.unsent ())
+	return 0;
+      _header = header;
+    }
+
+  return 1;
+}
+
 bool
 check_cygserver_available ()
 {
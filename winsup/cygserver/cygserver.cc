@@ -28,6 +28,7 @@ details. */
 #include "cygserver.h"
 #include "process.h"
 #include "transport.h"
+#include "transport_mux.h"
 
 #include "cygserver_ipc.h"
 #include "cygserver_msg.h"
@@ -301,11 +302,42 @@ client_request_get_version::serve (transport_layer_base *, process_cache *)
   version.patch = CYGWIN_SERVER_VERSION_PATCH;
 }
 
+/* Max. and current number of multiplexed connections. */
+static int32_t max_connections;
+static LONG connections;
+
+/*
+ * client_request_multiplex::serve ()
+ *
+ * Only checks the limit.  The connection is handed over to a
+ * server_connection by server_request::process after the reply has been
+ * sent.
+ */
+
+void
+client_request_multiplex::serve (transport_layer_base *, process_cache *)
+{
+  assert (!error_code ());
+
+  if (msglen ())
+    log (LOG_ERR, "unexpected request body ignored: %lu bytes", msglen ());
+
+  msglen (0);
+
+  if (connections >= max_connections)
+    {
+      debug ("too many multiplexed connections: %d", connections);
+      error_code (EAGAIN);
+    }
+}
+
 class server_request : public queue_request
 {
 public:
-  server_request (transport_layer_base *const conn, process_cache *const cache)
-    : _conn (conn), _cache (cache)
+  /* queue is NULL for requests received on a multiplexed connection. */
+  server_request (transport_layer_base *const conn, process_cache *const cache,
+		  threaded_queue *const queue = NULL)
+    : _conn (conn), _cache (cache), _queue (queue)
   {}
 
   virtual ~server_request ()
@@ -313,16 +345,55 @@ public:
     delete _conn;
   }
 
-  virtual void process ()
+  virtual void process ();
+
+private:
+  transport_layer_base *_conn;
+  process_cache *const _cache;
+  threaded_queue *const _queue;
+};
+
+/* Passes the requests read from a multiplexed connection to the worker
+   threads, so they are served concurrently and answered in any order. */
+class server_connection : public mux_connection
+{
+public:
+  server_connection (transport_layer_base *const conn,
+		     threaded_queue *const queue, process_cache *const cache)
+    : mux_connection (conn), _queue (queue), _cache (cache)
+  {
+    InterlockedIncrement (&connections);
+  }
+
+protected:
+  virtual ~server_connection ()
+  {
+    InterlockedDecrement (&connections);
+  }
+
+  virtual void submit (transport_layer_mux *const conn)
   {
-    client_request::handle_request (_conn, _cache);
+    _queue->add (new server_request (conn, _cache));
   }
 
 private:
-  transport_layer_base *const _conn;
+  threaded_queue *const _queue;
   process_cache *const _cache;
 };
 
+void
+server_request::process ()
+{
+  if (client_request::handle_request (_conn, _cache) && _queue)
+    {
+      server_connection *const conn =
+	new server_connection (_conn, _queue, _cache);
+      _conn = NULL;
+      if (!conn->start ())
+	conn->unref ();
+    }
+}
+
 class server_submission_loop : public queue_submission_loop
 {
 public:
@@ -398,7 +469,7 @@ server_submission_loop::request_loop ()
 		     GetLastError ());
 	}
       if (conn)
-	_queue->add (new server_request (conn, _cache));
+	_queue->add (new server_request (conn, _cache, _queue));
     }
 }
 
@@ -682,6 +753,10 @@ main (const int argc, char *argv[])
   if (!process_cache_size)
     process_cache_size = 62;
 
+  TUNABLE_INT_FETCH ("kern.srv.connections", &max_connections);
+  if (!max_connections)
+    max_connections = 64;
+
   if (support_sharedmem == TUN_UNDEF)
     TUNABLE_BOOL_FETCH ("kern.srv.sharedmem", &support_sharedmem);
   if (support_sharedmem == TUN_UNDEF)
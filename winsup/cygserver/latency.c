@@ -0,0 +1,154 @@
+/* latency.c: measure the round trip time of cygserver requests.
+
+This file is part of Cygwin.
+
+This software is a copyrighted work licensed under the terms of the
+Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
+details. */
+
+/* Build with `make cygserver-latency' and run it with cygserver running.
+   Each thread sends requests which are always served by cygserver, so the
+   numbers reflect the transport and the request dispatching.  Running
+   several threads shows whether their requests are served concurrently. */
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <sys/sem.h>
+
+static int semid = -1;
+static int msqid = -1;
+static int iterations = 10000;
+static int use_msg;
+
+struct worker
+{
+  pthread_t thread;
+  double *lat;
+  int failed;
+};
+
+static double
+now ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void *
+run (void *arg)
+{
+  struct worker *w = (struct worker *) arg;
+  struct semid_ds sds;
+  struct msqid_ds mds;
+
+  for (int i = 0; i < iterations; ++i)
+    {
+      double start = now ();
+      int ret = use_msg ? msgctl (msqid, IPC_STAT, &mds)
+			: semctl (semid, 0, IPC_STAT, &sds);
+      w->lat[i] = now () - start;
+      if (ret)
+	++w->failed;
+    }
+  return NULL;
+}
+
+static int
+cmp (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+static void
+usage (const char *pgm)
+{
+  fprintf (stderr,
+	   "Usage: %s [-m] [-n iterations] [-t threads]\n"
+	   "\n"
+	   "  -m   Use msgctl(2) rather than semctl(2) requests.\n"
+	   "  -n   Requests per thread, default 10000.\n"
+	   "  -t   Number of threads, default 1.\n", pgm);
+  exit (1);
+}
+
+int
+main (int argc, char **argv)
+{
+  int threads = 1;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "mn:t:")) != -1)
+    switch (opt)
+      {
+      case 'm':
+	use_msg = 1;
+	break;
+      case 'n':
+	iterations = atoi (optarg);
+	break;
+      case 't':
+	threads = atoi (optarg);
+	break;
+      default:
+	usage (argv[0]);
+      }
+  if (iterations < 1 || threads < 1 || optind != argc)
+    usage (argv[0]);
+
+  if (use_msg)
+    msqid = msgget (IPC_PRIVATE, IPC_CREAT | 0600);
+  else
+    semid = semget (IPC_PRIVATE, 1, IPC_CREAT | 0600);
+  if (msqid == -1 && semid == -1)
+    {
+      fprintf (stderr, "%s: %s (is cygserver running?)\n",
+	       use_msg ? "msgget" : "semget", strerror (errno));
+      return 1;
+    }
+
+  struct worker *w = (struct worker *) calloc (threads, sizeof *w);
+  double *lat = (double *) malloc (sizeof *lat * threads * iterations);
+  if (!w || !lat)
+    {
+      fprintf (stderr, "out of memory\n");
+      return 1;
+    }
+
+  double start = now ();
+  for (int i = 0; i < threads; ++i)
+    {
+      w[i].lat = lat + i * iterations;
+      pthread_create (&w[i].thread, NULL, run, &w[i]);
+    }
+  int failed = 0;
+  for (int i = 0; i < threads; ++i)
+    {
+      pthread_join (w[i].thread, NULL);
+      failed += w[i].failed;
+    }
+  double elapsed = now () - start;
+
+  if (use_msg)
+    msgctl (msqid, IPC_RMID, NULL);
+  else
+    semctl (semid, 0, IPC_RMID);
+
+  size_t n = (size_t) threads * iterations;
+  qsort (lat, n, sizeof *lat, cmp);
+  printf ("%d thread(s), %zu requests, %d failed\n", threads, n, failed);
+  printf ("latency (us): min %.1f  median %.1f  p99 %.1f  max %.1f\n",
+	  lat[0], lat[n / 2], lat[n * 99 / 100], lat[n - 1]);
+  printf ("throughput: %.0f requests/s\n", n / (elapsed / 1e6));
+  return failed != 0;
+}
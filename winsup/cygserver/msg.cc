@@ -96,6 +96,12 @@ client_request_msg::serve (transport_layer_base *const conn,
       case MSGOP_msgsnd:
 	res = msgsnd (&td, &_parameters.in.sndargs);
         break;
+      case MSGOP_msgmap:
+	res = msgmap (&td, &_parameters.in.ctlargs);
+        break;
+      case MSGOP_msgwakeup:
+	res = msgwakeup (&td, &_parameters.in.ctlargs);
+        break;
       default:
 	res = ENOSYS;
         td.td_retval[0] = -1;
@@ -109,6 +115,8 @@ client_request_msg::serve (transport_layer_base *const conn,
     _parameters.out.rcv = td.td_retval[0];
   else
     _parameters.out.ret = td.td_retval[0];
+  if (msgop == MSGOP_msgmap)
+    _parameters.out.obj = td.td_retval[1];
   msglen (sizeof (_parameters.out));
 }
 #endif /* __OUTSIDE_CYGWIN__ */
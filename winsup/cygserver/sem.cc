@@ -78,7 +78,8 @@ client_request_sem::serve (transport_layer_base *const conn,
   client->release ();
   thread td (client, &_parameters.in.ipcblk, true);
   int res;
-  switch (_parameters.in.semop)
+  semop_t op = _parameters.in.semop; /* Gets overwritten otherwise. */
+  switch (op)
     {
       case SEMOP_semctl:
 	res = semctl (&td, &_parameters.in.ctlargs);
@@ -89,6 +90,12 @@ client_request_sem::serve (transport_layer_base *const conn,
       case SEMOP_semop:
 	res = semop (&td, &_parameters.in.opargs);
         break;
+      case SEMOP_semmap:
+	res = semmap (&td, &_parameters.in.ctlargs);
+        break;
+      case SEMOP_semwakeup:
+	res = semwakeup (&td, &_parameters.in.ctlargs);
+        break;
       default:
 	res = ENOSYS;
         td.td_retval[0] = -1;
@@ -99,6 +106,8 @@ client_request_sem::serve (transport_layer_base *const conn,
     free (_parameters.in.ipcblk.gidlist);
   error_code (res);
   _parameters.out.ret = td.td_retval[0];
+  if (op == SEMOP_semmap)
+    _parameters.out.obj = td.td_retval[1];
   msglen (sizeof (_parameters.out));
 }
 #endif /* __OUTSIDE_CYGWIN__ */
@@ -39,10 +39,12 @@ __FBSDID("$FreeBSD: /usr/local/www/cvsroot/FreeBSD/src/sys/kern/sysv_msg.c,v 1.5
 #include <sys/msg.h>
 #include <malloc.h>
 #include <errno.h>
+#include <string.h>
 #include <time.h>
 #include "cygserver.h"
 #include "process.h"
 #include "cygserver_ipc.h"
+#include "cygserver_msg.h"
 
 #ifdef __CYGWIN__
 #define MSG_DEBUG
@@ -54,7 +56,9 @@ __FBSDID("$FreeBSD: /usr/local/www/cvsroot/FreeBSD/src/sys/kern/sysv_msg.c,v 1.5
 #define DPRINTF(a)
 #endif
 
-static void msg_freehdr(struct msg *msghdr);
+static void msq_sync(int msqid);
+static void msq_shared_free(int msqid);
+static int msq_shared_renew(int msqid);
 
 #ifndef __CYGWIN__
 int msgctl(struct thread *, struct msgctl_args *);
@@ -69,16 +73,6 @@ static sy_call_t *msgcalls[] = {
 #endif /* __CYGWIN__ */
 
 
-struct msg {
-	struct	msg *msg_next;	/* next msg in the chain */
-	long	msg_type;	/* type of this message */
-    				/* >0 -> type of this message */
-    				/* 0 -> free header */
-	u_short	msg_ts;		/* size of this message */
-	short	msg_spot;	/* location of start of msg in buffer */
-};
-
-
 #ifndef MSGSSZ
 #define MSGSSZ	8		/* Each segment must be 2^N long */
 #endif
@@ -126,29 +120,40 @@ struct msginfo msginfo = {
 
 /*
  * The rest of this file is specific to this particular implementation.
+ *
+ * CYGWIN: Every queue has its own section, see cygserver_msg.h, holding
+ * msgtql message headers and enough segments for msgmnb bytes, so the
+ * limit on the number of messages applies per queue.  The section is
+ * shared with the clients allowed to read and write the queue, so the
+ * queue itself, its counters and the free lists are protected by the
+ * lock in the section.  It's taken after msq_mtx and never held while
+ * sleeping or copying from or to the client.
  */
 
-struct msgmap {
-	short	next;		/* next segment in buffer */
-    				/* -1 -> available */
-    				/* 0..(MSGSEG-1) -> index of next segment */
-};
-
 #define MSG_LOCKED	01000	/* Is this msqid_ds locked? */
 
-static int nfree_msgmaps;	/* # of free map entries */
-static short free_msgmaps;	/* head of linked list of free map entries */
-static struct msg *free_msghdrs;/* list of free msg headers */
-static char *msgpool;		/* MSGMAX byte long msg buffer pool */
-static struct msgmap *msgmaps;	/* MSGSEG msgmap structures */
-static struct msg *msghdrs;	/* MSGTQL msg headers */
 static struct msqid_ds *msqids;	/* MSGMNI msqid_ds struct's */
+static struct msq_shared **msq_sh;	/* MSGMNI shared sections */
+static vm_object_t *msq_obj;	/* and their handles */
+static int msq_nhdrs;		/* message headers per queue */
+static int msq_nsegs;		/* segments per queue */
 static struct mtx msq_mtx;	/* global mutex for message queues. */
 
 #ifdef __CYGWIN__
 static struct msg_info msg_info;
 #endif /* __CYGWIN__ */
 
+#define MSQ_SHLOCK(ix)		ipc_shlock_server(&msq_sh[(ix)]->lock)
+#define MSQ_SHUNLOCK(ix)	ipc_shunlock(&msq_sh[(ix)]->lock)
+#define MSQ_SHARED_SZ \
+	MSQ_SHARED_SIZE(msq_nhdrs, msq_nsegs, msginfo.msgssz)
+
+static msq_arena
+msq_getarena(int msqid)
+{
+	return msq_arena(msq_sh[msqid], msq_nhdrs, msq_nsegs, msginfo.msgssz);
+}
+
 void
 msginit()
 {
@@ -161,18 +166,15 @@ msginit()
 	TUNABLE_INT_FETCH("kern.ipc.msgmni", &msginfo.msgmni);
 	TUNABLE_INT_FETCH("kern.ipc.msgtql", &msginfo.msgtql);
 
-	msgpool = (char *) sys_malloc(msginfo.msgmax, M_MSG, M_WAITOK);
-	if (msgpool == NULL)
-		panic("msgpool is NULL");
-	msgmaps = (msgmap *) sys_malloc(sizeof(struct msgmap) * msginfo.msgseg, M_MSG, M_WAITOK);
-	if (msgmaps == NULL)
-		panic("msgmaps is NULL");
-	msghdrs = (msg *) sys_malloc(sizeof(struct msg) * msginfo.msgtql, M_MSG, M_WAITOK);
-	if (msghdrs == NULL)
-		panic("msghdrs is NULL");
 	msqids = (msqid_ds *) sys_malloc(sizeof(struct msqid_ds) * msginfo.msgmni, M_MSG, M_WAITOK);
 	if (msqids == NULL)
 		panic("msqids is NULL");
+	msq_sh = (msq_shared **) sys_malloc(sizeof(struct msq_shared *) * msginfo.msgmni, M_MSG, M_WAITOK);
+	if (msq_sh == NULL)
+		panic("msq_sh is NULL");
+	msq_obj = (vm_object_t *) sys_malloc(sizeof(vm_object_t) * msginfo.msgmni, M_MSG, M_WAITOK);
+	if (msq_obj == NULL)
+		panic("msq_obj is NULL");
 
 	/*
 	 * msginfo.msgssz should be a power of two for efficiency reasons.
@@ -194,35 +196,20 @@ msginit()
 		panic("msginfo.msgseg > 32767");
 	}
 
-	if (msgmaps == NULL)
-		panic("msgmaps is NULL");
-
-	for (i = 0; i < msginfo.msgseg; i++) {
-		if (i > 0)
-			msgmaps[i-1].next = i;
-		msgmaps[i].next = -1;	/* implies entry is available */
-	}
-	free_msgmaps = 0;
-	nfree_msgmaps = msginfo.msgseg;
-
-	if (msghdrs == NULL)
-		panic("msghdrs is NULL");
-
-	for (i = 0; i < msginfo.msgtql; i++) {
-		msghdrs[i].msg_type = 0;
-		if (i > 0)
-			msghdrs[i-1].msg_next = &msghdrs[i];
-		msghdrs[i].msg_next = NULL;
-    	}
-	free_msghdrs = &msghdrs[0];
-
-	if (msqids == NULL)
-		panic("msqids is NULL");
+	/*
+	 * Every message wastes less than a segment, so this many segments
+	 * are never the limiting factor.
+	 */
+	msq_nhdrs = msginfo.msgtql;
+	msq_nsegs = (msginfo.msgmnb + msginfo.msgssz - 1) / msginfo.msgssz
+	    + msq_nhdrs;
 
 	for (i = 0; i < msginfo.msgmni; i++) {
 		msqids[i].msg_qbytes = 0;	/* implies entry is available */
 		msqids[i].msg_perm.seq = 0;	/* reset to a known value */
 		msqids[i].msg_perm.mode = 0;
+		msq_sh[i] = NULL;
+		msq_obj[i] = NULL;
 	}
 	mtx_init(&msq_mtx, "msq", NULL, MTX_DEF);
 }
@@ -250,9 +237,11 @@ msgunload()
 		return (EBUSY);
 #endif /* __CYGWIN__ */
 
-	sys_free(msgpool, M_MSG);
-	sys_free(msgmaps, M_MSG);
-	sys_free(msghdrs, M_MSG);
+	for (msqid = 0; msqid < msginfo.msgmni; msqid++)
+		if (msq_sh[msqid])
+			ipc_shared_free(msq_obj[msqid], msq_sh[msqid]);
+	sys_free(msq_sh, M_MSG);
+	sys_free(msq_obj, M_MSG);
 	sys_free(msqids, M_MSG);
 	mtx_destroy(&msq_mtx);
 	return (0);
@@ -317,27 +306,65 @@ msgsys(thread *td, struct msgsys_args *uap)
 }
 #endif
 
+/*
+ * Copy the counters maintained in the shared section into the msqid_ds.
+ */
 static void
-msg_freehdr(struct msg *msghdr)
+msq_sync(int msqid)
 {
-	while (msghdr->msg_ts > 0) {
-		short next;
-		if (msghdr->msg_spot < 0 || msghdr->msg_spot >= msginfo.msgseg)
-			panic("msghdr->msg_spot out of range");
-		next = msgmaps[msghdr->msg_spot].next;
-		msgmaps[msghdr->msg_spot].next = free_msgmaps;
-		free_msgmaps = msghdr->msg_spot;
-		nfree_msgmaps++;
-		msghdr->msg_spot = next;
-		if (msghdr->msg_ts >= msginfo.msgssz)
-			msghdr->msg_ts -= msginfo.msgssz;
-		else
-			msghdr->msg_ts = 0;
-	}
-	if (msghdr->msg_spot != -1)
-		panic("msghdr->msg_spot != -1");
-	msghdr->msg_next = free_msghdrs;
-	free_msghdrs = msghdr;
+	struct msqid_ds *msqptr = &msqids[msqid];
+	struct msq_shared *sh = msq_sh[msqid];
+
+	if (!sh)
+		return;
+	ipc_shlock_server(&sh->lock);
+	msqptr->msg_cbytes = sh->cbytes;
+	msqptr->msg_qnum = sh->qnum;
+	msqptr->msg_lspid = sh->lspid;
+	msqptr->msg_lrpid = sh->lrpid;
+	msqptr->msg_stime = sh->stime;
+	msqptr->msg_rtime = sh->rtime;
+	ipc_shunlock(&sh->lock);
+}
+
+/*
+ * Drop the section of a queue.  Clients which still have it mapped see
+ * it as removed and come asking.
+ */
+static void
+msq_shared_free(int msqid)
+{
+	MSQ_SHLOCK(msqid);
+	msq_sh[msqid]->removed = 1;
+	MSQ_SHUNLOCK(msqid);
+	ipc_shared_free(msq_obj[msqid], msq_sh[msqid]);
+	msq_sh[msqid] = NULL;
+	msq_obj[msqid] = NULL;
+}
+
+/*
+ * Move a queue into a fresh section when its permissions change, so
+ * clients have to ask for the new one and get their permissions checked
+ * again.
+ */
+static int
+msq_shared_renew(int msqid)
+{
+	struct msq_shared *nsh;
+	vm_object_t nobj;
+
+	nsh = (struct msq_shared *) ipc_shared_alloc(MSQ_SHARED_SZ, &nobj);
+	if (!nsh)
+		return (ENOMEM);
+	MSQ_SHLOCK(msqid);
+	memcpy(nsh, msq_sh[msqid], MSQ_SHARED_SZ);
+	nsh->lock = 0;
+	msq_sh[msqid]->removed = 1;
+	MSQ_SHUNLOCK(msqid);
+	ipc_shared_free(msq_obj[msqid], msq_sh[msqid]);
+	msq_sh[msqid] = nsh;
+	msq_obj[msqid] = nobj;
+	return (0);
 }
 
 #ifndef _SYS_SYSPROTO_H_
@@ -376,12 +403,24 @@ msgctl(struct thread *td, struct msgctl_args *uap)
 		}
 		if (msqid > msginfo.msgmni)
 			msqid = msginfo.msgmni;
+		mtx_lock(&msq_mtx);
+		for (int i = 0; i < msqid; i++)
+			msq_sync(i);
 		error = copyout(msqids, user_msqptr,
 				msqid * sizeof(struct msqid_ds));
 		td->td_retval[0] = error ? -1 : 0;
+		mtx_unlock(&msq_mtx);
 		return (error);
 	} else if (cmd == MSG_INFO) {
 		mtx_lock(&msq_mtx);
+		msg_info.msg_num = msg_info.msg_tot = 0;
+		for (int i = 0; i < msginfo.msgmni; i++) {
+			if (msq_sh[i] == NULL)
+				continue;
+			msq_sync(i);
+			msg_info.msg_num += msqids[i].msg_qnum;
+			msg_info.msg_tot += msqids[i].msg_cbytes;
+		}
 		error = copyout(&msg_info, user_msqptr,
 				sizeof(struct msg_info));
 		td->td_retval[0] = error ? -1 : 0;
@@ -420,36 +459,18 @@ msgctl(struct thread *td, struct msgctl_args *uap)
 	switch (cmd) {
 
 	case IPC_RMID:
-	{
-		struct msg *msghdr;
 		if ((error = ipcperm(td, &msqptr->msg_perm, IPC_M)))
 			goto done2;
-		/* Free the message headers */
-		msghdr = msqptr->msg_first;
-		while (msghdr != NULL) {
-			struct msg *msghdr_tmp;
-
-			/* Free the segments of each message */
-			msqptr->msg_cbytes -= msghdr->msg_ts;
-			msqptr->msg_qnum--;
-			msghdr_tmp = msghdr;
-			msghdr = msghdr->msg_next;
-			msg_freehdr(msghdr_tmp);
-		}
-
-		if (msqptr->msg_cbytes != 0)
-			panic("msg_cbytes is screwed up");
-		if (msqptr->msg_qnum != 0)
-			panic("msg_qnum is screwed up");
-
+		/* The messages go away with the section. */
+		msq_shared_free(msqid);
+		msqptr->msg_cbytes = 0;
+		msqptr->msg_qnum = 0;
 		msqptr->msg_qbytes = 0;	/* Mark it as free */
 #ifdef __CYGWIN__
 		msg_info.msg_ids--;
 #endif /* __CYGWIN__ */
 
 		wakeup(msqptr);
-	}
-
 		break;
 
 	case IPC_SET:
@@ -470,11 +491,14 @@ msgctl(struct thread *td, struct msgctl_args *uap)
 			error = EINVAL;		/* non-standard errno! */
 			goto done2;
 		}
+		if ((error = msq_shared_renew(msqid)) != 0)
+			goto done2;
 		msqptr->msg_perm.uid = msqbuf.msg_perm.uid;	/* change the owner */
 		msqptr->msg_perm.gid = msqbuf.msg_perm.gid;	/* change the owner */
 		msqptr->msg_perm.mode = (msqptr->msg_perm.mode & ~0777) |
 		    (msqbuf.msg_perm.mode & 0777);
 		msqptr->msg_qbytes = msqbuf.msg_qbytes;
+		msq_sh[msqid]->qbytes = msqbuf.msg_qbytes;
 		msqptr->msg_ctime = time (NULL);
 		break;
 
@@ -483,6 +507,8 @@ msgctl(struct thread *td, struct msgctl_args *uap)
 			DPRINTF(("requester doesn't have read access\n"));
 			goto done2;
 		}
+		msq_sync(msqid);
+		msqbuf = *msqptr;
 		break;
 
 	default:
@@ -496,7 +522,7 @@ msgctl(struct thread *td, struct msgctl_args *uap)
 done2:
 	mtx_unlock(&msq_mtx);
 	if (cmd == IPC_STAT && error == 0)
-		error = copyout(msqptr, user_msqptr, sizeof(struct msqid_ds));
+		error = copyout(&msqbuf, user_msqptr, sizeof(struct msqid_ds));
 	return(error);
 }
 
@@ -567,6 +593,13 @@ msgget(struct thread *td, struct msgget_args *uap)
 			goto done2;
 		}
 		DPRINTF(("msqid %d is available\n", msqid));
+		msq_sh[msqid] = (struct msq_shared *)
+		    ipc_shared_alloc(MSQ_SHARED_SZ, &msq_obj[msqid]);
+		if (!msq_sh[msqid]) {
+			error = ENOSPC;
+			goto done2;
+		}
+		msq_getarena(msqid).init(msginfo.msgmnb);
 		msqptr->msg_perm.key = key;
 #ifdef __CYGWIN__
 		msqptr->msg_perm.cuid = td->ipcblk->uid;
@@ -628,10 +661,10 @@ msgsnd(struct thread *td, struct msgsnd_args *uap)
 	const void *user_msgp = uap->msgp;
 	size_t msgsz = uap->msgsz;
 	int msgflg = uap->msgflg;
-	int segs_needed, error = 0;
+	int error = 0;
 	struct msqid_ds *msqptr;
-	struct msg *msghdr;
-	short next;
+	int msghdr, next;
+	long msg_type;
 
 	DPRINTF(("call to msgsnd(%d, 0x%x, %d, %d)\n", msqid, user_msgp, msgsz,
 	    msgflg));
@@ -666,9 +699,7 @@ msgsnd(struct thread *td, struct msgsnd_args *uap)
 		goto done2;
 	}
 
-	segs_needed = (msgsz + msginfo.msgssz - 1) / msginfo.msgssz;
-	DPRINTF(("msgsz=%d, msgssz=%d, segs_needed=%d\n", msgsz, msginfo.msgssz,
-	    segs_needed));
+	DPRINTF(("msgsz=%d, msgssz=%d\n", msgsz, msginfo.msgssz));
 	for (;;) {
 		int need_more_resources = 0;
 
@@ -687,16 +718,9 @@ msgsnd(struct thread *td, struct msgsnd_args *uap)
 			DPRINTF(("msqid is locked\n"));
 			need_more_resources = 1;
 		}
-		if (msgsz + msqptr->msg_cbytes > msqptr->msg_qbytes) {
-			DPRINTF(("msgsz + msg_cbytes > msg_qbytes\n"));
-			need_more_resources = 1;
-		}
-		if (segs_needed > nfree_msgmaps) {
-			DPRINTF(("segs_needed > nfree_msgmaps\n"));
-			need_more_resources = 1;
-		}
-		if (free_msghdrs == NULL) {
-			DPRINTF(("no more msghdrs\n"));
+		MSQ_SHLOCK(msqid);
+		if (!msq_getarena(msqid).fits(msgsz)) {
+			DPRINTF(("no room for the message\n"));
 			need_more_resources = 1;
 		}
 
@@ -704,11 +728,15 @@ msgsnd(struct thread *td, struct msgsnd_args *uap)
 			int we_own_it;
 
 			if ((msgflg & IPC_NOWAIT) != 0) {
+				MSQ_SHUNLOCK(msqid);
 				DPRINTF(("need more resources but caller "
 				    "doesn't want to wait\n"));
 				error = EAGAIN;
 				goto done2;
 			}
+			/* Tell clients that they have to wake us up. */
+			msq_sh[msqid]->snd_waiters++;
+			MSQ_SHUNLOCK(msqid);
 
 			if ((msqptr->msg_perm.mode & MSG_LOCKED) != 0) {
 				DPRINTF(("we don't own the msqid_ds\n"));
@@ -726,6 +754,21 @@ msgsnd(struct thread *td, struct msgsnd_args *uap)
 			DPRINTF(("good morning, error=%d\n", error));
 			if (we_own_it)
 				msqptr->msg_perm.mode &= ~MSG_LOCKED;
+
+			/*
+			 * Make sure that the msq queue still exists
+			 */
+
+			if (msqptr->msg_qbytes == 0 ||
+			    msqptr->msg_perm.seq != IPCID_TO_SEQ(uap->msqid)) {
+				DPRINTF(("msqid deleted\n"));
+				error = EIDRM;
+				goto done2;
+			}
+			MSQ_SHLOCK(msqid);
+			msq_sh[msqid]->snd_waiters--;
+			MSQ_SHUNLOCK(msqid);
+
 			if (error == EWOULDBLOCK) {
 				DPRINTF(("timed out\n"));
 				continue;
@@ -739,17 +782,6 @@ msgsnd(struct thread *td, struct msgsnd_args *uap)
 				error = EINTR;
 				goto done2;
 			}
-
-			/*
-			 * Make sure that the msq queue still exists
-			 */
-
-			if (msqptr->msg_qbytes == 0) {
-				DPRINTF(("msqid deleted\n"));
-				error = EIDRM;
-				goto done2;
-			}
-
 		} else {
 			DPRINTF(("got all the resources that we need\n"));
 			break;
@@ -758,164 +790,84 @@ msgsnd(struct thread *td, struct msgsnd_args *uap)
 
 	/*
 	 * We have the resources that we need.
-	 * Make sure!
+	 * Allocate a message header and space for the message.
 	 */
 
-	if (msqptr->msg_perm.mode & MSG_LOCKED)
-		panic("msg_perm.mode & MSG_LOCKED");
-	if (segs_needed > nfree_msgmaps)
-		panic("segs_needed > nfree_msgmaps");
-	if (msgsz + msqptr->msg_cbytes > msqptr->msg_qbytes)
-		panic("msgsz + msg_cbytes > msg_qbytes");
-	if (free_msghdrs == NULL)
-		panic("no more msghdrs");
-
-	/*
-	 * Re-lock the msqid_ds in case we page-fault when copying in the
-	 * message
-	 */
-
-	if ((msqptr->msg_perm.mode & MSG_LOCKED) != 0)
-		panic("msqid_ds is already locked");
-	msqptr->msg_perm.mode |= MSG_LOCKED;
-
-	/*
-	 * Allocate a message header
-	 */
-
-	msghdr = free_msghdrs;
-	free_msghdrs = msghdr->msg_next;
-	msghdr->msg_spot = -1;
-	msghdr->msg_ts = msgsz;
-
-	/*
-	 * Allocate space for the message
-	 */
-
-	while (segs_needed > 0) {
-		if (nfree_msgmaps <= 0)
-			panic("not enough msgmaps");
-		if (free_msgmaps == -1)
-			panic("nil free_msgmaps");
-		next = free_msgmaps;
-		if (next <= -1)
-			panic("next too low #1");
-		if (next >= msginfo.msgseg)
-			panic("next out of range #1");
-		DPRINTF(("allocating segment %d to message\n", next));
-		free_msgmaps = msgmaps[next].next;
-		nfree_msgmaps--;
-		msgmaps[next].next = msghdr->msg_spot;
-		msghdr->msg_spot = next;
-		segs_needed--;
+	msghdr = msq_getarena(msqid).alloc(0, msgsz);
+	MSQ_SHUNLOCK(msqid);
+	if (msghdr < 0) {
+		/* A client messed up the queue. */
+		error = EINVAL;
+		goto done2;
 	}
 
 	/*
-	 * Copy in the message type
+	 * Copy in the message type.  msq_mtx is held while copying, so
+	 * nothing but us touches the allocated segments.
 	 */
 
-	mtx_unlock(&msq_mtx);
-	if ((error = copyin(user_msgp, &msghdr->msg_type,
-	    sizeof(msghdr->msg_type))) != 0) {
-		mtx_lock(&msq_mtx);
+	if ((error = copyin(user_msgp, &msg_type, sizeof(msg_type))) != 0) {
 		DPRINTF(("error %d copying the message type\n", error));
-		msg_freehdr(msghdr);
-		msqptr->msg_perm.mode &= ~MSG_LOCKED;
-		wakeup(msqptr);
-		goto done2;
+		goto fail;
 	}
-	mtx_lock(&msq_mtx);
-	user_msgp = (const char *)user_msgp + sizeof(msghdr->msg_type);
+	user_msgp = (const char *)user_msgp + sizeof(msg_type);
 
 	/*
 	 * Validate the message type
 	 */
 
-	if (msghdr->msg_type < 1) {
-		msg_freehdr(msghdr);
-		msqptr->msg_perm.mode &= ~MSG_LOCKED;
-		wakeup(msqptr);
-		DPRINTF(("mtype (%d) < 1\n", msghdr->msg_type));
+	if (msg_type < 1) {
+		DPRINTF(("mtype (%d) < 1\n", msg_type));
 		error = EINVAL;
-		goto done2;
+		goto fail;
 	}
 
 	/*
 	 * Copy in the message body
 	 */
 
-	next = msghdr->msg_spot;
+	next = msq_getarena(msqid).hdr(msghdr)->spot;
 	while (msgsz > 0) {
+		msq_arena arena = msq_getarena(msqid);
 		size_t tlen;
 		if (msgsz > (unsigned long) msginfo.msgssz)
 			tlen = msginfo.msgssz;
 		else
 			tlen = msgsz;
-		if (next <= -1)
-			panic("next too low #2");
-		if (next >= msginfo.msgseg)
-			panic("next out of range #2");
-		mtx_unlock(&msq_mtx);
-		if ((error = copyin(user_msgp, &msgpool[next * msginfo.msgssz],
+		if (!arena.seg_ok(next)) {
+			error = EINVAL;
+			goto fail;
+		}
+		if ((error = copyin(user_msgp, arena.seg_addr(next),
 		    tlen)) != 0) {
-			mtx_lock(&msq_mtx);
 			DPRINTF(("error %d copying in message segment\n",
 			    error));
-			msg_freehdr(msghdr);
-			msqptr->msg_perm.mode &= ~MSG_LOCKED;
-			wakeup(msqptr);
-			goto done2;
+			goto fail;
 		}
-		mtx_lock(&msq_mtx);
 		msgsz -= tlen;
 		user_msgp = (const char *)user_msgp + tlen;
-		next = msgmaps[next].next;
-	}
-	if (next != -1)
-		panic("didn't use all the msg segments");
-
-	/*
-	 * We've got the message.  Unlock the msqid_ds.
-	 */
-
-	msqptr->msg_perm.mode &= ~MSG_LOCKED;
-
-	/*
-	 * Make sure that the msqid_ds is still allocated.
-	 */
-
-	if (msqptr->msg_qbytes == 0) {
-		msg_freehdr(msghdr);
-		wakeup(msqptr);
-		error = EIDRM;
-		goto done2;
+		next = arena.seg_next(next);
 	}
 
 	/*
 	 * Put the message into the queue
 	 */
 
-	if (msqptr->msg_first == NULL) {
-		msqptr->msg_first = msghdr;
-		msqptr->msg_last = msghdr;
-	} else {
-		msqptr->msg_last->msg_next = msghdr;
-		msqptr->msg_last = msghdr;
-	}
-	msqptr->msg_last->msg_next = NULL;
-
-	msqptr->msg_cbytes += msghdr->msg_ts;
-	msqptr->msg_qnum++;
-	msqptr->msg_lspid = td->td_proc->p_pid;
-	msqptr->msg_stime = time (NULL);
-
-#ifdef __CYGWIN__
-	msg_info.msg_num++;
-	msg_info.msg_tot += uap->msgsz;
-#endif /* __CYGWIN__ */
+	MSQ_SHLOCK(msqid);
+	msq_getarena(msqid).hdr(msghdr)->type = msg_type;
+	msq_getarena(msqid).link(msghdr);
+	msq_sh[msqid]->lspid = td->td_proc->p_pid;
+	msq_sh[msqid]->stime = time (NULL);
+	MSQ_SHUNLOCK(msqid);
 
 	wakeup(msqptr);
 	td->td_retval[0] = 0;
+	goto done2;
+fail:
+	MSQ_SHLOCK(msqid);
+	msq_getarena(msqid).discard(msghdr);
+	MSQ_SHUNLOCK(msqid);
+	wakeup(msqptr);
 done2:
 	mtx_unlock(&msq_mtx);
 	return (error);
@@ -944,9 +896,12 @@ msgrcv(struct thread *td, struct msgrcv_args *uap)
 	int msgflg = uap->msgflg;
 	size_t len;
 	struct msqid_ds *msqptr;
-	struct msg *msghdr;
+	struct msq_hdr *hdr;
+	int msghdr, prev;
+	long msg_type;
+	size_t msg_ts;
 	int error = 0;
-	short next;
+	int next;
 
 	DPRINTF(("call to msgrcv(%d, 0x%x, %d, %ld, %d)\n", msqid, user_msgp,
 	    msgsz, msgtyp, msgflg));
@@ -980,103 +935,58 @@ msgrcv(struct thread *td, struct msgrcv_args *uap)
 		goto done2;
 	}
 
-	msghdr = NULL;
-	while (msghdr == NULL) {
-		if (msgtyp == 0) {
-			msghdr = msqptr->msg_first;
-			if (msghdr != NULL) {
-				if (msgsz < msghdr->msg_ts &&
-				    (msgflg & MSG_NOERROR) == 0) {
-					DPRINTF(("first message on the queue "
-					    "is too big (want %d, got %d)\n",
-					    msgsz, msghdr->msg_ts));
-					error = E2BIG;
-					goto done2;
-				}
-				if (msqptr->msg_first == msqptr->msg_last) {
-					msqptr->msg_first = NULL;
-					msqptr->msg_last = NULL;
-				} else {
-					msqptr->msg_first = msghdr->msg_next;
-					if (msqptr->msg_first == NULL)
-						panic("msg_first/last screwed up #1");
-				}
-			}
-		} else {
-			struct msg *previous;
-			struct msg **prev;
-
-			previous = NULL;
-			prev = &(msqptr->msg_first);
-			while ((msghdr = *prev) != NULL) {
-				/*
-				 * Is this message's type an exact match or is
-				 * this message's type less than or equal to
-				 * the absolute value of a negative msgtyp?
-				 * Note that the second half of this test can
-				 * NEVER be true if msgtyp is positive since
-				 * msg_type is always positive!
-				 */
-
-				if (msgtyp == msghdr->msg_type ||
-				    msghdr->msg_type <= -msgtyp) {
-					DPRINTF(("found message type %d, "
-					    "requested %d\n",
-					    msghdr->msg_type, msgtyp));
-					if (msgsz < msghdr->msg_ts &&
-					    (msgflg & MSG_NOERROR) == 0) {
-						DPRINTF(("requested message "
-						    "on the queue is too big "
-						    "(want %d, got %d)\n",
-						    msgsz, msghdr->msg_ts));
-						error = E2BIG;
-						goto done2;
-					}
-					*prev = msghdr->msg_next;
-					if (msghdr == msqptr->msg_last) {
-						if (previous == NULL) {
-							if (prev !=
-							    &msqptr->msg_first)
-								panic("msg_first/last screwed up #2");
-							msqptr->msg_first =
-							    NULL;
-							msqptr->msg_last =
-							    NULL;
-						} else {
-							if (prev ==
-							    &msqptr->msg_first)
-								panic("msg_first/last screwed up #3");
-							msqptr->msg_last =
-							    previous;
-						}
-					}
-					break;
-				}
-				previous = msghdr;
-				prev = &(msghdr->msg_next);
-			}
-		}
+	for (;;) {
+		msq_arena arena = msq_getarena(msqid);
 
 		/*
-		 * We've either extracted the msghdr for the appropriate
-		 * message or there isn't one.
-		 * If there is one then bail out of this loop.
+		 * Look for a message with the appropriate type.  Note that
+		 * msgtyp 0 takes the first message, and a negative msgtyp
+		 * the first message with a type less than or equal to the
+		 * absolute value of msgtyp.
 		 */
 
-		if (msghdr != NULL)
+		MSQ_SHLOCK(msqid);
+		msghdr = arena.find(msgtyp, prev);
+
+		/*
+		 * If there is one then take it off the queue and bail out
+		 * of this loop.
+		 */
+
+		if (msghdr >= 0) {
+			hdr = arena.hdr(msghdr);
+			DPRINTF(("found message type %d, requested %d\n",
+			    hdr->type, msgtyp));
+			if (msgsz < hdr->ts && (msgflg & MSG_NOERROR) == 0) {
+				DPRINTF(("requested message on the queue "
+				    "is too big (want %d, got %d)\n",
+				    msgsz, hdr->ts));
+				MSQ_SHUNLOCK(msqid);
+				error = E2BIG;
+				goto done2;
+			}
+			arena.unlink(msghdr, prev);
+			msg_type = hdr->type;
+			msg_ts = hdr->ts;
+			next = hdr->spot;
 			break;
+		}
 
 		/*
 		 * Hmph!  No message found.  Does the user want to wait?
 		 */
 
 		if ((msgflg & IPC_NOWAIT) != 0) {
+			MSQ_SHUNLOCK(msqid);
 			DPRINTF(("no appropriate message found (msgtyp=%d)\n",
 			    msgtyp));
 			/* The SVID says to return ENOMSG. */
 			error = ENOMSG;
 			goto done2;
 		}
+		/* Tell clients that they have to wake us up. */
+		msq_sh[msqid]->rcv_waiters++;
+		MSQ_SHUNLOCK(msqid);
 
 		/*
 		 * Wait for something to happen
@@ -1087,16 +997,6 @@ msgrcv(struct thread *td, struct msgrcv_args *uap)
 		    "msgrcv", 0);
 		DPRINTF(("msgrcv:  good morning (error=%d)\n", error));
 
-		if (error != 0) {
-			DPRINTF(("msgrcv:  interrupted system call\n"));
-#ifdef __CYGWIN__
-		    if (error == EIDRM)
-                        goto done2;
-#endif /* __CYGWIN__ */
-			error = EINTR;
-			goto done2;
-		}
-
 		/*
 		 * Make sure that the msq queue still exists
 		 */
@@ -1107,6 +1007,19 @@ msgrcv(struct thread *td, struct msgrcv_args *uap)
 			error = EIDRM;
 			goto done2;
 		}
+		MSQ_SHLOCK(msqid);
+		msq_sh[msqid]->rcv_waiters--;
+		MSQ_SHUNLOCK(msqid);
+
+		if (error != 0) {
+			DPRINTF(("msgrcv:  interrupted system call\n"));
+#ifdef __CYGWIN__
+		    if (error == EIDRM)
+                        goto done2;
+#endif /* __CYGWIN__ */
+			error = EINTR;
+			goto done2;
+		}
 	}
 
 	/*
@@ -1115,10 +1028,9 @@ msgrcv(struct thread *td, struct msgrcv_args *uap)
 	 * First, do the bookkeeping (before we risk being interrupted).
 	 */
 
-	msqptr->msg_cbytes -= msghdr->msg_ts;
-	msqptr->msg_qnum--;
-	msqptr->msg_lrpid = td->td_proc->p_pid;
-	msqptr->msg_rtime = time (NULL);
+	msq_sh[msqid]->lrpid = td->td_proc->p_pid;
+	msq_sh[msqid]->rtime = time (NULL);
+	MSQ_SHUNLOCK(msqid);
 
 	/*
 	 * Make msgsz the actual amount that we'll be returning.
@@ -1126,75 +1038,123 @@ msgrcv(struct thread *td, struct msgrcv_args *uap)
 	 * (since msgsz is never increased).
 	 */
 
-	DPRINTF(("found a message, msgsz=%d, msg_ts=%d\n", msgsz,
-	    msghdr->msg_ts));
-	if (msgsz > msghdr->msg_ts)
-		msgsz = msghdr->msg_ts;
+	DPRINTF(("found a message, msgsz=%d, msg_ts=%d\n", msgsz, msg_ts));
+	if (msgsz > msg_ts)
+		msgsz = msg_ts;
 
 	/*
-	 * Return the type to the user.
+	 * Return the type to the user.  msq_mtx is held while copying, so
+	 * nothing but us touches the message.
 	 */
 
-	mtx_unlock(&msq_mtx);
-	error = copyout(&(msghdr->msg_type), user_msgp,
-	    sizeof(msghdr->msg_type));
-	mtx_lock(&msq_mtx);
+	error = copyout(&msg_type, user_msgp, sizeof(msg_type));
 	if (error != 0) {
 		DPRINTF(("error (%d) copying out message type\n", error));
-		msg_freehdr(msghdr);
-		wakeup(msqptr);
-		goto done2;
+		goto done;
 	}
-	user_msgp = (char *)user_msgp + sizeof(msghdr->msg_type);
+	user_msgp = (char *)user_msgp + sizeof(msg_type);
 
 	/*
 	 * Return the segments to the user
 	 */
 
-	next = msghdr->msg_spot;
 	for (len = 0; len < msgsz; len += msginfo.msgssz) {
+		msq_arena arena = msq_getarena(msqid);
 		size_t tlen;
 
 		if (msgsz - len > (unsigned long) msginfo.msgssz)
 			tlen = msginfo.msgssz;
 		else
 			tlen = msgsz - len;
-		if (next <= -1)
-			panic("next too low #3");
-		if (next >= msginfo.msgseg)
-			panic("next out of range #3");
-		mtx_unlock(&msq_mtx);
-		error = copyout(&msgpool[next * msginfo.msgssz],
-		    user_msgp, tlen);
-		mtx_lock(&msq_mtx);
+		if (!arena.seg_ok(next)) {
+			error = EINVAL;
+			goto done;
+		}
+		error = copyout(arena.seg_addr(next), user_msgp, tlen);
 		if (error != 0) {
 			DPRINTF(("error (%d) copying out message segment\n",
 			    error));
-			msg_freehdr(msghdr);
-			wakeup(msqptr);
-			goto done2;
+			goto done;
 		}
 		user_msgp = (char *)user_msgp + tlen;
-		next = msgmaps[next].next;
+		next = arena.seg_next(next);
 	}
 
 	/*
 	 * Done, return the actual number of bytes copied out.
 	 */
 
+	td->td_retval[0] = msgsz;
+done:
+	MSQ_SHLOCK(msqid);
+	msq_getarena(msqid).discard(msghdr);
+	MSQ_SHUNLOCK(msqid);
+	wakeup(msqptr);
+done2:
+	mtx_unlock(&msq_mtx);
+	return (error);
+}
+
 #ifdef __CYGWIN__
-	msg_info.msg_num--;
-	msg_info.msg_tot -= msgsz;
-#endif /* __CYGWIN__ */
+/*
+ * Hand out the shared section of a queue.  Only processes allowed to
+ * read and write the queue get it, everybody else keeps calling msgsnd
+ * and msgrcv.
+ */
+int
+msgmap(struct thread *td, struct msgctl_args *uap)
+{
+	int msqid = IPCID_TO_IX(uap->msqid);
+	struct msqid_ds *msqptr;
+	int error = 0;
 
-	msg_freehdr(msghdr);
-	wakeup(msqptr);
-	td->td_retval[0] = msgsz;
+	DPRINTF(("call to msgmap(%d)\n", uap->msqid));
+	if (msqid < 0 || msqid >= msginfo.msgmni)
+		return (EINVAL);
+	msqptr = &msqids[msqid];
+	mtx_lock(&msq_mtx);
+	if (msqptr->msg_qbytes == 0 ||
+	    msqptr->msg_perm.seq != IPCID_TO_SEQ(uap->msqid)) {
+		error = EINVAL;
+		goto done2;
+	}
+	if ((error = ipcperm(td, &msqptr->msg_perm, IPC_R | IPC_W)))
+		goto done2;
+	td->td_retval[0] = 0;
+	td->td_retval[1] = vm_object_duplicate(td, msq_obj[msqid]);
 done2:
 	mtx_unlock(&msq_mtx);
 	return (error);
 }
 
+/*
+ * A client sent or received a message while somebody was waiting in
+ * msgsnd or msgrcv.
+ */
+int
+msgwakeup(struct thread *td, struct msgctl_args *uap)
+{
+	int msqid = IPCID_TO_IX(uap->msqid);
+	struct msqid_ds *msqptr;
+	int error = 0;
+
+	DPRINTF(("call to msgwakeup(%d)\n", uap->msqid));
+	if (msqid < 0 || msqid >= msginfo.msgmni)
+		return (EINVAL);
+	msqptr = &msqids[msqid];
+	mtx_lock(&msq_mtx);
+	if (msqptr->msg_qbytes == 0 ||
+	    msqptr->msg_perm.seq != IPCID_TO_SEQ(uap->msqid))
+		error = EINVAL;
+	else {
+		wakeup(msqptr);
+		td->td_retval[0] = 0;
+	}
+	mtx_unlock(&msq_mtx);
+	return (error);
+}
+#endif /* __CYGWIN__ */
+
 #ifndef __CYGWIN__
 static int
 sysctl_msqids(SYSCTL_HANDLER_ARGS)
@@ -33,10 +33,12 @@ __FBSDID("$FreeBSD: /repoman/r/ncvs/src/sys/kern/sysv_sem.c,v 1.70 2004/05/30 20
 #include <sys/queue.h>
 #include <malloc.h>
 #include <errno.h>
+#include <string.h>
 #include <time.h>
 #include "cygserver.h"
 #include "process.h"
 #include "cygserver_ipc.h"
+#include "cygserver_sem.h"
 #include <sys/smallprint.h>
 
 #ifdef __CYGWIN__
@@ -52,6 +54,10 @@ __FBSDID("$FreeBSD: /repoman/r/ncvs/src/sys/kern/sysv_sem.c,v 1.70 2004/05/30 20
 #endif
 
 static int semvalid(int semid, struct semid_ds *semaptr);
+#ifdef __CYGWIN__
+static void sem_sync_otime(int semid);
+static int sem_shared_renew(int semid);
+#endif
 
 static struct sem_undo *semu_alloc(struct thread *td);
 static int semundo_adjust(struct thread *td, struct sem_undo **supptr,
@@ -80,7 +86,12 @@ static int	semtots = 0;
 static int	semtot = 0;
 static struct semid_ds *sema;	/* semaphore id pool */
 static struct mtx *sema_mtx;	/* semaphore id pool mutexes*/
+#ifdef __CYGWIN__
+static struct sem_shared **sema_sh;	/* shared sections of the sets */
+static vm_object_t *sema_obj;	/* and their handles */
+#else
 static struct sem *sem;		/* semaphore pool */
+#endif
 static SLIST_HEAD(, sem_undo) semu_list;	/* list of active undo structures */
 static int	*semu;		/* undo structure pool */
 #ifndef __CYGWIN__
@@ -93,12 +104,26 @@ static eventhandler_tag semexit_tag;
 #define SEMUNDO_UNLOCK()	mtx_unlock(&SEMUNDO_MTX);
 #define SEMUNDO_LOCKASSERT(how,pid)	mtx_assert(&SEMUNDO_MTX, (how), (pid));
 
+/*
+ * CYGWIN: Lock of the shared section of a set.  Taken after the set's
+ * mutex and after SEMUNDO_MTX, never held while sleeping.
+ */
+#ifdef __CYGWIN__
+#define SEMA_SHLOCK(ix)		ipc_shlock_server(&sema_sh[(ix)]->lock)
+#define SEMA_SHUNLOCK(ix)	ipc_shunlock(&sema_sh[(ix)]->lock)
+#else
+#define SEMA_SHLOCK(ix)
+#define SEMA_SHUNLOCK(ix)
+#endif
+
+#ifndef __CYGWIN__
 struct sem {
 	u_short	semval;		/* semaphore value */
 	pid_t	sempid;		/* pid of last operation */
 	u_short	semncnt;	/* # awaiting semval > cval */
 	u_short	semzcnt;	/* # awaiting semval = 0 */
 };
+#endif /* __CYGWIN__ */
 
 /*
  * Undo structure (one per process)
@@ -234,7 +259,14 @@ seminit(void)
 					    un_ent[seminfo.semume]));
 #endif /* __CYGWIN__ */
 
+#ifdef __CYGWIN__
+	sema_sh = (struct sem_shared **) sys_malloc(sizeof(struct sem_shared *) * seminfo.semmni,
+	    M_SEM, M_WAITOK);
+	sema_obj = (vm_object_t *) sys_malloc(sizeof(vm_object_t) * seminfo.semmni, M_SEM,
+	    M_WAITOK);
+#else
 	sem = (struct sem *) sys_malloc(sizeof(struct sem) * seminfo.semmns, M_SEM, M_WAITOK);
+#endif /* __CYGWIN__ */
 	sema = (struct semid_ds *) sys_malloc(sizeof(struct semid_ds) * seminfo.semmni, M_SEM,
 	    M_WAITOK);
 	sema_mtx = (struct mtx *) sys_malloc(sizeof(struct mtx) * seminfo.semmni, M_SEM,
@@ -245,6 +277,10 @@ seminit(void)
 		sema[i].sem_base = 0;
 		sema[i].sem_perm.mode = 0;
 		sema[i].sem_perm.seq = 0;
+#ifdef __CYGWIN__
+		sema_sh[i] = NULL;
+		sema_obj[i] = NULL;
+#endif /* __CYGWIN__ */
 	}
 	for (i = 0; i < seminfo.semmni; i++)
 	{
@@ -278,7 +314,15 @@ semunload(void)
 
 	EVENTHANDLER_DEREGISTER(process_exit, semexit_tag);
 #endif /* __CYGWIN__ */
+#ifdef __CYGWIN__
+	for (int i = 0; i < seminfo.semmni; i++)
+		if (sema_sh[i])
+			ipc_shared_free(sema_obj[i], sema_sh[i]);
+	sys_free(sema_sh, M_SEM);
+	sys_free(sema_obj, M_SEM);
+#else
 	sys_free(sem, M_SEM);
+#endif /* __CYGWIN__ */
 	sys_free(sema, M_SEM);
 	sys_free(semu, M_SEM);
 	for (int i = 0; i < seminfo.semmni; i++) {
@@ -546,6 +590,51 @@ semvalid(int semid, struct semid_ds *semaptr)
 	    semaptr->sem_perm.seq != IPCID_TO_SEQ(semid) ? EINVAL : 0);
 }
 
+#ifdef __CYGWIN__
+/*
+ * Clients only update the semop time in the shared section.
+ */
+static void
+sem_sync_otime(int semid)
+{
+	if (sema_sh[semid])
+		sema[semid].sem_otime = sema_sh[semid]->otime;
+}
+
+/*
+ * Move a set into a fresh section when its permissions change.  Clients
+ * which mapped the old one see it as removed, drop it and have to ask
+ * for the new one, so the new permissions are checked again.
+ */
+static int
+sem_shared_renew(int semid)
+{
+	struct sem_shared *osh = sema_sh[semid];
+	struct sem_shared *nsh;
+	vm_object_t nobj;
+
+	int nsems = sema[semid].sem_nsems;
+
+	/* The geometry in the section is writable by clients. */
+	nsh = (struct sem_shared *)
+	    ipc_shared_alloc(SEM_SHARED_SIZE(nsems), &nobj);
+	if (!nsh)
+		return (ENOMEM);
+	ipc_shlock_server(&osh->lock);
+	memcpy(nsh, osh, SEM_SHARED_SIZE(nsems));
+	nsh->lock = 0;
+	nsh->semvmx = seminfo.semvmx;
+	nsh->nsems = nsems;
+	osh->removed = 1;
+	ipc_shunlock(&osh->lock);
+	ipc_shared_free(sema_obj[semid], osh);
+	sema_sh[semid] = nsh;
+	sema_obj[semid] = nobj;
+	sema[semid].sem_base = nsh->base;
+	return (0);
+}
+#endif /* __CYGWIN__ */
+
 /*
  * Note that the user-mode half of this passes a union, not a pointer
  */
@@ -599,6 +688,8 @@ __semctl(struct thread *td, struct __semctl_args *uap)
 		}
 		if (semid > seminfo.semmni)
 			semid = seminfo.semmni;
+		for (i = 0; i < semid; i++)
+			sem_sync_otime(i);
 		error = copyout(sema, real_arg.buf,
 				semid * sizeof(struct semid_ds));
 		td->td_retval[0] = error ? -1 : 0;
@@ -629,6 +720,9 @@ __semctl(struct thread *td, struct __semctl_args *uap)
 		}
 		if ((error = ipcperm(td, &semaptr->sem_perm, IPC_R)))
 			goto done2;
+#ifdef __CYGWIN__
+		sem_sync_otime(semid);
+#endif
 		mtx_unlock(sema_mtxp);
 		error = copyout(semaptr, real_arg.buf, sizeof(struct semid_ds));
 		rval = IXSEQ_TO_IPCID(semid,semaptr->sem_perm);
@@ -663,6 +757,20 @@ __semctl(struct thread *td, struct __semctl_args *uap)
 #endif
 		semtot -= semaptr->sem_nsems;
 		semtots--;
+#ifdef __CYGWIN__
+		/*
+		 * Every set has its own section, so there's nothing to
+		 * compact.  Clients still having the section mapped see
+		 * the removed flag and come here to get EINVAL.
+		 */
+		SEMA_SHLOCK(semid);
+		sema_sh[semid]->removed = 1;
+		SEMA_SHUNLOCK(semid);
+		ipc_shared_free(sema_obj[semid], sema_sh[semid]);
+		sema_sh[semid] = NULL;
+		sema_obj[semid] = NULL;
+		semaptr->sem_base = NULL;
+#else
 		for (i = semaptr->sem_base - sem; i < semtot; i++)
 			sem[i] = sem[i + semaptr->sem_nsems];
 		for (i = 0; i < seminfo.semmni; i++) {
@@ -670,6 +778,7 @@ __semctl(struct thread *td, struct __semctl_args *uap)
 			    sema[i].sem_base > semaptr->sem_base)
 				sema[i].sem_base -= semaptr->sem_nsems;
 		}
+#endif /* __CYGWIN__ */
 		semaptr->sem_perm.mode = 0;
 		SEMUNDO_LOCK();
 		semundo_clear(semid, -1, td);
@@ -687,6 +796,10 @@ __semctl(struct thread *td, struct __semctl_args *uap)
 			goto done2;
 		if ((error = ipcperm(td, &semaptr->sem_perm, IPC_M)))
 			goto done2;
+#ifdef __CYGWIN__
+		if ((error = sem_shared_renew(semid)) != 0)
+			goto done2;
+#endif
 		semaptr->sem_perm.uid = sbuf.sem_perm.uid;
 		semaptr->sem_perm.gid = sbuf.sem_perm.gid;
 		semaptr->sem_perm.mode = (semaptr->sem_perm.mode & ~0777) |
@@ -702,6 +815,9 @@ __semctl(struct thread *td, struct __semctl_args *uap)
 			goto done2;
 		if ((error = ipcperm(td, &semaptr->sem_perm, IPC_R)))
 			goto done2;
+#ifdef __CYGWIN__
+		sem_sync_otime(semid);
+#endif
 		sbuf = *semaptr;
 		mtx_unlock(sema_mtxp);
 		error = copyout(semaptr, real_arg.buf,
@@ -757,8 +873,10 @@ __semctl(struct thread *td, struct __semctl_args *uap)
 			goto done2;
 		if ((error = ipcperm(td, &semaptr->sem_perm, IPC_R)))
 			goto done2;
+		SEMA_SHLOCK(semid);
 		for (i = 0; i < semaptr->sem_nsems; i++)
 			array[i] = semaptr->sem_base[i].semval;
+		SEMA_SHUNLOCK(semid);
 		mtx_unlock(sema_mtxp);
 		error = copyout(array, real_arg.array,
 		    i * sizeof(real_arg.array[0]));
@@ -793,7 +911,9 @@ __semctl(struct thread *td, struct __semctl_args *uap)
 			error = ERANGE;
 			goto done2;
 		}
+		SEMA_SHLOCK(semid);
 		semaptr->sem_base[semnum].semval = real_arg.val;
+		SEMA_SHUNLOCK(semid);
 		SEMUNDO_LOCK();
 		semundo_clear(semid, semnum, td);
 		SEMUNDO_UNLOCK();
@@ -824,6 +944,7 @@ raced:
 		}
 		if ((error = ipcperm(td, &semaptr->sem_perm, IPC_W)))
 			goto done2;
+		SEMA_SHLOCK(semid);
 		for (i = 0; i < semaptr->sem_nsems; i++) {
 			usval = array[i];
 			if (usval > seminfo.semvmx) {
@@ -832,6 +953,7 @@ raced:
 			}
 			semaptr->sem_base[i].semval = usval;
 		}
+		SEMA_SHUNLOCK(semid);
 		SEMUNDO_LOCK();
 		semundo_clear(semid, -1, td);
 		SEMUNDO_UNLOCK();
@@ -931,6 +1053,16 @@ semget(struct thread *td, struct semget_args *uap)
 			goto done2;
 		}
 		DPRINTF(("semid %d is available\n", semid));
+#ifdef __CYGWIN__
+		sema_sh[semid] = (struct sem_shared *)
+		    ipc_shared_alloc(SEM_SHARED_SIZE(nsems), &sema_obj[semid]);
+		if (!sema_sh[semid]) {
+			error = ENOSPC;
+			goto done2;
+		}
+		sema_sh[semid]->semvmx = seminfo.semvmx;
+		sema_sh[semid]->nsems = nsems;
+#endif
 		sema[semid].sem_perm.key = key;
 #ifdef __CYGWIN__
 		sema[semid].sem_perm.cuid = td->ipcblk->uid;
@@ -949,6 +1081,13 @@ semget(struct thread *td, struct semget_args *uap)
 		sema[semid].sem_nsems = nsems;
 		sema[semid].sem_otime = 0;
 		sema[semid].sem_ctime = time (NULL);
+#ifdef __CYGWIN__
+		/* The section comes zeroed. */
+		sema[semid].sem_base = sema_sh[semid]->base;
+		semtot += nsems;
+		semtots++;
+		DPRINTF(("sembase = 0x%x\n", sema[semid].sem_base));
+#else
 		sema[semid].sem_base = &sem[semtot];
 		semtot += nsems;
 		semtots++;
@@ -956,6 +1095,7 @@ semget(struct thread *td, struct semget_args *uap)
 		    sizeof(sema[semid].sem_base[0])*nsems);
 		DPRINTF(("sembase = 0x%x, next = 0x%x\n", sema[semid].sem_base,
 		    &sem[semtot]));
+#endif
 	} else {
 		DPRINTF(("didn't find it and wasn't asked to create it\n"));
 		error = ENOENT;
@@ -1071,11 +1211,19 @@ semop(struct thread *td, struct semop_args *uap)
 	 *
 	 * This ensures that from the perspective of other tasks, a set
 	 * of requests is atomic (never partially satisfied).
+	 *
+	 * CYGWIN: Clients operate on the semaphores in the shared section
+	 * themselves, so the values are only stable under its lock.  The
+	 * undo structures are adjusted under the same lock, so a failure
+	 * can still be rolled back without anybody noticing.
 	 */
 	for (;;) {
 		do_wakeup = 0;
 		error = 0;	/* error return if necessary */
 
+		if (do_undos)
+			SEMUNDO_LOCK();
+		SEMA_SHLOCK(semid);
 		for (i = 0; i < nsops; i++) {
 			sopptr = &sops[i];
 			semptr = &semaptr->sem_base[sopptr->sem_num];
@@ -1128,23 +1276,24 @@ semop(struct thread *td, struct semop_args *uap)
 			semaptr->sem_base[sops[j].sem_num].semval -=
 			    sops[j].sem_op;
 
-		/* If we detected an error, return it */
-		if (error != 0)
-			goto done2;
-
 		/*
-		 * If the request that we couldn't satisfy has the
-		 * NOWAIT flag set then return with EAGAIN.
+		 * If we detected an error, return it.  If the request that
+		 * we couldn't satisfy has the NOWAIT flag set then return
+		 * with EAGAIN.
 		 */
-		if (sopptr->sem_flg & IPC_NOWAIT) {
+		if (error == 0 && (sopptr->sem_flg & IPC_NOWAIT))
 			error = EAGAIN;
-			goto done2;
+		if (error == 0) {
+			if (sopptr->sem_op == 0)
+				semptr->semzcnt++;
+			else
+				semptr->semncnt++;
 		}
-
-		if (sopptr->sem_op == 0)
-			semptr->semzcnt++;
-		else
-			semptr->semncnt++;
+		SEMA_SHUNLOCK(semid);
+		if (do_undos)
+			SEMUNDO_UNLOCK();
+		if (error != 0)
+			goto done2;
 
 		DPRINTF(("semop:  good night!\n"));
 		error = msleep(semaptr, sema_mtxp, (PZERO - 4) | PCATCH,
@@ -1165,10 +1314,16 @@ semop(struct thread *td, struct semop_args *uap)
 		 * The semaphore is still alive.  Readjust the count of
 		 * waiting processes.
 		 */
+#ifdef __CYGWIN__
+		/* IPC_SET may have moved the set to another section. */
+		semptr = &semaptr->sem_base[sopptr->sem_num];
+#endif
+		SEMA_SHLOCK(semid);
 		if (sopptr->sem_op == 0)
 			semptr->semzcnt--;
 		else
 			semptr->semncnt--;
+		SEMA_SHUNLOCK(semid);
 
 		/*
 		 * Is it really morning, or was our sleep interrupted?
@@ -1191,7 +1346,6 @@ done:
 	 * Process any SEM_UNDO requests.
 	 */
 	if (do_undos) {
-		SEMUNDO_LOCK();
 		suptr = NULL;
 		for (i = 0; i < nsops; i++) {
 			/*
@@ -1236,6 +1390,7 @@ done:
 				    sops[j].sem_op;
 
 			DPRINTF(("error = %d from semundo_adjust\n", error));
+			SEMA_SHUNLOCK(semid);
 			SEMUNDO_UNLOCK();
 			goto done2;
 		} /* loop through the sops */
@@ -1249,6 +1404,10 @@ done:
 		semptr->sempid = td->td_proc->p_pid;
 	}
 	semaptr->sem_otime = time (NULL);
+#ifdef __CYGWIN__
+	sema_sh[semid]->otime = semaptr->sem_otime;
+#endif
+	SEMA_SHUNLOCK(semid);
 
 	/*
 	 * Do a wakeup if any semaphore was up'd whilst something was
@@ -1268,6 +1427,63 @@ done2:
 	return (error);
 }
 
+#ifdef __CYGWIN__
+/*
+ * Hand out the shared section of a semaphore set.  Only processes allowed
+ * to read and alter the set get it, everybody else keeps calling semop.
+ */
+int
+semmap(struct thread *td, struct semctl_args *uap)
+{
+	int semid = IPCID_TO_IX(uap->semid);
+	struct semid_ds *semaptr;
+	struct mtx *sema_mtxp;
+	int error;
+
+	DPRINTF(("call to semmap(%d)\n", uap->semid));
+	if (semid < 0 || semid >= seminfo.semmni)
+		return (EINVAL);
+	semaptr = &sema[semid];
+	sema_mtxp = &sema_mtx[semid];
+	mtx_lock(sema_mtxp);
+	if ((error = semvalid(uap->semid, semaptr)) != 0)
+		goto done2;
+	if ((error = ipcperm(td, &semaptr->sem_perm, IPC_R | IPC_W)))
+		goto done2;
+	td->td_retval[0] = 0;
+	td->td_retval[1] = vm_object_duplicate(td, sema_obj[semid]);
+done2:
+	mtx_unlock(sema_mtxp);
+	return (error);
+}
+
+/*
+ * A client changed semaphores in the shared section while somebody was
+ * waiting in semop.
+ */
+int
+semwakeup(struct thread *td, struct semctl_args *uap)
+{
+	int semid = IPCID_TO_IX(uap->semid);
+	struct semid_ds *semaptr;
+	struct mtx *sema_mtxp;
+	int error;
+
+	DPRINTF(("call to semwakeup(%d)\n", uap->semid));
+	if (semid < 0 || semid >= seminfo.semmni)
+		return (EINVAL);
+	semaptr = &sema[semid];
+	sema_mtxp = &sema_mtx[semid];
+	mtx_lock(sema_mtxp);
+	if ((error = semvalid(uap->semid, semaptr)) == 0) {
+		wakeup(semaptr);
+		td->td_retval[0] = 0;
+	}
+	mtx_unlock(sema_mtxp);
+	return (error);
+}
+#endif /* __CYGWIN__ */
+
 /*
  * Go through the undo structures for this process and apply the adjustments to
  * semaphores.
@@ -1345,6 +1561,9 @@ semexit_myhook(void *arg, struct proc *p)
 			    suptr->un_ent[ix].un_adjval,
 			    semaptr->sem_base[semnum].semval));
 
+#ifdef __CYGWIN__
+			SEMA_SHLOCK(semid);
+#endif
 			if (adjval < 0) {
 				if (semaptr->sem_base[semnum].semval < -adjval)
 					semaptr->sem_base[semnum].semval = 0;
@@ -1353,6 +1572,9 @@ semexit_myhook(void *arg, struct proc *p)
 					    adjval;
 			} else
 				semaptr->sem_base[semnum].semval += adjval;
+#ifdef __CYGWIN__
+			SEMA_SHUNLOCK(semid);
+#endif
 
 			wakeup(semaptr);
 			DPRINTF(("semexit:  back from wakeup\n"));
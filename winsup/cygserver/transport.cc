@@ -20,11 +20,11 @@ details. */
 #include "transport.h"
 #include "transport_pipes.h"
 
-/* The factory */
+/* The factory.  A connection to be multiplexed needs an overlapped pipe. */
 transport_layer_base *
-create_server_transport ()
+create_server_transport (const bool multiplexed)
 {
-  return new transport_layer_pipes;
+  return new transport_layer_pipes (multiplexed);
 }
 
 #ifndef __INSIDE_CYGWIN__
@@ -11,7 +11,7 @@ details. */
 #ifndef _TRANSPORT_H
 #define _TRANSPORT_H
 
-class transport_layer_base *create_server_transport ();
+class transport_layer_base *create_server_transport (bool multiplexed = false);
 
 class transport_layer_base
 {
@@ -0,0 +1,513 @@
+/* transport_mux.cc
+
+This file is part of Cygwin.
+
+This software is a copyrighted work licensed under the terms of the
+Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
+details. */
+
+/* to allow this to link into cygwin and the .dll, a little magic is needed. */
+#ifdef __OUTSIDE_CYGWIN__
+#include "woutsup.h"
+#else
+#include "winsup.h"
+#endif
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cygerrno.h"
+#include "transport.h"
+#include "transport_mux.h"
+
+#ifdef __INSIDE_CYGWIN__
+#define SET_ERRNO(err)	set_errno (err)
+#else
+#define SET_ERRNO(err)	errno = (err)
+#endif
+
+/* The underlying pipe may return less than asked for, the frames are
+   bigger than what a single request on a connection of its own used to
+   transfer at once. */
+static bool
+read_all (transport_layer_base *const conn, void *const buf, const size_t len)
+{
+  for (size_t done = 0; done < len; )
+    {
+      const ssize_t count = conn->read ((char *) buf + done, len - done);
+      if (count <= 0)
+	return false;
+      done += count;
+    }
+  return true;
+}
+
+static bool
+write_all (transport_layer_base *const conn, void *const buf,
+	   const size_t len)
+{
+  for (size_t done = 0; done < len; )
+    {
+      const ssize_t count = conn->write ((char *) buf + done, len - done);
+      if (count <= 0)
+	return false;
+      done += count;
+    }
+  return true;
+}
+
+#ifdef __INSIDE_CYGWIN__
+
+/*
+ * The client side.
+ *
+ * There is no thread reading the connection.  Instead, one of the threads
+ * waiting for a reply reads the next frame and hands it to the thread it
+ * belongs to, until its own reply has arrived.  Then another waiting
+ * thread takes over.
+ */
+
+struct mux_waiter
+{
+  mux_waiter *next;
+  char *buf;
+  size_t size;
+  ULONG id;
+  int err;
+  bool done;
+};
+
+bool
+mux_connection::attached ()
+{
+  AcquireSRWLockShared (&_lock);
+  const bool ret = _pipe && !_broken;
+  ReleaseSRWLockShared (&_lock);
+  return ret;
+}
+
+/* Make conn the connection of the process.  Returns false if another
+   thread has been faster, the caller has to delete conn then. */
+bool
+mux_connection::attach (transport_layer_base *const conn)
+{
+  AcquireSRWLockExclusive (&_lock);
+  const bool ret = !_pipe;
+  if (ret)
+    {
+      _pipe = conn;
+      _broken = false;
+    }
+  ReleaseSRWLockExclusive (&_lock);
+  return ret;
+}
+
+/* Called with _lock held.  The pipe is closed when the last thread using
+   it leaves transact. */
+void
+mux_connection::fail_all ()
+{
+  _broken = true;
+  for (mux_waiter *w = _waiters; w; w = w->next)
+    if (!w->done)
+      {
+	w->err = EINVAL;
+	w->done = true;
+      }
+  WakeAllConditionVariable (&_cond);
+}
+
+/* Read the next reply into the buffer of the thread waiting for it.  Only
+   called by the thread which set _reading, without holding _lock. */
+bool
+mux_connection::read_frame ()
+{
+  mux_frame_t frame;
+  mux_waiter *w;
+  int err = 0;
+
+  if (!read_all (_pipe, &frame, sizeof frame))
+    return false;
+
+  AcquireSRWLockShared (&_lock);
+  for (w = _waiters; w && w->id != frame.id; w = w->next)
+    ;
+  ReleaseSRWLockShared (&_lock);
+
+  if (w && frame.len <= w->size - sizeof frame)
+    {
+      if (!read_all (_pipe, w->buf + sizeof frame, frame.len))
+	return false;
+      ((mux_frame_t *) w->buf)->len = frame.len;
+    }
+  else
+    {
+      char scratch[256];
+
+      for (ULONG left = frame.len; left; )
+	{
+	  const ULONG len = left < sizeof scratch ? left : sizeof scratch;
+	  if (!read_all (_pipe, scratch, len))
+	    return false;
+	  left -= len;
+	}
+      if (!w)
+	{
+	  debug_printf ("reply to unknown request %u dropped", frame.id);
+	  return true;
+	}
+      err = EINVAL;
+    }
+
+  AcquireSRWLockExclusive (&_lock);
+  w->err = err;
+  w->done = true;
+  ReleaseSRWLockExclusive (&_lock);
+  return true;
+}
+
+/* Send the request in buf, which has room for a frame header, and wait for
+   the reply, which replaces it.  Returns 0 on success, 1 if the request
+   couldn't be sent, and -1 with errno set if it failed otherwise. */
+int
+mux_connection::transact (char *const buf, const size_t size)
+{
+  mux_frame_t *const frame = (mux_frame_t *) buf;
+  mux_waiter w = { NULL, buf, size, 0, 0, false };
+
+  AcquireSRWLockExclusive (&_lock);
+  if (!_pipe || _broken)
+    {
+      ReleaseSRWLockExclusive (&_lock);
+      return 1;
+    }
+  ++_users;
+  w.id = frame->id = ++_next_id;
+  w.next = _waiters;
+  _waiters = &w;
+  ReleaseSRWLockExclusive (&_lock);
+
+  AcquireSRWLockExclusive (&_wlock);
+  const bool sent = write_all (_pipe, buf, sizeof *frame + frame->len);
+  ReleaseSRWLockExclusive (&_wlock);
+
+  AcquireSRWLockExclusive (&_lock);
+  if (!sent)
+    {
+      /* Nothing is executed before cygserver has read the whole frame, so
+	 the request can be sent again on a new connection.  The pipe is
+	 broken, so a thread reading it fails as well. */
+      debug_printf ("request %u write failure, error = %u",
+		    w.id, GetLastError ());
+      _broken = true;
+      w.done = true;
+    }
+  while (!w.done)
+    if (_reading)
+      SleepConditionVariableSRW (&_cond, &_lock, INFINITE, 0);
+    else
+      {
+	_reading = true;
+	ReleaseSRWLockExclusive (&_lock);
+	const bool ok = read_frame ();
+	AcquireSRWLockExclusive (&_lock);
+	_reading = false;
+	if (!ok)
+	  {
+	    debug_printf ("reply read failure, error = %u", GetLastError ());
+	    fail_all ();
+	  }
+	else
+	  WakeAllConditionVariable (&_cond);
+      }
+
+  mux_waiter **wp;
+  for (wp = &_waiters; *wp != &w; wp = &(*wp)->next)
+    ;
+  *wp = w.next;
+  if (!--_users && _broken)
+    {
+      delete _pipe;
+      _pipe = NULL;
+    }
+  ReleaseSRWLockExclusive (&_lock);
+
+  if (!sent)
+    return 1;
+  if (w.err)
+    {
+      SET_ERRNO (w.err);
+      return -1;
+    }
+  return 0;
+}
+
+transport_layer_mux::transport_layer_mux (mux_connection *const conn,
+					  char *const buf, const size_t size)
+  : _conn (conn),
+    _buf (buf),
+    _size (size),
+    _len (0),
+    _pos (0),
+    _writing (true),
+    _unsent (false)
+{
+  assert (_size > sizeof (mux_frame_t));
+}
+
+#else /* !__INSIDE_CYGWIN__ */
+
+/*
+ * The server side.
+ */
+
+mux_connection::mux_connection (transport_layer_base *const conn)
+  : _conn (conn),
+    _refs (1)
+{
+  InitializeCriticalSection (&_wlock);
+}
+
+mux_connection::~mux_connection ()
+{
+  delete _conn;
+  DeleteCriticalSection (&_wlock);
+}
+
+void
+mux_connection::unref ()
+{
+  if (!InterlockedDecrement (&_refs))
+    delete this;
+}
+
+/* Start the thread reading the connection, which holds the initial
+   reference.  Only requests are read there, so the stack can be small. */
+bool
+mux_connection::start ()
+{
+  DWORD tid;
+  const HANDLE hThread =
+    CreateThread (NULL, 65536, start_routine, this,
+		  STACK_SIZE_PARAM_IS_A_RESERVATION, &tid);
+
+  if (!hThread)
+    {
+      system_printf ("failed to create connection thread, error = %u",
+		     GetLastError ());
+      return false;
+    }
+
+  (void) CloseHandle (hThread);
+  return true;
+}
+
+/*static*/ DWORD WINAPI
+mux_connection::start_routine (const LPVOID lpParam)
+{
+  class mux_connection *const conn = (class mux_connection *) lpParam;
+  assert (conn);
+
+  conn->read_loop ();
+  conn->unref ();
+
+  return 0;
+}
+
+void
+mux_connection::read_loop ()
+{
+  mux_frame_t frame;
+
+  while (read_all (_conn, &frame, sizeof frame))
+    {
+      if (frame.len > MUX_MAX_FRAME - sizeof frame)
+	{
+	  log (LOG_ERR, "request frame too big: %u bytes", frame.len);
+	  break;
+	}
+
+      char *const buf = (char *) malloc (sizeof frame + frame.len);
+      if (!buf)
+	{
+	  log (LOG_ERR, "out of memory reading request frame");
+	  break;
+	}
+      memcpy (buf, &frame, sizeof frame);
+      if (!read_all (_conn, buf + sizeof frame, frame.len))
+	{
+	  free (buf);
+	  break;
+	}
+
+      ref ();
+      submit (new transport_layer_mux (this, buf));
+    }
+
+  debug ("multiplexed connection closed (err %u)", GetLastError ());
+}
+
+/* buf starts with the frame header of the reply. */
+void
+mux_connection::reply (char *const buf)
+{
+  const mux_frame_t *const frame = (mux_frame_t *) buf;
+
+  EnterCriticalSection (&_wlock);
+  if (!write_all (_conn, buf, sizeof *frame + frame->len))
+    debug ("reply %u write failure (err %u)", frame->id, GetLastError ());
+  LeaveCriticalSection (&_wlock);
+}
+
+/* buf has been allocated by malloc and holds the request frame. */
+transport_layer_mux::transport_layer_mux (mux_connection *const conn,
+					  char *const buf)
+  : _conn (conn),
+    _buf (buf),
+    _size (sizeof (mux_frame_t) + ((mux_frame_t *) buf)->len),
+    _len (((mux_frame_t *) buf)->len),
+    _pos (0),
+    _writing (false)
+{
+}
+
+int
+transport_layer_mux::listen ()
+{
+  assert (false);
+  return -1;
+}
+
+class transport_layer_base *
+transport_layer_mux::accept (bool *const recoverable)
+{
+  assert (false);
+  *recoverable = false;
+  return NULL;
+}
+
+bool
+transport_layer_mux::impersonate_client ()
+{
+  return _conn->transport ()->impersonate_client ();
+}
+
+bool
+transport_layer_mux::revert_to_self ()
+{
+  return _conn->transport ()->revert_to_self ();
+}
+
+#endif /* !__INSIDE_CYGWIN__ */
+
+transport_layer_mux::~transport_layer_mux ()
+{
+  close ();
+}
+
+/* On the server side, send the reply.  A request which has been dropped
+   gets an empty reply, which the client takes as ENOSYS. */
+void
+transport_layer_mux::close ()
+{
+  if (!_conn)
+    return;
+
+#ifndef __INSIDE_CYGWIN__
+  if (!_writing)
+    _len = 0;
+  ((mux_frame_t *) _buf)->len = _len;
+  _conn->reply (_buf);
+  _conn->unref ();
+  free (_buf);
+#endif
+
+  _conn = NULL;
+  _buf = NULL;
+}
+
+ssize_t
+transport_layer_mux::read (void *const buf, const size_t len)
+{
+  assert (_conn);
+
+#ifdef __INSIDE_CYGWIN__
+  if (_writing)
+    {
+      _writing = false;
+      ((mux_frame_t *) _buf)->len = _len;
+      switch (_conn->transact (_buf, _size))
+	{
+	case 1:
+	  _unsent = true;
+	  SET_ERRNO (EPIPE);
+	  return -1;
+	case -1:
+	  return -1;
+	}
+      _len = ((mux_frame_t *) _buf)->len;
+      _pos = 0;
+      if (!_len)
+	{
+	  SET_ERRNO (ENOSYS);
+	  return -1;
+	}
+    }
+#endif
+
+  if (_pos == _len)
+    {
+      SET_ERRNO (EINVAL);
+      return -1;
+    }
+
+  const size_t count = len < _len - _pos ? len : _len - _pos;
+  memcpy (buf, _buf + sizeof (mux_frame_t) + _pos, count);
+  _pos += count;
+  return count;
+}
+
+ssize_t
+transport_layer_mux::write (void *const buf, const size_t len)
+{
+  assert (_conn);
+
+  if (!_writing)
+    {
+      _writing = true;
+      _len = 0;
+    }
+
+  if (sizeof (mux_frame_t) + _len + len > _size)
+    {
+#ifndef __INSIDE_CYGWIN__
+      const size_t size = sizeof (mux_frame_t) + _len + len;
+      char *const nbuf = (char *) realloc (_buf, size);
+      if (nbuf)
+	{
+	  _buf = nbuf;
+	  _size = size;
+	}
+      else
+#endif
+	{
+	  SET_ERRNO (EINVAL);
+	  return -1;
+	}
+    }
+
+  memcpy (_buf + sizeof (mux_frame_t) + _len, buf, len);
+  _len += len;
+  return len;
+}
+
+int
+transport_layer_mux::connect ()
+{
+  assert (false);
+  return -1;
+}
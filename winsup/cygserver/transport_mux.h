@@ -0,0 +1,134 @@
+/* transport_mux.h
+
+This file is part of Cygwin.
+
+This software is a copyrighted work licensed under the terms of the
+Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
+details. */
+
+#ifndef _TRANSPORT_MUX_H
+#define _TRANSPORT_MUX_H
+
+/* A multiplexed connection carries requests of all threads of a client
+   process, and cygserver answers them in any order.  Each request and each
+   reply is sent as a frame, made up of this header followed by len bytes,
+   which are exactly what a connection of its own would carry for the
+   request, i.e. the client_request header and body. */
+struct mux_frame_t
+{
+  ULONG id;
+  ULONG len;
+};
+
+/* Max. size of a frame including its header.  Bigger requests use a
+   connection of their own. */
+#define MUX_MAX_FRAME	32768
+
+class transport_layer_mux;
+
+#ifdef __INSIDE_CYGWIN__
+
+/* The persistent connection of the process to cygserver.  Instances must
+   be NO_COPY and zero-initialized, the connection doesn't survive fork. */
+class mux_connection
+{
+public:
+  bool unavailable () const { return _unavail; }
+  void set_unavailable () { _unavail = true; }
+
+  bool attached ();
+  bool attach (transport_layer_base *);
+  int transact (char *buf, size_t size);
+
+private:
+  SRWLOCK _lock;
+  SRWLOCK _wlock;
+  CONDITION_VARIABLE _cond;
+  transport_layer_base *_pipe;
+  struct mux_waiter *_waiters;
+  ULONG _next_id;
+  unsigned _users;
+  bool _reading;
+  bool _broken;
+  bool _unavail;
+
+  bool read_frame ();
+  void fail_all ();
+};
+
+#else /* !__INSIDE_CYGWIN__ */
+
+/* The server side of a multiplexed connection.  A thread of its own reads
+   the request frames and passes them to submit.  The object deletes itself
+   when the client has gone away and all its requests have been answered. */
+class mux_connection
+{
+public:
+  mux_connection (transport_layer_base *);
+
+  bool start ();
+  void reply (char *buf);
+  void ref () { InterlockedIncrement (&_refs); }
+  void unref ();
+
+  transport_layer_base *transport () const { return _conn; }
+
+protected:
+  virtual ~mux_connection ();
+  virtual void submit (transport_layer_mux *) = 0;
+
+private:
+  transport_layer_base *const _conn;
+  LONG _refs;
+  CRITICAL_SECTION _wlock;
+
+  static DWORD WINAPI start_routine (LPVOID /* this */);
+  void read_loop ();
+};
+
+#endif /* !__INSIDE_CYGWIN__ */
+
+/* A single request on a multiplexed connection.  What is written to it is
+   collected and sent as one frame, and reads are served from the frame
+   received in return. */
+class transport_layer_mux : public transport_layer_base
+{
+public:
+#ifndef __INSIDE_CYGWIN__
+  virtual int listen ();
+  virtual class transport_layer_base *accept (bool *recoverable);
+#endif
+
+  virtual void close ();
+  virtual ssize_t read (void *buf, size_t len);
+  virtual ssize_t write (void *buf, size_t len);
+  virtual int connect ();
+
+#ifndef __INSIDE_CYGWIN__
+  virtual bool impersonate_client ();
+  virtual bool revert_to_self ();
+
+  transport_layer_mux (mux_connection *, char *buf);
+#else
+  transport_layer_mux (mux_connection *, char *buf, size_t size);
+
+  /* True if the request couldn't be sent at all, because the connection
+     has been broken before. */
+  bool unsent () const { return _unsent; }
+#endif
+
+  virtual ~transport_layer_mux ();
+
+private:
+  mux_connection *_conn;
+  char *_buf;
+  size_t _size;
+  size_t _len;
+  size_t _pos;
+  bool _writing;
+#ifdef __INSIDE_CYGWIN__
+  bool _unsent;
+#endif
+};
+
+#endif /* _TRANSPORT_MUX_H */
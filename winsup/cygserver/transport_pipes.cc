@@ -53,7 +53,10 @@ enum
 transport_layer_pipes::transport_layer_pipes (const HANDLE hPipe)
   : _hPipe (hPipe),
     _is_accepted_endpoint (true),
-    _is_listening_endpoint (false)
+    _is_listening_endpoint (false),
+    _overlapped (true),
+    _read_event (NULL),
+    _write_event (NULL)
 {
   assert (_hPipe);
   assert (_hPipe != INVALID_HANDLE_VALUE);
@@ -62,10 +65,13 @@ transport_layer_pipes::transport_layer_pipes (const HANDLE hPipe)
 
 #endif /* !__INSIDE_CYGWIN__ */
 
-transport_layer_pipes::transport_layer_pipes ()
+transport_layer_pipes::transport_layer_pipes (const bool overlapped)
   : _hPipe (NULL),
     _is_accepted_endpoint (false),
-    _is_listening_endpoint (false)
+    _is_listening_endpoint (false),
+    _overlapped (overlapped),
+    _read_event (NULL),
+    _write_event (NULL)
 {
   wchar_t cyg_instkey[18];
 
@@ -79,10 +85,36 @@ transport_layer_pipes::~transport_layer_pipes ()
   close ();
 }
 
+/* Reads and writes on an overlapped pipe each use an event of their own,
+   so that they can be pending at the same time. */
+bool
+transport_layer_pipes::create_events ()
+{
+  assert (_overlapped);
+
+  _read_event = CreateEvent (NULL, TRUE, FALSE, NULL);
+  _write_event = CreateEvent (NULL, TRUE, FALSE, NULL);
+  if (_read_event && _write_event)
+    return true;
+
+  debug_printf ("error creating pipe events (%u)", GetLastError ());
+  return false;
+}
+
+BOOL
+transport_layer_pipes::finish_io (BOOL ret, OVERLAPPED *const ov,
+				  DWORD *const count)
+{
+  if (!ret && _overlapped && GetLastError () == ERROR_IO_PENDING)
+    ret = GetOverlappedResult (_hPipe, ov, count, TRUE);
+  return ret;
+}
+
 #ifndef __INSIDE_CYGWIN__
 
 static HANDLE listen_pipe;
 static HANDLE connect_pipe;
+static HANDLE connect_event;
 
 int
 transport_layer_pipes::listen ()
@@ -122,6 +154,15 @@ transport_layer_pipes::listen ()
       return -1;
     }
 
+  /* The accepted pipe instances are overlapped, see accept. */
+  connect_event = CreateEvent (NULL, TRUE, FALSE, NULL);
+  if (!connect_event)
+    {
+      system_printf ("failed to create pipe connect event, error = %u",
+		     GetLastError ());
+      return -1;
+    }
+
   return 0;
 }
 
@@ -134,8 +175,10 @@ transport_layer_pipes::accept (bool *const recoverable)
 
   debug ("Try to create named pipe instance: %ls", _pipe_name);
 
+  /* Always overlapped, the client may turn the connection into a
+     multiplexed one. */
   const HANDLE accept_pipe =
-    CreateNamedPipeW (_pipe_name, PIPE_ACCESS_DUPLEX,
+    CreateNamedPipeW (_pipe_name, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
 		      PIPE_TYPE_BYTE | PIPE_WAIT, PIPE_UNLIMITED_INSTANCES,
 		      0, 0, 1000, &sec_all_nih);
 
@@ -146,8 +189,14 @@ transport_layer_pipes::accept (bool *const recoverable)
       return NULL;
     }
 
-  if (!ConnectNamedPipe (accept_pipe, NULL)
-      && GetLastError () != ERROR_PIPE_CONNECTED)
+  OVERLAPPED ov = { 0 };
+  DWORD count;
+
+  ov.hEvent = connect_event;
+  BOOL ret = ConnectNamedPipe (accept_pipe, &ov);
+  if (!ret && GetLastError () == ERROR_IO_PENDING)
+    ret = GetOverlappedResult (accept_pipe, &ov, &count, TRUE);
+  if (!ret && GetLastError () != ERROR_PIPE_CONNECTED)
     {
       debug_printf ("error connecting to pipe (%u)", GetLastError ());
       (void) CloseHandle (accept_pipe);
@@ -155,7 +204,14 @@ transport_layer_pipes::accept (bool *const recoverable)
       return NULL;
     }
 
-  return new transport_layer_pipes (accept_pipe);
+  transport_layer_pipes *const conn = new transport_layer_pipes (accept_pipe);
+  if (!conn->create_events ())
+    {
+      delete conn;
+      *recoverable = true;
+      return NULL;
+    }
+  return conn;
 }
 
 #endif /* !__INSIDE_CYGWIN__ */
@@ -189,6 +245,17 @@ transport_layer_pipes::close ()
 
       _hPipe = NULL;
     }
+
+  if (_read_event)
+    {
+      (void) CloseHandle (_read_event);
+      _read_event = NULL;
+    }
+  if (_write_event)
+    {
+      (void) CloseHandle (_write_event);
+      _write_event = NULL;
+    }
 }
 
 ssize_t
@@ -201,7 +268,10 @@ transport_layer_pipes::read (void *const buf, const size_t len)
   assert (!_is_listening_endpoint);
 
   DWORD count;
-  if (!ReadFile (_hPipe, buf, len, &count, NULL))
+  OVERLAPPED ov = { 0 };
+  ov.hEvent = _read_event;
+  if (!finish_io (ReadFile (_hPipe, buf, len, &count,
+			    _overlapped ? &ov : NULL), &ov, &count))
     {
       debug_printf ("error reading from pipe (%u)", GetLastError ());
       SET_ERRNO (EINVAL);	// FIXME?
@@ -221,7 +291,10 @@ transport_layer_pipes::write (void *const buf, const size_t len)
   assert (!_is_listening_endpoint);
 
   DWORD count;
-  if (!WriteFile (_hPipe, buf, len, &count, NULL))
+  OVERLAPPED ov = { 0 };
+  ov.hEvent = _write_event;
+  if (!finish_io (WriteFile (_hPipe, buf, len, &count,
+			     _overlapped ? &ov : NULL), &ov, &count))
     {
       debug_printf ("error writing to pipe, error = %u", GetLastError ());
       SET_ERRNO (EINVAL);	// FIXME?
@@ -252,6 +325,14 @@ transport_layer_pipes::connect ()
   BOOL rc = TRUE;
   int retries = 0;
 
+  /* An overlapped pipe is used for many requests, so let cygserver see
+     the security context of the client as it was when connecting, rather
+     than that of whichever thread wrote last. */
+  const DWORD flags = _overlapped
+		      ? FILE_FLAG_OVERLAPPED | SECURITY_SQOS_PRESENT
+			| SECURITY_IMPERSONATION
+		      : SECURITY_IMPERSONATION;
+
   debug_printf ("Try to connect to named pipe: %W", _pipe_name);
   while (rc)
     {
@@ -260,7 +341,7 @@ transport_layer_pipes::connect ()
 			    FILE_SHARE_READ | FILE_SHARE_WRITE,
 			    &sec_all_nih,
 			    OPEN_EXISTING,
-			    SECURITY_IMPERSONATION,
+			    flags,
 			    NULL);
 
       if (_hPipe != INVALID_HANDLE_VALUE)
@@ -270,6 +351,11 @@ transport_layer_pipes::connect ()
 	  ProtectHandle (_hPipe);
 #endif
 	  assume_cygserver = true;
+	  if (_overlapped && !create_events ())
+	    {
+	      close ();
+	      return -1;
+	    }
 	  return 0;
 	}
 
@@ -37,7 +37,7 @@ public:
   virtual bool revert_to_self ();
 #endif
 
-  transport_layer_pipes ();
+  transport_layer_pipes (bool overlapped = false);
   virtual ~transport_layer_pipes ();
 
 private:
@@ -46,7 +46,15 @@ private:
   const bool _is_accepted_endpoint;
   bool _is_listening_endpoint;
 
+  /* Overlapped pipes allow one thread to read while another one writes,
+     as required by multiplexed connections.  See transport_mux.cc. */
+  const bool _overlapped;
+  HANDLE _read_event;
+  HANDLE _write_event;
+
   transport_layer_pipes (HANDLE hPipe);
+  bool create_events ();
+  BOOL finish_io (BOOL ret, OVERLAPPED *ov, DWORD *count);
 };
 
 #endif /* _TRANSPORT_PIPES_H */
@@ -85,6 +85,9 @@ _cygtls::fixup_after_fork ()
   stacklock = spinning = 0;
   signal_arrived = NULL;
   locals.select.sockevt = NULL;
+  locals.select.afdevt = NULL;
+  /* Don't continue the random keystream of the parent. */
+  memset (&locals.chacha20, 0, sizeof locals.chacha20);
   locals.cw_timer = NULL;
   locals.cw_timer_inuse = false;
   locals.pathbufs.clear ();
@@ -129,16 +132,28 @@ _cygtls::remove (DWORD wait)
       free_local (select.ser_num);
       free_local (select.w4);
     }
+  if (locals.select.afdevt)
+    {
+      CloseHandle (locals.select.afdevt);
+      locals.select.afdevt = NULL;
+    }
   /* Free memory used by network functions. */
   free_local (ntoa_buf);
   free_local (protoent_buf);
   free_local (servent_buf);
   free_local (hostent_buf);
+  /* Give cached fhandler slots back to the pools. */
+  cpool_flush (this);
+  /* Wipe the random generator state. */
+  memset (&locals.chacha20, 0, sizeof locals.chacha20);
   /* Free temporary TLS path buffers. */
   locals.pathbufs.destroy ();
   /* Close timer handle. */
   if (locals.cw_timer)
     NtClose (locals.cw_timer);
+  /* Give the strace ring back. */
+  if (strace.ring ())
+    strace.ring_release ();
   if (mutex)
     {
       ReleaseMutex (mutex);
@@ -13,6 +13,7 @@ details. */
 #include "glob.h"
 #include <ctype.h>
 #include <locale.h>
+#include <spawn.h>
 #include <sys/param.h>
 #include "environ.h"
 #include "sigproc.h"
@@ -34,6 +35,7 @@ details. */
 #include "tls_pbuf.h"
 #include "exception.h"
 #include "cygxdr.h"
+#include "stackprof.h"
 #include <fenv.h>
 #include "ntdll.h"
 
@@ -644,6 +646,14 @@ child_info_spawn::handle_spawn ()
   if (!dynamically_loaded || get_parent_handle ())
       {
 	cygheap_fixup_in_child (true);
+	/* The fstab files may have changed since the parent opened the user
+	   shared region.  Drop the inherited handle, so memory_init opens the
+	   region by the name matching the current files. */
+	if (cygwin_user_h)
+	  {
+	    CloseHandle (cygwin_user_h);
+	    cygwin_user_h = NULL;
+	  }
 	memory_init ();
       }
 
@@ -674,6 +684,11 @@ child_info_spawn::handle_spawn ()
     cygheap->fdtab.move_fd (__stdin, 0);
   if (__stdout >= 0)
     cygheap->fdtab.move_fd (__stdout, 1);
+  if (moreinfo->setup.nfds)
+    cygheap->fdtab.fixup_after_spawn (moreinfo->setup.fdmap,
+				      moreinfo->setup.nfds);
+  if (moreinfo->setup.flags & POSIX_SPAWN_SETSID)
+    setsid ();
   cygheap->user.groups.clear_supp ();
 
   /* If we're execing we may have "inherited" a list of children forked by the
@@ -694,6 +709,13 @@ child_info_spawn::handle_spawn ()
     }
 
   signal_fixup_after_exec ();
+  if (moreinfo->setup.flags & POSIX_SPAWN_SETSIGDEF)
+    for (int i = 1; i < _NSIG; i++)
+      if (sigismember (&moreinfo->setup.sigdefault, i))
+	{
+	  global_sigs[i].sa_handler = SIG_DFL;
+	  global_sigs[i].sa_flags &= ~SA_SIGINFO;
+	}
   fixup_lockf_after_exec (type == _CH_EXEC);
 }
 
@@ -958,6 +980,7 @@ dll_crt0_1 (void *)
 
   (void) xdr_set_vprintf (&cygxdr_vwarnx);
   cygwin_finished_initializing = true;
+  stackprof_init ();
   /* Call init of loaded dlls. */
   dlls.init ();
 
@@ -1128,6 +1151,8 @@ do_exit (int status)
 
   lock_process until_exit (true);
 
+  stackprof_exit ();
+
   if (exit_state < ES_EVENTS_TERMINATE)
     exit_state = ES_EVENTS_TERMINATE;
 
@@ -9,7 +9,9 @@ details. */
 #define  __INSIDE_CYGWIN_NET__
 
 #include "winsup.h"
+#include "miscfuncs.h"
 #include <stdlib.h>
+#include <alloca.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <wchar.h>
@@ -93,14 +95,20 @@ dtable::extend (size_t howmuch, size_t min)
       set_errno (ENOMEM);
       return 0;
     }
-  if (fds)
-    {
-      memcpy (newfds, fds, size * sizeof (fds[0]));
-      cfree (fds);
-    }
+  fhandler_base **oldfds = fds;
+  if (oldfds)
+    memcpy (newfds, oldfds, size * sizeof (fds[0]));
 
-  size = new_size;
+  /* get_ref reads size before fds, so it never indexes the old array
+     beyond its end. */
   fds = newfds;
+  MemoryBarrier ();
+  size = new_size;
+  if (oldfds)
+    {
+      synchronize ();
+      cfree (oldfds);
+    }
   debug_printf ("size %ld, fds %p", size, fds);
   return 1;
 }
@@ -247,14 +255,72 @@ out:
 void
 dtable::release (int fd)
 {
-  if (fds[fd]->need_fixup_before ())
+  fhandler_base *fh = fds[fd];
+
+  if (fh->need_fixup_before ())
     dec_need_fixup_before ();
-  fds[fd]->dec_refcnt ();
+  /* Make the fhandler unreachable before dropping the reference of the
+     fd table, see get_ref. */
   fds[fd] = NULL;
+  fh->dec_refcnt ();
   if (fd <= 2)
     set_std_handle (fd);
 }
 
+/* Return the fhandler of fd with a reference taken, or NULL if fd isn't
+   open.  This doesn't take the fd table lock, so threads doing I/O on
+   different fds don't contend on it.  The lookup is protected by the
+   lookups counters instead: an fhandler is only deleted, and an fd array
+   replaced by extend is only freed, after synchronize has seen no lookup
+   in progress.  Since the fhandler has been removed from the table before,
+   no later lookup can find it.  The counters are per CPU, so lookups on
+   different CPUs don't share a cache line either. */
+fhandler_base *
+dtable::get_ref (int fd)
+{
+  fhandler_base *fh = NULL;
+  LONG gen = *(volatile LONG *) &lookup_gen;
+  LONG *count = &lookups[gen & 1][GetCurrentProcessorNumber ()
+				  & (DTABLE_LOOKUP_STRIPES - 1)].count;
+
+  InterlockedIncrement (count);
+  size_t cur_size = *(volatile size_t *) &size;
+  MemoryBarrier ();
+  fhandler_base **cur_fds = *(fhandler_base **volatile *) &fds;
+  if (fd >= 0 && (size_t) fd < cur_size)
+    {
+      fh = *(fhandler_base *volatile *) &cur_fds[fd];
+      /* A count of zero means the fhandler is just being closed, or is
+	 still being set up by cygheap_fdnew. */
+      if (fh && !fh->inc_refcnt_if_used ())
+	fh = NULL;
+    }
+  InterlockedDecrement (count);
+  return fh;
+}
+
+static NO_COPY SRWLOCK synchronize_lock = SRWLOCK_INIT;
+
+/* Wait until no get_ref started before is still running.  Each round
+   switches new lookups over to the other generation, then waits for the
+   counters of the old one to drain, so a steady stream of new lookups
+   can't keep us waiting.  The second round catches lookups which read the
+   generation before the first switch but only registered afterwards. */
+void
+dtable::synchronize ()
+{
+  AcquireSRWLockExclusive (&synchronize_lock);
+  for (int round = 0; round < 2; round++)
+    {
+      LONG old = InterlockedIncrement (&lookup_gen) - 1;
+
+      for (int i = 0; i < DTABLE_LOOKUP_STRIPES; i++)
+	while (*(volatile LONG *) &lookups[old & 1][i].count)
+	  yield ();
+    }
+  ReleaseSRWLockExclusive (&synchronize_lock);
+}
+
 extern "C" int
 cygwin_attach_handle_to_fd (char *name, int fd, HANDLE handle, mode_t bin,
 			    DWORD myaccess)
@@ -428,13 +494,13 @@ dtable::init_std_file_from_handle (int fd, HANDLE handle)
 
 #define cnew(name, ...) \
   ({ \
-    void* ptr = (void*) ccalloc (HEAP_FHANDLER, 1, sizeof (name)); \
+    void* ptr = (void*) cpalloc (HEAP_FHANDLER, sizeof (name)); \
     ptr ? new (ptr) name (__VA_ARGS__) : NULL; \
   })
 
 #define cnew_no_ctor(name, ...) \
   ({ \
-    void* ptr = (void*) ccalloc (HEAP_FHANDLER, 1, sizeof (name)); \
+    void* ptr = (void*) cpalloc (HEAP_FHANDLER, sizeof (name)); \
     ptr ? new (ptr) name (ptr) : NULL; \
   })
 
@@ -901,6 +967,7 @@ void
 dtable::fixup_after_exec ()
 {
   first_fd_for_open = 0;
+  reset_lookups ();
   fhandler_base *fh;
   for (size_t i = 0; i < size; i++)
     if ((fh = fds[i]) != NULL)
@@ -923,10 +990,69 @@ dtable::fixup_after_exec ()
     cygheap->ctty->fixup_after_exec ();
 }
 
+/* Called after fixup_after_exec in a child started by posix_spawn without
+   forking.  The parent made sure that only the fds referenced by fdmap have
+   been inherited.  fdmap[i] is the parent's fd which has to show up as fd i,
+   or -1 if fd i is closed. */
+void
+dtable::fixup_after_spawn (const int *fdmap, int nfds)
+{
+  int *tmpfd = (int *) alloca (nfds * sizeof (int));
+  size_t top = size > (size_t) nfds ? size : (size_t) nfds;
+
+  /* Move all inherited fds out of the way first, so we can handle
+     arbitrary permutations. */
+  for (int i = 0; i < nfds; i++)
+    {
+      int j;
+
+      tmpfd[i] = -1;
+      if (fdmap[i] < 0)
+	continue;
+      for (j = 0; j < i; j++)
+	if (fdmap[j] == fdmap[i])
+	  break;
+      if (j < i)
+	tmpfd[i] = tmpfd[j];
+      else if (!not_open (fdmap[i]))
+	{
+	  tmpfd[i] = find_unused_handle (top);
+	  if (tmpfd[i] >= 0)
+	    move_fd (fdmap[i], tmpfd[i]);
+	}
+    }
+  /* Now the target slots only contain fds nobody asked for. */
+  for (int i = 0; i < nfds; i++)
+    if (!not_open (i))
+      close (i);
+  for (int i = 0; i < nfds; i++)
+    {
+      int j;
+
+      if (tmpfd[i] < 0)
+	continue;
+      for (j = 0; j < i; j++)
+	if (tmpfd[j] == tmpfd[i])
+	  break;
+      if (j < i)
+	{
+	  /* dup3 leaves taking the fd table's reference to the caller. */
+	  if (dup3 (j, i, 0) == i)
+	    fds[i]->inc_refcnt ();
+	}
+      else
+	move_fd (tmpfd[i], i);
+      if (i <= 2)
+	set_std_handle (i);
+    }
+}
+
 void
 dtable::fixup_after_fork (HANDLE parent)
 {
   fhandler_base *fh;
+  /* The parent may have been in the middle of a lookup. */
+  reset_lookups ();
   for (size_t i = 0; i < size; i++)
     if ((fh = fds[i]) != NULL)
       {
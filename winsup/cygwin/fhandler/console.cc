@@ -74,6 +74,91 @@ static struct fhandler_base::rabuf_t con_ra;
    in xterm compatible mode */
 static wchar_t last_char;
 
+/* Output of fhandler_console::write in xterm compatible mode, i.e. text
+   and the escape sequences passed through to the console, is collected
+   here and written by a single WriteConsoleW call when write returns.
+   Without it, every run of text and every escape sequence took a call of
+   its own, including attaching to the console under attach_mutex.  The
+   collected output is also written before this thread calls any other
+   console function, see attach_console, so console functions querying or
+   moving the cursor still see the output in order. */
+static class write_batch_buffer
+{
+private:
+  static const DWORD WRITE_CHUNK = 16384u;	/* As MAX_WRITE_CHARS */
+  PWCHAR buf;
+  DWORD len;
+  HANDLE output_handle;
+  LONG tid;			/* Collecting thread, 0 if none. */
+public:
+  /* Start collecting into nbuf, a tmp_pathbuf of NT_MAX_PATH WCHARs.
+     Returns false if a thread, maybe this one, is already collecting. */
+  bool start (HANDLE h, PWCHAR nbuf)
+  {
+    if (InterlockedCompareExchange (&tid, (LONG) GetCurrentThreadId (), 0))
+      return false;
+    buf = nbuf;
+    len = 0;
+    output_handle = h;
+    return true;
+  }
+  bool active () const { return tid == (LONG) GetCurrentThreadId (); }
+  /* Returns false if not collecting or if the text doesn't fit.  The caller
+     writes the text itself then, after the collected output, since
+     attach_console writes that out first. */
+  bool put (const wchar_t *s, DWORD n)
+  {
+    if (!active () || n > NT_MAX_PATH - len)
+      return false;
+    wmemcpy (buf + len, s, n);
+    len += n;
+    return true;
+  }
+  /* Write the collected output.  The caller must be attached to the
+     console and hold attach_mutex. */
+  bool write_out ()
+  {
+    PWCHAR p = buf;
+    DWORD done;
+
+    if (!active () || !len)
+      return true;
+    while (len > 0)
+      {
+	DWORD n = len > WRITE_CHUNK ? WRITE_CHUNK : len;
+	if (!WriteConsoleW (output_handle, p, n, &done, 0))
+	  {
+	    debug_printf ("WriteConsoleW failed, %E");
+	    len = 0;
+	    return false;
+	  }
+	len -= done;
+	p += done;
+      }
+    return true;
+  }
+  bool flush (DWORD owner)
+  {
+    bool ret = true;
+
+    if (active () && len)
+      {
+	acquire_attach_mutex (mutex_timeout);
+	DWORD resume_pid = fhandler_console::attach_console (owner);
+	ret = write_out ();
+	fhandler_console::detach_console (resume_pid, owner);
+	release_attach_mutex ();
+      }
+    return ret;
+  }
+  bool stop (DWORD owner)
+  {
+    bool ret = flush (owner);
+    InterlockedExchange (&tid, 0);
+    return ret;
+  }
+} NO_COPY wbbuf;
+
 DWORD
 fhandler_console::attach_console (DWORD owner, bool *err)
 {
@@ -97,6 +182,7 @@ fhandler_console::attach_console (DWORD owner, bool *err)
 	  return (DWORD) -1;
 	}
     }
+  wbbuf.write_out ();
   return resume_pid;
 }
 
@@ -177,6 +263,8 @@ public:
 	    ixput -= bytes;
 	  }
       }
+    if (wbbuf.put (bufw, len))
+      return;
     acquire_attach_mutex (mutex_timeout);
     DWORD resume_pid = fhandler_console::attach_console (owner);
     WriteConsoleW (output_handle, bufw, len, NULL, 0);
@@ -2553,6 +2641,12 @@ fhandler_console::write_console (PWCHAR buf, DWORD len, DWORD& done)
   if (len > 0)
     last_char = buf[len-1];
 
+  if (wbbuf.put (buf, len))
+    {
+      done = len;
+      return true;
+    }
+
   while (len > 0)
     {
       DWORD nbytes = len > MAX_WRITE_CHARS ? MAX_WRITE_CHARS : len;
@@ -3834,6 +3928,8 @@ fhandler_console::write (const void *vsrc, size_t len)
      in write instead of in write_normal should be faster, too. */
   tmp_pathbuf tp;
   write_buf = tp.w_get ();
+  bool batch = wincap.has_con_24bit_colors () && !con_is_legacy
+	       && wbbuf.start (get_output_handle (), tp.w_get ());
 
   debug_printf ("%p, %ld", vsrc, len);
 
@@ -3846,6 +3942,8 @@ fhandler_console::write (const void *vsrc, size_t len)
 	  src = write_normal (src, end);
 	  if (!src) /* write_normal failed */
 	    {
+	      if (batch)
+		wbbuf.stop (con.owner);
 	      release_output_mutex ();
 	      return -1;
 	    }
@@ -4150,6 +4248,12 @@ fhandler_console::write (const void *vsrc, size_t len)
 	  break;
 	}
     }
+  if (batch && !wbbuf.stop (con.owner))
+    {
+      __seterrno ();
+      release_output_mutex ();
+      return -1;
+    }
   release_output_mutex ();
 
   syscall_printf ("%ld = fhandler_console::write(...)", len);
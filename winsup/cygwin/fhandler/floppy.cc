@@ -27,11 +27,17 @@ details. */
 
 #define bytes_per_sector devbufalign
 
+/* Buffer size for disks.  Reading megabytes at a time, and the next ones
+   ahead asynchronously, keeps fast devices busy.  Floppies don't gain
+   anything from it. */
+#define DISK_BUFSIZ	(2 * 1024 * 1024)
+
 /**********************************************************************/
 /* fhandler_dev_floppy */
 
 fhandler_dev_floppy::fhandler_dev_floppy ()
-  : fhandler_dev_raw (), status ()
+  : fhandler_dev_raw (), io_align (0), ra_handle (NULL), ra_evt (NULL),
+    ra_bufalloc (NULL), ra_buf (NULL), ra_pos (0), seq_pos (0), status ()
 {
 }
 
@@ -150,6 +156,99 @@ fhandler_dev_floppy::read_file (void *buf, DWORD to_read, DWORD *read, int *err)
   return ret;
 }
 
+/* Start reading the devbufsiz bytes at pos into ra_buf asynchronously,
+   using a handle of its own, so it doesn't disturb the file position of
+   the synchronous handle. */
+bool
+fhandler_dev_floppy::ra_start (off_t pos)
+{
+  NTSTATUS status;
+  IO_STATUS_BLOCK io;
+  OBJECT_ATTRIBUTES attr;
+  LARGE_INTEGER off = { QuadPart:pos };
+  ULONG len = devbufsiz;
+
+  if (pos >= drive_size)
+    return false;
+  if (pos + len > drive_size)
+    len = rounddown (drive_size - pos, bytes_per_sector);
+  if (!len)
+    return false;
+  if (!ra_handle)
+    {
+      status = NtOpenFile (&ra_handle, GENERIC_READ,
+			   pc.init_reopen_attr (attr, get_handle ()), &io,
+			   FILE_SHARE_VALID_FLAGS,
+			   get_options () & ~FILE_SYNCHRONOUS_IO_NONALERT);
+      if (!NT_SUCCESS (status))
+	{
+	  debug_printf ("NtOpenFile (%S) for read-ahead, status %y",
+			pc.get_nt_native_path (), status);
+	  ra_handle = NULL;
+	  return false;
+	}
+      if (!(ra_evt = CreateEvent (&sec_none_nih, TRUE, FALSE, NULL)))
+	{
+	  ra_close ();
+	  return false;
+	}
+    }
+  if (!ra_bufalloc)
+    {
+      ra_bufalloc = new char [devbufsiz + devbufalign];
+      ra_buf = (char *) roundup2 ((uintptr_t) ra_bufalloc,
+				  (uintptr_t) devbufalign);
+    }
+  status = NtReadFile (ra_handle, ra_evt, NULL, NULL, &ra_io, ra_buf, len,
+		       &off, NULL);
+  if (!NT_SUCCESS (status))
+    {
+      debug_printf ("read-ahead of %u bytes from pos %U, status %y",
+		    len, pos, status);
+      return false;
+    }
+  ra_pos = pos;
+  ra_pending (true);
+  return true;
+}
+
+/* Wait for the pending read-ahead.  Returns the number of bytes read,
+   0 on error, which the subsequent synchronous read will report. */
+DWORD
+fhandler_dev_floppy::ra_finish ()
+{
+  ra_pending (false);
+  if (WaitForSingleObject (ra_evt, INFINITE) != WAIT_OBJECT_0
+      || !NT_SUCCESS (ra_io.Status))
+    return 0;
+  return (DWORD) ra_io.Information;
+}
+
+void
+fhandler_dev_floppy::ra_cancel ()
+{
+  if (ra_pending ())
+    {
+      IO_STATUS_BLOCK io;
+
+      NtCancelIoFileEx (ra_handle, &ra_io, &io);
+      ra_finish ();
+    }
+}
+
+void
+fhandler_dev_floppy::ra_close ()
+{
+  ra_cancel ();
+  if (ra_handle)
+    NtClose (ra_handle);
+  if (ra_evt)
+    CloseHandle (ra_evt);
+  ra_reset ();
+  delete [] ra_bufalloc;
+  ra_bufalloc = ra_buf = NULL;
+}
+
 /* See comment in write_file below. */
 BOOL
 fhandler_dev_floppy::lock_partition (DWORD to_write)
@@ -337,12 +436,23 @@ fhandler_dev_floppy::open (int flags, mode_t)
 	     usually non-buffered and non-cached, the performance without
 	     buffering is worse than access to a file system on same device.
 	     Whoever uses O_DIRECT has my condolences. */
-	  devbufsiz = MAX (16 * bytes_per_sector, 65536);
+	  devbufsiz = MAX (16 * bytes_per_sector,
+			   get_major () == DEV_FLOPPY_MAJOR ? 65536
+							    : DISK_BUFSIZ);
 	  devbufalloc = new char [devbufsiz + devbufalign];
 	  devbuf = (char *) roundup2 ((uintptr_t) devbufalloc,
 				      (uintptr_t) devbufalign);
 	}
 
+      /* Reads go straight into the caller's buffer if it's suitably
+	 aligned for the device. */
+      FILE_ALIGNMENT_INFORMATION fai;
+      IO_STATUS_BLOCK io;
+      if (NT_SUCCESS (NtQueryInformationFile (get_handle (), &io, &fai,
+					      sizeof fai,
+					      FileAlignmentInformation)))
+	io_align = fai.AlignmentRequirement;
+
       /* If we're not trying to access a floppy disk, make sure we're actually
          allowed to read *all* of the device or volume.  This is actually
 	 documented in the MSDN CreateFile man page. */
@@ -359,6 +469,7 @@ fhandler_dev_floppy::open (int flags, mode_t)
 int
 fhandler_dev_floppy::close ()
 {
+  ra_close ();
   int ret = fhandler_dev_raw::close ();
 
   if (partitions && InterlockedDecrement (&partitions->refcnt) == 0)
@@ -376,11 +487,35 @@ fhandler_dev_floppy::dup (fhandler_base *child, int flags)
 {
   int ret = fhandler_dev_raw::dup (child, flags);
 
-  if (!ret && partitions)
-    InterlockedIncrement (&partitions->refcnt);
+  if (!ret)
+    {
+      fhandler_dev_floppy *fhc = (fhandler_dev_floppy *) child;
+
+      fhc->ra_reset ();
+      fhc->ra_bufalloc = fhc->ra_buf = NULL;
+      if (partitions)
+	InterlockedIncrement (&partitions->refcnt);
+    }
   return ret;
 }
 
+void
+fhandler_dev_floppy::fixup_after_fork (HANDLE parent)
+{
+  fhandler_dev_raw::fixup_after_fork (parent);
+  /* The read-ahead handles aren't inherited, and a pending read-ahead
+     fills the buffer of the parent. */
+  ra_reset ();
+}
+
+void
+fhandler_dev_floppy::fixup_after_exec ()
+{
+  fhandler_dev_raw::fixup_after_exec ();
+  ra_reset ();
+  ra_bufalloc = ra_buf = NULL;
+}
+
 inline off_t
 fhandler_dev_floppy::get_current_position ()
 {
@@ -434,7 +569,42 @@ fhandler_dev_floppy::raw_read (void *ptr, size_t& ulen)
 	    }
 	  if (len > 0)
 	    {
-	      if (len >= devbufsiz)
+	      off_t current_position = get_current_position ();
+
+	      /* Take over the buffer read ahead for this position, and
+		 start reading the next one. */
+	      if (ra_pending ())
+		{
+		  if (ra_pos == current_position && (read2 = ra_finish ()))
+		    {
+		      LARGE_INTEGER off = { QuadPart:current_position + read2 };
+
+		      debug_printf ("%u bytes from pos %U read ahead", read2,
+				    current_position);
+		      if (!SetFilePointerEx (get_handle (), off, NULL,
+					     FILE_BEGIN))
+			{
+			  __seterrno ();
+			  goto err;
+			}
+		      char *t = devbufalloc;
+		      devbufalloc = ra_bufalloc;
+		      ra_bufalloc = t;
+		      t = devbuf;
+		      devbuf = ra_buf;
+		      ra_buf = t;
+		      devbufstart = 0;
+		      devbufend = read2;
+		      seq_pos = off.QuadPart;
+		      ra_start (seq_pos);
+		      continue;
+		    }
+		  ra_cancel ();
+		}
+
+	      /* Big reads go straight into the caller's buffer, if the
+		 device can read into it. */
+	      if (len >= devbufsiz && !((uintptr_t) p & io_align))
 		{
 		  bytes_to_read = (len / bytes_per_sector) * bytes_per_sector;
 		  tgt = p;
@@ -444,7 +614,6 @@ fhandler_dev_floppy::raw_read (void *ptr, size_t& ulen)
 		  tgt = devbuf;
 		  bytes_to_read = devbufsiz;
 		}
-	      off_t current_position = get_current_position ();
 	      if (current_position + bytes_to_read >= drive_size)
 		bytes_to_read = drive_size - current_position;
 	      if (!bytes_to_read)
@@ -452,7 +621,7 @@ fhandler_dev_floppy::raw_read (void *ptr, size_t& ulen)
 
 	      debug_printf ("read %u bytes from pos %U %s", bytes_to_read,
 			    current_position,
-			    len < devbufsiz ? "into buffer" : "directly");
+			    tgt == devbuf ? "into buffer" : "directly");
 	      if (!read_file (tgt, bytes_to_read, &read2, &ret))
 		{
 		  if (!IS_EOM (ret))
@@ -481,6 +650,10 @@ fhandler_dev_floppy::raw_read (void *ptr, size_t& ulen)
 		{
 		  devbufstart = 0;
 		  devbufend = read2;
+		  /* Read ahead once the buffer is refilled sequentially. */
+		  if (current_position == seq_pos && !eom_detected ())
+		    ra_start (current_position + read2);
+		  seq_pos = current_position + read2;
 		}
 	      else
 		{
@@ -541,6 +714,9 @@ fhandler_dev_floppy::raw_write (const void *ptr, size_t len)
   if (!len)
     return 0;
 
+  /* Data read ahead may be stale after writing. */
+  ra_cancel ();
+
   if (devbuf)
     {
       DWORD cplen, written;
@@ -684,8 +860,9 @@ fhandler_dev_floppy::lseek (off_t offset, int whence)
   sector_aligned_offset.QuadPart = rounddown (offset, bytes_per_sector);
   bytes_left = offset - sector_aligned_offset.QuadPart;
 
-  /* Invalidate buffer. */
+  /* Invalidate buffers. */
   devbufstart = devbufend = 0;
+  ra_cancel ();
 
   if (!SetFilePointerEx (get_handle (), sector_aligned_offset, NULL,
 			 FILE_BEGIN))
@@ -758,6 +935,9 @@ fhandler_dev_floppy::ioctl (unsigned int cmd, void *buf)
       *(int *)buf = 0;
       break;
     default:
+      /* RDSETBLK changes devbufsiz, so the read-ahead buffer has to go. */
+      if (cmd == RDIOCDOP)
+	ra_close ();
       ret = fhandler_dev_raw::ioctl (cmd, buf);
       break;
     }
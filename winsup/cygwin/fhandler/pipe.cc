@@ -431,6 +431,148 @@ fhandler_pipe::reader_closed ()
   return n_reader == n_writer;
 }
 
+/* Blocking writes of more than one chunk keep two chunks queued in the
+   pipe, so the reader can drain one while the next one is already waiting,
+   rather than waiting for us to wake up and submit it.  The chunks are
+   written right from the caller's buffer, since we return only after
+   all of them completed.
+
+   The next chunk is only submitted if the previous one is pending, which
+   means the pipe is in queued mode and keeps them in order.  Returns 0 if
+   nothing could be written without waiting, which only happens if the
+   pipe is in nonblocking mode anyway, e.g. when inherited from a non-Cygwin
+   process.  raw_write falls back to writing chunk by chunk in this case. */
+ssize_t
+fhandler_pipe_fifo::raw_write_queued (const void *ptr, size_t len,
+				      ULONG chunk)
+{
+  struct
+  {
+    HANDLE evt;
+    IO_STATUS_BLOCK io;
+    ULONG len;
+  } w[2] = {};
+  const char *p = (const char *) ptr;
+  size_t submitted = 0, nbytes = 0;
+  int head = 0, pending = 0;
+  bool stop = false;
+  NTSTATUS status = STATUS_SUCCESS;
+  DWORD waitret = WAIT_OBJECT_0;
+
+  for (int i = 0; i < 2; i++)
+    if (!(w[i].evt = CreateEvent (NULL, true, false, NULL)))
+      {
+	__seterrno ();
+	if (i)
+	  CloseHandle (w[0].evt);
+	return -1;
+      }
+
+  while (!stop || pending)
+    {
+      /* Keep two chunks queued. */
+      while (!stop && pending < 2 && submitted < len)
+	{
+	  int i = (head + pending) % 2;
+
+	  w[i].len = (ULONG) MIN (len - submitted, (size_t) chunk);
+	  status = NtWriteFile (get_handle (), w[i].evt, NULL, NULL, &w[i].io,
+				(PVOID) (p + submitted), w[i].len, NULL, NULL);
+	  if (status == STATUS_PENDING)
+	    {
+	      submitted += w[i].len;
+	      ++pending;
+	      status = STATUS_SUCCESS;
+	    }
+	  else if (NT_SUCCESS (status))
+	    {
+	      submitted += w[i].io.Information;
+	      nbytes += w[i].io.Information;
+	      if (select_sem && w[i].io.Information > 0)
+		release_select_sem ("raw_write_queued");
+	      if (w[i].io.Information < w[i].len)
+		stop = true;
+	    }
+	  else
+	    stop = true;
+	}
+      if (submitted >= len)
+	stop = true;
+      if (!pending)
+	break;
+
+      /* Wait for the oldest chunk, checking for the reader closing the
+	 pipe in between, as in raw_write. */
+      waitret = cygwait (w[head].evt, (DWORD) 0, cw_cancel | cw_sig_eintr);
+      if (waitret == WAIT_SIGNALED && _my_tls.call_signal_handler ())
+	waitret = WAIT_TIMEOUT;
+      if (waitret == WAIT_TIMEOUT && reader_closed ())
+	{
+	  status = STATUS_PIPE_BROKEN;
+	  waitret = WAIT_FAILED;
+	}
+      if (waitret == WAIT_TIMEOUT)
+	{
+	  cygwait (select_sem, 10, cw_cancel);
+	  continue;
+	}
+      if (waitret != WAIT_OBJECT_0)
+	{
+	  /* Collect what has been written of the pending chunks before
+	     they got cancelled. */
+	  CancelIo (get_handle ());
+	  while (pending)
+	    {
+	      WaitForSingleObject (w[head].evt, INFINITE);
+	      nbytes += w[head].io.Information;
+	      head ^= 1;
+	      --pending;
+	    }
+	  if (waitret == WAIT_CANCELED)
+	    status = STATUS_THREAD_CANCELED;
+	  else if (waitret == WAIT_SIGNALED)
+	    status = STATUS_THREAD_SIGNALED;
+	  break;
+	}
+      /* Keep the first error. */
+      if (NT_SUCCESS (status))
+	status = w[head].io.Status;
+      nbytes += w[head].io.Information;
+      if (select_sem && w[head].io.Information > 0)
+	release_select_sem ("raw_write_queued");
+      head ^= 1;
+      --pending;
+      if (!NT_SUCCESS (status) || isclosed ())
+	{
+	  stop = true;
+	  if (pending)
+	    CancelIo (get_handle ());
+	}
+    }
+  CloseHandle (w[0].evt);
+  CloseHandle (w[1].evt);
+
+  if (isclosed ())  /* A signal handler might have closed the fd. */
+    set_errno (EBADF);
+  else if (status == STATUS_THREAD_CANCELED)
+    pthread::static_cancel_self ();
+  else if (status == STATUS_THREAD_SIGNALED)
+    {
+      if (!nbytes)
+	set_errno (EINTR);
+    }
+  else if (STATUS_PIPE_IS_CLOSED (status))
+    {
+      set_errno (EPIPE);
+      raise (SIGPIPE);
+    }
+  else if (!NT_SUCCESS (status))
+    __seterrno_from_nt_status (status);
+  else if (!nbytes)
+    return 0;
+  return nbytes ?: -1;
+}
+
 ssize_t
 fhandler_pipe_fifo::raw_write (const void *ptr, size_t len)
 {
@@ -456,7 +598,12 @@ fhandler_pipe_fifo::raw_write (const void *ptr, size_t len)
   else if (is_nonblocking ())
     chunk = len = pipe_buf_size;
   else
-    chunk = pipe_buf_size;
+    {
+      chunk = pipe_buf_size;
+      ssize_t ret = raw_write_queued (ptr, len, chunk);
+      if (ret)
+	return ret;
+    }
 
   if (!(evt = CreateEvent (NULL, false, false, NULL)))
     {
@@ -1188,8 +1335,34 @@ fhandler_pipe::ioctl (unsigned int cmd, void *p)
 int
 fhandler_pipe::fcntl (int cmd, intptr_t arg)
 {
-  if (cmd != F_SETFL)
-    return fhandler_base::fcntl (cmd, arg);
+  switch (cmd)
+    {
+    case F_GETPIPE_SZ:
+      return pipe_buf_size;
+    case F_SETPIPE_SZ:
+      /* The buffer size of a Windows pipe is fixed when creating it.
+	 What we can set is the size of the chunks written at once, up to
+	 two of which are queued in the pipe by a blocking write.  Round up
+	 to a power of two pages, like Linux. */
+      if (arg < 0)
+	{
+	  set_errno (EINVAL);
+	  return -1;
+	}
+      if ((size_t) arg > MAX_PIPEBUFSIZE)
+	{
+	  set_errno (EPERM);
+	  return -1;
+	}
+      pipe_buf_size = wincap.page_size ();
+      while (pipe_buf_size < (size_t) arg)
+	pipe_buf_size <<= 1;
+      return pipe_buf_size;
+    case F_SETFL:
+      break;
+    default:
+      return fhandler_base::fcntl (cmd, arg);
+    }
 
   const bool was_nonblocking = is_nonblocking ();
   int res = fhandler_base::fcntl (cmd, arg);
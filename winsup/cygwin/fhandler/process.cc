@@ -50,6 +50,7 @@ static off_t format_process_fd (void *, char *&);
 static off_t format_process_mounts (void *, char *&);
 static off_t format_process_mountinfo (void *, char *&);
 static off_t format_process_environ (void *, char *&);
+static off_t format_process_fhpools (void *, char *&);
 
 static const virt_tab_t process_tab[] =
 {
@@ -62,6 +63,7 @@ static const virt_tab_t process_tab[] =
   { _VN ("exe"),        FH_PROCESS,   virt_symlink,   format_process_exename },
   { _VN ("exename"),    FH_PROCESS,   virt_file,      format_process_exename },
   { _VN ("fd"),         FH_PROCESSFD, virt_directory, format_process_fd },
+  { _VN ("fhpools"),    FH_PROCESS,   virt_file,      format_process_fhpools },
   { _VN ("gid"),        FH_PROCESS,   virt_file,      format_process_gid },
   { _VN ("maps"),       FH_PROCESS,   virt_file,      format_process_maps },
   { _VN ("mountinfo"),  FH_PROCESS,   virt_file,      format_process_mountinfo },
@@ -601,6 +603,26 @@ format_process_environ (void *data, char *&destbuf)
   return fs;
 }
 
+static off_t
+format_process_fhpools (void *data, char *&destbuf)
+{
+  _pinfo *p = (_pinfo *) data;
+  size_t fs;
+
+  if (destbuf)
+    {
+      cfree (destbuf);
+      destbuf = NULL;
+    }
+  destbuf = p ? p->fhpools (fs) : NULL;
+  if (!destbuf || !*destbuf)
+    {
+      destbuf = cstrdup ("<defunct>");
+      fs = strlen (destbuf) + 1;
+    }
+  return fs - 1;
+}
+
 struct heap_info
 {
   struct heap
@@ -1322,17 +1344,22 @@ format_process_mountstuff (void *data, char *&destbuf, bool mountinfo)
   HANDLE u_hdl = NULL;
   off_t len = 0;
   struct mntent *mnt;
+  bool other_user = p->uid != myself->uid;
 
-  if (p->uid != myself->uid)
+  /* A process started before the fstab files changed uses an older mount
+     table than ours.  Open the one it uses. */
+  if (other_user || p->mount_key != cygheap->user_shared_key)
     {
       WCHAR sid_string[UNLEN + 1] = L""; /* Large enough for SID */
+      WCHAR name[UNLEN + 16];
 
       cygsid p_sid;
 
       if (!p_sid.getfrompw (internal_getpwuid (p->uid)))
 	return 0;
       p_sid.string (sid_string);
-      u_shared = (user_info *) open_shared (sid_string, USER_VERSION, u_hdl,
+      user_shared_name (name, sid_string, p->mount_key);
+      u_shared = (user_info *) open_shared (name, USER_VERSION, u_hdl,
 					    sizeof (user_info), SH_JUSTOPEN,
 					    &sec_none_nih);
       if (!u_shared)
@@ -1357,7 +1384,7 @@ format_process_mountstuff (void *data, char *&destbuf, bool mountinfo)
 	 _my_tls.locals.available_drives contains the mappings of the current
 	 user.  So, when printing the mount table of another user, we check
 	 each cygdrive entry if it's a remote drive.  If so, ignore it. */
-      if (iteration >= mtab->nmounts && u_hdl)
+      if (iteration >= mtab->nmounts && other_user)
 	{
 	  WCHAR drive[3] = { (WCHAR) mnt->mnt_fsname[0], L':', L'\0' };
 	  disk_type dt = get_disk_type (drive);
@@ -28,6 +28,7 @@ details. */
 #include "registry.h"
 #include "tls_pbuf.h"
 #include "winf.h"
+#include "clock.h"
 
 #ifndef PROC_THREAD_ATTRIBUTE_PSEUDOCONSOLE
 #define PROC_THREAD_ATTRIBUTE_PSEUDOCONSOLE 0x00020016
@@ -2350,6 +2351,17 @@ fhandler_pty_master::ioctl (unsigned int cmd, void *arg)
       break;
     case TIOCSPGRP:
       return this->tcsetpgrp ((pid_t) (intptr_t) arg);
+    case TIOCGFWDSTAT:
+      {
+	struct ptyfwdstat *pfs = (struct ptyfwdstat *) arg;
+	pfs->pfs_bytes = get_ttyp ()->fwd_bytes;
+	pfs->pfs_reads = get_ttyp ()->fwd_reads;
+	pfs->pfs_plain_reads = get_ttyp ()->fwd_plain_reads;
+	pfs->pfs_usecs = get_ttyp ()->fwd_time / (NS100PERSEC / USPERSEC);
+	pfs->pfs_max_usecs = get_ttyp ()->fwd_max_time
+			     / (NS100PERSEC / USPERSEC);
+      }
+      break;
     case FIONREAD:
       {
 	DWORD n;
@@ -2614,6 +2626,27 @@ pty_master_thread (VOID *arg)
   return fhandler_pty_master::pty_master_thread (&p);
 }
 
+/* True if buf is plain 7 bit ASCII.  That reads the same in all code pages
+   a pty can use, so it doesn't need any conversion. */
+static bool
+is_7bit_ascii (const char *buf, DWORD len)
+{
+  const char *end = buf + len;
+
+  for (; buf + sizeof (uint64_t) <= end; buf += sizeof (uint64_t))
+    {
+      uint64_t v;
+
+      memcpy (&v, buf, sizeof v);
+      if (v & 0x8080808080808080ULL)
+	return false;
+    }
+  for (; buf < end; ++buf)
+    if (*buf & 0x80)
+      return false;
+  return true;
+}
+
 /* The function pty_master_fwd_thread() should be static because the
    instance is deleted if the master is dup()'ed and the original is
    closed. In this case, dup()'ed instance still exists, therefore,
@@ -2628,6 +2661,10 @@ fhandler_pty_master::pty_master_fwd_thread (const master_fwd_thread_param_t *p)
   tmp_pathbuf tp;
   char *outbuf = tp.c_get ();
   char *mbbuf = tp.c_get ();
+  /* The read buffer starts at NT_MAX_PATH bytes and grows up to the pipe
+     size as long as reads fill it completely. */
+  DWORD outbuf_size = NT_MAX_PATH;
+  char *bigbuf = NULL;
   static mbstate_t mbp;
 
   termios_printf ("Started.");
@@ -2637,179 +2674,235 @@ fhandler_pty_master::pty_master_fwd_thread (const master_fwd_thread_param_t *p)
       DWORD n;
       p->ttyp->fwd_not_empty =
 	::bytes_available (n, p->from_slave_nat) && n;
-      if (!ReadFile (p->from_slave_nat, outbuf, NT_MAX_PATH, &rlen, NULL))
+      if (!ReadFile (p->from_slave_nat, outbuf, outbuf_size, &rlen, NULL))
 	{
 	  termios_printf ("ReadFile for forwarding failed, %E");
 	  break;
 	}
       if (p->ttyp->stop_fwd_thread)
 	break;
-      ssize_t wlen = rlen;
-      char *ptr = outbuf;
+      LONGLONG started = get_clock (CLOCK_MONOTONIC)->n100secs ();
+      DWORD total = rlen;
+      bool plain;
+
       if (p->ttyp->pcon_activated)
 	{
-	  /* Avoid setting window title to "cygwin-console-helper.exe" */
-	  int state = 0;
-	  int start_at = 0;
-	  for (DWORD i=0; i<rlen; i++)
-	    if (outbuf[i] == '\033')
-	      {
-		start_at = i;
-		state = 1;
-		continue;
-	      }
-	    else if ((state == 1 && outbuf[i] == ']') ||
-		     (state == 2 && outbuf[i] == '0') ||
-		     (state == 3 && outbuf[i] == ';'))
-	      {
-		state ++;
-		continue;
-	      }
-	    else if (state == 4 && outbuf[i] == '\a')
-	      {
-		const char *helper_str = "\\bin\\cygwin-console-helper.exe";
-		if (memmem (&outbuf[start_at], i + 1 - start_at,
-			    helper_str, strlen (helper_str)))
+	  /* All of the below looks for escape sequences. */
+	  if (memchr (outbuf, '\033', rlen))
+	    {
+	      /* Avoid setting window title to "cygwin-console-helper.exe" */
+	      int state = 0;
+	      int start_at = 0;
+	      for (DWORD i=0; i<rlen; i++)
+		if (outbuf[i] == '\033')
 		  {
-		    memmove (&outbuf[start_at], &outbuf[i+1], rlen-i-1);
-		    rlen = wlen = start_at + rlen - i - 1;
+		    start_at = i;
+		    state = 1;
+		    continue;
+		  }
+		else if ((state == 1 && outbuf[i] == ']') ||
+			 (state == 2 && outbuf[i] == '0') ||
+			 (state == 3 && outbuf[i] == ';'))
+		  {
+		    state ++;
+		    continue;
+		  }
+		else if (state == 4 && outbuf[i] == '\a')
+		  {
+		    const char *helper_str = "\\bin\\cygwin-console-helper.exe";
+		    if (memmem (&outbuf[start_at], i + 1 - start_at,
+				helper_str, strlen (helper_str)))
+		      {
+			memmove (&outbuf[start_at], &outbuf[i+1], rlen-i-1);
+			rlen = start_at + rlen - i - 1;
+		      }
+		    state = 0;
+		    continue;
+		  }
+		else if (outbuf[i] == '\a')
+		  {
+		    state = 0;
+		    continue;
 		  }
-		state = 0;
-		continue;
-	      }
-	    else if (outbuf[i] == '\a')
-	      {
-		state = 0;
-		continue;
-	      }
-
-	  /* Remove CSI > Pm m */
-	  state = 0;
-	  start_at = 0;
-	  for (DWORD i = 0; i < rlen; i++)
-	    if (outbuf[i] == '\033')
-	      {
-		start_at = i;
-		state = 1;
-		continue;
-	      }
-	    else if ((state == 1 && outbuf[i] == '[')
-		     || (state == 2 && outbuf[i] == '>'))
-	      {
-		state ++;
-		continue;
-	      }
-	    else if (state == 3 && (isdigit (outbuf[i]) || outbuf[i] == ';'))
-	      continue;
-	    else if (state == 3 && outbuf[i] == 'm')
-	      {
-		memmove (&outbuf[start_at], &outbuf[i+1], rlen-i-1);
-		rlen = wlen = start_at + rlen - i - 1;
-		state = 0;
-		i = start_at - 1;
-		continue;
-	      }
-	    else
-	      state = 0;
 
-	  /* Remove OSC Ps ; ? BEL/ST */
-	  for (DWORD i = 0; i < rlen; i++)
-	    if (state == 0 && outbuf[i] == '\033')
-	      {
-		start_at = i;
-		state = 1;
-		continue;
-	      }
-	    else if ((state == 1 && outbuf[i] == ']')
-		     || (state == 2 && outbuf[i] == ';')
-		     || (state == 3 && outbuf[i] == '?')
-		     || (state == 4 && outbuf[i] == '\033'))
-	      {
-		state ++;
-		continue;
-	      }
-	    else if (state == 2 && isdigit (outbuf[i]))
-	      continue;
-	    else if ((state == 4 && outbuf[i] == '\a')
-		     || (state == 5 && outbuf[i] == '\\'))
-	      {
-		memmove (&outbuf[start_at], &outbuf[i+1], rlen-i-1);
-		rlen = wlen = start_at + rlen - i - 1;
-		state = 0;
-		i = start_at - 1;
-		continue;
-	      }
-	    else
+	      /* Remove CSI > Pm m */
 	      state = 0;
+	      start_at = 0;
+	      for (DWORD i = 0; i < rlen; i++)
+		if (outbuf[i] == '\033')
+		  {
+		    start_at = i;
+		    state = 1;
+		    continue;
+		  }
+		else if ((state == 1 && outbuf[i] == '[')
+			 || (state == 2 && outbuf[i] == '>'))
+		  {
+		    state ++;
+		    continue;
+		  }
+		else if (state == 3
+			 && (isdigit (outbuf[i]) || outbuf[i] == ';'))
+		  continue;
+		else if (state == 3 && outbuf[i] == 'm')
+		  {
+		    memmove (&outbuf[start_at], &outbuf[i+1], rlen-i-1);
+		    rlen = start_at + rlen - i - 1;
+		    state = 0;
+		    i = start_at - 1;
+		    continue;
+		  }
+		else
+		  state = 0;
 
-	  if (p->ttyp->term_code_page != CP_UTF8)
-	    {
-	      size_t nlen = NT_MAX_PATH;
-	      convert_mb_str (p->ttyp->term_code_page, mbbuf, &nlen,
-			      CP_UTF8, ptr, wlen, &mbp);
-
-	      ptr = mbbuf;
-	      wlen = rlen = nlen;
+	      /* Remove OSC Ps ; ? BEL/ST */
+	      for (DWORD i = 0; i < rlen; i++)
+		if (state == 0 && outbuf[i] == '\033')
+		  {
+		    start_at = i;
+		    state = 1;
+		    continue;
+		  }
+		else if ((state == 1 && outbuf[i] == ']')
+			 || (state == 2 && outbuf[i] == ';')
+			 || (state == 3 && outbuf[i] == '?')
+			 || (state == 4 && outbuf[i] == '\033'))
+		  {
+		    state ++;
+		    continue;
+		  }
+		else if (state == 2 && isdigit (outbuf[i]))
+		  continue;
+		else if ((state == 4 && outbuf[i] == '\a')
+			 || (state == 5 && outbuf[i] == '\\'))
+		  {
+		    memmove (&outbuf[start_at], &outbuf[i+1], rlen-i-1);
+		    rlen = start_at + rlen - i - 1;
+		    state = 0;
+		    i = start_at - 1;
+		    continue;
+		  }
+		else
+		  state = 0;
 	    }
 
-	  /* OPOST processing was already done in pseudo console,
-	     so just write it to to_master. */
-	  DWORD written;
-	  while (rlen>0)
+	  /* No conversion is needed for plain ASCII, unless the previous
+	     read ended in a truncated multibyte char. */
+	  plain = p->ttyp->term_code_page == CP_UTF8
+		  || (!mbp.__count && is_7bit_ascii (outbuf, rlen));
+	  for (DWORD off = 0; off < rlen; )
 	    {
-	      if (!WriteFile (p->to_master, ptr, wlen, &written, NULL))
+	      char *ptr = outbuf + off;
+	      DWORD wlen = rlen - off;
+	      if (plain)
+		off = rlen;
+	      else
 		{
-		  termios_printf ("WriteFile for forwarding failed, %E");
-		  break;
+		  size_t nlen = NT_MAX_PATH;
+		  wlen = MIN (wlen, NT_MAX_PATH);
+		  off += wlen;
+		  convert_mb_str (p->ttyp->term_code_page, mbbuf, &nlen,
+				  CP_UTF8, ptr, wlen, &mbp);
+		  ptr = mbbuf;
+		  wlen = nlen;
 		}
-	      ptr += written;
-	      wlen = (rlen -= written);
-	    }
-	  continue;
-	}
 
-      UINT cp_from;
-      pinfo pinfo_target = pinfo (p->ttyp->invisible_console_pid);
-      DWORD target_pid = 0;
-      if (pinfo_target)
-	target_pid = pinfo_target->dwProcessId;
-      if (target_pid)
-	{
-	  /* Slave attaches to a different console than master.
-	     Therefore reattach here. */
-	  DWORD resume_pid =
-	    attach_console_temporarily (target_pid);
-	  cp_from = GetConsoleOutputCP ();
-	  resume_from_temporarily_attach (resume_pid);
+	      /* OPOST processing was already done in pseudo console,
+		 so just write it to to_master. */
+	      DWORD written;
+	      while (wlen > 0)
+		{
+		  if (!WriteFile (p->to_master, ptr, wlen, &written, NULL))
+		    {
+		      termios_printf ("WriteFile for forwarding failed, %E");
+		      break;
+		    }
+		  ptr += written;
+		  wlen -= written;
+		}
+	    }
 	}
       else
-	cp_from = GetConsoleOutputCP ();
-
-      if (p->ttyp->term_code_page != cp_from)
 	{
-	  size_t nlen = NT_MAX_PATH;
-	  convert_mb_str (p->ttyp->term_code_page, mbbuf, &nlen,
-			  cp_from, ptr, wlen, &mbp);
+	  /* Plain ASCII needs no conversion, so there's no need to find
+	     out the console code page either. */
+	  UINT cp_from = p->ttyp->term_code_page;
+	  plain = !mbp.__count && is_7bit_ascii (outbuf, rlen);
+	  if (!plain)
+	    {
+	      pinfo pinfo_target = pinfo (p->ttyp->invisible_console_pid);
+	      DWORD target_pid = 0;
+	      if (pinfo_target)
+		target_pid = pinfo_target->dwProcessId;
+	      if (target_pid)
+		{
+		  /* Slave attaches to a different console than master.
+		     Therefore reattach here. */
+		  DWORD resume_pid =
+		    attach_console_temporarily (target_pid);
+		  cp_from = GetConsoleOutputCP ();
+		  resume_from_temporarily_attach (resume_pid);
+		}
+	      else
+		cp_from = GetConsoleOutputCP ();
+	      plain = p->ttyp->term_code_page == cp_from;
+	    }
 
-	  ptr = mbbuf;
-	  wlen = rlen = nlen;
+	  WaitForSingleObject (p->output_mutex, mutex_timeout);
+	  for (DWORD off = 0; off < rlen; )
+	    {
+	      char *ptr = outbuf + off;
+	      ssize_t wlen = rlen - off;
+	      if (plain)
+		off = rlen;
+	      else
+		{
+		  size_t nlen = NT_MAX_PATH;
+		  wlen = MIN (wlen, NT_MAX_PATH);
+		  off += wlen;
+		  convert_mb_str (p->ttyp->term_code_page, mbbuf, &nlen,
+				  cp_from, ptr, wlen, &mbp);
+		  ptr = mbbuf;
+		  wlen = nlen;
+		}
+	      while (wlen > 0)
+		{
+		  ssize_t len = wlen;
+		  if (!process_opost_output (p->to_master, ptr, len,
+					     true /* disable output_stopped */,
+					     p->ttyp, false))
+		    {
+		      termios_printf ("WriteFile for forwarding failed, %E");
+		      break;
+		    }
+		  ptr += len;
+		  wlen -= len;
+		}
+	    }
+	  ReleaseMutex (p->output_mutex);
 	}
 
-      WaitForSingleObject (p->output_mutex, mutex_timeout);
-      while (rlen>0)
+      LONGLONG elapsed = get_clock (CLOCK_MONOTONIC)->n100secs () - started;
+      p->ttyp->fwd_bytes += total;
+      p->ttyp->fwd_reads++;
+      if (plain)
+	p->ttyp->fwd_plain_reads++;
+      p->ttyp->fwd_time += elapsed;
+      if ((ULONGLONG) elapsed > p->ttyp->fwd_max_time)
+	p->ttyp->fwd_max_time = elapsed;
+
+      if (total == outbuf_size && outbuf_size < fhandler_pty_common::pipesize)
 	{
-	  if (!process_opost_output (p->to_master, ptr, wlen,
-				     true /* disable output_stopped */,
-				     p->ttyp, false))
+	  char *nbuf = (char *) malloc (2 * outbuf_size);
+	  if (nbuf)
 	    {
-	      termios_printf ("WriteFile for forwarding failed, %E");
-	      break;
+	      free (bigbuf);
+	      outbuf = bigbuf = nbuf;
+	      outbuf_size *= 2;
 	    }
-	  ptr += wlen;
-	  wlen = (rlen -= wlen);
 	}
-      ReleaseMutex (p->output_mutex);
     }
+  free (bigbuf);
   return 0;
 }
 
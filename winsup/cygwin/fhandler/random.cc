@@ -17,6 +17,7 @@ details. */
 #include "dtable.h"
 #include "cygheap.h"
 #include "child_info.h"
+#include "miscfuncs.h"
 
 #define RANDOM   8
 #define URANDOM  9
@@ -125,9 +126,9 @@ fhandler_dev_random::read (void *ptr, size_t& len)
 	  free (dummy);
 	}
 
-      /* If device is /dev/urandom, just use system RNG as is, with our own
-	 PRNG as fallback. */
-      else if (!RtlGenRandom (ptr, len))
+      /* If device is /dev/urandom, use the per-thread ChaCha20 generator
+	 seeded from the system RNG, with our own PRNG as fallback. */
+      else if (!chacha20_random (ptr, len))
 	len = pseudo_read (ptr, len);
     }
   __except (EFAULT)
@@ -117,10 +117,20 @@
 #define OFF_MAX LLONG_MAX
 #endif
 
-static NO_COPY muto lockf_guard;
+/* The inode list is hashed by device and inode number, each bucket
+   having its own lock, so that locking on unrelated files doesn't
+   serialize on a single mutex. */
+static NO_COPY muto lockf_guard[INODE_LIST_BUCKETS];
 
-#define INODE_LIST_LOCK()	(lockf_guard.init ("lockf_guard")->acquire ())
-#define INODE_LIST_UNLOCK()	(lockf_guard.release ())
+static inline uint32_t
+inode_bucket (dev_t dev, ino_t ino)
+{
+  return (dev ^ ino ^ (ino >> 32)) & (INODE_LIST_BUCKETS - 1);
+}
+
+#define INODE_LIST(b)		(&cygheap->inode_list[(b)])
+#define INODE_LIST_LOCK(b)	(lockf_guard[b].init ("lockf_guard")->acquire ())
+#define INODE_LIST_UNLOCK(b)	(lockf_guard[b].release ())
 
 #define LOCK_DIR_NAME_FMT	L"flock-%08x-%016X"
 #define LOCK_DIR_NAME_LEN	31	/* Length of the resulting name */
@@ -296,8 +306,17 @@ class inode_t
   private:
     HANDLE		 i_dir;
     HANDLE		 i_mtx;
+    HANDLE		 i_gen;    /* Lock object creation counter, see
+				      get_all_locks_list. */
     uint32_t		 i_cnt;    /* # of threads referencing this instance. */
     uint32_t		 i_lock_cnt; /* # of locks for this file */
+    lockf_t		*i_cache;  /* Cached all locks list... */
+    uint32_t		 i_cache_cnt;
+    uint32_t		 i_cache_size;
+    LONG		 i_cache_gen; /* ...valid for this i_gen count. */
+    bool		 i_from_cache; /* i_all_lf was built from i_cache. */
+
+    LONG get_gen ();
 
   public:
     inode_t (dev_t dev, ino_t ino);
@@ -322,8 +341,9 @@ class inode_t
     void unlock_and_remove_if_unused ();
 
     lockf_t *get_all_locks_list ();
-    uint32_t get_lock_count () /* needs get_all_locks_list() */
-    { return i_lock_cnt; }
+    uint32_t get_lock_count (); /* needs get_all_locks_list() */
+    void lock_obj_created (lockf_t *);
+    void lock_obj_deleted (lockf_t *);
 
     bool del_my_locks (long long id, HANDLE fhdl);
 };
@@ -333,6 +353,9 @@ inode_t::~inode_t ()
   lockf_t *lock, *n_lock;
   for (lock = i_lockf; lock && (n_lock = lock->lf_next, 1); lock = n_lock)
     delete lock;
+  if (i_cache)
+    cfree (i_cache);
+  NtClose (i_gen);
   NtClose (i_mtx);
   NtClose (i_dir);
 }
@@ -340,15 +363,17 @@ inode_t::~inode_t ()
 void
 inode_t::unlock_and_remove_if_unused ()
 {
+  uint32_t b = inode_bucket (i_dev, i_ino);
+
   UNLOCK ();
-  INODE_LIST_LOCK ();
+  INODE_LIST_LOCK (b);
   unuse ();
   if (i_lockf == NULL && !inuse ())
     {
       LIST_REMOVE (this, i_next);
       delete this;
     }
-  INODE_LIST_UNLOCK ();
+  INODE_LIST_UNLOCK (b);
 }
 
 bool
@@ -428,55 +453,60 @@ fixup_lockf_after_exec (bool exec)
 {
   inode_t *node, *next_node;
 
-  INODE_LIST_LOCK ();
-  if (LIST_FIRST (&cygheap->inode_list))
-    allow_others_to_sync ();
-  LIST_FOREACH_SAFE (node, &cygheap->inode_list, i_next, next_node)
+  for (uint32_t b = 0; b < INODE_LIST_BUCKETS; ++b)
     {
-      node->notused ();
-      int cnt = 0;
-      cygheap_fdenum cfd (true);
-      while (cfd.next () >= 0)
-	if (cfd->get_dev () == node->i_dev
-	    && cfd->get_ino () == node->i_ino
-	    && ++cnt >= 1)
-	  break;
-      if (cnt == 0)
+      INODE_LIST_LOCK (b);
+      if (LIST_FIRST (INODE_LIST (b)))
+	allow_others_to_sync ();
+      LIST_FOREACH_SAFE (node, INODE_LIST (b), i_next, next_node)
 	{
-	  LIST_REMOVE (node, i_next);
-	  delete node;
-	}
-      else
-	{
-	  node->LOCK ();
-	  lockf_t *lock, *n_lock;
-	  lockf_t **prev = &node->i_lockf;
-	  for (lock = *prev; lock && (n_lock = lock->lf_next, 1); lock = n_lock)
-	    if (lock->lf_flags & F_POSIX)
-	      {
-		if (exec)
-		  {
-		    /* The parent called exec.  The lock is passed to the child.
-		       Recreate lock object with changed ownership. */
-		    lock->del_lock_obj (NULL);
-		    lock->lf_wid = myself->dwProcessId;
-		    lock->lf_ver = 0;
-		    lock->create_lock_obj ();
-		  }
-		else
+	  node->notused ();
+	  int cnt = 0;
+	  cygheap_fdenum cfd (true);
+	  while (cfd.next () >= 0)
+	    if (cfd->get_dev () == node->i_dev
+		&& cfd->get_ino () == node->i_ino
+		&& ++cnt >= 1)
+	      break;
+	  if (cnt == 0)
+	    {
+	      LIST_REMOVE (node, i_next);
+	      delete node;
+	    }
+	  else
+	    {
+	      node->LOCK ();
+	      lockf_t *lock, *n_lock;
+	      lockf_t **prev = &node->i_lockf;
+	      for (lock = *prev; lock && (n_lock = lock->lf_next, 1);
+		   lock = n_lock)
+		if (lock->lf_flags & F_POSIX)
 		  {
-		    /* The parent called spawn.  The parent continues to hold
-		       the POSIX lock, ownership is not passed to the child.
-		       Give up the lock in the child. */
-		    *prev = n_lock;
-		    lock->close_lock_obj ();
-		    delete lock;
+		    if (exec)
+		      {
+			/* The parent called exec.  The lock is passed to the
+			   child.  Recreate lock object with changed
+			   ownership. */
+			lock->del_lock_obj (NULL);
+			lock->lf_wid = myself->dwProcessId;
+			lock->lf_ver = 0;
+			lock->create_lock_obj ();
+		      }
+		    else
+		      {
+			/* The parent called spawn.  The parent continues to
+			   hold the POSIX lock, ownership is not passed to the
+			   child.  Give up the lock in the child. */
+			*prev = n_lock;
+			lock->close_lock_obj ();
+			delete lock;
+		      }
 		  }
-	      }
-	  node->UNLOCK ();
+	      node->UNLOCK ();
+	    }
 	}
+      INODE_LIST_UNLOCK (b);
     }
-  INODE_LIST_UNLOCK ();
 }
 
 /* static method to return a pointer to the inode_t structure for a specific
@@ -486,20 +516,21 @@ inode_t *
 inode_t::get (dev_t dev, ino_t ino, bool create_if_missing, bool lock)
 {
   inode_t *node;
+  uint32_t b = inode_bucket (dev, ino);
 
-  INODE_LIST_LOCK ();
-  LIST_FOREACH (node, &cygheap->inode_list, i_next)
+  INODE_LIST_LOCK (b);
+  LIST_FOREACH (node, INODE_LIST (b), i_next)
     if (node->i_dev == dev && node->i_ino == ino)
       break;
   if (!node && create_if_missing)
     {
       node = new inode_t (dev, ino);
       if (node)
-	LIST_INSERT_HEAD (&cygheap->inode_list, node, i_next);
+	LIST_INSERT_HEAD (INODE_LIST (b), node, i_next);
     }
   if (node)
     node->use ();
-  INODE_LIST_UNLOCK ();
+  INODE_LIST_UNLOCK (b);
   if (node && lock)
     node->LOCK ();
   return node;
@@ -507,7 +538,8 @@ inode_t::get (dev_t dev, ino_t ino, bool create_if_missing, bool lock)
 
 inode_t::inode_t (dev_t dev, ino_t ino)
 : i_lockf (NULL), i_all_lf (NULL), i_dev (dev), i_ino (ino), i_cnt (0L),
-  i_lock_cnt (0)
+  i_lock_cnt (0), i_cache (NULL), i_cache_cnt (0), i_cache_size (0),
+  i_cache_gen (-1), i_from_cache (false)
 {
   HANDLE parent_dir;
   WCHAR name[48];
@@ -532,6 +564,14 @@ inode_t::inode_t (dev_t dev, ino_t ino)
   status = NtCreateMutant (&i_mtx, CYG_MUTANT_ACCESS, &attr, FALSE);
   if (!NT_SUCCESS (status))
     api_fatal ("NtCreateMutant(inode): %y", status);
+  /* Create a semaphore object in the file specific dir, which is used as
+     a counter of lock objects created by all processes. */
+  InitializeObjectAttributes (&attr, &ro_u_gen, OBJ_INHERIT | OBJ_OPENIF,
+			      i_dir, everyone_sd (CYG_SEMAPHORE_ACCESS));
+  status = NtCreateSemaphore (&i_gen, CYG_SEMAPHORE_ACCESS, &attr, 0,
+			      LONG_MAX);
+  if (!NT_SUCCESS (status))
+    api_fatal ("NtCreateSemaphore(inode): %y", status);
 }
 
 /* Enumerate all lock event objects for this file and create a lockf_t
@@ -581,6 +621,75 @@ lockf_t::from_obj_name (inode_t *node, lockf_t **head, const wchar_t *name)
   return true;
 }
 
+/* Enumerating the lock objects in the NT namespace is expensive, so the
+   result is cached in i_cache and only rescanned if another process
+   created a lock object since.  To recognize that, every process bumps the
+   count of the i_gen semaphore when creating a lock object.  All of this
+   happens under the inode mutex, so the count can't change while we hold
+   it.  Lock objects removed by other processes are not tracked.  The
+   cached entries for them are harmless, since lf_getblock ignores locks
+   whose event object is gone or signalled. */
+LONG
+inode_t::get_gen ()
+{
+  SEMAPHORE_BASIC_INFORMATION sbi;
+
+  if (!NT_SUCCESS (NtQuerySemaphore (i_gen, SemaphoreBasicInformation,
+				     &sbi, sizeof sbi, NULL))
+      || sbi.CurrentCount == LONG_MAX)
+    return -1;
+  return sbi.CurrentCount;
+}
+
+/* Called with the inode mutex held after this process created the lock
+   object for LOCK.  If our cache was up to date before, keep it that way. */
+void
+inode_t::lock_obj_created (lockf_t *lock)
+{
+  LONG prev;
+
+  if (!ReleaseSemaphore (i_gen, 1, &prev) || prev != i_cache_gen
+      || prev + 1 == LONG_MAX || i_cache_cnt >= MAX_LOCKF_CNT)
+    {
+      i_cache_gen = -1;
+      return;
+    }
+  if (i_cache_cnt >= i_cache_size)
+    {
+      lockf_t *c = (lockf_t *) crealloc (i_cache, (i_cache_size + 16)
+						  * sizeof (lockf_t));
+      if (!c)
+	{
+	  i_cache_gen = -1;
+	  return;
+	}
+      i_cache = c;
+      i_cache_size += 16;
+    }
+  memcpy ((void *) (i_cache + i_cache_cnt++), (void *) lock, sizeof *lock);
+  i_cache_gen = prev + 1;
+}
+
+/* Called with the inode mutex held after this process signalled the lock
+   object for LOCK.  Drop it from the cache. */
+void
+inode_t::lock_obj_deleted (lockf_t *lock)
+{
+  for (uint32_t i = 0; i < i_cache_cnt; ++i)
+    {
+      lockf_t *c = i_cache + i;
+      if (c->lf_flags == lock->lf_flags && c->lf_type == lock->lf_type
+	  && c->lf_start == lock->lf_start && c->lf_end == lock->lf_end
+	  && c->lf_id == lock->lf_id && c->lf_wid == lock->lf_wid
+	  && c->lf_ver == lock->lf_ver)
+	{
+	  memmove ((void *) c, (void *) (c + 1),
+		   (--i_cache_cnt - i) * sizeof *c);
+	  break;
+	}
+    }
+}
+
 lockf_t *
 inode_t::get_all_locks_list ()
 {
@@ -590,6 +699,26 @@ inode_t::get_all_locks_list ()
   BOOLEAN restart = TRUE;
   bool last_run = false;
   lockf_t newlock, *lock = i_all_lf;
+  LONG gen = get_gen ();
+
+  if (gen >= 0 && gen == i_cache_gen)
+    {
+      for (uint32_t i = 0; i < i_cache_cnt; ++i)
+	{
+	  if (lock > i_all_lf)
+	    lock[-1].lf_next = lock;
+	  new (lock) lockf_t (i_cache[i]);
+	  lock->lf_head = &i_all_lf;
+	  lock->lf_inode = this;
+	  lock->lf_next = NULL;
+	  lock->lf_obj = NULL;
+	  ++lock;
+	}
+      i_lock_cnt = lock - i_all_lf;
+      i_from_cache = true;
+      return i_lock_cnt ? i_all_lf : NULL;
+    }
+  i_from_cache = false;
 
   PDIRECTORY_BASIC_INFORMATION dbi_buf = (PDIRECTORY_BASIC_INFORMATION)
 					 tp.w_get ();
@@ -624,12 +753,48 @@ inode_t::get_all_locks_list ()
 	}
     }
   i_lock_cnt = lock - i_all_lf;
+  /* Update the cache. */
+  i_cache_gen = -1;
+  if (gen >= 0 && i_lock_cnt > i_cache_size)
+    {
+      lockf_t *c = (lockf_t *) crealloc (i_cache, (i_lock_cnt + 16)
+						  * sizeof (lockf_t));
+      if (c)
+	{
+	  i_cache = c;
+	  i_cache_size = i_lock_cnt + 16;
+	}
+    }
+  if (gen >= 0 && i_lock_cnt <= i_cache_size)
+    {
+      if (i_lock_cnt)
+	memcpy ((void *) i_cache, (void *) i_all_lf,
+		i_lock_cnt * sizeof (lockf_t));
+      i_cache_cnt = i_lock_cnt;
+      i_cache_gen = gen;
+    }
   /* If no lock has been found, return NULL. */
   if (lock == i_all_lf)
     return NULL;
   return i_all_lf;
 }
 
+/* Return the number of locks in the list built by get_all_locks_list.
+   A list built from the cache may still contain locks other processes
+   have removed since, so the count may be too high.  That's harmless
+   unless it gets near MAX_LOCKF_CNT, so only then rebuild the list from
+   the lock objects to avoid a spurious ENOLCK. */
+uint32_t
+inode_t::get_lock_count ()
+{
+  if (i_from_cache && i_lock_cnt > MAX_LOCKF_CNT / 2)
+    {
+      i_cache_gen = -1;
+      get_all_locks_list ();
+    }
+  return i_lock_cnt;
+}
+
 /* Create the lock object name.  The name is constructed from the lock
    properties which identify it uniquely, all values in hex. */
 POBJECT_ATTRIBUTES
@@ -732,27 +897,31 @@ delete_lock_in_parent (PVOID param)
 
   /* Scan list of all inodes, and reap stale BSD lock if lf_id matches.
      Remove inode if empty. */
-  INODE_LIST_LOCK ();
-  LIST_FOREACH_SAFE (node, &cygheap->inode_list, i_next, next_node)
-    if (!node->inuse ())
-      {
-	for (prev = &node->i_lockf, lock = *prev; lock; lock = *prev)
+  for (uint32_t b = 0; b < INODE_LIST_BUCKETS; ++b)
+    {
+      INODE_LIST_LOCK (b);
+      LIST_FOREACH_SAFE (node, INODE_LIST (b), i_next, next_node)
+	if (!node->inuse ())
 	  {
-	    if ((lock->lf_flags & F_FLOCK) && IsEventSignalled (lock->lf_obj))
+	    for (prev = &node->i_lockf, lock = *prev; lock; lock = *prev)
+	      {
+		if ((lock->lf_flags & F_FLOCK)
+		    && IsEventSignalled (lock->lf_obj))
+		  {
+		    *prev = lock->lf_next;
+		    delete lock;
+		  }
+		else
+		  prev = &lock->lf_next;
+	      }
+	    if (node->i_lockf == NULL)
 	      {
-		*prev = lock->lf_next;
-		delete lock;
+		LIST_REMOVE (node, i_next);
+		delete node;
 	      }
-	    else
-	      prev = &lock->lf_next;
-	  }
-	if (node->i_lockf == NULL)
-	  {
-	    LIST_REMOVE (node, i_next);
-	    delete node;
 	  }
-      }
-  INODE_LIST_UNLOCK ();
+      INODE_LIST_UNLOCK (b);
+    }
   return 0;
 }
 
@@ -793,6 +962,7 @@ lockf_t::create_lock_obj ()
 	}
     }
   while (!NT_SUCCESS (status));
+  lf_inode->lock_obj_created (this);
   /* For BSD locks, notify the parent process. */
   if (lf_flags & F_FLOCK)
     {
@@ -881,6 +1051,8 @@ lockf_t::del_lock_obj (HANDLE fhdl, bool signal)
 	  NTSTATUS status = NtSetEvent (lf_obj, NULL);
 	  if (!NT_SUCCESS (status))
 	    system_printf ("NtSetEvent, %y", status);
+	  if (lf_inode)
+	    lf_inode->lock_obj_deleted (this);
 	  /* For BSD locks, notify the parent process. */
 	  if (lf_flags & F_FLOCK)
 	    {
@@ -24,6 +24,7 @@ details. */
 #include "dll_init.h"
 #include "cygmalloc.h"
 #include "ntdll.h"
+#include "stackprof.h"
 
 #define NPIDS_HELD 4
 
@@ -199,6 +200,7 @@ frok::child (volatile char * volatile here)
   CloseHandle (hParent);
   hParent = NULL;
   cygwin_finished_initializing = true;
+  stackprof_init ();
   return 0;
 }
 
@@ -0,0 +1,422 @@
+/* gai_async.cc: asynchronous name resolution, getaddrinfo_a and friends.
+
+This file is part of Cygwin.
+
+This software is a copyrighted work licensed under the terms of the
+Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
+details. */
+
+#include "winsup.h"
+#include "cygtls.h"
+#include "sigproc.h"
+#include "clock.h"
+#include "cygwait.h"
+#include <netdb.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/queue.h>
+
+extern "C" int cygwin_getaddrinfo (const char *, const char *,
+				   const struct addrinfo *,
+				   struct addrinfo **);
+
+/* Requests are queued in FIFO order and served by a pool of at most
+   GAI_MAXTHREADS resolver threads.  The threads are created on demand,
+   only if there are more queued requests than threads waiting for work,
+   and stay around for the lifetime of the process.
+
+   A request already picked up by a resolver thread can't be canceled,
+   there's no way to abort a running getaddrinfo call.
+
+   All of the below is protected by gai_lock.  Threads waiting in
+   gai_suspend register an event in gai_waiters, which is set whenever
+   any request completes. */
+#define GAI_MAXTHREADS	8
+
+/* One per getaddrinfo_a call.  Notifies the caller when the last of its
+   requests completed.  refcnt counts the requests plus the caller. */
+struct gai_list
+{
+  LONG refcnt;
+  ULONG pending;
+  HANDLE done_evt;		/* GAI_WAIT */
+  struct sigevent sev;		/* GAI_NOWAIT */
+};
+
+struct gai_request
+{
+  TAILQ_ENTRY (gai_request) chain;
+  struct gaicb *cb;
+  gai_list *list;
+  bool last;
+};
+
+struct gai_waiter
+{
+  LIST_ENTRY (gai_waiter) chain;
+  HANDLE evt;
+};
+
+TAILQ_HEAD (gai_queue_head, gai_request);
+
+/* NO_COPY: A forked child starts without resolver threads and requests. */
+static NO_COPY SRWLOCK gai_lock = SRWLOCK_INIT;
+static NO_COPY CONDITION_VARIABLE gai_work = CONDITION_VARIABLE_INIT;
+static NO_COPY gai_queue_head gai_queue = TAILQ_HEAD_INITIALIZER (gai_queue);
+static NO_COPY LIST_HEAD (, gai_waiter) gai_waiters
+  = LIST_HEAD_INITIALIZER (gai_waiters);
+static NO_COPY ULONG gai_queued;
+static NO_COPY ULONG gai_nthreads;
+static NO_COPY ULONG gai_busy;
+
+static void
+gai_list_release (gai_list *list)
+{
+  if (InterlockedDecrement (&list->refcnt) == 0)
+    {
+      if (list->done_evt)
+	CloseHandle (list->done_evt);
+      free (list);
+    }
+}
+
+static void
+gai_notify_on_pthread (struct sigevent *evp)
+{
+  pthread_attr_t *attr;
+  pthread_attr_t default_attr;
+  pthread_t thr;
+
+  if (evp->sigev_notify_attributes)
+    attr = evp->sigev_notify_attributes;
+  else
+    {
+      pthread_attr_init (attr = &default_attr);
+      pthread_attr_setdetachstate (attr, PTHREAD_CREATE_DETACHED);
+    }
+  if (pthread_create (&thr, attr,
+		      (void * (*) (void *)) evp->sigev_notify_function,
+		      evp->sigev_value.sival_ptr))
+    debug_printf ("gai notification thread creation failed, %E");
+}
+
+/* Called without lock when the last request of LIST completed. */
+static void
+gai_list_done (gai_list *list)
+{
+  if (list->done_evt)
+    {
+      SetEvent (list->done_evt);
+      return;
+    }
+  switch (list->sev.sigev_notify)
+    {
+    case SIGEV_SIGNAL:
+      if (list->sev.sigev_signo)
+	{
+	  /* There's no SI_ASYNCNL (yet), so use the AIO code, just as
+	     lio_listio does. */
+	  siginfo_t si = {0};
+	  si.si_code = SI_ASYNCIO;
+	  si.si_signo = list->sev.sigev_signo;
+	  si.si_value = list->sev.sigev_value;
+	  sig_send (myself, si);
+	}
+      break;
+    case SIGEV_THREAD:
+      gai_notify_on_pthread (&list->sev);
+      break;
+    }
+}
+
+/* Store the result of REQ and wake up gai_suspend.  Call under lock. */
+static void
+gai_complete (gai_request *req, struct addrinfo *res, int ret)
+{
+  gai_waiter *w;
+
+  req->cb->ar_result = ret ? NULL : res;
+  req->cb->__return = ret;
+  req->last = --req->list->pending == 0;
+  LIST_FOREACH (w, &gai_waiters, chain)
+    SetEvent (w->evt);
+}
+
+/* Second half of gai_complete, called without lock.  REQ is freed. */
+static void
+gai_finish (gai_request *req)
+{
+  if (req->last)
+    gai_list_done (req->list);
+  gai_list_release (req->list);
+  free (req);
+}
+
+static DWORD
+gai_worker (VOID *)
+{
+  AcquireSRWLockExclusive (&gai_lock);
+  while (1)
+    {
+      while (TAILQ_EMPTY (&gai_queue))
+	SleepConditionVariableSRW (&gai_work, &gai_lock, INFINITE, 0);
+
+      gai_request *req = TAILQ_FIRST (&gai_queue);
+      TAILQ_REMOVE (&gai_queue, req, chain);
+      --gai_queued;
+      ++gai_busy;
+      ReleaseSRWLockExclusive (&gai_lock);
+
+      struct gaicb *cb = req->cb;
+      struct addrinfo *res = NULL;
+      int ret = cygwin_getaddrinfo (cb->ar_name, cb->ar_service,
+				    cb->ar_request, &res);
+
+      AcquireSRWLockExclusive (&gai_lock);
+      --gai_busy;
+      gai_complete (req, res, ret);
+      ReleaseSRWLockExclusive (&gai_lock);
+      gai_finish (req);
+      AcquireSRWLockExclusive (&gai_lock);
+    }
+  return 0;
+}
+
+/* Make sure there's a thread for each queued request, up to
+   GAI_MAXTHREADS.  Call under lock.  Returns false if there's no resolver
+   thread at all. */
+static bool
+gai_start_workers ()
+{
+  static const char *names[GAI_MAXTHREADS] =
+    { "gai1", "gai2", "gai3", "gai4", "gai5", "gai6", "gai7", "gai8" };
+
+  while (gai_nthreads < GAI_MAXTHREADS
+	 && gai_queued > gai_nthreads - gai_busy)
+    {
+      if (!new cygthread (gai_worker, NULL, names[gai_nthreads]))
+	{
+	  debug_printf ("couldn't create a resolver thread, %E");
+	  break;
+	}
+      ++gai_nthreads;
+    }
+  return gai_nthreads > 0;
+}
+
+extern "C" int
+getaddrinfo_a (int mode, struct gaicb *list[], int nitems,
+	       struct sigevent *sevp)
+{
+  gai_list *gl;
+  gai_request **reqs;
+  int nreqs = 0;
+  int ret = 0;
+
+  if ((mode != GAI_WAIT && mode != GAI_NOWAIT) || nitems < 0)
+    {
+      set_errno (EINVAL);
+      return EAI_SYSTEM;
+    }
+  for (int i = 0; i < nitems; ++i)
+    if (list[i])
+      ++nreqs;
+  if (nreqs == 0)
+    return 0;
+
+  /* Allocate everything upfront, so we either queue all requests or
+     none. */
+  gl = (gai_list *) calloc (1, sizeof *gl);
+  reqs = (gai_request **) calloc (nreqs, sizeof *reqs);
+  if (!gl || !reqs)
+    goto nomem;
+  for (int i = 0; i < nreqs; ++i)
+    if (!(reqs[i] = (gai_request *) malloc (sizeof (gai_request))))
+      goto nomem;
+  if (mode == GAI_WAIT
+      && !(gl->done_evt = CreateEvent (&sec_none_nih, TRUE, FALSE, NULL)))
+    goto nomem;
+  gl->refcnt = nreqs + 1;
+  gl->pending = nreqs;
+  if (mode == GAI_NOWAIT && sevp)
+    gl->sev = *sevp;
+  else
+    gl->sev.sigev_notify = SIGEV_NONE;
+
+  AcquireSRWLockExclusive (&gai_lock);
+  for (int i = 0, r = 0; i < nitems; ++i)
+    if (list[i])
+      {
+	gai_request *req = reqs[r++];
+
+	req->cb = list[i];
+	req->list = gl;
+	req->last = false;
+	list[i]->ar_result = NULL;
+	list[i]->__return = EAI_INPROGRESS;
+	TAILQ_INSERT_TAIL (&gai_queue, req, chain);
+	++gai_queued;
+      }
+  if (!gai_start_workers ())
+    {
+      /* No thread, no resolution.  Take the requests back. */
+      for (int i = 0; i < nreqs; ++i)
+	{
+	  TAILQ_REMOVE (&gai_queue, reqs[i], chain);
+	  reqs[i]->cb->__return = EAI_AGAIN;
+	  free (reqs[i]);
+	}
+      gai_queued -= nreqs;
+      ReleaseSRWLockExclusive (&gai_lock);
+      free (reqs);
+      if (gl->done_evt)
+	CloseHandle (gl->done_evt);
+      free (gl);
+      set_errno (EAGAIN);
+      return EAI_AGAIN;
+    }
+  WakeAllConditionVariable (&gai_work);
+  ReleaseSRWLockExclusive (&gai_lock);
+  free (reqs);
+
+  if (mode == GAI_WAIT)
+    switch (cygwait (gl->done_evt, cw_infinite, cw_sig_eintr))
+      {
+      case WAIT_OBJECT_0:
+	break;
+      case WAIT_SIGNALED:
+	_my_tls.call_signal_handler ();
+	ret = EAI_INTR;
+	break;
+      default:
+	__seterrno ();
+	ret = EAI_SYSTEM;
+	break;
+      }
+  gai_list_release (gl);
+  return ret;
+
+nomem:
+  if (reqs)
+    for (int i = 0; i < nreqs; ++i)
+      free (reqs[i]);
+  free (reqs);
+  if (gl && gl->done_evt)
+    CloseHandle (gl->done_evt);
+  free (gl);
+  set_errno (ENOMEM);
+  return EAI_MEMORY;
+}
+
+extern "C" int
+gai_error (struct gaicb *req)
+{
+  return *(volatile int *) &req->__return;
+}
+
+extern "C" int
+gai_suspend (const struct gaicb *const list[], int nitems,
+	     const struct timespec *timeout)
+{
+  LARGE_INTEGER to, *pto = cw_infinite;
+  LONG64 deadline = 0;
+  gai_waiter w;
+  int ret;
+
+  if (timeout)
+    {
+      if (!valid_timespec (*timeout))
+	{
+	  set_errno (EINVAL);
+	  return EAI_SYSTEM;
+	}
+      deadline = get_clock (CLOCK_MONOTONIC)->n100secs ()
+		 + timeout->tv_sec * NS100PERSEC
+		 + (timeout->tv_nsec + 99) / 100;
+      pto = &to;
+    }
+  w.evt = CreateEvent (&sec_none_nih, FALSE, FALSE, NULL);
+  if (!w.evt)
+    {
+      __seterrno ();
+      return EAI_SYSTEM;
+    }
+
+  AcquireSRWLockExclusive (&gai_lock);
+  LIST_INSERT_HEAD (&gai_waiters, &w, chain);
+  while (1)
+    {
+      bool any = false;
+
+      ret = EAI_ALLDONE;
+      for (int i = 0; i < nitems; ++i)
+	if (list[i])
+	  {
+	    if (list[i]->__return != EAI_INPROGRESS)
+	      {
+		ret = 0;
+		break;
+	      }
+	    any = true;
+	  }
+      if (ret == 0 || !any)
+	break;
+      if (timeout)
+	{
+	  to.QuadPart = get_clock (CLOCK_MONOTONIC)->n100secs () - deadline;
+	  if (to.QuadPart >= 0)
+	    {
+	      ret = EAI_AGAIN;
+	      break;
+	    }
+	}
+      ReleaseSRWLockExclusive (&gai_lock);
+      DWORD res = cygwait (w.evt, pto, cw_sig_eintr);
+      AcquireSRWLockExclusive (&gai_lock);
+      if (res == WAIT_SIGNALED)
+	{
+	  ret = EAI_INTR;
+	  break;
+	}
+    }
+  LIST_REMOVE (&w, chain);
+  ReleaseSRWLockExclusive (&gai_lock);
+  CloseHandle (w.evt);
+  if (ret == EAI_INTR)
+    _my_tls.call_signal_handler ();
+  return ret;
+}
+
+extern "C" int
+gai_cancel (struct gaicb *req)
+{
+  gai_queue_head canceled = TAILQ_HEAD_INITIALIZER (canceled);
+  gai_request *r, *next;
+  int ret = EAI_ALLDONE;
+
+  AcquireSRWLockExclusive (&gai_lock);
+  for (r = TAILQ_FIRST (&gai_queue); r; r = next)
+    {
+      next = TAILQ_NEXT (r, chain);
+      if (req && r->cb != req)
+	continue;
+      TAILQ_REMOVE (&gai_queue, r, chain);
+      --gai_queued;
+      gai_complete (r, NULL, EAI_CANCELED);
+      TAILQ_INSERT_TAIL (&canceled, r, chain);
+      ret = EAI_CANCELED;
+      if (req)
+	break;
+    }
+  /* Not queued but still in progress means a resolver thread is on it. */
+  if (req ? req->__return == EAI_INPROGRESS : gai_busy > 0)
+    ret = EAI_NOTCANCELED;
+  ReleaseSRWLockExclusive (&gai_lock);
+
+  for (r = TAILQ_FIRST (&canceled); r; r = next)
+    {
+      next = TAILQ_NEXT (r, chain);
+      gai_finish (r);
+    }
+  return ret;
+}
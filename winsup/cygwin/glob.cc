@@ -93,6 +93,9 @@ __FBSDID("$FreeBSD: src/lib/libc/gen/glob.c,v 1.28 2010/05/12 17:44:00 gordon Ex
 #include <wctype.h>
 
 #include "collate.h"
+#ifdef __CYGWIN__
+#include "cygthread.h"
+#endif
 
 #ifdef __CYGWIN__
 #define Cchar(c)	(ignore_case_with_glob ? towlower (c) : (c))
@@ -158,24 +161,50 @@ typedef char Char;
 #define M_COLL_CNT(_c)	(((_c) & ~M_COLL_MASK) >> 8)
 #define	ismeta(c)	(((c)&M_QUOTE) != 0)
 
+#define	GLOB_DHASH	64	/* directory cache hash size */
+#define	GLOB_NTHREADS	4	/* helper threads reading directories */
+
+struct glob_dent {
+	char		*name;
+	unsigned char	 type;		/* d_type */
+};
+
+struct glob_dir {
+	struct glob_dir	 *next;
+	char		 *path;		/* as passed to opendir */
+	struct glob_dent *ents;
+	size_t		  nents;
+	int		  error;	/* errno if it couldn't be read */
+	int		  filled;
+};
+
+struct glob_dcache {
+	struct glob_dir	*hash[GLOB_DHASH];
+};
+
 static int	 compare(const void *, const void *);
 static int	 g_Ctoc(const Char *, char *, size_t);
 static int	 g_lstat(Char *, struct stat *, glob_t *);
+static void	 g_freecache(struct glob_dcache *);
 static DIR	*g_opendir(Char *, glob_t *);
 static const Char *g_strchr(const Char *, wint_t);
 #ifdef notdef
 static Char	*g_strcat(Char *, const Char *);
 #endif
 static int	 g_stat(Char *, struct stat *, glob_t *);
-static int	 glob0(const Char *, glob_t *, size_t *);
-static int	 glob1(Char *, glob_t *, size_t *);
-static int	 glob2(Char *, Char *, Char *, Char *, glob_t *, size_t *);
-static int	 glob3(Char *, Char *, Char *, Char *, Char *, glob_t *, size_t *);
+static int	 glob0(const Char *, glob_t *, size_t *, struct glob_dcache *);
+static int	 glob1(Char *, glob_t *, size_t *, struct glob_dcache *);
+static int	 glob2(Char *, Char *, Char *, Char *, glob_t *, size_t *,
+		    struct glob_dcache *);
+static int	 glob3(Char *, Char *, Char *, Char *, Char *, glob_t *, size_t *,
+		    struct glob_dcache *);
 static int	 globextend(const Char *, glob_t *, size_t *);
 static const Char *
 		 globtilde(const Char *, Char *, size_t, glob_t *);
-static int	 globexp1(const Char *, glob_t *, size_t *);
-static int	 globexp2(const Char *, const Char *, glob_t *, int *, size_t *);
+static int	 globexp1(const Char *, glob_t *, size_t *,
+		    struct glob_dcache *);
+static int	 globexp2(const Char *, const Char *, glob_t *, int *, size_t *,
+		    struct glob_dcache *);
 static int	 match(Char *, Char *, Char *);
 #ifdef DEBUG
 static void	 qprintf(const char *, Char *);
@@ -220,6 +249,8 @@ glob(const char *__restrict pattern, int flags, int (*errfunc)(const char *, int
 	mbstate_t mbs;
 	wint_t wc;
 	size_t clen;
+	struct glob_dcache dcache;
+	int err;
 
 	patnext = pattern;
 	if (!(flags & GLOB_APPEND)) {
@@ -274,10 +305,13 @@ glob(const char *__restrict pattern, int flags, int (*errfunc)(const char *, int
 	}
 	*bufnext = EOS;
 
+	memset(&dcache, 0, sizeof(dcache));
 	if (flags & GLOB_BRACE)
-	    return globexp1(patbuf, pglob, &limit);
+	    err = globexp1(patbuf, pglob, &limit, &dcache);
 	else
-	    return glob0(patbuf, pglob, &limit);
+	    err = glob0(patbuf, pglob, &limit, &dcache);
+	g_freecache(&dcache);
+	return (err);
 }
 
 /*
@@ -286,20 +320,21 @@ glob(const char *__restrict pattern, int flags, int (*errfunc)(const char *, int
  * characters
  */
 static int
-globexp1(const Char *pattern, glob_t *pglob, size_t *limit)
+globexp1(const Char *pattern, glob_t *pglob, size_t *limit,
+    struct glob_dcache *dcache)
 {
 	const Char* ptr = pattern;
 	int rv;
 
 	/* Protect a single {}, for find(1), like csh */
 	if (pattern[0] == LBRACE && pattern[1] == RBRACE && pattern[2] == EOS)
-		return glob0(pattern, pglob, limit);
+		return glob0(pattern, pglob, limit, dcache);
 
 	while ((ptr = g_strchr(ptr, LBRACE)) != NULL)
-		if (!globexp2(ptr, pattern, pglob, &rv, limit))
+		if (!globexp2(ptr, pattern, pglob, &rv, limit, dcache))
 			return rv;
 
-	return glob0(pattern, pglob, limit);
+	return glob0(pattern, pglob, limit, dcache);
 }
 
 
@@ -309,7 +344,8 @@ globexp1(const Char *pattern, glob_t *pglob, size_t *limit)
  * If it fails then it tries to glob the rest of the pattern and returns.
  */
 static int
-globexp2(const Char *ptr, const Char *pattern, glob_t *pglob, int *rv, size_t *limit)
+globexp2(const Char *ptr, const Char *pattern, glob_t *pglob, int *rv,
+    size_t *limit, struct glob_dcache *dcache)
 {
 	int     i;
 	Char   *lm, *ls;
@@ -348,7 +384,7 @@ globexp2(const Char *ptr, const Char *pattern, glob_t *pglob, int *rv, size_t *l
 
 	/* Non matching braces; just glob the pattern */
 	if (i != 0 || *pe == EOS) {
-		*rv = glob0(patbuf, pglob, limit);
+		*rv = glob0(patbuf, pglob, limit, dcache);
 		return 0;
 	}
 
@@ -397,7 +433,7 @@ globexp2(const Char *ptr, const Char *pattern, glob_t *pglob, int *rv, size_t *l
 #ifdef DEBUG
 				qprintf("globexp2:", patbuf);
 #endif
-				*rv = globexp1(patbuf, pglob, limit);
+				*rv = globexp1(patbuf, pglob, limit, dcache);
 
 				/* move after the comma, to the next string */
 				pl = pm + 1;
@@ -482,7 +518,8 @@ globtilde(const Char *pattern, Char *patbuf, size_t patbuf_len, glob_t *pglob)
  * if things went well, nonzero if errors occurred.
  */
 static int
-glob0(const Char *pattern, glob_t *pglob, size_t *limit)
+glob0(const Char *pattern, glob_t *pglob, size_t *limit,
+    struct glob_dcache *dcache)
 {
 	const Char *qpatnext, *qpatrbsrch;
 	int err;
@@ -597,7 +634,7 @@ glob0(const Char *pattern, glob_t *pglob, size_t *limit)
 	qprintf("glob0:", patbuf);
 #endif
 
-	if ((err = glob1(patbuf, pglob, limit)) != 0)
+	if ((err = glob1(patbuf, pglob, limit, dcache)) != 0)
 		return(err);
 
 	/*
@@ -627,7 +664,8 @@ compare(const void *p, const void *q)
 }
 
 static int
-glob1(Char *pattern, glob_t *pglob, size_t *limit)
+glob1(Char *pattern, glob_t *pglob, size_t *limit,
+    struct glob_dcache *dcache)
 {
 	Char pathbuf[MAXPATHLEN];
 
@@ -635,7 +673,7 @@ glob1(Char *pattern, glob_t *pglob, size_t *limit)
 	if (*pattern == EOS)
 		return(0);
 	return(glob2(pathbuf, pathbuf, pathbuf + MAXPATHLEN - 1,
-	    pattern, pglob, limit));
+	    pattern, pglob, limit, dcache));
 }
 
 /*
@@ -645,7 +683,7 @@ glob1(Char *pattern, glob_t *pglob, size_t *limit)
  */
 static int
 glob2(Char *pathbuf, Char *pathend, Char *pathend_last, Char *pattern,
-      glob_t *pglob, size_t *limit)
+      glob_t *pglob, size_t *limit, struct glob_dcache *dcache)
 {
 	struct stat sb;
 	Char *p, *q;
@@ -696,37 +734,268 @@ glob2(Char *pathbuf, Char *pathend, Char *pathend_last, Char *pattern,
 			}
 		} else			/* Need expansion, recurse. */
 			return(glob3(pathbuf, pathend, pathend_last, pattern, p,
-			    pglob, limit));
+			    pglob, limit, dcache));
 	}
 	/* NOTREACHED */
 }
 
+/*
+ * Convert the directory entry name to Char at pathend.  Returns a pointer
+ * behind the terminating EOS.
+ */
+static Char *
+g_dname(Char *pathend, Char *pathend_last, const char *name)
+{
+	const char *sc;
+	Char *dc;
+	wint_t wc;
+	size_t clen;
+	mbstate_t mbs;
+
+	memset(&mbs, 0, sizeof(mbs));
+	dc = pathend;
+	sc = name;
+	while (dc < pathend_last) {
+		clen = mbrtowi(&wc, sc, MB_LEN_MAX, &mbs);
+		if (clen == (size_t)-1 || clen == (size_t)-2) {
+			wc = *sc;
+			clen = 1;
+			memset(&mbs, 0, sizeof(mbs));
+		}
+		if ((*dc++ = wc) == EOS)
+			break;
+		sc += clen;
+	}
+	return (dc);
+}
+
+/*
+ * Directory listing cache.  Every directory is read at most once per
+ * glob() call, even if brace alternatives or several matches lead to it
+ * again, and its entry names and types are kept until glob() returns.
+ * If a pattern segment matches several directories and the pattern
+ * continues below them, g_prefetch reads their listings on a few helper
+ * threads in parallel before glob3 visits them in order.
+ */
+static struct glob_dir g_toolong = { NULL, NULL, NULL, 0, ENAMETOOLONG, 1 };
+
+static size_t
+g_hash(const char *path)
+{
+	size_t h = 5381;
+
+	while (*path)
+		h = h * 33 + (unsigned char) *path++;
+	return (h % GLOB_DHASH);
+}
+
+/* Read the directory listing of gd->path into gd. */
+static void
+g_filldir(struct glob_dir *gd)
+{
+	struct glob_dent *ents;
+	struct dirent *dp;
+	DIR *dirp;
+	size_t size = 0;
+
+	gd->filled = 1;
+	if ((dirp = opendir(gd->path)) == NULL) {
+		gd->error = errno ?: ENOENT;
+		return;
+	}
+	while ((dp = readdir(dirp)) != NULL) {
+		if (gd->nents == size) {
+			size = size ? size * 2 : 64;
+			ents = (struct glob_dent *) realloc(gd->ents,
+			    size * sizeof(*ents));
+			if (ents == NULL)
+				break;
+			gd->ents = ents;
+		}
+		if ((gd->ents[gd->nents].name = strdup(dp->d_name)) == NULL)
+			break;
+		gd->ents[gd->nents++].type = dp->d_type;
+	}
+	if (dp != NULL)
+		gd->error = ENOMEM;
+	closedir(dirp);
+}
+
+/* Look up path in the cache, adding an empty entry if it's missing. */
+static struct glob_dir *
+g_lookupdir(const char *path, struct glob_dcache *dcache)
+{
+	struct glob_dir *gd, **head;
+
+	head = &dcache->hash[g_hash(path)];
+	for (gd = *head; gd; gd = gd->next)
+		if (!strcmp(gd->path, path))
+			return (gd);
+	if ((gd = (struct glob_dir *) calloc(1, sizeof(*gd))) == NULL)
+		return (NULL);
+	if ((gd->path = strdup(path)) == NULL) {
+		free(gd);
+		return (NULL);
+	}
+	gd->next = *head;
+	*head = gd;
+	return (gd);
+}
+
+static struct glob_dir *
+g_cachedir(Char *str, struct glob_dcache *dcache)
+{
+	struct glob_dir *gd;
+	char buf[MAXPATHLEN];
+
+	if (!*str)
+		strcpy(buf, ".");
+	else if (g_Ctoc(str, buf, sizeof(buf)))
+		return (&g_toolong);
+	if ((gd = g_lookupdir(buf, dcache)) != NULL && !gd->filled)
+		g_filldir(gd);
+	return (gd);
+}
+
+struct glob_jobs {
+	struct glob_dir	**dirs;
+	size_t		  ndirs;
+	volatile LONG	  next;
+};
+
+static DWORD
+g_filljobs(void *arg)
+{
+	struct glob_jobs *jobs = (struct glob_jobs *) arg;
+	LONG i;
+
+	while ((size_t) (i = InterlockedIncrement(&jobs->next) - 1)
+	    < jobs->ndirs)
+		g_filldir(jobs->dirs[i]);
+	return (0);
+}
+
+/*
+ * Collect the directories glob3 will read next for the matching entries
+ * of gd, and read those not cached yet in parallel.
+ */
+static void
+g_prefetch(Char *pathbuf, Char *pathend, Char *pathend_last,
+    Char *pattern, Char *restpattern, struct glob_dir *gd,
+    struct glob_dcache *dcache)
+{
+	struct glob_jobs jobs;
+	cygthread *thr[GLOB_NTHREADS];
+	const Char *p;
+	size_t i, nthr;
+	char buf[MAXPATHLEN];
+
+	/* Nothing to read if the rest of the pattern is literal. */
+	for (p = restpattern; *p != EOS && !ismeta(*p); p++)
+		;
+	if (*p == EOS || gd->nents < 2)
+		return;
+	jobs.dirs = (struct glob_dir **) malloc(gd->nents *
+	    sizeof(*jobs.dirs));
+	if (jobs.dirs == NULL)
+		return;
+	jobs.ndirs = 0;
+	jobs.next = 0;
+	for (i = 0; i < gd->nents; i++) {
+		struct glob_dir *sub;
+		const char *name = gd->ents[i].name;
+		unsigned char type = gd->ents[i].type;
+		Char *q;
+
+		if (type != DT_DIR && type != DT_LNK && type != DT_UNKNOWN)
+			continue;
+		if (name[0] == DOT && *pattern != DOT)
+			continue;
+		q = g_dname(pathend, pathend_last, name) - 1;
+		if (*q != EOS || !match(pathend, pattern, restpattern))
+			continue;
+		/* Append literal segments, like glob2 does. */
+		for (p = restpattern; *p != EOS; ) {
+			const Char *seg = p;
+
+			while (*p != EOS && *p != SEP && !ismeta(*p))
+				p++;
+			if (*p != EOS && *p != SEP)
+				break;
+			if (q + (p - seg) > pathend_last)
+				break;
+			while (seg < p)
+				*q++ = *seg++;
+			while (*p == SEP && q < pathend_last)
+				*q++ = *p++;
+		}
+		if (*p == EOS || ismeta(*p) == 0)
+			continue;
+		*q = EOS;
+		if (g_Ctoc(pathbuf, buf, sizeof(buf)))
+			continue;
+		if ((sub = g_lookupdir(buf, dcache)) == NULL)
+			break;
+		if (!sub->filled) {
+			sub->filled = 1;
+			jobs.dirs[jobs.ndirs++] = sub;
+		}
+	}
+	*pathend = EOS;
+
+	nthr = 0;
+	if (jobs.ndirs > 1)
+		for (; nthr < MIN(jobs.ndirs - 1, GLOB_NTHREADS); nthr++)
+			if ((thr[nthr] = new cygthread(g_filljobs, &jobs,
+			    "glob")) == NULL)
+				break;
+	g_filljobs(&jobs);
+	for (i = 0; i < nthr; i++)
+		thr[i]->detach();
+	free(jobs.dirs);
+}
+
+static void
+g_freecache(struct glob_dcache *dcache)
+{
+	struct glob_dir *gd, *next;
+	size_t i, j;
+
+	for (i = 0; i < GLOB_DHASH; i++)
+		for (gd = dcache->hash[i]; gd; gd = next) {
+			next = gd->next;
+			for (j = 0; j < gd->nents; j++)
+				free(gd->ents[j].name);
+			free(gd->ents);
+			free(gd->path);
+			free(gd);
+		}
+}
+
 static int
 glob3(Char *pathbuf, Char *pathend, Char *pathend_last,
       Char *pattern, Char *restpattern,
-      glob_t *pglob, size_t *limit)
+      glob_t *pglob, size_t *limit, struct glob_dcache *dcache)
 {
 	struct dirent *dp;
-	DIR *dirp;
+	DIR *dirp = NULL;
+	struct glob_dir *gd = NULL;
+	size_t gi = 0;
 	int err;
 	char buf[MAXPATHLEN];
 
-	/*
-	 * The readdirfunc declaration can't be prototyped, because it is
-	 * assigned, below, to two functions which are prototyped in glob.h
-	 * and dirent.h as taking pointers to differently typed opaque
-	 * structures.
-	 * CYGWIN: Needs prototype and subsequently wild casting to avoid
-	 * compiler error.
-	 */
-	struct dirent *(*readdirfunc)(void *);
-
 	if (pathend > pathend_last)
 		return (GLOB_ABORTED);
 	*pathend = EOS;
 	errno = 0;
 
-	if ((dirp = g_opendir(pathbuf, pglob)) == NULL) {
+	if (!(pglob->gl_flags & GLOB_ALTDIRFUNC)) {
+		if ((gd = g_cachedir(pathbuf, dcache)) == NULL)
+			return (GLOB_NOSPACE);
+		errno = gd->error;
+	} else
+		dirp = g_opendir(pathbuf, pglob);
+	if (gd ? gd->error : dirp == NULL) {
 		/* TODO: don't call for ENOENT or ENOTDIR? */
 		if (pglob->gl_errfunc) {
 			if (g_Ctoc(pathbuf, buf, sizeof(buf)))
@@ -738,51 +1007,71 @@ glob3(Char *pathbuf, Char *pathend, Char *pathend_last,
 		return(0);
 	}
 
+	/*
+	 * If the pattern goes on below the matching entries, read their
+	 * directories in parallel now.  The loop below then finds them
+	 * in the cache.
+	 */
+	if (gd)
+		g_prefetch(pathbuf, pathend, pathend_last, pattern,
+		    restpattern, gd, dcache);
+
 	err = 0;
 
-	/* Search directory for matching names. */
-	if (pglob->gl_flags & GLOB_ALTDIRFUNC)
-		readdirfunc = pglob->gl_readdir;
-	else
-		readdirfunc = (dirent*(*)(void*)) readdir;
-	while ((dp = (*readdirfunc)(dirp))) {
-		char *sc;
+	/*
+	 * Search directory for matching names.  Without GLOB_ALTDIRFUNC
+	 * they come from the cache.
+	 */
+	for (;;) {
+		const char *name;
+		unsigned char type;
 		Char *dc;
-		wint_t wc;
-		size_t clen;
-		mbstate_t mbs;
 
-		/* Initial DOT must be matched literally. */
-		if (dp->d_name[0] == DOT && *pattern != DOT)
-			continue;
-		memset(&mbs, 0, sizeof(mbs));
-		dc = pathend;
-		sc = dp->d_name;
-		while (dc < pathend_last) {
-			clen = mbrtowi(&wc, sc, MB_LEN_MAX, &mbs);
-			if (clen == (size_t)-1 || clen == (size_t)-2) {
-				wc = *sc;
-				clen = 1;
-				memset(&mbs, 0, sizeof(mbs));
-			}
-			if ((*dc++ = wc) == EOS)
+		if (gd) {
+			if (gi >= gd->nents)
+				break;
+			name = gd->ents[gi].name;
+			type = gd->ents[gi++].type;
+		} else {
+			if ((dp = (*pglob->gl_readdir)(dirp)) == NULL)
 				break;
-			sc += clen;
+			name = dp->d_name;
+			type = DT_UNKNOWN;
 		}
+
+		/* Initial DOT must be matched literally. */
+		if (name[0] == DOT && *pattern != DOT)
+			continue;
+		dc = g_dname(pathend, pathend_last, name);
 		if (!match(pathend, pattern, restpattern)) {
 			*pathend = EOS;
 			continue;
 		}
-		err = glob2(pathbuf, --dc, pathend_last, restpattern,
-		    pglob, limit);
+		/*
+		 * The entry has just been read from its directory, so the
+		 * final lstat in glob2 can be skipped if we already know
+		 * what GLOB_MARK needs to know.
+		 */
+		if (gd && *restpattern == EOS && dc[-1] == EOS &&
+		    (!(pglob->gl_flags & GLOB_MARK) ||
+		    (type != DT_UNKNOWN && type != DT_LNK))) {
+			if ((pglob->gl_flags & GLOB_MARK) && type == DT_DIR) {
+				if (dc > pathend_last)
+					return (GLOB_ABORTED);
+				dc[-1] = SEP;
+				*dc = EOS;
+			}
+			++pglob->gl_matchc;
+			err = globextend(pathbuf, pglob, limit);
+		} else
+			err = glob2(pathbuf, --dc, pathend_last, restpattern,
+			    pglob, limit, dcache);
 		if (err)
 			break;
 	}
 
-	if (pglob->gl_flags & GLOB_ALTDIRFUNC)
+	if (dirp)
 		(*pglob->gl_closedir)(dirp);
-	else
-		closedir(dirp);
 	return(err);
 }
 
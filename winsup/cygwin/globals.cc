@@ -125,6 +125,7 @@ extern "C" {
   extern UNICODE_STRING _RDATA ro_u_natp = _ROU (L"\\??\\");
   extern UNICODE_STRING _RDATA ro_u_uncp = _ROU (L"\\??\\UNC\\");
   extern UNICODE_STRING _RDATA ro_u_mtx = _ROU (L"mtx");
+  extern UNICODE_STRING _RDATA ro_u_gen = _ROU (L"gen");
   extern UNICODE_STRING _RDATA ro_u_csc = _ROU (L"CSC-CACHE");
   extern UNICODE_STRING _RDATA ro_u_fat = _ROU (L"FAT");
   extern UNICODE_STRING _RDATA ro_u_exfat = _ROU (L"exFAT");
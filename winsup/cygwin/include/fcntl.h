@@ -31,6 +31,18 @@ details. */
    mandatory locking semantics. */
 #define F_LCK_MANDATORY	0x99
 
+#if __GNU_VISIBLE
+/* Get and set the size of a pipe.  Same values as on Linux. */
+#define F_SETPIPE_SZ	1031
+#define F_GETPIPE_SZ	1032
+
+/* Flags for splice, tee and vmsplice. */
+#define SPLICE_F_MOVE		0x01	/* Ignored. */
+#define SPLICE_F_NONBLOCK	0x02	/* Don't block on the pipe. */
+#define SPLICE_F_MORE		0x04	/* Ignored. */
+#define SPLICE_F_GIFT		0x08	/* Ignored. */
+#endif
+
 /* POSIX-1.2008 requires this flag and allows to set it to 0 if its
    functionality is not required. */
 #define O_TTY_INIT	0
@@ -60,6 +72,10 @@ extern int posix_fadvise (int, off_t, off_t, int);
 extern int posix_fallocate (int, off_t, off_t);
 #if __GNU_VISIBLE
 extern int fallocate (int, int, off_t, off_t);
+struct iovec;
+extern ssize_t splice (int, loff_t *, int, loff_t *, size_t, unsigned int);
+extern ssize_t tee (int, int, size_t, unsigned int);
+extern ssize_t vmsplice (int, const struct iovec *, size_t, unsigned int);
 #endif
 
 __END_DECLS
@@ -126,6 +126,23 @@ struct addrinfo {
 };
 #endif
 
+#if __GNU_VISIBLE && !defined(__INSIDE_CYGWIN_NET__)
+/* Structure used as control block for asynchronous lookup. */
+struct gaicb {
+  const char            *ar_name;	/* name to look up */
+  const char            *ar_service;	/* service name */
+  const struct addrinfo *ar_request;	/* additional request specification */
+  struct addrinfo       *ar_result;	/* pointer to result */
+  /* The following are internal elements. */
+  int                   __return;
+  int                   __unused[5];
+};
+
+/* Lookup mode. */
+#define GAI_WAIT	0
+#define GAI_NOWAIT	1
+#endif
+
 /*
  * Error return codes from gethostbyname() and gethostbyaddr()
  * (left in extern int h_errno).
@@ -214,6 +231,11 @@ extern __declspec(dllimport) int h_errno;
 #if __GNU_VISIBLE
 /* Glibc extensions. */
 #define EAI_IDN_ENCODE	15	/* Parameter string not correctly encoded */
+#define EAI_INPROGRESS	16	/* Processing request in progress */
+#define EAI_CANCELED	17	/* Request canceled */
+#define EAI_NOTCANCELED	18	/* Request not canceled */
+#define EAI_ALLDONE	19	/* All requests done */
+#define EAI_INTR	20	/* Interrupted by a signal */
 #endif
 
 #endif /* __POSIX_VISIBLE >= 200112 */
@@ -259,6 +281,15 @@ int		getaddrinfo (const char *, const char *,
 int		getnameinfo (const struct sockaddr *, socklen_t, char *,
 			     socklen_t, char *, socklen_t, int);
 #endif
+#if __GNU_VISIBLE
+struct sigevent;
+struct timespec;
+int		getaddrinfo_a (int, struct gaicb *[], int, struct sigevent *);
+int		gai_suspend (const struct gaicb *const [], int,
+			     const struct timespec *);
+int		gai_error (struct gaicb *);
+int		gai_cancel (struct gaicb *);
+#endif
 
 #if __BSD_VISIBLE
 int		rcmd (char **, uint16_t, const char *, const char *,
@@ -28,6 +28,12 @@ details. */
 #include <stdarg.h>
 #include <sys/types.h>
 
+/* Set by strace --ring in the activation flag.  The traced process then
+   appends binary records to per-thread rings in a section shared with
+   strace instead of formatting every message and sending it via
+   OutputDebugString. */
+#define _STRACE_RING_ACTIVE 4
+
 #ifdef __cplusplus
 
 class child_info;
@@ -35,9 +41,13 @@ class strace
 {
   int vsprntf (char *buf, const char *func, const char *infmt, va_list ap);
   void write (unsigned category, const char *buf, int count);
+  void ring_init ();
+  void ring_write (unsigned category, const char *func, const char *fmt,
+		   va_list ap);
   unsigned char _active;
 public:
   void activate (bool);
+  void ring_release ();
   strace () {}
   int microseconds ();
   int version;
@@ -48,7 +58,8 @@ public:
   void vprntf (unsigned, const char *func, const char *, va_list ap);
   void wm (int message, int word, int lon);
   void write_childpid (pid_t);
-  bool attached () const {return _active == 3;}
+  bool attached () const {return (_active & 3) == 3;}
+  bool ring () const {return _active & _STRACE_RING_ACTIVE;}
   bool active () const {return _active & 1;}
   unsigned char& active_val () {return _active;}
 };
@@ -60,6 +71,80 @@ extern strace strace;
 #define _STRACE_INTERFACE_ACTIVATE_ADDR  -1
 #define _STRACE_INTERFACE_ACTIVATE_ADDR1 -2
 #define _STRACE_CHILD_PID -3
+#define _STRACE_RING_SECTION -4
+
+#define _STRACE_RING_MAGIC	0x53525943	/* "CYRS" */
+#define _STRACE_RING_VERSION	1
+#define _STRACE_RING_THREADS	64
+#define _STRACE_RING_RECORDS	1024		/* Per thread, power of 2. */
+#define _STRACE_RING_STRINGS	2048		/* Power of 2. */
+#define _STRACE_RING_STRLEN	112
+#define _STRACE_RING_ARGS	10
+#define _STRACE_RING_DATA	136
+#define _STRACE_RING_NOSTR	0xffff		/* String table index unknown. */
+#define _STRACE_RING_NULL	(~0ULL)		/* NULL string argument. */
+
+/* Argument types in __strace_ring_str.argtype. */
+#define _STRACE_ARG_INT		0
+#define _STRACE_ARG_STR		1	/* char *, copied to data */
+#define _STRACE_ARG_WSTR	2	/* PWCHAR, copied to data */
+#define _STRACE_ARG_USTR	3	/* PUNICODE_STRING, copied to data */
+
+/* Format strings, function and thread names are stored once per process
+   in the string table, keyed by their address in the traced process.
+   For format strings, the arguments are classified at the same time. */
+struct __strace_ring_str
+{
+  volatile unsigned long long addr;
+  volatile long ready;
+  unsigned char nargs;
+  unsigned char argtype[_STRACE_RING_ARGS];
+  char str[_STRACE_RING_STRLEN];
+};
+
+/* One message.  String arguments are copied to data, truncated if
+   necessary.  Their args slot holds the offset into data in the upper,
+   and the length in bytes in the lower 16 bits, or _STRACE_RING_NULL. */
+struct __strace_ring_rec
+{
+  volatile unsigned long long seq;	/* Record index + 1 once complete. */
+  long long usecs;
+  unsigned int category;
+  unsigned int tid;
+  unsigned short fmt;
+  unsigned short func;
+  unsigned short tname;
+  unsigned short pad;
+  unsigned int winerr;			/* For %E */
+  int errnum;				/* For %R */
+  unsigned long long args[_STRACE_RING_ARGS];
+  char data[_STRACE_RING_DATA];
+};
+
+/* Single writer (the owning thread), single reader (strace).  The writer
+   never blocks: if the reader didn't keep up, the record is counted in
+   dropped and discarded. */
+struct __strace_ring
+{
+  volatile long owner;			/* Windows thread id, 0 if unused. */
+  volatile long long dropped;
+  volatile unsigned long long head;	/* Written by the owner. */
+  volatile unsigned long long tail;	/* Written by strace. */
+  struct __strace_ring_rec rec[_STRACE_RING_RECORDS];
+};
+
+struct __strace_ring_hdr
+{
+  unsigned int magic;
+  unsigned int version;
+  unsigned int mask;			/* Set by strace. */
+  volatile int pid;
+  char progname[64];
+  volatile long long nothread_dropped;	/* No free ring for a thread. */
+  volatile long long nostr_dropped;	/* String table full. */
+  struct __strace_ring_str str[_STRACE_RING_STRINGS];
+  struct __strace_ring ring[_STRACE_RING_THREADS];
+};
 
 /* Bitmasks of tracing messages to print.  */
 
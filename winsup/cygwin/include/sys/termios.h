@@ -324,4 +324,18 @@ struct winsize
 #define TIOCGPGRP  (('T' << 8) | 0xf)
 #define TIOCSPGRP  (('T' << 8) | 0x10)
 
+/* Cygwin specific: Statistics of forwarding the output of native Windows
+   programs running in a pty to its master side.  Returned by the
+   TIOCGFWDSTAT ioctl on the master side. */
+struct ptyfwdstat
+{
+  unsigned long long pfs_bytes;		/* Bytes forwarded. */
+  unsigned long long pfs_reads;		/* Chunks read from native programs. */
+  unsigned long long pfs_plain_reads;	/* Chunks forwarded unconverted. */
+  unsigned long long pfs_usecs;		/* Total forwarding time. */
+  unsigned long long pfs_max_usecs;	/* Max. time forwarding one chunk. */
+};
+
+#define TIOCGFWDSTAT (('T' << 8) | 0x20)
+
 #endif	/* _SYS_TERMIOS_H */
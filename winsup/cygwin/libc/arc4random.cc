@@ -0,0 +1,128 @@
+/* arc4random.cc: per-thread ChaCha20 random number generator
+
+This file is part of Cygwin.
+
+This software is a copyrighted work licensed under the terms of the
+Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
+details. */
+
+#include "winsup.h"
+#include <ntsecapi.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include "cygtls.h"
+#include "miscfuncs.h"
+
+/* /dev/urandom, getrandom(2) and arc4random(3) return bytes of a ChaCha20
+   keystream generated per thread, so small reads neither need a system
+   call nor contend for a lock.
+
+   After each refill of the buffer, the key is replaced by the first bytes
+   of the new keystream, and returned bytes are wiped from the buffer, so
+   the state doesn't reveal earlier output.  Fresh entropy from the system
+   RNG is mixed into the key after CHACHA20_RESEED bytes and in a forked
+   child, which would repeat the output of its parent otherwise.
+   _cygtls::fixup_after_fork wipes the state of the forking thread, and the
+   process id stored with the key catches fork handlers running earlier.
+
+   This replaces the arc4random and arc4random_buf implementation of
+   newlib, which serializes all threads on a single state. */
+
+#define CHACHA20_RESEED	(1600 * 1024)
+
+static const uint8_t buf_nonce[CHACHA20_NONCESIZE] = { 0 };
+static const uint8_t bulk_nonce[CHACHA20_NONCESIZE] = { 1 };
+
+static bool
+chacha20_seed (chacha20_state &rs)
+{
+  uint8_t rnd[CHACHA20_KEYSIZE];
+
+  if (!RtlGenRandom (rnd, sizeof rnd))
+    {
+      debug_printf ("RtlGenRandom() = FALSE");
+      return false;
+    }
+  for (size_t i = 0; i < sizeof rnd; i++)
+    rs.key[i] ^= rnd[i];
+  memset (rnd, 0, sizeof rnd);
+  memset (rs.buf, 0, sizeof rs.buf);
+  rs.avail = 0;
+  rs.count = CHACHA20_RESEED;
+  rs.winpid = GetCurrentProcessId ();
+  return true;
+}
+
+static void
+chacha20_refill (chacha20_state &rs)
+{
+  chacha20_keystream (rs.buf, sizeof rs.buf / CHACHA20_BLOCKSIZE, rs.key, 0,
+		      buf_nonce);
+  memcpy (rs.key, rs.buf, sizeof rs.key);
+  memset (rs.buf, 0, sizeof rs.key);
+  rs.avail = sizeof rs.buf - sizeof rs.key;
+}
+
+/* Fill buf with len random bytes.  Returns false if the system RNG failed
+   to provide a seed.  Callers have to guard against invalid buffers. */
+bool
+chacha20_random (void *buf, size_t len)
+{
+  /* Threads not initialized by Cygwin have no state to use. */
+  if (!_my_tls.isinitialized ())
+    return RtlGenRandom (buf, len);
+
+  chacha20_state &rs = _my_tls.locals.chacha20;
+  uint8_t *p = (uint8_t *) buf;
+
+  while (len > 0)
+    {
+      if (rs.winpid != GetCurrentProcessId () || !rs.count)
+	{
+	  if (!chacha20_seed (rs))
+	    return false;
+	}
+      size_t n = MIN (len, rs.count);
+      if (n >= sizeof rs.buf)
+	{
+	  /* Generate big chunks right into the caller's buffer, with a nonce
+	     of their own, and rekey afterwards. */
+	  n = rounddown (n, CHACHA20_BLOCKSIZE);
+	  chacha20_keystream (p, n / CHACHA20_BLOCKSIZE, rs.key, 0,
+			      bulk_nonce);
+	  chacha20_refill (rs);
+	}
+      else
+	{
+	  if (!rs.avail)
+	    chacha20_refill (rs);
+	  n = MIN (n, rs.avail);
+	  uint8_t *ks = rs.buf + sizeof rs.buf - rs.avail;
+	  memcpy (p, ks, n);
+	  memset (ks, 0, n);
+	  rs.avail -= n;
+	}
+      rs.count -= n;
+      p += n;
+      len -= n;
+    }
+  return true;
+}
+
+extern "C" void
+arc4random_buf (void *buf, size_t n)
+{
+  /* Like newlib's implementation if getentropy fails. */
+  if (!chacha20_random (buf, n))
+    raise (SIGKILL);
+}
+
+extern "C" uint32_t
+arc4random ()
+{
+  uint32_t val;
+
+  arc4random_buf (&val, sizeof val);
+  return val;
+}
@@ -73,6 +73,7 @@ static size_t	 fts_maxarglen(char * const *);
 static void	 fts_padjust(FTS *, FTSENT *);
 static int	 fts_palloc(FTS *, size_t);
 static FTSENT	*fts_sort(FTS *, FTSENT *, size_t);
+static int	 fts_dirinfo(FTSENT *);
 static int	 fts_stat(FTS *, FTSENT *, int);
 static int	 fts_safe_changedir(FTS *, FTSENT *, int, const char *);
 static int	 fts_ufslinks(FTS *, const FTSENT *);
@@ -686,6 +687,16 @@ fts_build(FTS *sp, int type)
 		else
 			nlinks = -1;
 		nostat = 1;
+#ifdef __CYGWIN__
+	} else if (ISSET(FTS_NOSTAT)) {
+		/*
+		 * A logical walk still has to stat symlinks to find out
+		 * what they point to, but everything else can be taken
+		 * from d_type.
+		 */
+		nlinks = -1;
+		nostat = 2;
+#endif
 	} else {
 		nlinks = -1;
 		nostat = 0;
@@ -806,12 +817,35 @@ mem1:				saved_errno = errno;
 		} else if (nlinks == 0
 #ifdef DT_DIR
 		    || (nostat &&
-		    dp->d_type != DT_DIR && dp->d_type != DT_UNKNOWN)
+		    dp->d_type != DT_DIR && dp->d_type != DT_UNKNOWN
+#ifdef __CYGWIN__
+		    && (nostat == 1 || dp->d_type != DT_LNK)
+#endif
+		    )
 #endif
 		    ) {
 			p->fts_accpath =
 			    ISSET(FTS_NOCHDIR) ? p->fts_path : p->fts_name;
 			p->fts_info = FTS_NSOK;
+#ifdef __CYGWIN__
+		} else if (nostat == 1 && dp->d_type == DT_DIR &&
+		    dp->d_ino != 0 &&
+		    ISSET(FTS_NOCHDIR) && !ISSET(FTS_XDEV)) {
+			/*
+			 * Cygwin's readdir takes d_type and d_ino from the
+			 * same directory query which returned the name.
+			 * Without chdir and FTS_XDEV, the only thing needed
+			 * from a directory's stat is its inode number for
+			 * cycle detection, so skip stat(2) for directories,
+			 * too.  A link count of 1 means "unknown" to
+			 * fts_ufslinks.
+			 */
+			p->fts_accpath = p->fts_path;
+			p->fts_dev = cur->fts_dev;
+			p->fts_ino = dp->d_ino;
+			p->fts_nlink = 1;
+			p->fts_info = fts_dirinfo(p);
+#endif
 		} else {
 			/* Build a file name for fts_stat to stat. */
 			if (ISSET(FTS_NOCHDIR)) {
@@ -884,12 +918,36 @@ mem1:				saved_errno = errno;
 	return (head);
 }
 
+/*
+ * Classify a directory entry.  Assumes p->fts_dev and p->fts_ino are
+ * filled in.
+ */
 static int
-fts_stat(FTS *sp, FTSENT *p, int follow)
+fts_dirinfo(FTSENT *p)
 {
 	FTSENT *t;
-	dev_t dev;
-	ino_t ino;
+
+	if (ISDOT(p->fts_name))
+		return (FTS_DOT);
+
+	/*
+	 * Cycle detection is done by brute force when the directory
+	 * is first encountered.  If the tree gets deep enough or the
+	 * number of symbolic links to directories is high enough,
+	 * something faster might be worthwhile.
+	 */
+	for (t = p->fts_parent;
+	    t->fts_level >= FTS_ROOTLEVEL; t = t->fts_parent)
+		if (p->fts_ino == t->fts_ino && p->fts_dev == t->fts_dev) {
+			p->fts_cycle = t;
+			return (FTS_DC);
+		}
+	return (FTS_D);
+}
+
+static int
+fts_stat(FTS *sp, FTSENT *p, int follow)
+{
 	struct stat *sbp, sb;
 	int saved_errno;
 
@@ -936,26 +994,11 @@ err:		memset(sbp, 0, sizeof(struct stat));
 		 * understood that these fields are only referenced if fts_info
 		 * is set to FTS_D.
 		 */
-		dev = p->fts_dev = sbp->st_dev;
-		ino = p->fts_ino = sbp->st_ino;
+		p->fts_dev = sbp->st_dev;
+		p->fts_ino = sbp->st_ino;
 		p->fts_nlink = sbp->st_nlink;
 
-		if (ISDOT(p->fts_name))
-			return (FTS_DOT);
-
-		/*
-		 * Cycle detection is done by brute force when the directory
-		 * is first encountered.  If the tree gets deep enough or the
-		 * number of symbolic links to directories is high enough,
-		 * something faster might be worthwhile.
-		 */
-		for (t = p->fts_parent;
-		    t->fts_level >= FTS_ROOTLEVEL; t = t->fts_parent)
-			if (ino == t->fts_ino && dev == t->fts_dev) {
-				p->fts_cycle = t;
-				return (FTS_DC);
-			}
-		return (FTS_D);
+		return (fts_dirinfo(p));
 	}
 	if (S_ISLNK(sbp->st_mode))
 		return (FTS_SL);
@@ -12,6 +12,7 @@ details. */
 #include <sys/random.h>
 #include "cygtls.h"
 #include "ntdll.h"
+#include "miscfuncs.h"
 
 extern "C" int
 getentropy (void *ptr, size_t len)
@@ -54,9 +55,12 @@ getrandom (void *ptr, size_t len, unsigned int flags)
   len = MIN (len, (flags & GRND_RANDOM) ? 512 : 33554431);
   __try
     {
-      if (!RtlGenRandom (ptr, len))
+      /* GRND_RANDOM reads go to the system RNG, all others are served by
+	 the per-thread generator seeded from it. */
+      if ((flags & GRND_RANDOM) ? !RtlGenRandom (ptr, len)
+				: !chacha20_random (ptr, len))
 	{
-	  debug_printf ("RtlGenRandom() = FALSE");
+	  debug_printf ("random source failed");
 	  set_errno (EIO);
 	  return -1;
 	}
@@ -80,13 +80,373 @@ void minires_get_search(char * string, res_state statp)
   }
 }
 
+/*****************************************************************
+ *
+ Answer cache
+
+ Process-wide cache of the answers to res_nquery, including negative
+ answers (HOST_NOT_FOUND and NO_DATA).  An answer is only returned to
+ res_states asking the same name servers, or the OS resolver, with the
+ same options as the one it was stored for, e.g. to gethostbyname2 and
+ friends, which all use the default res_state.  Positive answers are
+ kept for the smallest TTL in the answer section, negative ones for the
+ TTL of the SOA record in the authority section (RFC 2308) if there is
+ one.
+ Cached messages are returned with their TTLs reduced by the time spent
+ in the cache.  The number of entries is bounded by "options cache-size:n"
+ in resolv.conf, 0 disables the cache; the least recently used entry is
+ evicted first.  With "options debug", every lookup prints the cache
+ statistics.
+
+ *****************************************************************/
+#define CACHE_DEFSIZE 256
+#define CACHE_MAXSIZE 16384
+#define CACHE_HASHSIZE 512      /* Power of 2 */
+#define CACHE_MAXTTL 86400      /* Cap for positive answers */
+#define CACHE_NEGTTL 60         /* Negative answers without SOA */
+#define CACHE_MAXNEGTTL 900     /* Cap for negative answers */
+
+/* What determines the answer besides the question: the name servers
+   asked, or the OS resolver, and the options res_nsend honours */
+#define CACHE_OPTIONS RES_IGNTC
+
+struct cache_key {
+  void * os_query;
+  int options;
+  int nscount;
+  struct {
+    in_addr_t addr;
+    in_port_t port;
+  } ns[MAXNS];
+};
+
+struct cache_entry {
+  struct cache_entry * hnext;          /* Hash chain */
+  struct cache_entry * prev, * next;   /* LRU list, most recent first */
+  unsigned int hash;
+  struct cache_key key;
+  int Class, Type;
+  int h_errno_val;                     /* NETDB_SUCCESS, HOST_NOT_FOUND, NO_DATA */
+  time_t stored, expires;
+  int len;                             /* Message length, 0 if negative */
+  char * name;
+  unsigned char msg[];
+};
+
+static struct {
+  struct cache_entry * hash[CACHE_HASHSIZE];
+  struct cache_entry * head, * tail;
+  int count, maxcount;
+  unsigned long hits, neghits, misses, stores, evictions, expired;
+} anscache = { .maxcount = CACHE_DEFSIZE };
+static NO_COPY SRWLOCK cache_lock = SRWLOCK_INIT;
+
+static time_t cache_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+static void cache_key(res_state statp, struct cache_key * kp)
+{
+  int i;
+
+  memset(kp, 0, sizeof *kp);
+  kp->os_query = statp->os_query;
+  kp->options = statp->options & CACHE_OPTIONS;
+  if (!kp->os_query) {
+    kp->nscount = statp->nscount;
+    for (i = 0; i < statp->nscount && i < MAXNS; i++) {
+      kp->ns[i].addr = statp->nsaddr_list[i].sin_addr.s_addr;
+      kp->ns[i].port = statp->nsaddr_list[i].sin_port;
+    }
+  }
+}
+
+static unsigned int cache_hash(const struct cache_key * kp, const char * name,
+			       int Class, int Type)
+{
+  const unsigned char * kptr = (const unsigned char *) kp;
+  unsigned int h = 2166136261U ^ (Class << 16) ^ Type; /* FNV-1a */
+  size_t i;
+
+  for (i = 0; i < sizeof *kp; i++)
+    h = (h ^ kptr[i]) * 16777619U;
+  for (; *name; name++)
+    if (*name != '.' || name[1])         /* Ignore a final dot */
+      h = (h ^ (unsigned char) tolower((unsigned char) *name)) * 16777619U;
+  return h;
+}
+
+static int cache_match(const char * a, const char * b)
+{
+  size_t la = strlen(a), lb = strlen(b);
+
+  if (la && a[la - 1] == '.')
+    la--;
+  if (lb && b[lb - 1] == '.')
+    lb--;
+  return la == lb && !strncasecmp(a, b, la);
+}
+
+/* Walk the resource records of a message.  Return the TTL to cache it
+   with, or -1 if it isn't well formed.  If elapsed is not 0, reduce
+   all TTLs in the message by elapsed seconds. */
+static int cache_ttl(unsigned char * msg, int len, int negative, int elapsed)
+{
+  unsigned char * ptr = msg + HFIXEDSZ, * eom = msg + len;
+  int counts[4], section, i, n, type, rdlen;
+  long ttl, minttl = -1;
+
+  if (len < HFIXEDSZ)
+    return -1;
+  for (section = 0; section < 4; section++)
+    counts[section] = (msg[4 + 2 * section] << 8) | msg[5 + 2 * section];
+  for (i = 0; i < counts[0]; i++) {
+    if ((n = dn_skipname(ptr, eom)) < 0 || ptr + n + QFIXEDSZ > eom)
+      return -1;
+    ptr += n + QFIXEDSZ;
+  }
+  for (section = 1; section < 4; section++) {
+    for (i = 0; i < counts[section]; i++) {
+      if ((n = dn_skipname(ptr, eom)) < 0 || ptr + n + RRFIXEDSZ > eom)
+	return -1;
+      ptr += n;
+      GETSHORT(type, ptr);
+      ptr += INT16SZ;                  /* Class */
+      GETLONG(ttl, ptr);
+      GETSHORT(rdlen, ptr);
+      if (ptr + rdlen > eom)
+	return -1;
+      if (type == ns_t_opt)            /* TTL holds flags */
+	;
+      else if (!negative && section == 1) {
+	if (minttl < 0 || ttl < minttl)
+	  minttl = ttl;
+      }
+      else if (negative && section == 2 && type == ns_t_soa
+	       && rdlen >= 5 * INT32SZ) {
+	long minimum;
+	unsigned char * mptr = ptr + rdlen - INT32SZ;
+
+	GETLONG(minimum, mptr);
+	if (minimum < ttl)
+	  ttl = minimum;
+	if (minttl < 0 || ttl < minttl)
+	  minttl = ttl;
+      }
+      if (elapsed && type != ns_t_opt) {
+	unsigned char * tptr = ptr - INT16SZ - INT32SZ;
+
+	ttl = ttl > elapsed ? ttl - elapsed : 0;
+	PUTLONG(ttl, tptr);
+      }
+      ptr += rdlen;
+    }
+  }
+  if (negative && minttl < 0)
+    minttl = CACHE_NEGTTL;
+  if (minttl > (negative ? CACHE_MAXNEGTTL : CACHE_MAXTTL))
+    minttl = negative ? CACHE_MAXNEGTTL : CACHE_MAXTTL;
+  return minttl;
+}
+
+/* Find an entry, with cache_lock held */
+static struct cache_entry * cache_find(const struct cache_key * kp,
+				       unsigned int hash, const char * DomName,
+				       int Class, int Type)
+{
+  struct cache_entry * ep;
+
+  for (ep = anscache.hash[hash & (CACHE_HASHSIZE - 1)]; ep; ep = ep->hnext)
+    if (ep->hash == hash && ep->Class == Class && ep->Type == Type
+	&& !memcmp(&ep->key, kp, sizeof *kp) && cache_match(ep->name, DomName))
+      break;
+  return ep;
+}
+
+static void cache_unlink(struct cache_entry * ep)
+{
+  struct cache_entry ** pp = &anscache.hash[ep->hash & (CACHE_HASHSIZE - 1)];
+
+  while (*pp != ep)
+    pp = &(*pp)->hnext;
+  *pp = ep->hnext;
+  if (ep->prev)
+    ep->prev->next = ep->next;
+  else
+    anscache.head = ep->next;
+  if (ep->next)
+    ep->next->prev = ep->prev;
+  else
+    anscache.tail = ep->prev;
+  anscache.count--;
+  free(ep);
+}
+
+static void cache_stats(res_state statp, const char * what, const char * name)
+{
+  DPRINTF(statp->options & RES_DEBUG,
+	  "cache %s \"%s\": %d entries, %lu hits, %lu negative hits, "
+	  "%lu misses, %lu stores, %lu expired, %lu evicted\n",
+	  what, name, anscache.count, anscache.hits, anscache.neghits, anscache.misses,
+	  anscache.stores, anscache.expired, anscache.evictions);
+}
+
+/* Return 1 and set *lenp if the answer is in the cache */
+static int cache_lookup(res_state statp, const char * DomName, int Class,
+			int Type, unsigned char * AnsPtr, int AnsLength,
+			int * lenp)
+{
+  struct cache_entry * ep;
+  struct cache_key key;
+  unsigned int hash;
+  time_t now;
+  int found = 0;
+
+  cache_key(statp, &key);
+  hash = cache_hash(&key, DomName, Class, Type);
+  now = cache_now();
+  AcquireSRWLockExclusive(&cache_lock);
+  if (anscache.maxcount == 0) {
+    ReleaseSRWLockExclusive(&cache_lock);
+    return 0;
+  }
+  ep = cache_find(&key, hash, DomName, Class, Type);
+  if (ep && ep->expires <= now) {
+    cache_unlink(ep);
+    anscache.expired++;
+    ep = NULL;
+  }
+  if (!ep)
+    anscache.misses++;
+  else {
+    found = 1;
+    /* Move to the front of the LRU list */
+    if (ep->prev) {
+      ep->prev->next = ep->next;
+      if (ep->next)
+	ep->next->prev = ep->prev;
+      else
+	anscache.tail = ep->prev;
+      ep->prev = NULL;
+      ep->next = anscache.head;
+      anscache.head->prev = ep;
+      anscache.head = ep;
+    }
+    statp->res_h_errno = ep->h_errno_val;
+    if (ep->h_errno_val != NETDB_SUCCESS) {
+      anscache.neghits++;
+      *lenp = -1;
+    }
+    else {
+      anscache.hits++;
+      memcpy(AnsPtr, ep->msg, ep->len < AnsLength ? ep->len : AnsLength);
+      if (ep->len <= AnsLength && now > ep->stored)
+	cache_ttl(AnsPtr, ep->len, 0, now - ep->stored);
+      *lenp = ep->len;
+    }
+  }
+  ReleaseSRWLockExclusive(&cache_lock);
+  cache_stats(statp, found ? "hit" : "miss", DomName);
+  return found;
+}
+
+/* Store the result of a query, as returned by os_query or res_nsend */
+static void cache_store(res_state statp, const char * DomName, int Class,
+			int Type, unsigned char * AnsPtr, int AnsLength,
+			int len)
+{
+  struct cache_entry * ep, * old;
+  unsigned int hash;
+  size_t namelen;
+  int ttl, negative;
+
+  if (len >= 0) {
+    /* Only complete answers */
+    if (len > AnsLength || len < HFIXEDSZ || (AnsPtr[3] & ERR_MASK) != NOERROR
+	|| (AnsPtr[6] | AnsPtr[7]) == 0)
+      return;
+    negative = 0;
+    ttl = cache_ttl(AnsPtr, len, 0, 0);
+  }
+  else if (statp->res_h_errno == HOST_NOT_FOUND
+	   || statp->res_h_errno == NO_DATA) {
+    negative = 1;
+    /* The os_query doesn't provide a message, res_nsend may */
+    ttl = (AnsLength >= HFIXEDSZ && (AnsPtr[2] & QR))
+	  ? cache_ttl(AnsPtr, AnsLength, 1, 0) : -1;
+    if (ttl < 0)
+      ttl = CACHE_NEGTTL;
+    len = 0;
+  }
+  else
+    return;
+  if (ttl <= 0)
+    return;
+
+  namelen = strlen(DomName) + 1;
+  if (!(ep = (struct cache_entry *) malloc(sizeof *ep + len + namelen)))
+    return;
+  cache_key(statp, &ep->key);
+  hash = cache_hash(&ep->key, DomName, Class, Type);
+  ep->hash = hash;
+  ep->Class = Class;
+  ep->Type = Type;
+  ep->h_errno_val = negative ? statp->res_h_errno : NETDB_SUCCESS;
+  ep->stored = cache_now();
+  ep->expires = ep->stored + ttl;
+  ep->len = len;
+  memcpy(ep->msg, AnsPtr, len);
+  ep->name = (char *) ep->msg + len;
+  memcpy(ep->name, DomName, namelen);
+
+  AcquireSRWLockExclusive(&cache_lock);
+  if (anscache.maxcount == 0) {
+    ReleaseSRWLockExclusive(&cache_lock);
+    free(ep);
+    return;
+  }
+  /* Replace a stale copy */
+  if ((old = cache_find(&ep->key, hash, DomName, Class, Type)))
+    cache_unlink(old);
+  while (anscache.count >= anscache.maxcount && anscache.tail) {
+    cache_unlink(anscache.tail);
+    anscache.evictions++;
+  }
+  ep->hnext = anscache.hash[hash & (CACHE_HASHSIZE - 1)];
+  anscache.hash[hash & (CACHE_HASHSIZE - 1)] = ep;
+  ep->prev = NULL;
+  ep->next = anscache.head;
+  if (anscache.head)
+    anscache.head->prev = ep;
+  else
+    anscache.tail = ep;
+  anscache.head = ep;
+  anscache.count++;
+  anscache.stores++;
+  ReleaseSRWLockExclusive(&cache_lock);
+  DPRINTF(statp->options & RES_DEBUG, "cache store \"%s\" type %d ttl %d%s\n",
+	  DomName, Type, ttl, negative ? " (negative)" : "");
+}
+
+/* Set the maximum number of entries, from res_ninit */
+static void cache_resize(int maxcount)
+{
+  AcquireSRWLockExclusive(&cache_lock);
+  anscache.maxcount = maxcount;
+  ReleaseSRWLockExclusive(&cache_lock);
+}
+
 /***********************************************************************
 
 Read options
 
 
 ***********************************************************************/
-static void get_options(res_state statp, int n, char **words)
+static void get_options(res_state statp, int n, char **words, int * cachesize)
 {
   char *ptr;
   int i, value;
@@ -137,6 +497,15 @@ static void get_options(res_state statp, int n, char **words)
 	DPRINTF(statp->options & RES_DEBUG, "%s: %d\n", words[i], value);
 	continue;
       }
+      if (!strcasecmp("cache-size", words[i])) {
+	if (value < 0)
+	  value = 0;
+	else if (value > CACHE_MAXSIZE)
+	  value = CACHE_MAXSIZE;
+	*cachesize = value;
+	DPRINTF(statp->options & RES_DEBUG, "%s: %d\n", words[i], value);
+	continue;
+      }
     }
     DPRINTF(statp->options & RES_DEBUG, "unknown option: \"%s\"\n", words[i]);
   }
@@ -153,7 +522,7 @@ We only look for nameserver, domain, search and options
 #else
 #define MAXSIZE MAXDNSRCH + 1 /* Make unused one visible */
 #endif
-static void get_resolv(res_state statp)
+static void get_resolv(res_state statp, int * cachesize)
 {
   FILE * fd;
   char *words[MAXSIZE + 1], line[4096], *ptr;
@@ -209,7 +578,7 @@ static void get_resolv(res_state statp)
       }
       /* Options line */
       else if (!strncasecmp("options", words[0], sizes[0])) {
-	get_options(statp, i - 1, &words[1]);
+	get_options(statp, i - 1, &words[1], cachesize);
 	debug = statp->options & RES_DEBUG;
       }
     }
@@ -280,7 +649,7 @@ struct __res_state *__res_state(void)
  *****************************************************************/
 int res_ninit(res_state statp)
 {
-  int i;
+  int i, cachesize = CACHE_DEFSIZE; /* May be changed by get_resolv */
 
   statp->res_h_errno = NETDB_SUCCESS;
    /* Only debug may be set before calling init */
@@ -300,7 +669,8 @@ int res_ninit(res_state statp)
   for (i = 0; i < (int) DIM(statp->dnsrch); i++)  statp->dnsrch[i] = 0;
 
   /* resolv.conf (dns servers & search list)*/
-  get_resolv(statp);
+  get_resolv(statp, &cachesize);
+  cache_resize(cachesize);
   /* Get dns servers and search list from an os-specific routine, set os_query */
   get_dns_info(statp);
 
@@ -710,17 +1080,23 @@ int res_nquery( res_state statp, const char * DomName, int Class, int Type,
   DPRINTF(statp->options & RES_DEBUG, "query \"%s\" type %d\n", DomName, Type);
   statp->res_h_errno = NETDB_SUCCESS;
 
+  if (cache_lookup(statp, DomName, Class, Type, AnsPtr, AnsLength, &len))
+    return len;
+
   /* If a hook exists to a native implementation, use it */
   if (statp->os_query) {
     if (AnsLength >= 2)
         memset(AnsPtr, 0/*Id*/, 2);
-    return ((os_query_t *) statp->os_query)(statp, DomName, Class, Type, AnsPtr, AnsLength);
+    len = ((os_query_t *) statp->os_query)(statp, DomName, Class, Type, AnsPtr, AnsLength);
   }
-
-  if ((len = res_nmkquery (statp, QUERY, DomName, Class, Type,
-			   0, 0, 0, packet, PACKETSZ)) < 0)
-    return -1;
-  return res_nsend( statp, packet, len, AnsPtr, AnsLength);
+  else {
+    if ((len = res_nmkquery (statp, QUERY, DomName, Class, Type,
+			     0, 0, 0, packet, PACKETSZ)) < 0)
+      return -1;
+    len = res_nsend( statp, packet, len, AnsPtr, AnsLength);
+  }
+  cache_store(statp, DomName, Class, Type, AnsPtr, AnsLength, len);
+  return len;
 }
 
 int res_query( const char * DomName, int Class, int Type, unsigned char * AnsPtr, int AnsLength)
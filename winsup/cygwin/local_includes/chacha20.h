@@ -0,0 +1,93 @@
+/* chacha20.h: ChaCha20 keystream generator, as specified in RFC 8439.
+
+This file is part of Cygwin.
+
+This software is a copyrighted work licensed under the terms of the
+Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
+details. */
+
+/* This header is plain C and only depends on the C library, so the
+   known-answer test in winsup/testsuite/winsup.api/chacha20.c can be built
+   and run on any host. */
+
+#ifndef _CHACHA20_H
+#define _CHACHA20_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CHACHA20_KEYSIZE	32
+#define CHACHA20_NONCESIZE	12
+#define CHACHA20_BLOCKSIZE	64
+
+#define CHACHA20_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define CHACHA20_QR(a, b, c, d) \
+  do { \
+    a += b; d ^= a; d = CHACHA20_ROTL (d, 16); \
+    c += d; b ^= c; b = CHACHA20_ROTL (b, 12); \
+    a += b; d ^= a; d = CHACHA20_ROTL (d, 8); \
+    c += d; b ^= c; b = CHACHA20_ROTL (b, 7); \
+  } while (0)
+
+static inline uint32_t
+chacha20_load32 (const uint8_t *p)
+{
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8)
+	 | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline void
+chacha20_store32 (uint8_t *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+/* Write nblocks blocks of the keystream of key and nonce to out, starting
+   with block counter. */
+static inline void
+chacha20_keystream (uint8_t *out, size_t nblocks, const uint8_t *key,
+		    uint32_t counter, const uint8_t *nonce)
+{
+  uint32_t in[16], x[16];
+  int i;
+
+  /* "expand 32-byte k" */
+  in[0] = 0x61707865;
+  in[1] = 0x3320646e;
+  in[2] = 0x79622d32;
+  in[3] = 0x6b206574;
+  for (i = 0; i < 8; i++)
+    in[4 + i] = chacha20_load32 (key + 4 * i);
+  in[12] = counter;
+  for (i = 0; i < 3; i++)
+    in[13 + i] = chacha20_load32 (nonce + 4 * i);
+
+  while (nblocks-- > 0)
+    {
+      memcpy (x, in, sizeof x);
+      for (i = 0; i < 10; i++)
+	{
+	  CHACHA20_QR (x[0], x[4], x[8], x[12]);
+	  CHACHA20_QR (x[1], x[5], x[9], x[13]);
+	  CHACHA20_QR (x[2], x[6], x[10], x[14]);
+	  CHACHA20_QR (x[3], x[7], x[11], x[15]);
+	  CHACHA20_QR (x[0], x[5], x[10], x[15]);
+	  CHACHA20_QR (x[1], x[6], x[11], x[12]);
+	  CHACHA20_QR (x[2], x[7], x[8], x[13]);
+	  CHACHA20_QR (x[3], x[4], x[9], x[14]);
+	}
+      for (i = 0; i < 16; i++)
+	chacha20_store32 (out + 4 * i, x[i] + in[i]);
+      out += CHACHA20_BLOCKSIZE;
+      in[12]++;
+    }
+  memset (x, 0, sizeof x);
+  memset (in, 0, sizeof in);
+}
+
+#endif /* _CHACHA20_H */
@@ -120,6 +120,18 @@ public:
 
 class fhandler_base;
 
+/* Process state to set up in a child started by posix_spawn without
+   forking.  See __posix_spawn_nofork in spawn.cc. */
+struct spawn_setup
+{
+  int flags;		/* POSIX_SPAWN_* flags */
+  pid_t pgroup;		/* POSIX_SPAWN_SETPGROUP */
+  sigset_t sigmask;	/* POSIX_SPAWN_SETSIGMASK */
+  sigset_t sigdefault;	/* POSIX_SPAWN_SETSIGDEF */
+  int nfds;		/* Number of entries in fdmap, 0 if fds are unchanged */
+  int *fdmap;		/* Parent fd showing up as fd i in the child, or -1 */
+};
+
 class cygheap_exec_info
 {
 public:
@@ -128,6 +140,7 @@ public:
   int envc;
   char **envp;
   HANDLE myself_pinfo;
+  spawn_setup setup;
   int nchildren;
   cchildren children[0];
   static cygheap_exec_info *alloc ();
@@ -190,7 +203,7 @@ public:
   bool has_execed_cygwin () const { return iscygwin () && has_execed (); }
   operator HANDLE& () {return hExeced;}
   int worker (const char *, const char *const *, const char *const [],
-		     int, int = -1, int = -1);
+		     int, int = -1, int = -1, const spawn_setup * = NULL);
 };
 
 extern child_info_spawn ch_spawn;
@@ -490,6 +490,43 @@ struct mini_cygheap
 
 #define NBUCKETS 40
 
+/* Pools of cygheap blocks for fhandlers, see cpalloc in mm/cygheap.cc. */
+#define CPOOL_LINE	64	/* Slot data is aligned to a cache line. */
+#define CPOOL_MAXSIZE	16384	/* Bigger slots are not pooled. */
+
+struct cpool_slab
+{
+  cpool_slab *next;
+  char *slots;
+  unsigned nslots;
+};
+
+struct cpool
+{
+  SRWLOCK lock;
+  unsigned size;		/* Slot size including the block headers. */
+  unsigned nslabs;
+  unsigned nslots;
+  unsigned nfree;		/* Slots in the depot. */
+  unsigned long refills;	/* Thread caches refilled from the depot. */
+  unsigned long flushes;	/* Thread caches flushed to the depot. */
+  void *depot;			/* Free slots not cached by any thread. */
+  cpool_slab *slabs;
+};
+
+struct cpool_info
+{
+  SRWLOCK lock;			/* Held while adding a pool. */
+  LONG epoch;			/* Invalidates the thread caches. */
+  LONG unpooled;		/* Allocations too big for a pool. */
+  unsigned npools;
+  /* Pool index + 1 by slot size / CPOOL_LINE, 0 if there's no pool yet. */
+  unsigned char index[CPOOL_MAXSIZE / CPOOL_LINE + 1];
+  cpool pool[CPOOL_MAX];
+};
+
+#define INODE_LIST_BUCKETS 32	/* Power of 2 */
+
 struct threadlist_t
 {
   struct _cygtls *thread;
@@ -502,6 +539,7 @@ struct init_cygheap: public mini_cygheap
 {
   _cmalloc_entry *chain;
   char *buckets[NBUCKETS];
+  cpool_info cpools;
   UNICODE_STRING installation_root;
   WCHAR installation_root_buf[PATH_MAX];
   UNICODE_STRING installation_dir;
@@ -515,6 +553,7 @@ struct init_cygheap: public mini_cygheap
   cygheap_user user;
   user_heap_info user_heap;
   shared_region_info shared_regions;
+  ULONG user_shared_key;	/* fstab_stamp key in the user shared name */
   mode_t umask;
   LONG rlim_as_id;
   unsigned long rlim_core;
@@ -532,7 +571,7 @@ struct init_cygheap: public mini_cygheap
   pid_t pid;			/* my pid */
   struct {			/* Equivalent to using LIST_HEAD. */
     struct inode_t *lh_first;
-  } inode_list;			/* Global inode pointer for adv. locking. */
+  } inode_list[INODE_LIST_BUCKETS]; /* Hashed inode lists for adv. locking. */
   hook_chain hooks;
   void close_ctty ();
   void init_installation_root ();
@@ -542,6 +581,7 @@ struct init_cygheap: public mini_cygheap
   threadlist_t *find_tls (_cygtls *);
   threadlist_t *find_tls (int, bool&);
   sigset_t compute_sigblkmask ();
+  void sample_threads (void (*) (_cygtls *));
   void unlock_tls (threadlist_t *t) { if (t) ReleaseMutex (t->mutex); }
 };
 
@@ -618,12 +658,10 @@ public:
   {
     if (lockit)
       cygheap->fdtab.lock ();
-    if (fd >= 0 && fd < (int) cygheap->fdtab.size && cygheap->fdtab[fd] != NULL)
+    if ((fh = cygheap->fdtab.get_ref (fd)))
       {
 	this->fd = fd;
 	locked = lockit;
-	fh = cygheap->fdtab[fd];
-	fh->inc_refcnt ();
       }
     else
       {
@@ -633,7 +671,6 @@ public:
 	if (lockit)
 	  cygheap->fdtab.unlock ();
 	locked = false;
-	fh = NULL;
       }
   }
   ~cygheap_fdget ()
@@ -641,10 +678,17 @@ public:
     if (fh && fh->dec_refcnt () <= 0)
       {
 	debug_only_printf ("deleting fh %p", fh);
+	cygheap->fdtab.synchronize ();
 	delete fh;
       }
   }
   void release () { cygheap->fdtab.release (fd); }
+  /* The fhandler referenced by this object, even if another thread closed
+     fd in the meantime. */
+  operator fhandler_base* &() {return fh;}
+  operator fhandler_socket* () const {return reinterpret_cast<fhandler_socket *> (fh);}
+  operator fhandler_pipe* () const {return reinterpret_cast<fhandler_pipe *> (fh);}
+  fhandler_base *operator -> () const {return fh;}
 };
 
 class cygheap_fdenum : public cygheap_fdmanip
@@ -671,5 +715,7 @@ class cygheap_fdenum : public cygheap_fdmanip
 };
 
 void cygheap_fixup_in_child (bool);
+void cpool_flush (_cygtls *);
+size_t cpool_format (char *);
 void cygheap_init ();
 void setup_cygheap ();
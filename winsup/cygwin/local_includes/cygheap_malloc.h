@@ -37,6 +37,11 @@ enum cygheap_types
   HEAP_3_FHANDLER
 };
 
+/* Max. number of fhandler pools and max. number of free slots a thread
+   caches per pool.  See cpalloc in mm/cygheap.cc. */
+#define CPOOL_MAX	16
+#define CPOOL_MAG	8
+
 extern "C" {
 void cfree (void *);
 void *cmalloc (cygheap_types, size_t);
@@ -45,6 +50,7 @@ void *ccalloc (cygheap_types, size_t, size_t);
 void *cmalloc_abort (cygheap_types, size_t);
 void *crealloc_abort (void *, size_t);
 void *ccalloc_abort (cygheap_types, size_t, size_t);
+void *cpalloc (cygheap_types, size_t);
 PWCHAR cwcsdup (PCWSTR);
 PWCHAR cwcsdup1 (PCWSTR);
 char *cstrdup (const char *);
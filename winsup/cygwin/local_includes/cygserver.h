@@ -45,6 +45,7 @@ protected:
     CYGSERVER_REQUEST_SHM,
     CYGSERVER_REQUEST_SETPWD,
     CYGSERVER_REQUEST_PWDGRP,
+    CYGSERVER_REQUEST_MULTIPLEX,
     CYGSERVER_REQUEST_LAST
   } request_code_t;
 
@@ -63,7 +64,7 @@ protected:
 
 public:
 #ifndef __INSIDE_CYGWIN__
-  static void handle_request (transport_layer_base *, process_cache *);
+  static bool handle_request (transport_layer_base *, process_cache *);
 #endif
 
   client_request (request_code_t request_code,
@@ -89,6 +90,10 @@ private:
   void * const _buf;
   const size_t _buflen;
 
+#ifdef __INSIDE_CYGWIN__
+  int send_multiplexed ();
+#endif
+
 #ifndef __INSIDE_CYGWIN__
   void handle (transport_layer_base *, process_cache *);
   virtual void serve (transport_layer_base *, process_cache *) = 0;
@@ -139,6 +144,28 @@ private:
 
 #endif /* !__INSIDE_CYGWIN__ */
 
+/*---------------------------------------------------------------------------*
+ * class client_request_multiplex
+ *
+ * Turns the connection it is sent on into the persistent connection of
+ * the client process, see transport_mux.cc.
+ *---------------------------------------------------------------------------*/
+
+class client_request_multiplex : public client_request
+{
+public:
+  client_request_multiplex ();
+
+#ifdef __INSIDE_CYGWIN__
+  bool start (transport_layer_base *);
+#endif
+
+private:
+#ifndef __INSIDE_CYGWIN__
+  virtual void serve (transport_layer_base *, process_cache *);
+#endif
+};
+
 /*---------------------------------------------------------------------------*
  * class client_request_attach_tty
  *---------------------------------------------------------------------------*/
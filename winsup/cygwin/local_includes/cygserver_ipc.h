@@ -29,7 +29,162 @@ struct proc {
   HANDLE signal_arrived;
 };
 
+/*
+ * Semaphore sets and message queues live in sections shared between
+ * cygserver and the clients allowed to read and alter them.  Their lock
+ * word holds the Windows PID of the owner, so a lock left behind by a
+ * process which died while holding it can be broken.  The lock is only
+ * held for a few instructions and never while blocking.
+ */
+inline bool
+ipc_shlock_owner_dead (DWORD winpid)
+{
+  HANDLE h = OpenProcess (SYNCHRONIZE, FALSE, winpid);
+  if (!h)
+    return GetLastError () == ERROR_INVALID_PARAMETER;
+  bool dead = WaitForSingleObject (h, 0) == WAIT_OBJECT_0;
+  CloseHandle (h);
+  return dead;
+}
+
+inline void
+ipc_shlock (volatile LONG *lock)
+{
+  const LONG me = (LONG) GetCurrentProcessId ();
+  LONG owner;
+
+  for (unsigned spins = 0;
+       (owner = InterlockedCompareExchange (lock, me, 0)) != 0; ++spins)
+    {
+      if (spins < 128)
+	YieldProcessor ();
+      else if (spins % 256)
+	SwitchToThread ();
+      else if (owner != me && ipc_shlock_owner_dead (owner)
+	       && InterlockedCompareExchange (lock, me, owner) == owner)
+	break;
+    }
+}
+
+/* Only release the lock if it's still ours, see ipc_shlock_server. */
+inline void
+ipc_shunlock (volatile LONG *lock)
+{
+  InterlockedCompareExchange (lock, 0, (LONG) GetCurrentProcessId ());
+}
+
+#ifndef __INSIDE_CYGWIN__
+/*
+ * cygserver must not wait indefinitely for a lock word which clients can
+ * set at will, least of all while holding one of its global mutexes.  It
+ * waits a bounded number of rounds for the owner, then takes the lock
+ * over.  Server threads only take the lock of an object while holding its
+ * mutex, so they never take it from each other.  A client stalling that
+ * long while holding the lock, or forging an owner, can only corrupt the
+ * one object it has write access to anyway.
+ */
+#define IPC_SHLOCK_SERVER_SPINS	4096
+
+inline void
+ipc_shlock_server (volatile LONG *lock)
+{
+  const LONG me = (LONG) GetCurrentProcessId ();
+  LONG owner;
+
+  for (unsigned spins = 0;
+       (owner = InterlockedCompareExchange (lock, me, 0)) != 0; ++spins)
+    {
+      if (spins < 128)
+	YieldProcessor ();
+      else if (spins < IPC_SHLOCK_SERVER_SPINS)
+	SwitchToThread ();
+      else if (InterlockedCompareExchange (lock, me, owner) == owner)
+	break;
+    }
+}
+#endif /* !__INSIDE_CYGWIN__ */
+
 #ifdef __INSIDE_CYGWIN__
+/* The sections of semaphore sets and message queues mapped into this
+   process, see sem.cc and msg.cc.  An entry without view means that
+   cygserver didn't hand out the section, so the id always takes the slow
+   path.  Instances must be NO_COPY, the views don't survive fork. */
+#define IPC_SHMAP_SIZE	32
+
+class ipc_shmap
+{
+  SRWLOCK lock;
+  unsigned next;
+  struct
+  {
+    bool used;
+    int id;
+    void *view;
+  } map[IPC_SHMAP_SIZE];
+
+  void drop (unsigned i)
+  {
+    if (map[i].view)
+      UnmapViewOfFile (map[i].view);
+    map[i].used = false;
+    map[i].view = NULL;
+  }
+
+public:
+  /* Returns true with the lock held shared if id is known.  Call release
+     when done with the view. */
+  bool find (int id, void *&view)
+  {
+    AcquireSRWLockShared (&lock);
+    for (unsigned i = 0; i < IPC_SHMAP_SIZE; ++i)
+      if (map[i].used && map[i].id == id)
+	{
+	  view = map[i].view;
+	  return true;
+	}
+    ReleaseSRWLockShared (&lock);
+    return false;
+  }
+  void release () { ReleaseSRWLockShared (&lock); }
+
+  /* Map the section hdl as returned by cygserver, or remember the failure
+     if hdl is NULL.  hdl is closed, the view keeps the section alive. */
+  void add (int id, HANDLE hdl)
+  {
+    unsigned i, slot = IPC_SHMAP_SIZE;
+
+    AcquireSRWLockExclusive (&lock);
+    for (i = 0; i < IPC_SHMAP_SIZE; ++i)
+      if (map[i].used && map[i].id == id)
+	break;
+      else if (!map[i].used && slot == IPC_SHMAP_SIZE)
+	slot = i;
+    if (i == IPC_SHMAP_SIZE)
+      {
+	if (slot == IPC_SHMAP_SIZE)
+	  drop (slot = next++ % IPC_SHMAP_SIZE);
+	map[slot].used = true;
+	map[slot].id = id;
+	map[slot].view = hdl ? MapViewOfFile (hdl, FILE_MAP_READ
+						    | FILE_MAP_WRITE,
+					      0, 0, 0)
+			     : NULL;
+      }
+    ReleaseSRWLockExclusive (&lock);
+    if (hdl)
+      CloseHandle (hdl);
+  }
+
+  void remove (int id)
+  {
+    AcquireSRWLockExclusive (&lock);
+    for (unsigned i = 0; i < IPC_SHMAP_SIZE; ++i)
+      if (map[i].used && map[i].id == id)
+	drop (i);
+    ReleaseSRWLockExclusive (&lock);
+  }
+};
+
 #include "sigproc.h"
 extern inline void
 ipc_set_proc_info (proc &blk, bool in_fork = false)
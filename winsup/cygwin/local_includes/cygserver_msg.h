@@ -24,6 +24,220 @@ class transport_layer_base;
 class process_cache;
 #endif
 
+/* Message header, as kept in the shared section of its queue. */
+struct msq_hdr {
+  int	  next;			/* next message on queue or free list */
+  int	  spot;			/* first segment of the message */
+  long	  type;			/* type of the message */
+  size_t  ts;			/* size of the message */
+};
+
+/*
+ * Shared section of a message queue.  cygserver maps it for the lifetime
+ * of the queue, clients with read and write permission map it on their
+ * first msgsnd or msgrcv and send and receive messages on their own as
+ * long as they don't have to wait.  The message headers, the segment map
+ * and the segment pool follow the structure.  Everything below lock is
+ * protected by it.
+ */
+struct msq_shared {
+  LONG	    lock;		/* see ipc_shlock */
+  LONG	    removed;		/* set by IPC_RMID and IPC_SET */
+  LONG	    rcv_waiters;	/* # of msgrcv sleeping in cygserver */
+  LONG	    snd_waiters;	/* # of msgsnd sleeping in cygserver */
+  msglen_t  qbytes;		/* max # of bytes on queue */
+  msglen_t  cbytes;		/* # of bytes on queue */
+  msgqnum_t qnum;		/* # of messages on queue */
+  pid_t	    lspid;		/* pid of last msgsnd */
+  pid_t	    lrpid;		/* pid of last msgrcv */
+  time_t    stime;		/* last msgsnd time */
+  time_t    rtime;		/* last msgrcv time */
+  int	    ssz;		/* size of a segment */
+  int	    nhdrs;		/* # of message headers */
+  int	    nsegs;		/* # of segments */
+  int	    first;		/* first message on queue, -1 if empty */
+  int	    last;		/* last message on queue, -1 if empty */
+  int	    free_hdrs;		/* first free message header, -1 if none */
+  int	    free_segs;		/* first free segment, -1 if none */
+  int	    nfree_segs;		/* # of free segments */
+};
+
+#define MSQ_SHARED_SIZE(nhdrs, nsegs, ssz) \
+  (sizeof (struct msq_shared) + (nhdrs) * sizeof (struct msq_hdr) \
+   + (nsegs) * (sizeof (int) + (ssz)))
+
+/* Operations on the section of a queue, called with its lock held.
+   cygserver passes its own idea of the geometry, so a client scribbling
+   over the section can't make it access memory outside of it.  Indices
+   out of range end a list. */
+class msq_arena
+{
+  struct msq_shared *sh;
+  int nhdrs, nsegs, ssz;
+
+  struct msq_hdr *hdrs () const { return (struct msq_hdr *) (sh + 1); }
+  int *segmap () const { return (int *) (hdrs () + nhdrs); }
+  char *pool () const { return (char *) (segmap () + nsegs); }
+  bool hdr_ok (int ix) const { return ix >= 0 && ix < nhdrs; }
+
+public:
+  msq_arena (struct msq_shared *_sh, int _nhdrs, int _nsegs, int _ssz)
+  : sh (_sh), nhdrs (_nhdrs), nsegs (_nsegs), ssz (_ssz) {}
+  msq_arena (struct msq_shared *_sh)
+  : sh (_sh), nhdrs (_sh->nhdrs), nsegs (_sh->nsegs), ssz (_sh->ssz) {}
+
+  bool seg_ok (int seg) const { return seg >= 0 && seg < nsegs; }
+  char *seg_addr (int seg) const { return pool () + seg * ssz; }
+  int seg_next (int seg) const { return segmap ()[seg]; }
+  struct msq_hdr *hdr (int ix) const { return hdrs () + ix; }
+
+  /* Set up a freshly created, zeroed section. */
+  void init (msglen_t qbytes)
+  {
+    sh->qbytes = qbytes;
+    sh->ssz = ssz;
+    sh->nhdrs = nhdrs;
+    sh->nsegs = nsegs;
+    sh->first = sh->last = -1;
+    for (int i = 0; i < nhdrs; ++i)
+      hdrs ()[i].next = i + 1 < nhdrs ? i + 1 : -1;
+    sh->free_hdrs = nhdrs ? 0 : -1;
+    for (int i = 0; i < nsegs; ++i)
+      segmap ()[i] = i + 1 < nsegs ? i + 1 : -1;
+    sh->free_segs = nsegs ? 0 : -1;
+    sh->nfree_segs = nsegs;
+  }
+
+  int segs_needed (size_t ts) const { return (ts + ssz - 1) / ssz; }
+
+  /* Is there room for a message of size ts? */
+  bool fits (size_t ts) const
+  {
+    return ts + sh->cbytes <= sh->qbytes && hdr_ok (sh->free_hdrs)
+	   && segs_needed (ts) <= sh->nfree_segs;
+  }
+
+  /* Allocate header and segments for a message of size ts, fits must have
+     returned true.  Returns the header, or -1. */
+  int alloc (long type, size_t ts)
+  {
+    int ix = sh->free_hdrs;
+    if (!hdr_ok (ix))
+      return -1;
+    struct msq_hdr *h = hdr (ix);
+    sh->free_hdrs = h->next;
+    h->next = -1;
+    h->spot = -1;
+    h->type = type;
+    h->ts = ts;
+    int *tail = &h->spot;
+    for (int n = segs_needed (ts); n > 0; --n)
+      {
+	int seg = sh->free_segs;
+	if (!seg_ok (seg))
+	  {
+	    discard (ix);
+	    return -1;
+	  }
+	sh->free_segs = segmap ()[seg];
+	--sh->nfree_segs;
+	segmap ()[seg] = -1;
+	*tail = seg;
+	tail = &segmap ()[seg];
+      }
+    return ix;
+  }
+
+  /* Return header ix and its segments to the free lists. */
+  void discard (int ix)
+  {
+    if (!hdr_ok (ix))
+      return;
+    struct msq_hdr *h = hdr (ix);
+    for (int seg = h->spot, n = nsegs; seg_ok (seg) && n > 0; --n)
+      {
+	int next = segmap ()[seg];
+	segmap ()[seg] = sh->free_segs;
+	sh->free_segs = seg;
+	++sh->nfree_segs;
+	seg = next;
+      }
+    h->spot = -1;
+    h->type = 0;
+    h->next = sh->free_hdrs;
+    sh->free_hdrs = ix;
+  }
+
+  /* Append message ix to the queue. */
+  void link (int ix)
+  {
+    hdr (ix)->next = -1;
+    if (hdr_ok (sh->last))
+      hdr (sh->last)->next = ix;
+    else
+      sh->first = ix;
+    sh->last = ix;
+    sh->cbytes += hdr (ix)->ts;
+    ++sh->qnum;
+  }
+
+  /* Find the first message matching msgtyp as msgrcv does.  Returns its
+     header, or -1, and its predecessor in prev. */
+  int find (long msgtyp, int &prev) const
+  {
+    prev = -1;
+    for (int ix = sh->first, n = nhdrs; hdr_ok (ix) && n > 0; --n)
+      {
+	if (msgtyp == 0 || msgtyp == hdr (ix)->type
+	    || hdr (ix)->type <= -msgtyp)
+	  return ix;
+	prev = ix;
+	ix = hdr (ix)->next;
+      }
+    return -1;
+  }
+
+  /* Take message ix, as returned by find, off the queue. */
+  void unlink (int ix, int prev)
+  {
+    int next = hdr (ix)->next;
+    if (hdr_ok (prev))
+      hdr (prev)->next = next;
+    else
+      sh->first = next;
+    if (sh->last == ix)
+      sh->last = prev;
+    sh->cbytes -= hdr (ix)->ts;
+    --sh->qnum;
+  }
+
+  /* Copy the message body from buf into the segments of ix, or up to len
+     bytes of it from the segments to buf. */
+  void put (int ix, const char *buf)
+  {
+    size_t len = hdr (ix)->ts;
+    for (int seg = hdr (ix)->spot; len > 0 && seg_ok (seg);
+	 seg = seg_next (seg))
+      {
+	size_t tlen = len > (size_t) ssz ? ssz : len;
+	memcpy (seg_addr (seg), buf, tlen);
+	buf += tlen;
+	len -= tlen;
+      }
+  }
+  void get (int ix, char *buf, size_t len) const
+  {
+    for (int seg = hdr (ix)->spot; len > 0 && seg_ok (seg);
+	 seg = seg_next (seg))
+      {
+	size_t tlen = len > (size_t) ssz ? ssz : len;
+	memcpy (buf, seg_addr (seg), tlen);
+	buf += tlen;
+	len -= tlen;
+      }
+  }
+};
+
 class client_request_msg : public client_request
 {
   friend class client_request;
@@ -34,7 +248,10 @@ public:
       MSGOP_msgctl,
       MSGOP_msgget,
       MSGOP_msgrcv,
-      MSGOP_msgsnd
+      MSGOP_msgsnd,
+      MSGOP_msgmap,	/* Get the shared section of a queue. */
+      MSGOP_msgwakeup	/* Wake up waiters after a client side send or
+			   receive. */
     };
 
 private:
@@ -53,9 +270,12 @@ private:
       };
     } in;
 
-    union {
-      int ret;
-      ssize_t rcv;
+    struct {
+      union {
+	int ret;
+	ssize_t rcv;
+      };
+      vm_object_t obj;
     } out;
   } _parameters;
 
@@ -71,19 +291,23 @@ public:
   client_request_msg (key_t, int);			// msgget
   client_request_msg (int, void *, size_t, long, int);	// msgrcv
   client_request_msg (int, const void *, size_t, int);	// msgsnd
+  client_request_msg (msgop_t, int);			// msgmap, msgwakeup
 #endif
 
   int retval () const { return msglen () ? _parameters.out.ret : -1; }
   ssize_t rcvval () const { return _parameters.out.rcv; }
+  vm_object_t objval () const { return _parameters.out.obj; }
 };
 
 #ifndef __INSIDE_CYGWIN__
-int msginit ();
+void msginit ();
 int msgunload ();
 int msgctl (struct thread *, struct msgctl_args *);
 int msgget (struct thread *, struct msgget_args *);
 int msgsnd (struct thread *, struct msgsnd_args *);
 int msgrcv (struct thread *, struct msgrcv_args *);
+int msgmap (struct thread *, struct msgctl_args *);
+int msgwakeup (struct thread *, struct msgctl_args *);
 #endif
 
 #endif /* __CYGSERVER_MSG_H__ */
@@ -24,6 +24,32 @@ class transport_layer_base;
 class process_cache;
 #endif
 
+/* Semaphore, as kept in the shared section of its set. */
+struct sem {
+  u_short semval;		/* semaphore value */
+  pid_t	  sempid;		/* pid of last operation */
+  u_short semncnt;		/* # awaiting semval > cval */
+  u_short semzcnt;		/* # awaiting semval = 0 */
+};
+
+/*
+ * Shared section of a semaphore set.  cygserver maps it for the lifetime
+ * of the set, clients with read and alter permission map it on their first
+ * semop and perform the operations which neither block, nor need SEM_UNDO
+ * on their own.  Everything below lock is protected by it.
+ */
+struct sem_shared {
+  LONG	  lock;			/* see ipc_shlock */
+  LONG	  removed;		/* set by IPC_RMID and IPC_SET */
+  int	  semvmx;		/* copy of seminfo.semvmx */
+  u_short nsems;		/* # of semaphores in set */
+  time_t  otime;		/* last semop time */
+  struct sem base[0];		/* the semaphores */
+};
+
+#define SEM_SHARED_SIZE(nsems) \
+  (sizeof (struct sem_shared) + (nsems) * sizeof (struct sem))
+
 class client_request_sem : public client_request
 {
   friend class client_request;
@@ -33,7 +59,9 @@ public:
     {
       SEMOP_semctl,
       SEMOP_semget,
-      SEMOP_semop
+      SEMOP_semop,
+      SEMOP_semmap,	/* Get the shared section of a set. */
+      SEMOP_semwakeup	/* Wake up waiters after a client side semop. */
     };
 
 private:
@@ -51,8 +79,9 @@ private:
       };
     } in;
 
-    union {
+    struct {
       int ret;
+      vm_object_t obj;
     } out;
   } _parameters;
 
@@ -67,19 +96,23 @@ public:
   client_request_sem (int, int, int, union semun *);	// semctl
   client_request_sem (key_t, int, int);			// semget
   client_request_sem (int, struct sembuf *, size_t);	// semop
+  client_request_sem (semop_t, int);			// semmap, semwakeup
 #endif
 
   int retval () const { return msglen () ? _parameters.out.ret : -1; }
+  vm_object_t objval () const { return _parameters.out.obj; }
 };
 
 #ifndef __INSIDE_CYGWIN__
-int seminit ();
+void seminit ();
 int semunload ();
 void semexit_myhook(void *arg, struct proc *p);
 
 int semctl (struct thread *, struct semctl_args *);
 int semget (struct thread *, struct semget_args *);
 int semop (struct thread *, struct semop_args *);
+int semmap (struct thread *, struct semctl_args *);
+int semwakeup (struct thread *, struct semctl_args *);
 #endif
 
 #endif /* __CYGSERVER_SEM_H__ */
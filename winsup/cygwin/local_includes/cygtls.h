@@ -29,6 +29,8 @@ details. */
 #define TLS_STACK_SIZE 256
 
 #include "cygthread.h"
+#include "cygheap_malloc.h"
+#include "chacha20.h"
 
 #define TP_NUM_C_BUFS 50
 #define TP_NUM_W_BUFS 50
@@ -84,6 +86,24 @@ public:
   };
 };
 
+/* Free fhandler slots cached by a thread, see cpalloc in mm/cygheap.cc. */
+struct cpool_cache
+{
+  LONG epoch;
+  unsigned char count[CPOOL_MAX];
+  void *slots[CPOOL_MAX];
+};
+
+/* Per-thread state of the ChaCha20 generator, see libc/arc4random.cc. */
+struct chacha20_state
+{
+  DWORD winpid;			/* Process the key has been seeded in. */
+  uint32_t avail;		/* Unused bytes at the end of buf. */
+  size_t count;			/* Bytes left until the next reseed. */
+  uint8_t key[CHACHA20_KEYSIZE];
+  uint8_t buf[4 * CHACHA20_BLOCKSIZE];
+};
+
 struct _local_storage
 {
   /* passwd.cc */
@@ -105,6 +125,7 @@ struct _local_storage
   /* select.cc */
   struct {
     HANDLE  sockevt;
+    HANDLE  afdevt;
     int     max_w4;
     LONG   *ser_num;			// note: malloced
     HANDLE *w4;				// note: malloced
@@ -137,6 +158,12 @@ struct _local_storage
   HANDLE cw_timer;
   bool cw_timer_inuse;
 
+  /* cygheap.cc */
+  cpool_cache cpool;
+
+  /* arc4random.cc */
+  chacha20_state chacha20;
+
   tls_pathbuf pathbufs;
   char ttybuf[32];
 };
@@ -17,6 +17,8 @@ details. */
 class suffix_info;
 
 #define BFH_OPTS (PC_NULLEMPTY | PC_FULL | PC_POSIX)
+#define DTABLE_LOOKUP_STRIPES 16	/* Power of 2 */
+
 class dtable
 {
   fhandler_base **fds;
@@ -26,10 +28,18 @@ class dtable
   static const int initial_archetype_size = 8;
   size_t first_fd_for_open;
   int cnt_need_fixup_before;
+  /* Lookups in progress by generation and CPU, see get_ref. */
+  struct
+  {
+    LONG count;
+    char pad[64 - sizeof (LONG)];	/* One cache line each. */
+  } lookups[2][DTABLE_LOOKUP_STRIPES];
+  LONG lookup_gen;
+  void reset_lookups () { memset (lookups, 0, sizeof lookups); }
 public:
   size_t size;
 
-  dtable () : archetypes (NULL), narchetypes (0), farchetype (0), first_fd_for_open(3), cnt_need_fixup_before(0) {}
+  dtable () : archetypes (NULL), narchetypes (0), farchetype (0), first_fd_for_open(3), cnt_need_fixup_before(0), lookups (), lookup_gen (0) {}
   void init () {first_fd_for_open = 3;}
 
   void dec_need_fixup_before ()
@@ -58,9 +68,12 @@ public:
   int find_unused_handle (size_t start);
   int find_unused_handle () { return find_unused_handle (first_fd_for_open);}
   void release (int fd);
+  fhandler_base *get_ref (int fd);
+  void synchronize ();
   void init_std_file_from_handle (int fd, HANDLE handle);
   int dup3 (int oldfd, int newfd, int flags);
   void fixup_after_exec ();
+  void fixup_after_spawn (const int *, int);
   inline fhandler_base *&operator [](int fd) const { return fds[fd]; }
   bool select_read (int fd, select_stuff *);
   bool select_write (int fd, select_stuff *);
@@ -26,6 +26,9 @@ details. */
    so small.  http://cygwin.com/ml/cygwin/2011-03/msg00541.html  */
 #define DEFAULT_PIPEBUFSIZE PREFERRED_IO_BLKSIZE
 
+/* Upper limit of the write chunk size of a pipe set via F_SETPIPE_SZ. */
+#define MAX_PIPEBUFSIZE ((size_t) (8 * 1024 * 1024))
+
 /* Used for fhandler_pipe::create.  Use an available flag which will
    never be used in Cygwin for this function. */
 #define PIPE_ADD_PID	FILE_FLAG_FIRST_PIPE_INSTANCE
@@ -225,6 +228,18 @@ class fhandler_base
  public:
   LONG inc_refcnt () {return InterlockedIncrement (&_refcnt);}
   LONG dec_refcnt () {return InterlockedDecrement (&_refcnt);}
+  /* Take a reference unless the last one has already been dropped. */
+  bool inc_refcnt_if_used ()
+  {
+    LONG cnt = _refcnt, prev;
+
+    while (cnt > 0)
+      if ((prev = InterlockedCompareExchange (&_refcnt, cnt + 1, cnt)) == cnt)
+	return true;
+      else
+	cnt = prev;
+    return false;
+  }
   class fhandler_base *archetype;
   int usecount;
 
@@ -519,7 +534,7 @@ public:
 
   virtual fhandler_base *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_base));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_base));
     fhandler_base *fh = new (ptr) fhandler_base (ptr);
     fh->copy_from (this);
     return fh;
@@ -780,7 +795,7 @@ class fhandler_socket_inet: public fhandler_socket_wsock
 
   fhandler_socket_inet *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_socket_inet));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_socket_inet));
     fhandler_socket_inet *fh = new (ptr) fhandler_socket_inet (ptr);
     fh->copy_from (this);
     return fh;
@@ -880,7 +895,7 @@ class fhandler_socket_local: public fhandler_socket_wsock
 
   fhandler_socket_local *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_socket_local));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_socket_local));
     fhandler_socket_local *fh = new (ptr) fhandler_socket_local (ptr);
     fh->copy_from (this);
     return fh;
@@ -1169,7 +1184,7 @@ class fhandler_socket_unix : public fhandler_socket
 
   fhandler_socket_unix *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_socket_unix));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_socket_unix));
     fhandler_socket_unix *fh = new (ptr) fhandler_socket_unix (ptr);
     fh->copy_from (this);
     return fh;
@@ -1184,6 +1199,7 @@ class fhandler_pipe_fifo: public fhandler_base
  protected:
   size_t pipe_buf_size;
   virtual void release_select_sem (const char *) {};
+  ssize_t raw_write_queued (const void *ptr, size_t len, ULONG chunk);
 
  public:
   fhandler_pipe_fifo ();
@@ -1251,13 +1267,14 @@ public:
 
   fhandler_pipe *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_pipe));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_pipe));
     fhandler_pipe *fh = new (ptr) fhandler_pipe (ptr);
     fh->copy_from (this);
     return fh;
   }
   void set_pipe_non_blocking (bool nonblocking);
   HANDLE get_query_handle () const { return query_hdl; }
+  HANDLE get_read_mtx () const { return read_mtx; }
   void close_query_handle ()
   {
     if (query_hdl)
@@ -1546,7 +1563,7 @@ public:
 
   fhandler_fifo *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_fifo));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_fifo));
     fhandler_fifo *fhf = new (ptr) fhandler_fifo (ptr);
     fhf->copy_from (this);
     fhf->pipe_name_buf = NULL;
@@ -1598,7 +1615,7 @@ class fhandler_dev_raw: public fhandler_base
 
   fhandler_dev_raw *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_dev_raw));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_dev_raw));
     fhandler_dev_raw *fh = new (ptr) fhandler_dev_raw (ptr);
     fh->copy_from (this);
     return fh;
@@ -1618,14 +1635,25 @@ class fhandler_dev_floppy: public fhandler_dev_raw
  private:
   off_t drive_size;
   part_t *partitions;
+  ULONG io_align;		/* Buffer alignment mask of the device. */
+  /* Asynchronous read-ahead into a second buffer of devbufsiz bytes. */
+  HANDLE ra_handle;
+  HANDLE ra_evt;
+  char *ra_bufalloc;
+  char *ra_buf;
+  IO_STATUS_BLOCK ra_io;
+  off_t ra_pos;			/* Device offset of the pending read. */
+  off_t seq_pos;		/* Device offset after the last buffer fill. */
   struct status_flags
   {
     unsigned eom_detected    : 1;
+    unsigned ra_pending      : 1;
    public:
-    status_flags () : eom_detected (0) {}
+    status_flags () : eom_detected (0), ra_pending (0) {}
   } status;
 
   IMPLEMENT_STATUS_FLAG (bool, eom_detected)
+  IMPLEMENT_STATUS_FLAG (bool, ra_pending)
 
   inline off_t get_current_position ();
   int get_drive_info (struct hd_geometry *geo);
@@ -1635,12 +1663,24 @@ class fhandler_dev_floppy: public fhandler_dev_raw
   BOOL write_file (const void *buf, DWORD to_write, DWORD *written, int *err);
   BOOL read_file (void *buf, DWORD to_read, DWORD *read, int *err);
 
+  bool ra_start (off_t pos);
+  DWORD ra_finish ();
+  void ra_cancel ();
+  void ra_close ();
+  void ra_reset ()
+  {
+    ra_handle = ra_evt = NULL;
+    ra_pending (false);
+  }
+
  public:
   fhandler_dev_floppy ();
 
   int open (int flags, mode_t mode = 0);
   int close ();
   int dup (fhandler_base *child, int);
+  void fixup_after_fork (HANDLE);
+  void fixup_after_exec ();
   void raw_read (void *ptr, size_t& ulen);
   ssize_t raw_write (const void *ptr, size_t ulen);
   off_t lseek (off_t offset, int whence);
@@ -1657,7 +1697,7 @@ class fhandler_dev_floppy: public fhandler_dev_raw
 
   fhandler_dev_floppy *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_dev_floppy));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_dev_floppy));
     fhandler_dev_floppy *fh = new (ptr) fhandler_dev_floppy (ptr);
     fh->copy_from (this);
     return fh;
@@ -1705,7 +1745,7 @@ class fhandler_dev_tape: public fhandler_dev_raw
 
   fhandler_dev_tape *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_dev_tape));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_dev_tape));
     fhandler_dev_tape *fh = new (ptr) fhandler_dev_tape (ptr);
     fh->copy_from (this);
     return fh;
@@ -1782,7 +1822,7 @@ class fhandler_disk_file: public fhandler_base
 
   fhandler_disk_file *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_disk_file));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_disk_file));
     fhandler_disk_file *fh = new (ptr) fhandler_disk_file (ptr);
     fh->copy_from (this);
     return fh;
@@ -1818,7 +1858,7 @@ public:
 
   fhandler_dev *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_dev));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_dev));
     fhandler_dev *fh = new (ptr) fhandler_dev (ptr);
     fh->copy_from (this);
     return fh;
@@ -1849,7 +1889,7 @@ class fhandler_cygdrive: public fhandler_disk_file
 
   fhandler_cygdrive *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_cygdrive));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_cygdrive));
     fhandler_cygdrive *fh = new (ptr) fhandler_cygdrive (ptr);
     fh->copy_from (this);
     return fh;
@@ -1908,7 +1948,7 @@ class fhandler_serial: public fhandler_base
 
   fhandler_serial *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_serial));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_serial));
     fhandler_serial *fh = new (ptr) fhandler_serial (ptr);
     fh->copy_from (this);
     return fh;
@@ -2016,7 +2056,7 @@ class fhandler_termios: public fhandler_base
 
   virtual fhandler_termios *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_termios));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_termios));
     fhandler_termios *fh = new (ptr) fhandler_termios (ptr);
     fh->copy_from (this);
     return fh;
@@ -2337,7 +2377,7 @@ private:
 
   fhandler_console *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_console));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_console));
     fhandler_console *fh = new (ptr) fhandler_console (ptr);
     fh->copy_from (this);
     return fh;
@@ -2432,7 +2472,7 @@ class fhandler_pty_common: public fhandler_termios
 
   virtual fhandler_pty_common *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_pty_common));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_pty_common));
     fhandler_pty_common *fh = new (ptr) fhandler_pty_common (ptr);
     fh->copy_from (this);
     return fh;
@@ -2513,7 +2553,7 @@ class fhandler_pty_slave: public fhandler_pty_common
 
   fhandler_pty_slave *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_pty_slave));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_pty_slave));
     fhandler_pty_slave *fh = new (ptr) fhandler_pty_slave (ptr);
     fh->copy_from (this);
     return fh;
@@ -2633,7 +2673,7 @@ public:
 
   fhandler_pty_master *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_pty_master));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_pty_master));
     fhandler_pty_master *fh = new (ptr) fhandler_pty_master (ptr);
     fh->copy_from (this);
     return fh;
@@ -2664,7 +2704,7 @@ class fhandler_dev_null: public fhandler_base
 
   fhandler_dev_null *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_dev_null));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_dev_null));
     fhandler_dev_null *fh = new (ptr) fhandler_dev_null (ptr);
     fh->copy_from (this);
     return fh;
@@ -2700,7 +2740,7 @@ class fhandler_dev_zero: public fhandler_base
 
   fhandler_dev_zero *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_dev_zero));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_dev_zero));
     fhandler_dev_zero *fh = new (ptr) fhandler_dev_zero (ptr);
     fh->copy_from (this);
     return fh;
@@ -2732,7 +2772,7 @@ class fhandler_dev_random: public fhandler_base
 
   fhandler_dev_random *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_dev_random));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_dev_random));
     fhandler_dev_random *fh = new (ptr) fhandler_dev_random (ptr);
     fh->copy_from (this);
     return fh;
@@ -2770,7 +2810,7 @@ class fhandler_dev_clipboard: public fhandler_base
 
   fhandler_dev_clipboard *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_dev_clipboard));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_dev_clipboard));
     fhandler_dev_clipboard *fh = new (ptr) fhandler_dev_clipboard (ptr);
     fh->copy_from (this);
     return fh;
@@ -2808,7 +2848,7 @@ class fhandler_windows: public fhandler_base
 
   fhandler_windows *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_windows));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_windows));
     fhandler_windows *fh = new (ptr) fhandler_windows (ptr);
     fh->copy_from (this);
     return fh;
@@ -2837,7 +2877,7 @@ class fhandler_dev_mixer: public fhandler_base
 
   fhandler_dev_mixer *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_dev_mixer));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_dev_mixer));
     fhandler_dev_mixer *fh = new (ptr) fhandler_dev_mixer (ptr);
     fh->copy_from (this);
     return fh;
@@ -2903,7 +2943,7 @@ class fhandler_dev_dsp: public fhandler_base
 
   fhandler_dev_dsp *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_dev_dsp));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_dev_dsp));
     fhandler_dev_dsp *fh = new (ptr) fhandler_dev_dsp (ptr);
     fh->copy_from (this);
     return fh;
@@ -2963,7 +3003,7 @@ class fhandler_virtual : public fhandler_base
 
   virtual fhandler_virtual *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_virtual));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_virtual));
     fhandler_virtual *fh = new (ptr) fhandler_virtual (ptr);
     fh->copy_from (this);
     return fh;
@@ -2995,7 +3035,7 @@ class fhandler_proc: public fhandler_virtual
 
   virtual fhandler_proc *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_proc));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_proc));
     fhandler_proc *fh = new (ptr) fhandler_proc (ptr);
     fh->copy_from (this);
     return fh;
@@ -3031,7 +3071,7 @@ class fhandler_procsys: public fhandler_virtual
 
   fhandler_procsys *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_procsys));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_procsys));
     fhandler_procsys *fh = new (ptr) fhandler_procsys (ptr);
     fh->copy_from (this);
     return fh;
@@ -3060,7 +3100,7 @@ class fhandler_procsysvipc: public fhandler_proc
 
   fhandler_procsysvipc *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_procsysvipc));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_procsysvipc));
     fhandler_procsysvipc *fh = new (ptr) fhandler_procsysvipc (ptr);
     fh->copy_from (this);
     return fh;
@@ -3091,7 +3131,7 @@ class fhandler_netdrive: public fhandler_virtual
 
   fhandler_netdrive *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_netdrive));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_netdrive));
     fhandler_netdrive *fh = new (ptr) fhandler_netdrive (ptr);
     fh->copy_from (this);
     return fh;
@@ -3132,7 +3172,7 @@ class fhandler_registry: public fhandler_proc
 
   fhandler_registry *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_registry));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_registry));
     fhandler_registry *fh = new (ptr) fhandler_registry (ptr);
     fh->copy_from (this);
     return fh;
@@ -3166,7 +3206,7 @@ class fhandler_process: public fhandler_proc
 
   fhandler_process *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_process));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_process));
     fhandler_process *fh = new (ptr) fhandler_process (ptr);
     fh->copy_from (this);
     return fh;
@@ -3194,7 +3234,7 @@ class fhandler_process_fd : public fhandler_process
 
   fhandler_process_fd *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_process_fd));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_process_fd));
     fhandler_process_fd *fh = new (ptr) fhandler_process_fd (ptr);
     fh->copy_from (this);
     return fh;
@@ -3222,7 +3262,7 @@ class fhandler_procnet: public fhandler_proc
 
   fhandler_procnet *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_procnet));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_procnet));
     fhandler_procnet *fh = new (ptr) fhandler_procnet (ptr);
     fh->copy_from (this);
     return fh;
@@ -3273,7 +3313,7 @@ private:
 
   fhandler_dev_disk *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_dev_disk));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_dev_disk));
     fhandler_dev_disk *fh = new (ptr) fhandler_dev_disk (ptr);
     fh->copy_from (this);
     return fh;
@@ -3300,7 +3340,7 @@ class fhandler_dev_fd: public fhandler_virtual
 
   virtual fhandler_dev_fd *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_dev_fd));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_dev_fd));
     fhandler_dev_fd *fh = new (ptr) fhandler_dev_fd (ptr);
     fh->copy_from (this);
     return fh;
@@ -3340,7 +3380,7 @@ class fhandler_signalfd : public fhandler_base
 
   fhandler_signalfd *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_signalfd));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_signalfd));
     fhandler_signalfd *fh = new (ptr) fhandler_signalfd (ptr);
     fh->copy_from (this);
     return fh;
@@ -3390,7 +3430,7 @@ class fhandler_timerfd : public fhandler_base
 
   fhandler_timerfd *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_timerfd));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_timerfd));
     fhandler_timerfd *fh = new (ptr) fhandler_timerfd (ptr);
     fh->copy_from (this);
     return fh;
@@ -3474,7 +3514,7 @@ public:
 
   fhandler_mqueue *clone (cygheap_types malloc_type = HEAP_FHANDLER)
   {
-    void *ptr = (void *) ccalloc (malloc_type, 1, sizeof (fhandler_mqueue));
+    void *ptr = (void *) cpalloc (malloc_type, sizeof (fhandler_mqueue));
     fhandler_mqueue *fh = new (ptr) fhandler_mqueue (ptr);
     fh->copy_from (this);
     return fh;
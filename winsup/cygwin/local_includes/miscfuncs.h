@@ -102,6 +102,9 @@ ssize_t check_iovec (const struct iovec *, int, bool);
 
 void SetThreadName (DWORD dwThreadID, const char* threadName);
 
+/* Per-thread ChaCha20 generator, see libc/arc4random.cc. */
+bool chacha20_random (void *, size_t);
+
 WORD __get_cpus_per_group (void);
 WORD __get_group_count (void);
 
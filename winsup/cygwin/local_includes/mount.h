@@ -154,6 +154,21 @@ class mount_item
   int build_win32 (char *, const char *, unsigned *, unsigned);
 };
 
+/* Fingerprint of /etc/fstab and /etc/fstab.d/$USER, built from the last
+   write time and size of both files.  It's part of the name of the per-user
+   shared memory region holding the mount table, so processes started after
+   one of the files changed get a freshly parsed mount table, while all other
+   processes just map the table compiled by the first process of the user. */
+class fstab_stamp
+{
+  LARGE_INTEGER mtime[2];
+  LARGE_INTEGER size[2];
+
+ public:
+  fstab_stamp (const char *user);
+  ULONG key () const;
+};
+
 /* Don't change this number willy-nilly.  What we need is to have a more
    dynamic allocation scheme, but the current scheme should be satisfactory
    for a long while yet.  */
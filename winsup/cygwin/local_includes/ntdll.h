@@ -1452,6 +1452,7 @@ extern "C"
 				    PTOKEN_PRIVILEGES, PULONG);
   NTSTATUS NtAllocateLocallyUniqueId (PLUID);
   NTSTATUS NtAssignProcessToJobObject (HANDLE, HANDLE);
+  NTSTATUS NtCancelIoFileEx (HANDLE, PIO_STATUS_BLOCK, PIO_STATUS_BLOCK);
   NTSTATUS NtCancelTimer (HANDLE, PBOOLEAN);
   NTSTATUS NtClose (HANDLE);
   NTSTATUS NtCommitTransaction (HANDLE, BOOLEAN);
@@ -1479,6 +1480,9 @@ extern "C"
   NTSTATUS NtCreateTransaction (PHANDLE, ACCESS_MASK, POBJECT_ATTRIBUTES,
 				LPGUID, HANDLE, ULONG, ULONG, ULONG,
 				PLARGE_INTEGER, PUNICODE_STRING);
+  NTSTATUS NtDeviceIoControlFile (HANDLE, HANDLE, PIO_APC_ROUTINE, PVOID,
+				  PIO_STATUS_BLOCK, ULONG, PVOID, ULONG, PVOID,
+				  ULONG);
   NTSTATUS NtDuplicateToken (HANDLE, ACCESS_MASK, POBJECT_ATTRIBUTES, BOOLEAN,
 			     TOKEN_TYPE, PHANDLE);
   NTSTATUS NtFsControlFile (HANDLE, HANDLE, PIO_APC_ROUTINE, PVOID,
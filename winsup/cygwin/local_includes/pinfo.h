@@ -35,7 +35,8 @@ enum picom
   PICOM_PIPE_FHANDLER = 6,
   PICOM_FILE_PATHCONV = 7,
   PICOM_ENVIRON = 8,
-  PICOM_SIGINFO = 9
+  PICOM_SIGINFO = 9,
+  PICOM_FHPOOLS = 10
 };
 
 #define EXITCODE_SET		0x8000000
@@ -97,6 +98,10 @@ public:
   /* Non-zero if process was stopped by a signal. */
   char stopsig;
 
+  /* fstab_stamp key of the mount table the process uses, so
+     /proc/<pid>/mounts can open the same table. */
+  ULONG mount_key;
+
   inline void set_has_pgid_children ()
   {
     if (pgid == pid)
@@ -115,6 +120,7 @@ public:
   char *cwd (size_t &);
   char *cmdline (size_t &);
   char *environ (size_t &);
+  char *fhpools (size_t &);
   char *win_heap_info (size_t &);
   int siginfo (sigset_t &, sigset_t &, sigset_t &);
   bool set_ctty (class fhandler_termios *, int);
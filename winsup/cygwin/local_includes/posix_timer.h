@@ -17,15 +17,21 @@ class timer_tracker
   clockid_t clock_id;
   sigevent evp;
   struct itimerspec time_spec;
-  HANDLE timer;
-  HANDLE cancel_evt;
-  HANDLE sync_thr;
   LONG64 interval;
   LONG64 exp_ts;
   LONG overrun_count_curr;
   LONG64 overrun_count;
-
-  bool cancel ();
+  /* Managed by timer_queue under its lock. */
+  LONG64 q_due;			/* Next expiry on the clock of the heap. */
+  LONG q_idx;			/* Index in the heap, -1 if not armed. */
+  int q_heap;			/* The heap of the queue holding the timer. */
+
+  void cancel ();
+  bool is_alarm () const { return clock_id == CLOCK_REALTIME_ALARM
+				  || clock_id == CLOCK_BOOTTIME_ALARM; }
+  bool is_realtime () const { return clock_id == CLOCK_REALTIME
+				     || clock_id == CLOCK_REALTIME_COARSE
+				     || clock_id == CLOCK_REALTIME_ALARM; }
 
  public:
   void *operator new (size_t, void *p) __attribute__ ((nothrow)) {return p;}
@@ -47,8 +53,11 @@ class timer_tracker
   int gettime (itimerspec *, bool);
   int settime (int, const itimerspec *, itimerspec *);
 
-  DWORD thread_func ();
+  LONG64 expire ();
   static void fixup_after_fork ();
+
+  friend class timer_heap;
+  friend class timer_queue;
 };
 
 #endif /* __POSIX_TIMER_H__ */
@@ -84,7 +84,13 @@ struct select_socket_info: public select_info
   int num_w4;
   LONG *ser_num;
   HANDLE *w4;
-  select_socket_info (): select_info (), num_w4 (0), ser_num (0), w4 (NULL) {}
+  struct _AFD_POLL_INFO *afd_poll;	/* malloced, NULL if not used */
+  ULONG afd_size;
+  ULONG afd_num;
+  HANDLE afd_event;
+  select_socket_info (): select_info (), num_w4 (0), ser_num (0), w4 (NULL),
+			 afd_poll (NULL), afd_size (0), afd_num (0),
+			 afd_event (NULL) {}
 };
 
 struct select_dsp_info: public select_info
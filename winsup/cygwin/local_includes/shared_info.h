@@ -33,7 +33,7 @@ public:
 /* Data accessible to all tasks */
 
 
-#define CURR_SHARED_MAGIC 0x205f4579U
+#define CURR_SHARED_MAGIC 0x8bd23b10U
 
 #define USER_VERSION   1
 
@@ -89,6 +89,7 @@ HANDLE get_shared_parent_dir ();
 HANDLE get_session_parent_dir ();
 char *shared_name (char *, const char *, int);
 WCHAR *shared_name (WCHAR *, const WCHAR *, int);
+WCHAR *user_shared_name (WCHAR *, const WCHAR *, ULONG);
 void *open_shared (const WCHAR *, int, HANDLE&, DWORD,
 		   shared_locations, PSECURITY_ATTRIBUTES = &sec_all,
 		   DWORD = FILE_MAP_READ | FILE_MAP_WRITE);
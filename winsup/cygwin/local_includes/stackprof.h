@@ -0,0 +1,15 @@
+/* stackprof.h: in-process sampling profiler
+
+  This file is part of Cygwin.
+
+  This software is a copyrighted work licensed under the terms of the
+  Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
+  details. */
+
+#ifndef STACKPROF_H
+#define STACKPROF_H
+
+void stackprof_init ();
+void stackprof_exit ();
+
+#endif /* STACKPROF_H */
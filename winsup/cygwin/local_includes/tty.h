@@ -121,6 +121,12 @@ private:
   UINT term_code_page;
   ULONGLONG fwd_last_time;
   bool fwd_not_empty;
+  /* Statistics of the forwarding thread, see TIOCGFWDSTAT. */
+  ULONGLONG fwd_bytes;
+  ULONGLONG fwd_reads;
+  ULONGLONG fwd_plain_reads;
+  ULONGLONG fwd_time;		/* In 100ns units. */
+  ULONGLONG fwd_max_time;
   HANDLE h_pcon_write_pipe;
   HANDLE h_pcon_condrv_reference;
   HANDLE h_pcon_conhost_process;
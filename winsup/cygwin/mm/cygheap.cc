@@ -63,6 +63,13 @@ static NO_COPY uint32_t nthreads;
 
 #define to_cmalloc(s) ((_cmalloc_entry *) (((char *) (s)) - offsetof (_cmalloc_entry, data)))
 
+/* _cmalloc_entry::b of the slots of fhandler pool n is CPOOL_BUCKET + n,
+   cygheap_entry::type of free slots is CPOOL_FREE. */
+#define CPOOL_BUCKET NBUCKETS
+#define CPOOL_FREE (-1)
+#define CPOOL_HDR (sizeof (_cmalloc_entry) + sizeof (cygheap_entry))
+#define CPOOL_SLAB 16384
+
 #define CFMAP_OPTIONS (SEC_RESERVE | PAGE_READWRITE)
 #define MVMAP_OPTIONS (FILE_MAP_WRITE)
 
@@ -70,6 +77,8 @@ extern "C" {
 static void _cfree (void *);
 static void *_csbrk (int);
 }
+static void cpool_fixup ();
+static void cpool_free (cygheap_entry *, unsigned);
 
 #define nextpage(x) ((char *) roundup2 ((uintptr_t) (x), \
 					wincap.allocation_granularity ()))
@@ -124,6 +133,7 @@ cygheap_fixup_in_child (bool execed)
       else
 	ce->type += HEAP_1_MAX;	/* Mark for freeing after next exec */
     }
+  cpool_fixup ();
 }
 
 void
@@ -401,9 +411,14 @@ _cmalloc (unsigned size)
 static void
 _cfree (void *ptr)
 {
-  cygheap_protect.acquire ();
   _cmalloc_entry *rvc = to_cmalloc (ptr);
   unsigned b = rvc->b;
+  if (b >= CPOOL_BUCKET)
+    {
+      cpool_free ((cygheap_entry *) ptr, b - CPOOL_BUCKET);
+      return;
+    }
+  cygheap_protect.acquire ();
   rvc->ptr = cygheap->buckets[b];
   cygheap->buckets[b] = (char *) rvc;
   cygheap_protect.release ();
@@ -417,7 +432,10 @@ _crealloc (void *ptr, unsigned size)
     newptr = _cmalloc (size);
   else
     {
-      unsigned oldsize = bucket_val[to_cmalloc (ptr)->b];
+      unsigned b = to_cmalloc (ptr)->b;
+      unsigned oldsize = b < CPOOL_BUCKET ? bucket_val[b]
+			 : cygheap->cpools.pool[b - CPOOL_BUCKET].size
+			   - sizeof (_cmalloc_entry);
       if (size <= oldsize)
 	return ptr;
       newptr = _cmalloc (size);
@@ -538,6 +556,286 @@ ccalloc_abort (cygheap_types x, size_t n, size_t size)
   return ccalloc (x, n, size, "ccalloc");
 }
 
+/* Pools of cygheap blocks for fhandlers.
+
+   Every open, socket, pipe or dup allocates an fhandler and every close
+   frees it again.  Taking them from the buckets fragments the cygheap and
+   contends for cygheap_protect, so fhandlers are allocated by cpalloc
+   from pools of equally sized slots, one pool per slot size.  A slot is
+   a normal cygheap block with its data aligned to a cache line, so cfree
+   and crealloc work as usual.  Slots are never returned to the buckets.
+
+   Every thread caches up to CPOOL_MAG free slots of each pool in its TLS,
+   so most allocations touch neither a lock nor memory shared with other
+   threads.  The pool lock is only taken to move half a cache worth of
+   slots from or to the depot of the pool.
+
+   Free slots are marked as CPOOL_FREE.  After fork and exec the depots
+   are rebuilt from the marks, which gives the slots cached by threads not
+   existing in the child back to the depots.  Bumping the epoch tells the
+   remaining thread that its cache is stale. */
+
+/* Add a slab to the depot of pool idx.  Called with the pool locked. */
+static bool
+cpool_grow (unsigned idx)
+{
+  cpool *p = cygheap->cpools.pool + idx;
+  unsigned n = MAX (CPOOL_SLAB / p->size, 2);
+
+  cygheap_protect.acquire ();
+  cpool_slab *s = (cpool_slab *) _csbrk (sizeof (cpool_slab) + CPOOL_LINE
+					 + n * p->size);
+  cygheap_protect.release ();
+  if (!s)
+    return false;
+  /* Align the data of the slots, not the slots themselves. */
+  s->slots = (char *) roundup2 ((uintptr_t) (s + 1) + CPOOL_HDR, CPOOL_LINE)
+	     - CPOOL_HDR;
+  s->nslots = n;
+  for (char *slot = s->slots; n-- > 0; slot += p->size)
+    {
+      _cmalloc_entry *rvc = (_cmalloc_entry *) slot;
+      cygheap_entry *c = (cygheap_entry *) rvc->data;
+
+      rvc->ptr = NULL;
+      rvc->b = CPOOL_BUCKET + idx;
+      rvc->prev = NULL;
+      c->type = CPOOL_FREE;
+      c->next = (cygheap_entry *) p->depot;
+      p->depot = c;
+    }
+  s->next = p->slabs;
+  p->slabs = s;
+  p->nslabs++;
+  p->nslots += s->nslots;
+  p->nfree += s->nslots;
+  return true;
+}
+
+/* Take up to n slots from the depot of pool idx and return them as a
+   list.  n is set to the number of slots taken. */
+static cygheap_entry *
+cpool_get (unsigned idx, unsigned &n, bool refill)
+{
+  cpool *p = cygheap->cpools.pool + idx;
+  cygheap_entry *list = NULL;
+  unsigned i;
+
+  AcquireSRWLockExclusive (&p->lock);
+  if (!p->depot)
+    cpool_grow (idx);
+  for (i = 0; i < n && p->depot; i++)
+    {
+      cygheap_entry *c = (cygheap_entry *) p->depot;
+      p->depot = c->next;
+      c->next = list;
+      list = c;
+    }
+  p->nfree -= i;
+  if (refill && i)
+    p->refills++;
+  ReleaseSRWLockExclusive (&p->lock);
+  n = i;
+  return list;
+}
+
+/* Give a list of free slots back to the depot of pool idx. */
+static void
+cpool_put (unsigned idx, cygheap_entry *list, bool flush)
+{
+  cpool *p = cygheap->cpools.pool + idx;
+
+  AcquireSRWLockExclusive (&p->lock);
+  while (list)
+    {
+      cygheap_entry *c = list;
+      list = c->next;
+      c->next = (cygheap_entry *) p->depot;
+      p->depot = c;
+      p->nfree++;
+    }
+  if (flush)
+    p->flushes++;
+  ReleaseSRWLockExclusive (&p->lock);
+}
+
+/* Return the slot cache of the calling thread, or NULL if the thread has
+   none. */
+static inline cpool_cache *
+cpool_thread_cache ()
+{
+  if (!_my_tls.isinitialized ())
+    return NULL;
+  cpool_cache *cache = &_my_tls.locals.cpool;
+  if (cache->epoch != cygheap->cpools.epoch)
+    {
+      memset (cache, 0, sizeof *cache);
+      cache->epoch = cygheap->cpools.epoch;
+    }
+  return cache;
+}
+
+/* Return the index of the pool for blocks of n bytes, -1 if they are not
+   pooled. */
+static int
+cpool_index (size_t n)
+{
+  cpool_info &pi = cygheap->cpools;
+  size_t size = roundup2 (n + CPOOL_HDR, CPOOL_LINE);
+
+  if (size > CPOOL_MAXSIZE)
+    return -1;
+  unsigned i = pi.index[size / CPOOL_LINE];
+  if (!i)
+    {
+      AcquireSRWLockExclusive (&pi.lock);
+      if (!(i = pi.index[size / CPOOL_LINE]) && pi.npools < CPOOL_MAX)
+	{
+	  pi.pool[pi.npools].size = size;
+	  i = ++pi.npools;
+	  MemoryBarrier ();
+	  pi.index[size / CPOOL_LINE] = i;
+	}
+      ReleaseSRWLockExclusive (&pi.lock);
+    }
+  return (int) i - 1;
+}
+
+/* Like ccalloc (x, 1, n), for fhandlers. */
+extern "C" void *
+cpalloc (cygheap_types x, size_t n)
+{
+  int idx;
+  cygheap_entry *c;
+
+  if (x > HEAP_1_START || (idx = cpool_index (n)) < 0)
+    {
+      InterlockedIncrement (&cygheap->cpools.unpooled);
+      return ccalloc (x, 1, n);
+    }
+  cpool_cache *cache = cpool_thread_cache ();
+  if (!cache)
+    {
+      unsigned cnt = 1;
+      c = cpool_get (idx, cnt, false);
+    }
+  else
+    {
+      if (!cache->count[idx])
+	{
+	  unsigned cnt = CPOOL_MAG / 2;
+	  cache->slots[idx] = cpool_get (idx, cnt, true);
+	  cache->count[idx] = cnt;
+	}
+      if ((c = (cygheap_entry *) cache->slots[idx]))
+	{
+	  cache->slots[idx] = c->next;
+	  cache->count[idx]--;
+	}
+    }
+  if (c)
+    memset (c->data, 0, n);
+  return creturn (x, c, n);
+}
+
+static void
+cpool_free (cygheap_entry *c, unsigned idx)
+{
+  cpool_cache *cache = cpool_thread_cache ();
+
+  c->type = CPOOL_FREE;
+  if (!cache)
+    {
+      c->next = NULL;
+      cpool_put (idx, c, false);
+      return;
+    }
+  if (cache->count[idx] >= CPOOL_MAG)
+    {
+      cygheap_entry *list = (cygheap_entry *) cache->slots[idx];
+      cygheap_entry *last = list;
+
+      for (int i = 1; i < CPOOL_MAG / 2; i++)
+	last = last->next;
+      cache->slots[idx] = last->next;
+      cache->count[idx] -= CPOOL_MAG / 2;
+      last->next = NULL;
+      cpool_put (idx, list, true);
+    }
+  c->next = (cygheap_entry *) cache->slots[idx];
+  cache->slots[idx] = c;
+  cache->count[idx]++;
+}
+
+/* Give the slots cached by an exiting thread back to the depots. */
+void
+cpool_flush (_cygtls *tls)
+{
+  cpool_cache *cache = &tls->locals.cpool;
+
+  if (cache->epoch == cygheap->cpools.epoch)
+    for (unsigned idx = 0; idx < cygheap->cpools.npools; idx++)
+      if (cache->count[idx])
+	cpool_put (idx, (cygheap_entry *) cache->slots[idx], true);
+  memset (cache, 0, sizeof *cache);
+}
+
+/* Rebuild the depots in a forked or execed child.  Locks held by other
+   threads of the parent are reset along the way. */
+static void
+cpool_fixup ()
+{
+  cpool_info &pi = cygheap->cpools;
+
+  InitializeSRWLock (&pi.lock);
+  for (unsigned idx = 0; idx < pi.npools; idx++)
+    {
+      cpool *p = pi.pool + idx;
+
+      InitializeSRWLock (&p->lock);
+      p->depot = NULL;
+      p->nfree = 0;
+      for (cpool_slab *s = p->slabs; s; s = s->next)
+	for (unsigned i = 0; i < s->nslots; i++)
+	  {
+	    _cmalloc_entry *rvc = (_cmalloc_entry *) (s->slots + i * p->size);
+	    cygheap_entry *c = (cygheap_entry *) rvc->data;
+
+	    if (c->type == CPOOL_FREE)
+	      {
+		c->next = (cygheap_entry *) p->depot;
+		p->depot = c;
+		p->nfree++;
+	      }
+	  }
+    }
+  pi.epoch++;
+}
+
+/* Print the pool statistics for /proc/PID/fhpools into buf.  Slots which
+   are neither in use nor in the depot are cached by threads. */
+size_t
+cpool_format (char *buf)
+{
+  cpool_info &pi = cygheap->cpools;
+  char *bp = buf;
+
+  bp += __small_sprintf (bp, " size  slabs  slots   free    refills    "
+			     "flushes\n");
+  for (unsigned idx = 0; idx < pi.npools; idx++)
+    {
+      cpool *p = pi.pool + idx;
+
+      AcquireSRWLockShared (&p->lock);
+      bp += __small_sprintf (bp, "%5u %6u %6u %6u %10lu %10lu\n",
+			     p->size, p->nslabs, p->nslots, p->nfree,
+			     p->refills, p->flushes);
+      ReleaseSRWLockShared (&p->lock);
+    }
+  bp += __small_sprintf (bp, "unpooled %d\n", pi.unpooled);
+  return bp - buf;
+}
+
 extern "C" PWCHAR
 cwcsdup (PCWSTR s)
 {
@@ -787,6 +1085,24 @@ init_cygheap::compute_sigblkmask ()
   return ret_mask;
 }
 
+/* Call FUNC for each pthread.  The thread's tls area is locked while FUNC
+   runs, so the thread can't go away in the meantime. */
+void
+init_cygheap::sample_threads (void (*func) (_cygtls *))
+{
+  tls_sentry here (INFINITE);
+  for (uint32_t ix = 0; ix < nthreads; ix++)
+    {
+      threadlist_t *t = threadlist + ix;
+      if (t->thread->tid && t->thread->initialized)
+	{
+	  WaitForSingleObject (t->mutex, INFINITE);
+	  func (t->thread);
+	  ReleaseMutex (t->mutex);
+	}
+    }
+}
+
 /* Called from profil.c to sample all non-main thread PC values for profiling */
 extern "C" void
 cygheap_profthr_all (void (*profthr_byhandle) (HANDLE))
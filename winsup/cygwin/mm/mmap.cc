@@ -20,6 +20,7 @@ details. */
 #include "cygheap.h"
 #include "ntdll.h"
 #include <sys/queue.h>
+#include <sys/tree.h>
 #include "mmap_alloc.h"
 
 /* __PROT_ATTACH indicates an anonymous mapping which is supposed to be
@@ -277,15 +278,30 @@ MapView (HANDLE h, void *addr, size_t len, DWORD openflags,
    Each mmap_record represents exactly one mapping.  For each mapping, there's
    an additional so called `page_map'.  It's an array of bits, one bit
    per mapped memory page.  The bit is set if the page is accessible,
-   unset otherwise. */
+   unset otherwise.
+
+   Additionally, all mmap_records of all lists are kept in a red-black tree
+   ordered by address, so looking up the records covering an address range
+   doesn't have to scan all mappings of the process.  Windows doesn't allow
+   views or allocations to overlap, so the records never overlap either, and
+   the start address alone is a sufficient key.  Records with unmapped pages
+   are also kept in a per-list `holes' list, so try_map finds room for a new
+   mapping without checking the page maps of all records. */
+
+class mmap_list;
 
 #pragma pack(push, 4)
 class mmap_record
 {
   public:
     LIST_ENTRY (mmap_record) mr_next;
+    LIST_ENTRY (mmap_record) mr_hole;
+    RB_ENTRY (mmap_record) mr_node;
 
   private:
+    mmap_list *map_list;
+    /* Number of unset bits in page_map. */
+    SIZE_T unused_pages;
     HANDLE mapping_hdl;
     SIZE_T len;
     caddr_t base_address;
@@ -302,6 +318,8 @@ class mmap_record
   public:
     mmap_record (int nfd, HANDLE h, DWORD of, int p, int f, off_t o, SIZE_T l,
 		 caddr_t b) :
+       map_list (NULL),
+       unused_pages (0),
        mapping_hdl (h),
        len (l),
        base_address (b),
@@ -334,8 +352,10 @@ class mmap_record
     off_t get_offset () const { return offset; }
     SIZE_T get_len () const { return len; }
     caddr_t get_address () const { return base_address; }
+    mmap_list *get_list () const { return map_list; }
+    SIZE_T get_unused_pages () const { return unused_pages; }
 
-    void init_page_map (mmap_record &r);
+    void init_page_map (mmap_record &r, mmap_list *ml);
 
     SIZE_T find_unused_pages (SIZE_T pages) const;
     bool match (caddr_t addr, SIZE_T len, caddr_t &m_addr, SIZE_T &m_len);
@@ -355,11 +375,23 @@ class mmap_record
 };
 #pragma pack(pop)
 
+RB_HEAD (mmap_tree, mmap_record);
+
+static inline int
+mmap_record_cmp (mmap_record *a, mmap_record *b)
+{
+  return (a->get_address () > b->get_address ())
+	 - (a->get_address () < b->get_address ());
+}
+
+RB_GENERATE_STATIC (mmap_tree, mmap_record, mr_node, mmap_record_cmp)
+
 class mmap_list
 {
   public:
     LIST_ENTRY (mmap_list) ml_next;
     LIST_HEAD (, mmap_record) recs;
+    LIST_HEAD (, mmap_record) holes;
 
   private:
     int fd;
@@ -381,10 +413,17 @@ class mmap_areas
 {
   public:
     LIST_HEAD (, mmap_list) lists;
+    struct mmap_tree recs;
 
     mmap_list *get_list_by_fd (int fd, struct stat *st);
     mmap_list *add_list (int fd, struct stat *st);
     void del_list (mmap_list *ml);
+    void insert_record (mmap_record *rec)
+      { RB_INSERT (mmap_tree, &recs, rec); }
+    void remove_record (mmap_record *rec)
+      { RB_REMOVE (mmap_tree, &recs, rec); }
+    mmap_record *first_match (caddr_t addr, SIZE_T len);
+    mmap_record *next_match (mmap_record *rec, caddr_t addr, SIZE_T len);
 };
 
 /* This is the global map structure pointer. */
@@ -438,9 +477,11 @@ mmap_record::match (caddr_t addr, SIZE_T len, caddr_t &m_addr, SIZE_T &m_len)
 }
 
 void
-mmap_record::init_page_map (mmap_record &r)
+mmap_record::init_page_map (mmap_record &r, mmap_list *ml)
 {
   *this = r;
+  map_list = ml;
+  unused_pages = 0;
   DWORD start_protect = gen_create_protect ();
   DWORD real_protect = gen_protect ();
   if (real_protect != start_protect && !noreserve ()
@@ -480,6 +521,9 @@ mmap_record::map_pages (SIZE_T len, int new_prot)
       return (off_t) -1;
     }
 
+  unused_pages -= len;
+  if (!unused_pages)
+    LIST_REMOVE (this, mr_hole);
   while (len-- > 0)
     MAP_SET (off + len);
   return off * wincap.page_size ();
@@ -510,6 +554,9 @@ mmap_record::map_pages (caddr_t addr, SIZE_T len, int new_prot)
       __seterrno ();
       return false;
     }
+  unused_pages -= len;
+  if (!unused_pages)
+    LIST_REMOVE (this, mr_hole);
   for (; len-- > 0; ++off)
     MAP_SET (off);
   return true;
@@ -529,14 +576,18 @@ mmap_record::unmap_pages (caddr_t addr, SIZE_T len)
 
   off /= wincap.page_size ();
   len = PAGE_CNT (len);
+  SIZE_T was_unused = unused_pages;
   for (; len-- > 0; ++off)
-    MAP_CLR (off);
+    if (MAP_ISSET (off))
+      {
+	MAP_CLR (off);
+	++unused_pages;
+      }
+  if (!was_unused && unused_pages)
+    LIST_INSERT_HEAD (&map_list->holes, this, mr_hole);
   /* Return TRUE if all pages are free'd which may result in unmapping
      the whole chunk. */
-  for (len = MAPSIZE (PAGE_CNT (get_len ())); len > 0; )
-    if (page_map[--len])
-      return false;
-  return true;
+  return unused_pages == PAGE_CNT (get_len ());
 }
 
 int
@@ -588,9 +639,10 @@ mmap_list::add_record (mmap_record &r)
 		      + MAPSIZE (PAGE_CNT (r.get_len ())) * sizeof (DWORD), 1);
   if (!rec)
     return NULL;
-  rec->init_page_map (r);
+  rec->init_page_map (r, this);
 
   LIST_INSERT_HEAD (&recs, rec, mr_next);
+  mmapped_areas.insert_record (rec);
   return rec;
 }
 
@@ -606,11 +658,15 @@ mmap_list::set (int nfd, struct stat *st)
       hash = st ? st->st_ino : (ino_t) 0;
     }
   LIST_INIT (&recs);
+  LIST_INIT (&holes);
 }
 
 bool
 mmap_list::del_record (mmap_record *rec)
 {
+  mmapped_areas.remove_record (rec);
+  if (rec->get_unused_pages ())
+    LIST_REMOVE (rec, mr_hole);
   LIST_REMOVE (rec, mr_next);
   cfree (rec);
   /* Return true if the list is empty which allows the caller to remove
@@ -628,8 +684,9 @@ mmap_list::try_map (void *addr, size_t len, int new_prot, int flags, off_t off)
       /* If MAP_FIXED isn't given, check if this mapping matches into the
 	 chunk of another already performed mapping. */
       SIZE_T plen = PAGE_CNT (len);
-      LIST_FOREACH (rec, &recs, mr_next)
-	if (rec->find_unused_pages (plen) != (SIZE_T) -1)
+      LIST_FOREACH (rec, &holes, mr_hole)
+	if (rec->get_unused_pages () >= plen
+	    && rec->find_unused_pages (plen) != (SIZE_T) -1)
 	  break;
       if (rec && rec->compatible_flags (flags))
 	{
@@ -646,8 +703,10 @@ mmap_list::try_map (void *addr, size_t len, int new_prot, int flags, off_t off)
       caddr_t u_addr;
       SIZE_T u_len;
 
-      LIST_FOREACH (rec, &recs, mr_next)
-	if (rec->match ((caddr_t) addr, len, u_addr, u_len))
+      for (rec = mmapped_areas.first_match ((caddr_t) addr, len); rec;
+	   rec = mmapped_areas.next_match (rec, (caddr_t) addr, len))
+	if (rec->get_list () == this
+	    && rec->match ((caddr_t) addr, len, u_addr, u_len))
 	  break;
       if (rec)
 	{
@@ -703,6 +762,39 @@ mmap_areas::del_list (mmap_list *ml)
   cfree (ml);
 }
 
+/* Return the record with the lowest address overlapping the area from addr
+   to addr + len, or NULL.  Since records don't overlap, that's either the
+   last record starting at or below addr, or the one following it. */
+mmap_record *
+mmap_areas::first_match (caddr_t addr, SIZE_T len)
+{
+  mmap_record *rec = RB_ROOT (&recs);
+  mmap_record *below = NULL;
+  caddr_t u_addr;
+  SIZE_T u_len;
+
+  while (rec)
+    if (rec->get_address () <= addr)
+      {
+	below = rec;
+	rec = RB_RIGHT (rec, mr_node);
+      }
+    else
+      rec = RB_LEFT (rec, mr_node);
+  if (below && below->match (addr, len, u_addr, u_len))
+    return below;
+  return next_match (below, addr, len);
+}
+
+/* Return the record following rec if it overlaps the area from addr to
+   addr + len, or NULL.  If rec is NULL, start with the lowest record. */
+mmap_record *
+mmap_areas::next_match (mmap_record *rec, caddr_t addr, SIZE_T len)
+{
+  rec = rec ? RB_NEXT (mmap_tree, &recs, rec) : RB_MIN (mmap_tree, &recs);
+  return (rec && rec->get_address () < addr + len) ? rec : NULL;
+}
+
 /* This function allows an external function to test if a given memory
    region is part of an mmapped memory region. */
 bool
@@ -710,28 +802,17 @@ is_mmapped_region (caddr_t start_addr, caddr_t end_address)
 {
   size_t len = end_address - start_addr;
 
-  LIST_READ_LOCK ();
-  mmap_list *map_list = mmapped_areas.get_list_by_fd (-1, NULL);
-
-  if (!map_list)
-    {
-      LIST_READ_UNLOCK ();
-      return false;
-    }
-
   mmap_record *rec;
-  caddr_t u_addr;
-  SIZE_T u_len;
   bool ret = false;
 
-  LIST_FOREACH (rec, &map_list->recs, mr_next)
-    {
-      if (rec->match (start_addr, len, u_addr, u_len))
-	{
-	  ret = true;
-	  break;
-	}
-    }
+  LIST_READ_LOCK ();
+  for (rec = mmapped_areas.first_match (start_addr, len); rec;
+       rec = mmapped_areas.next_match (rec, start_addr, len))
+    if (rec->get_list ()->anonymous ())
+      {
+	ret = true;
+	break;
+      }
   LIST_READ_UNLOCK ();
   return ret;
 }
@@ -761,23 +842,22 @@ mmap_is_attached_or_noreserve (void *addr, size_t len)
   mmap_region_status ret = MMAP_NONE;
 
   LIST_READ_LOCK ();
-  mmap_list *map_list = mmapped_areas.get_list_by_fd (-1, NULL);
 
   const size_t pagesize = wincap.allocation_granularity ();
   caddr_t start_addr = (caddr_t) rounddown ((uintptr_t) addr, pagesize);
   len += ((caddr_t) addr - start_addr);
   len = roundup2 (len, pagesize);
 
-  if (map_list == NULL)
-    goto out;
-
   mmap_record *rec;
   caddr_t u_addr;
   SIZE_T u_len;
 
-  LIST_FOREACH (rec, &map_list->recs, mr_next)
+  /* start_addr + len stays the same while walking the records. */
+  for (rec = mmapped_areas.first_match (start_addr, len); rec;
+       rec = mmapped_areas.next_match (rec, start_addr, len))
     {
-      if (!rec->match (start_addr, len, u_addr, u_len))
+      if (!rec->get_list ()->anonymous ()
+	  || !rec->match (start_addr, len, u_addr, u_len))
 	continue;
       if (rec->attached ())
 	{
@@ -806,7 +886,6 @@ mmap_is_attached_or_noreserve (void *addr, size_t len)
 	  break;
 	}
     }
-out:
   LIST_READ_UNLOCK ();
   return ret;
 }
@@ -1153,36 +1232,34 @@ munmap (void *addr, size_t len)
 
   LIST_WRITE_LOCK ();
 
-  /* Iterate over maps, unmap pages between addr and addr+len in all maps. */
-  mmap_list *map_list, *next_map_list;
-  LIST_FOREACH_SAFE (map_list, &mmapped_areas.lists, ml_next, next_map_list)
-    {
-      mmap_record *rec, *next_rec;
-      caddr_t u_addr;
-      SIZE_T u_len;
+  /* Iterate over the records overlapping addr to addr+len, unmap pages. */
+  mmap_record *rec, *next_rec;
+  caddr_t u_addr;
+  SIZE_T u_len;
 
-      LIST_FOREACH_SAFE (rec, &map_list->recs, mr_next, next_rec)
+  for (rec = mmapped_areas.first_match ((caddr_t) addr, len); rec;
+       rec = next_rec)
+    {
+      next_rec = mmapped_areas.next_match (rec, (caddr_t) addr, len);
+      if (!rec->match ((caddr_t) addr, len, u_addr, u_len))
+	continue;
+      if (rec->unmap_pages (u_addr, u_len))
 	{
-	  if (!rec->match ((caddr_t) addr, len, u_addr, u_len))
-	    continue;
-	  if (rec->unmap_pages (u_addr, u_len))
+	  /* The whole record has been unmapped, so we now actually
+	     unmap it from the system in full length... */
+	  fhandler_base *fh = rec->alloc_fh ();
+	  fh->munmap (rec->get_handle (),
+		      rec->get_address (),
+		      rec->get_len ());
+	  rec->free_fh (fh);
+
+	  /* ...and delete the record. */
+	  mmap_list *map_list = rec->get_list ();
+	  if (map_list->del_record (rec))
 	    {
-	      /* The whole record has been unmapped, so we now actually
-		 unmap it from the system in full length... */
-	      fhandler_base *fh = rec->alloc_fh ();
-	      fh->munmap (rec->get_handle (),
-			  rec->get_address (),
-			  rec->get_len ());
-	      rec->free_fh (fh);
-
-	      /* ...and delete the record. */
-	      if (map_list->del_record (rec))
-		{
-		  /* Yay, the last record has been removed from the list,
-		     we can remove the list now, too. */
-		  mmapped_areas.del_list (map_list);
-		  break;
-		}
+	      /* Yay, the last record has been removed from the list,
+		 we can remove the list now, too. */
+	      mmapped_areas.del_list (map_list);
 	    }
 	}
     }
@@ -1198,7 +1275,7 @@ extern "C" int
 msync (void *addr, size_t len, int flags)
 {
   int ret = -1;
-  mmap_list *map_list;
+  mmap_record *rec;
 
   syscall_printf ("msync (addr: %p, len %lu, flags %y)", addr, len, flags);
 
@@ -1218,29 +1295,23 @@ msync (void *addr, size_t len, int flags)
 
   LIST_READ_LOCK ();
 
-  /* Iterate over maps, looking for the mmapped area.  Error if not found. */
-  LIST_FOREACH (map_list, &mmapped_areas.lists, ml_next)
+  /* Look up the mmapped area.  Error if not found. */
+  rec = mmapped_areas.first_match ((caddr_t) addr, 1);
+  if (rec && rec->access ((caddr_t) addr))
     {
-      mmap_record *rec;
-      LIST_FOREACH (rec, &map_list->recs, mr_next)
-	{
-	  if (rec->access ((caddr_t) addr))
-	    {
-	      /* Check whole area given by len. */
-	      for (SIZE_T i = wincap.allocation_granularity ();
-		   i < len;
-		   i += wincap.allocation_granularity ())
-		if (!rec->access ((caddr_t) addr + i))
-		  {
-		    set_errno (ENOMEM);
-		    goto out;
-		  }
-	      fhandler_base *fh = rec->alloc_fh ();
-	      ret = fh->msync (rec->get_handle (), (caddr_t) addr, len, flags);
-	      rec->free_fh (fh);
-	      goto out;
-	    }
-	}
+      /* Check whole area given by len. */
+      for (SIZE_T i = wincap.allocation_granularity ();
+	   i < len;
+	   i += wincap.allocation_granularity ())
+	if (!rec->access ((caddr_t) addr + i))
+	  {
+	    set_errno (ENOMEM);
+	    goto out;
+	  }
+      fhandler_base *fh = rec->alloc_fh ();
+      ret = fh->msync (rec->get_handle (), (caddr_t) addr, len, flags);
+      rec->free_fh (fh);
+      goto out;
     }
 
   /* No matching mapping exists. */
@@ -1275,36 +1346,33 @@ mprotect (void *addr, size_t len, int prot)
 
   LIST_WRITE_LOCK ();
 
-  /* Iterate over maps, protect pages between addr and addr+len in all maps. */
-  mmap_list *map_list;
-  LIST_FOREACH (map_list, &mmapped_areas.lists, ml_next)
-    {
-      mmap_record *rec;
-      caddr_t u_addr;
-      SIZE_T u_len;
+  /* Iterate over the records overlapping addr to addr+len, protect pages. */
+  mmap_record *rec;
+  caddr_t u_addr;
+  SIZE_T u_len;
 
-      LIST_FOREACH (rec, &map_list->recs, mr_next)
+  for (rec = mmapped_areas.first_match ((caddr_t) addr, len); rec;
+       rec = mmapped_areas.next_match (rec, (caddr_t) addr, len))
+    {
+      if (!rec->match ((caddr_t) addr, len, u_addr, u_len))
+	continue;
+      in_mapped = true;
+      if (rec->attached ())
+	continue;
+      new_prot = gen_protect (prot, rec->get_flags ());
+      if (rec->noreserve ())
 	{
-	  if (!rec->match ((caddr_t) addr, len, u_addr, u_len))
-	    continue;
-	  in_mapped = true;
-	  if (rec->attached ())
-	    continue;
-	  new_prot = gen_protect (prot, rec->get_flags ());
-	  if (rec->noreserve ())
-	    {
-	      if (new_prot == PAGE_NOACCESS)
-		ret = VirtualFree (u_addr, u_len, MEM_DECOMMIT);
-	      else
-		ret = !!VirtualAlloc (u_addr, u_len, MEM_COMMIT, new_prot);
-	    }
+	  if (new_prot == PAGE_NOACCESS)
+	    ret = VirtualFree (u_addr, u_len, MEM_DECOMMIT);
 	  else
-	    ret = VirtualProtect (u_addr, u_len, new_prot, &old_prot);
-	  if (!ret)
-	    {
-	      __seterrno ();
-	      break;
-	    }
+	    ret = !!VirtualAlloc (u_addr, u_len, MEM_COMMIT, new_prot);
+	}
+      else
+	ret = VirtualProtect (u_addr, u_len, new_prot, &old_prot);
+      if (!ret)
+	{
+	  __seterrno ();
+	  break;
 	}
     }
 
@@ -110,6 +110,17 @@ shared_name (WCHAR *ret_buf, const WCHAR *str, int num)
   return ret_buf;
 }
 
+/* Name of the per-user shared region.  The SID makes it per-user, the
+   fstab_stamp key makes sure that a changed fstab is picked up by processes
+   started after the change, without having to reparse the files in every
+   other process. */
+WCHAR *
+user_shared_name (WCHAR *ret_buf, const WCHAR *sid_string, ULONG key)
+{
+  __small_swprintf (ret_buf, L"%W.%08x", sid_string, key);
+  return ret_buf;
+}
+
 #define page_const ((ptrdiff_t) 65535)
 #define pround(n) ((ptrdiff_t)(((n) + page_const) & ~page_const))
 
@@ -220,7 +231,8 @@ user_info::initialize ()
 void
 user_info::create (bool reinit)
 {
-  WCHAR name[UNLEN + 1] = L""; /* Large enough for SID */
+  WCHAR sid_string[UNLEN + 1] = L""; /* Large enough for SID */
+  WCHAR name[UNLEN + 16] = L"";
 
   if (reinit)
     {
@@ -232,7 +244,11 @@ user_info::create (bool reinit)
     }
 
   if (!cygwin_user_h)
-    cygheap->user.get_windows_id (name);
+    {
+      cygheap->user_shared_key = fstab_stamp (cygheap->user.name ()).key ();
+      user_shared_name (name, cygheap->user.get_windows_id (sid_string),
+			cygheap->user_shared_key);
+    }
 
   user_shared = (user_info *) open_shared (name, USER_VERSION,
 					   cygwin_user_h, sizeof (user_info),
@@ -241,7 +257,10 @@ user_info::create (bool reinit)
   ProtectHandleINH (cygwin_user_h);
   debug_printf ("user shared version %x", user_shared->version);
   if (reinit)
-    user_shared->initialize ();
+    {
+      myself->mount_key = cygheap->user_shared_key;
+      user_shared->initialize ();
+    }
   cygheap->shared_regions.user_shared_addr = user_shared;
 }
 
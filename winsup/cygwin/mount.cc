@@ -1321,6 +1321,53 @@ mount_info::from_fstab (bool user, WCHAR fstab[], PWCHAR fstab_end)
   return true;
 }
 
+static void
+stat_fstab (PWCHAR fstab, LARGE_INTEGER &mtime, LARGE_INTEGER &size)
+{
+  UNICODE_STRING upath;
+  OBJECT_ATTRIBUTES attr;
+  FILE_NETWORK_OPEN_INFORMATION fnoi;
+
+  RtlInitUnicodeString (&upath, fstab);
+  InitializeObjectAttributes (&attr, &upath, OBJ_CASE_INSENSITIVE, NULL, NULL);
+  if (NT_SUCCESS (NtQueryFullAttributesFile (&attr, &fnoi)))
+    {
+      mtime = fnoi.LastWriteTime;
+      size = fnoi.EndOfFile;
+    }
+  else
+    mtime.QuadPart = size.QuadPart = 0LL;
+}
+
+/* Only query the file attributes here.  Reading the files to compute a
+   content hash would cost about as much as parsing them. */
+fstab_stamp::fstab_stamp (const char *user)
+{
+  tmp_pathbuf tp;
+  PWCHAR fstab = tp.w_get ();
+  PWCHAR username;
+
+  username = wcpcpy (fstab, cygheap->installation_root.Buffer);
+  username = wcpcpy (username, L"\\etc\\fstab");
+  stat_fstab (fstab, mtime[0], size[0]);
+  username = wcpcpy (username, L".d\\");
+  sys_mbstowcs (username, NT_MAX_PATH - (username - fstab), user);
+  transform_chars (username, username + wcslen (username) - 1);
+  stat_fstab (fstab, mtime[1], size[1]);
+}
+
+ULONG
+fstab_stamp::key () const
+{
+  /* FNV-1a */
+  const unsigned char *p = (const unsigned char *) this;
+  ULONG hash = 2166136261U;
+
+  for (size_t i = 0; i < sizeof *this; ++i)
+    hash = (hash ^ p[i]) * 16777619U;
+  return hash;
+}
+
 /* write_cygdrive_info: Store default prefix and flags
    to use when creating cygdrives to the special user shared mem
    location used to store cygdrive information. */
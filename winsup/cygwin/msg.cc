@@ -11,6 +11,7 @@ details. */
 
 #include "sigproc.h"
 #include "cygtls.h"
+#include "tls_pbuf.h"
 
 #include "cygserver_msg.h"
 
@@ -82,6 +83,132 @@ client_request_msg::client_request_msg (int msqid,
   msglen (sizeof (_parameters.in));
 }
 
+client_request_msg::client_request_msg (msgop_t op, int msqid)
+  : client_request (CYGSERVER_REQUEST_MSG, &_parameters, sizeof (_parameters))
+{
+  _parameters.in.msgop = op;
+  ipc_set_proc_info (_parameters.in.ipcblk);
+
+  _parameters.in.ctlargs.msqid = msqid;
+  _parameters.in.ctlargs.cmd = 0;
+  _parameters.in.ctlargs.buf = NULL;
+
+  msglen (sizeof (_parameters.in));
+}
+
+/* Shared sections of the message queues used by this process. */
+static NO_COPY ipc_shmap msg_shmap;
+
+/* Returns the section of msqid with its lock held, or NULL if cygserver has
+   to handle the call.  Call msg_shared_done when done. */
+static struct msq_shared *
+msg_shared (int msqid)
+{
+  void *view;
+
+  if (!msg_shmap.find (msqid, view))
+    {
+      client_request_msg request (client_request_msg::MSGOP_msgmap, msqid);
+      if (request.make_request () == -1 || request.retval () == -1)
+	msg_shmap.add (msqid, NULL);
+      else
+	msg_shmap.add (msqid, request.objval ());
+      if (!msg_shmap.find (msqid, view))
+	return NULL;
+    }
+  struct msq_shared *sh = (struct msq_shared *) view;
+  if (!sh)
+    {
+      msg_shmap.release ();
+      return NULL;
+    }
+  ipc_shlock (&sh->lock);
+  if (sh->removed)
+    {
+      ipc_shunlock (&sh->lock);
+      msg_shmap.release ();
+      msg_shmap.remove (msqid);
+      return NULL;
+    }
+  return sh;
+}
+
+static void
+msg_shared_done (int msqid, struct msq_shared *sh, bool wakeup)
+{
+  ipc_shunlock (&sh->lock);
+  msg_shmap.release ();
+  if (wakeup)
+    {
+      client_request_msg request (client_request_msg::MSGOP_msgwakeup, msqid);
+      request.make_request ();
+    }
+}
+
+/* Put a message into the shared section of the queue, if there's room and
+   no other sender is waiting in cygserver.  Returns 0 on success, an errno
+   value on failure, and -1 if cygserver has to handle the call. */
+static int
+msgsnd_shared (int msqid, long type, const char *buf, size_t msgsz,
+	       int msgflg)
+{
+  struct msq_shared *sh;
+  int ix, error = 0;
+
+  if (type < 1 || !(sh = msg_shared (msqid)))
+    return -1;
+  msq_arena arena (sh);
+  if (sh->snd_waiters > 0 || msgsz > sh->qbytes)
+    error = -1;
+  else if (!arena.fits (msgsz))
+    error = (msgflg & IPC_NOWAIT) ? EAGAIN : -1;
+  else if ((ix = arena.alloc (type, msgsz)) < 0)
+    error = -1;
+  else
+    {
+      arena.put (ix, buf);
+      arena.link (ix);
+      sh->lspid = getpid ();
+      sh->stime = time (NULL);
+    }
+  msg_shared_done (msqid, sh, !error && sh->rcv_waiters > 0);
+  return error;
+}
+
+/* Take a message from the shared section of the queue, if there's one.
+   Returns 0 on success, an errno value on failure, and -1 if cygserver has
+   to handle the call.  At most bufsz bytes are copied to buf. */
+static int
+msgrcv_shared (int msqid, long &type, char *buf, size_t bufsz,
+	       size_t &msgsz, long msgtyp, int msgflg)
+{
+  struct msq_shared *sh;
+  int ix, prev, error = 0;
+
+  if (!(sh = msg_shared (msqid)))
+    return -1;
+  msq_arena arena (sh);
+  if ((ix = arena.find (msgtyp, prev)) < 0)
+    error = (msgflg & IPC_NOWAIT) ? ENOMSG : -1;
+  else if (msgsz < arena.hdr (ix)->ts && !(msgflg & MSG_NOERROR))
+    error = E2BIG;
+  else if ((msgsz < arena.hdr (ix)->ts ? msgsz : arena.hdr (ix)->ts) > bufsz)
+    error = -1;
+  else
+    {
+      arena.unlink (ix, prev);
+      if (msgsz > arena.hdr (ix)->ts)
+	msgsz = arena.hdr (ix)->ts;
+      type = arena.hdr (ix)->type;
+      arena.get (ix, buf, msgsz);
+      arena.discard (ix);
+      sh->lrpid = getpid ();
+      sh->rtime = time (NULL);
+    }
+  msg_shared_done (msqid, sh, !error && sh->snd_waiters > 0);
+  return error;
+}
+
 /*
  * XSI message queue API.  These are exported by the DLL.
  */
@@ -114,8 +241,13 @@ msgctl (int msqid, int cmd, struct msqid_ds *buf)
 	{
 	  syscall_printf ("-1 [%d] = msgctl ()", request.error_code ());
 	  set_errno (request.error_code ());
+	  if (request.error_code () == EINVAL
+	      || request.error_code () == EIDRM)
+	    msg_shmap.remove (msqid);
 	  __leave;
 	}
+      if (cmd == IPC_RMID || cmd == IPC_SET)
+	msg_shmap.remove (msqid);
       return request.retval ();
     }
   __except (EFAULT) {}
@@ -145,11 +277,32 @@ msgrcv (int msqid, void *msgp, size_t msgsz, long msgtyp, int msgflg)
 		  msqid, msgp, msgsz, msgtyp, msgflg);
   __try
     {
+      tmp_pathbuf tp;
+      char *buf = tp.c_get ();
+      long type;
+      size_t len = msgsz;
+      int error = msgrcv_shared (msqid, type, buf, NT_MAX_PATH, len,
+				 msgtyp, msgflg);
+      if (error > 0)
+	{
+	  syscall_printf ("-1 [%d] = msgrcv ()", error);
+	  set_errno (error);
+	  __leave;
+	}
+      if (error == 0)
+	{
+	  *(long *) msgp = type;
+	  memcpy ((char *) msgp + sizeof (long), buf, len);
+	  return len;
+	}
       client_request_msg request (msqid, msgp, msgsz, msgtyp, msgflg);
       if (request.make_request () == -1 || request.rcvval () == -1)
 	{
 	  syscall_printf ("-1 [%d] = msgrcv ()", request.error_code ());
 	  set_errno (request.error_code ());
+	  if (request.error_code () == EINVAL
+	      || request.error_code () == EIDRM)
+	    msg_shmap.remove (msqid);
 	  __leave;
 	}
       return request.rcvval ();
@@ -166,11 +319,31 @@ msgsnd (int msqid, const void *msgp, size_t msgsz, int msgflg)
 		  msqid, msgp, msgsz, msgflg);
   __try
     {
+      if (msgsz <= NT_MAX_PATH)
+	{
+	  tmp_pathbuf tp;
+	  char *buf = tp.c_get ();
+
+	  memcpy (buf, (const char *) msgp + sizeof (long), msgsz);
+	  int error = msgsnd_shared (msqid, *(const long *) msgp, buf, msgsz,
+				     msgflg);
+	  if (error > 0)
+	    {
+	      syscall_printf ("-1 [%d] = msgsnd ()", error);
+	      set_errno (error);
+	      __leave;
+	    }
+	  if (error == 0)
+	    return 0;
+	}
       client_request_msg request (msqid, msgp, msgsz, msgflg);
       if (request.make_request () == -1 || request.retval () == -1)
 	{
 	  syscall_printf ("-1 [%d] = msgsnd ()", request.error_code ());
 	  set_errno (request.error_code ());
+	  if (request.error_code () == EINVAL
+	      || request.error_code () == EIDRM)
+	    msg_shmap.remove (msqid);
 	  __leave;
 	}
       return request.retval ();
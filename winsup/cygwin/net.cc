@@ -53,24 +53,29 @@ extern "C"
 const struct in6_addr in6addr_any = IN6ADDR_ANY_INIT;
 const struct in6_addr in6addr_loopback = IN6ADDR_LOOPBACK_INIT;
 
-static fhandler_socket *
-get (const int fd)
+/* The socket fhandler of fd, or NULL with errno set.  The fhandler stays
+   referenced as long as this object exists, so a concurrent close(2) of fd
+   doesn't delete it while the call is using it. */
+class socket_fdget
 {
-  cygheap_fdget cfd (fd);
-
-  if (cfd < 0)
-    return NULL;
-
-  fhandler_socket *const fh = cfd->is_socket ();
-
-  if (!fh || (fh->get_flags () & O_PATH))
-    {
-      set_errno (ENOTSOCK);
-      return NULL;
-    }
+  cygheap_fdget cfd;
+  fhandler_socket *fh;
 
-  return fh;
-}
+public:
+  socket_fdget (const int fd) : cfd (fd), fh (NULL)
+  {
+    if (cfd < 0)
+      return;
+    fh = cfd->is_socket ();
+    if (!fh || (fh->get_flags () & O_PATH))
+      {
+	set_errno (ENOTSOCK);
+	fh = NULL;
+      }
+  }
+  operator fhandler_socket * () const {return fh;}
+  fhandler_socket *operator -> () const {return fh;}
+};
 
 /* exported as inet_ntoa: BSD 4.3 */
 extern "C" char *
@@ -587,7 +592,7 @@ cygwin_sendto (int fd, const void *buf, size_t len, int flags,
 
   __try
     {
-      fhandler_socket *fh = get (fd);
+      socket_fdget fh (fd);
       if (fh)
 	res = fh->sendto (buf, len, flags, to, tolen);
     }
@@ -609,7 +614,7 @@ cygwin_recvfrom (int fd, void *buf, size_t len, int flags,
 
   __try
     {
-      fhandler_socket *fh = get (fd);
+      socket_fdget fh (fd);
       if (fh)
 	/* Originally we shortcircuited here if res == 0.
 	   Allow 0 bytes buffer.  This is valid in POSIX and handled in
@@ -633,7 +638,7 @@ cygwin_setsockopt (int fd, int level, int optname, const void *optval,
 
   __try
     {
-      fhandler_socket *fh = get (fd);
+      socket_fdget fh (fd);
       if (fh)
 	ret = fh->setsockopt (level, optname, optval, optlen);
     }
@@ -653,7 +658,7 @@ cygwin_getsockopt (int fd, int level, int optname, void *optval,
 
   __try
     {
-      fhandler_socket *fh = get (fd);
+      socket_fdget fh (fd);
       if (fh)
 	ret = fh->getsockopt (level, optname, optval, optlen);
     }
@@ -688,7 +693,7 @@ sockatmark (int fd)
 extern "C" int
 getpeereid (int fd, uid_t *euid, gid_t *egid)
 {
-  fhandler_socket *fh = get (fd);
+  socket_fdget fh (fd);
   if (fh)
     return fh->getpeereid (NULL, euid, egid);
   return -1;
@@ -704,7 +709,7 @@ cygwin_connect (int fd, const struct sockaddr *name, socklen_t namelen)
 
   __try
     {
-      fhandler_socket *fh = get (fd);
+      socket_fdget fh (fd);
       if (fh)
 	res = fh->connect (name, namelen);
     }
@@ -1248,7 +1253,7 @@ cygwin_accept (int fd, struct sockaddr *peer, socklen_t *len)
 
   __try
     {
-      fhandler_socket *fh = get (fd);
+      socket_fdget fh (fd);
       if (fh)
 	res = fh->accept4 (peer, len,
 			   fh->is_nonblocking () ? SOCK_NONBLOCK : 0);
@@ -1269,7 +1274,7 @@ accept4 (int fd, struct sockaddr *peer, socklen_t *len, int flags)
 
   __try
     {
-      fhandler_socket *fh = get (fd);
+      socket_fdget fh (fd);
       if (!fh)
 	__leave;
       if ((flags & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) != 0)
@@ -1291,7 +1296,7 @@ cygwin_bind (int fd, const struct sockaddr *my_addr, socklen_t addrlen)
 
   __try
     {
-      fhandler_socket *fh = get (fd);
+      socket_fdget fh (fd);
       if (fh)
 	res = fh->bind (my_addr, addrlen);
     }
@@ -1309,7 +1314,7 @@ cygwin_getsockname (int fd, struct sockaddr *addr, socklen_t *namelen)
 
   __try
     {
-      fhandler_socket *fh = get (fd);
+      socket_fdget fh (fd);
       if (fh)
 	res = fh->getsockname (addr, namelen);
     }
@@ -1327,7 +1332,7 @@ cygwin_listen (int fd, int backlog)
 
   __try
     {
-      fhandler_socket *fh = get (fd);
+      socket_fdget fh (fd);
       if (fh)
 	res = fh->listen (backlog);
     }
@@ -1343,7 +1348,7 @@ cygwin_shutdown (int fd, int how)
 {
   int res = -1;
 
-  fhandler_socket *fh = get (fd);
+  socket_fdget fh (fd);
   if (fh)
     res = fh->shutdown (how);
   syscall_printf ("%R = shutdown(%d, %d)", res, fd, how);
@@ -1405,11 +1410,10 @@ extern "C" int
 cygwin_getpeername (int fd, struct sockaddr *name, socklen_t *len)
 {
   int res = -1;
-  fhandler_socket *fh = NULL;
 
   __try
     {
-      fh = get (fd);
+      socket_fdget fh (fd);
       if (fh)
 	res = fh->getpeername (name, len);
     }
@@ -1429,7 +1433,7 @@ cygwin_recv (int fd, void *buf, size_t len, int flags)
 
   __try
     {
-      fhandler_socket *fh = get (fd);
+      socket_fdget fh (fd);
       if (fh)
 	/* Originally we shortcircuited here if res == 0.
 	   Allow 0 bytes buffer.  This is valid in POSIX and handled in
@@ -1453,7 +1457,7 @@ cygwin_send (int fd, const void *buf, size_t len, int flags)
 
   __try
     {
-      fhandler_socket *fh = get (fd);
+      socket_fdget fh (fd);
       if (fh)
 	res = fh->sendto (buf, len, flags, NULL, 0);
     }
@@ -2177,7 +2181,7 @@ cygwin_bindresvport_sa (int fd, struct sockaddr *sa)
 
   __try
     {
-      fhandler_socket *fh = get (fd);
+      socket_fdget fh (fd);
       if (!fh)
 	__leave;
 
@@ -2360,7 +2364,7 @@ cygwin_recvmsg (int fd, struct msghdr *msg, int flags)
 
   __try
     {
-      fhandler_socket *fh = get (fd);
+      socket_fdget fh (fd);
       if (fh)
 	{
 	  res = check_iovec_for_read (msg->msg_iov, msg->msg_iovlen);
@@ -2391,7 +2395,7 @@ cygwin_sendmsg (int fd, const struct msghdr *msg, int flags)
 
   __try
     {
-      fhandler_socket *fh = get (fd);
+      socket_fdget fh (fd);
       if (fh)
 	{
 	  res = check_iovec_for_write (msg->msg_iov, msg->msg_iovlen);
@@ -2977,7 +2981,17 @@ static const struct gai_errmap_t
   /* EAI_OVERFLOW */
   {WSAEFAULT,		  "An argument buffer overflowed"},
   /* EAI_IDN_ENCODE */
-  {0,			  "Parameter string not correctly encoded"}
+  {0,			  "Parameter string not correctly encoded"},
+  /* EAI_INPROGRESS */
+  {0,			  "Processing request in progress"},
+  /* EAI_CANCELED */
+  {0,			  "Request canceled"},
+  /* EAI_NOTCANCELED */
+  {0,			  "Request not canceled"},
+  /* EAI_ALLDONE */
+  {0,			  "All requests done"},
+  /* EAI_INTR */
+  {0,			  "Interrupted by a signal"}
 };
 
 /* Exported as gai_strerror: POSIX.1-2001, POSIX.1-2008 */
@@ -77,6 +77,7 @@ pinfo::thisproc (HANDLE h)
     create_winpid_symlink ();
   procinfo->exec_sendsig = NULL;
   procinfo->exec_dwProcessId = 0;
+  procinfo->mount_key = cygheap->user_shared_key;
   debug_printf ("myself dwProcessId %u", procinfo->dwProcessId);
 }
 
@@ -692,6 +693,16 @@ commune_process (void *arg)
 	  sigproc_printf ("WritePipeOverlapped root failed, %E");
 	break;
       }
+    case PICOM_FHPOOLS:
+      {
+	sigproc_printf ("processing PICOM_FHPOOLS");
+	unsigned n = cpool_format (path) + 1;
+	if (!WritePipeOverlapped (tothem, &n, sizeof n, &nr, 1000L))
+	  sigproc_printf ("WritePipeOverlapped sizeof fhpools failed, %E");
+	else if (!WritePipeOverlapped (tothem, path, n, &nr, 1000L))
+	  sigproc_printf ("WritePipeOverlapped fhpools failed, %E");
+	break;
+      }
     case PICOM_SIGINFO:
       {
 	sigproc_printf ("processing PICOM_SIGINFO");
@@ -877,6 +888,7 @@ _pinfo::commune_request (__uint32_t code, ...)
     case PICOM_CMDLINE:
     case PICOM_CWD:
     case PICOM_ENVIRON:
+    case PICOM_FHPOOLS:
     case PICOM_ROOT:
     case PICOM_FDS:
     case PICOM_FD:
@@ -1179,6 +1191,30 @@ _pinfo::cmdline (size_t& n)
 }
 
 
+char *
+_pinfo::fhpools (size_t& n)
+{
+  char *s;
+  /* A non-Cygwin process has no fhandler pools. */
+  if (!pid || ISSTATE (this, PID_NOTCYGWIN))
+    return NULL;
+  if (pid != myself->pid)
+    {
+      commune_result cr = commune_request (PICOM_FHPOOLS);
+      s = cr.s;
+      n = cr.n;
+    }
+  else
+    {
+      tmp_pathbuf tp;
+      char *buf = tp.c_get ();
+
+      n = cpool_format (buf) + 1;
+      s = cstrdup (buf);
+    }
+  return s;
+}
+
 char *
 _pinfo::environ (size_t& n)
 {
@@ -21,29 +21,320 @@ details. */
 
 timer_tracker NO_COPY itimer_tracker (CLOCK_REALTIME, NULL);
 
+/* All armed timers of the process are kept in binary min-heaps ordered by
+   their next expiry.  A single thread sleeps on one waitable timer per
+   heap, each set to the earliest expiry in its heap, and expires the
+   timers in order.  This way arming a timer costs neither a thread nor
+   any kernel objects of its own.
+
+   Relative timers and timers on clocks other than CLOCK_REALTIME run on
+   the monotonic clock.  Absolute CLOCK_REALTIME timers are kept in heaps
+   of their own ordered by their realtime expiry, and their waitable timer
+   is set to that absolute system time, so they follow clock_settime and
+   time adjustments the way POSIX requires.  Alarm timers have heaps of
+   their own as well, since only their waitable timers may resume the
+   system from sleep.
+
+   Lock order is timer_tracker::srwlock first, then timer_queue::lock.
+   While expiring a timer, the thread drops the queue lock and notes the
+   timer in running, so that cancel can wait for it to finish. */
+enum
+{
+  TQ_MONO,
+  TQ_MONO_ALARM,
+  TQ_REAL,
+  TQ_REAL_ALARM,
+  TQ_NUM
+};
+
+class timer_heap
+{
+  timer_tracker **heap;
+  ULONG cnt;
+  ULONG size;
+  HANDLE timer;
+
+  void set (ULONG i, timer_tracker *tt) { heap[i] = tt; tt->q_idx = i; }
+  void up (ULONG);
+  void down (ULONG);
+
+ public:
+  static bool realtime (int q) { return q >= TQ_REAL; }
+  static bool alarm (int q) { return q == TQ_MONO_ALARM
+				     || q == TQ_REAL_ALARM; }
+  static LONG64 now (int q)
+  {
+    return get_clock (realtime (q) ? CLOCK_REALTIME
+				   : CLOCK_MONOTONIC)->n100secs ();
+  }
+
+  bool init ();
+  HANDLE get_timer () const { return timer; }
+  timer_tracker *first () const { return cnt ? heap[0] : NULL; }
+  bool insert (timer_tracker *, LONG64);
+  void remove (timer_tracker *);
+  void set_timer (int);
+};
+
+class timer_queue
+{
+  SRWLOCK lock;
+  CONDITION_VARIABLE done;
+  timer_heap heaps[TQ_NUM];
+  timer_tracker *running;
+  bool started;
+  HANDLE update_evt;
+
+  bool start ();
+  bool enqueue (timer_tracker *, LONG64);
+  void dequeue (timer_tracker *tt) { heaps[tt->q_heap].remove (tt); }
+
+ public:
+  bool arm (timer_tracker *, LONG64, bool);
+  void disarm (timer_tracker *);
+  DWORD thread_func ();
+};
+
+/* NO_COPY: A forked child starts without timers. */
+static NO_COPY timer_queue timer_q;
+
+void
+timer_heap::up (ULONG i)
+{
+  timer_tracker *tt = heap[i];
+
+  while (i > 0)
+    {
+      ULONG parent = (i - 1) / 2;
+      if (heap[parent]->q_due <= tt->q_due)
+	break;
+      set (i, heap[parent]);
+      i = parent;
+    }
+  set (i, tt);
+}
+
+void
+timer_heap::down (ULONG i)
+{
+  timer_tracker *tt = heap[i];
+
+  while (2 * i + 1 < cnt)
+    {
+      ULONG child = 2 * i + 1;
+      if (child + 1 < cnt && heap[child + 1]->q_due < heap[child]->q_due)
+	++child;
+      if (tt->q_due <= heap[child]->q_due)
+	break;
+      set (i, heap[child]);
+      i = child;
+    }
+  set (i, tt);
+}
+
 bool
-timer_tracker::cancel ()
+timer_heap::init ()
+{
+  return NT_SUCCESS (NtCreateTimer (&timer, TIMER_ALL_ACCESS, NULL,
+				    SynchronizationTimer));
+}
+
+/* Insert TT to expire at DUE on the clock of the heap.  Returns false if
+   the heap can't grow. */
+bool
+timer_heap::insert (timer_tracker *tt, LONG64 due)
+{
+  if (cnt >= size)
+    {
+      ULONG nsize = size ? 2 * size : 64;
+      void *p = heap ? HeapReAlloc (GetProcessHeap (), 0, heap,
+				    nsize * sizeof *heap)
+		     : HeapAlloc (GetProcessHeap (), 0, nsize * sizeof *heap);
+      if (!p)
+	return false;
+      heap = (timer_tracker **) p;
+      size = nsize;
+    }
+  tt->q_due = due;
+  set (cnt, tt);
+  up (cnt++);
+  return true;
+}
+
+void
+timer_heap::remove (timer_tracker *tt)
+{
+  if (tt->q_idx < 0)
+    return;
+
+  ULONG i = tt->q_idx;
+  tt->q_idx = -1;
+  if (i < --cnt)
+    {
+      timer_tracker *last = heap[cnt];
+
+      set (i, last);
+      up (i);
+      down (last->q_idx);
+    }
+}
+
+/* Set the waitable timer of heap Q to the earliest expiry. */
+void
+timer_heap::set_timer (int q)
 {
-  DWORD res;
+  LARGE_INTEGER DueTime;
 
-  if (!cancel_evt)
+  if (!cnt)
+    {
+      NtCancelTimer (timer, NULL);
+      return;
+    }
+  /* A positive due time is an absolute system time, which the kernel
+     adjusts to clock changes.  Note: Advanced Power Settings -> Sleep ->
+     Allow Wake Timers since W10 1709 */
+  if (realtime (q))
+    DueTime.QuadPart = heap[0]->q_due + FACTOR;
+  else
+    DueTime.QuadPart = MIN (now (q) - heap[0]->q_due, -1LL);
+  NtSetTimer (timer, &DueTime, NULL, NULL, alarm (q), 0, NULL);
+}
+
+static DWORD
+timer_thread (VOID *x)
+{
+  return ((timer_queue *) x)->thread_func ();
+}
+
+/* Create the queue's timers and thread on first use.  Call under lock. */
+bool
+timer_queue::start ()
+{
+  int q;
+
+  if (started)
+    return true;
+  update_evt = CreateEvent (&sec_none_nih, FALSE, FALSE, NULL);
+  if (!update_evt)
     return false;
-  SetEvent (cancel_evt);
-  if (sync_thr)
+  for (q = 0; q < TQ_NUM; ++q)
+    if (!heaps[q].init ())
+      break;
+  if (q < TQ_NUM)
     {
-      ReleaseSRWLockExclusive (&srwlock);
-      res = WaitForSingleObject (sync_thr, INFINITE);
-      AcquireSRWLockExclusive (&srwlock);
-      if (res != WAIT_OBJECT_0)
-	debug_printf ("WFSO returned unexpected value %u, %E", res);
+      while (q-- > 0)
+	NtClose (heaps[q].get_timer ());
+      CloseHandle (update_evt);
+      update_evt = NULL;
+      return false;
     }
+  new cygthread (timer_thread, this, "itimer");
+  started = true;
+  return true;
+}
+
+/* Insert TT to expire in DUE 100ns units.  Call under lock. */
+bool
+timer_queue::enqueue (timer_tracker *tt, LONG64 due)
+{
+  timer_heap &h = heaps[tt->q_heap];
+
+  if (!h.insert (tt, timer_heap::now (tt->q_heap) + (due > 0 ? due : 0)))
+    return false;
+  /* New earliest expiry?  Let the thread recompute its wait time. */
+  if (tt->q_idx == 0)
+    SetEvent (update_evt);
   return true;
 }
 
+/* Arm TT to expire in DUE 100ns units.  If ABS, TT is an absolute timer
+   and expires when its realtime expiry is reached, even if the clock
+   changes in the meantime. */
+bool
+timer_queue::arm (timer_tracker *tt, LONG64 due, bool abs)
+{
+  bool ret;
+
+  tt->q_heap = (abs && tt->is_realtime ()) ? TQ_REAL : TQ_MONO;
+  if (tt->is_alarm ())
+    ++tt->q_heap;
+  AcquireSRWLockExclusive (&lock);
+  ret = start () && enqueue (tt, due);
+  ReleaseSRWLockExclusive (&lock);
+  return ret;
+}
+
+/* Remove TT from the queue.  Called with TT's srwlock held, which is
+   temporarily released if the thread is just expiring TT. */
+void
+timer_queue::disarm (timer_tracker *tt)
+{
+  AcquireSRWLockExclusive (&lock);
+  while (running == tt)
+    {
+      ReleaseSRWLockExclusive (&lock);
+      ReleaseSRWLockExclusive (&tt->srwlock);
+      AcquireSRWLockExclusive (&lock);
+      while (running == tt)
+	SleepConditionVariableSRW (&done, &lock, INFINITE, 0);
+      ReleaseSRWLockExclusive (&lock);
+      AcquireSRWLockExclusive (&tt->srwlock);
+      AcquireSRWLockExclusive (&lock);
+    }
+  dequeue (tt);
+  ReleaseSRWLockExclusive (&lock);
+}
+
+DWORD
+timer_queue::thread_func ()
+{
+  HANDLE w4[TQ_NUM + 1];
+
+  for (int q = 0; q < TQ_NUM; ++q)
+    w4[q] = heaps[q].get_timer ();
+  w4[TQ_NUM] = update_evt;
+  AcquireSRWLockExclusive (&lock);
+  while (1)
+    {
+      timer_tracker *tt = NULL;
+
+      for (int q = 0; q < TQ_NUM && !tt; ++q)
+	if ((tt = heaps[q].first ()) && tt->q_due > timer_heap::now (q))
+	  tt = NULL;
+      if (tt)
+	{
+	  dequeue (tt);
+	  running = tt;
+	  ReleaseSRWLockExclusive (&lock);
+	  LONG64 next = tt->expire ();
+	  AcquireSRWLockExclusive (&lock);
+	  if (next > 0 && !enqueue (tt, next))
+	    debug_printf ("%p can't requeue timer", tt);
+	  running = NULL;
+	  WakeAllConditionVariable (&done);
+	  continue;
+	}
+      for (int q = 0; q < TQ_NUM; ++q)
+	heaps[q].set_timer (q);
+      ReleaseSRWLockExclusive (&lock);
+      if (WaitForMultipleObjects (TQ_NUM + 1, w4, FALSE, INFINITE)
+	  == WAIT_FAILED)
+	debug_printf ("wait failed, %E");
+      AcquireSRWLockExclusive (&lock);
+    }
+  return 0;
+}
+
+void
+timer_tracker::cancel ()
+{
+  timer_q.disarm (this);
+}
+
 timer_tracker::timer_tracker (clockid_t c, const sigevent *e)
-: magic (TT_MAGIC), clock_id (c), timer (NULL), cancel_evt (NULL),
-  sync_thr (NULL), interval (0), exp_ts (0), overrun_count_curr (0),
-  overrun_count (OVR_DISARMED)
+: magic (TT_MAGIC), clock_id (c), interval (0), exp_ts (0),
+  overrun_count_curr (0), overrun_count (OVR_DISARMED), q_due (0), q_idx (-1),
+  q_heap (0)
 {
   srwlock = SRWLOCK_INIT;
   if (e != NULL)
@@ -60,9 +351,6 @@ timer_tracker::~timer_tracker ()
 {
   AcquireSRWLockExclusive (&srwlock);
   cancel ();
-  NtClose (cancel_evt);
-  NtClose (sync_thr);
-  NtClose (timer);
   magic = 0;
   ReleaseSRWLockExclusive (&srwlock);
 }
@@ -112,127 +400,91 @@ notify_thread_wrapper (void *arg)
   return notify_func (evt->sigev_value.sival_ptr);
 }
 
-DWORD
-timer_tracker::thread_func ()
+/* Called from the timer queue thread when the timer expired.  Returns the
+   time until the next expiry in 100ns units for periodic timers, 0 if the
+   timer is done. */
+LONG64
+timer_tracker::expire ()
 {
-  HANDLE w4[2] = { timer, cancel_evt };
+  LONG64 next = 0;
 
-  debug_printf ("%p timer armed", this);
-  while (1)
+  AcquireSRWLockExclusive (&srwlock);
+  /* Make sure we haven't been disarmed in the meantime */
+  if (exp_ts == 0 && interval == 0)
     {
-      switch (WaitForMultipleObjects (2, w4, FALSE, INFINITE))
-	{
-	case WAIT_OBJECT_0:
-	  debug_printf ("%p timer expired", this);
-	  break;
-	case WAIT_OBJECT_0 + 1:
-	  debug_printf ("%p timer disarmed, %E", this);
-	  goto out;
-	default:
-	  debug_printf ("%p wait failed, %E", this);
-	  continue;
-	}
-      AcquireSRWLockExclusive (&srwlock);
-      /* Make sure we haven't been abandoned and/or disarmed in the meantime */
-      if (exp_ts == 0 && interval == 0)
-	{
-	  ReleaseSRWLockExclusive (&srwlock);
-	  goto out;
-	}
-      LONG64 exp_cnt = 0;
-      if (interval)
-	{
-	  /* Compute expiration count. */
-	  LONG64 now = get_clock_now ();
-	  LONG64 ts = get_exp_ts ();
-
-	  /* Make concessions for unexact realtime clock */
-	  if (ts > now)
-	    ts = now - 1;
-	  exp_cnt = (now - ts + interval - 1) / interval;
-	  ts += interval * exp_cnt;
-	  set_exp_ts (ts);
-	  /* NtSetTimer allows periods of up to 24 days only.  If the time
-	     is longer, we set the timer up as one-shot timer for each
-	     interval.  Restart timer here with new due time. */
-	  if (interval > INT_MAX * (NS100PERSEC / MSPERSEC))
-	    {
-	      BOOLEAN Resume = (clock_id == CLOCK_REALTIME_ALARM
-				|| clock_id == CLOCK_BOOTTIME_ALARM);
-	      LARGE_INTEGER DueTime = { QuadPart: -interval };
-
-	      NtSetTimer (timer, &DueTime, NULL, NULL, Resume, 0, NULL);
-	    }
-	}
-      switch (evp.sigev_notify)
-	{
-	case SIGEV_SIGNAL:
+      ReleaseSRWLockExclusive (&srwlock);
+      return 0;
+    }
+  debug_printf ("%p timer expired", this);
+  LONG64 exp_cnt = 0;
+  if (interval)
+    {
+      /* Compute expiration count. */
+      LONG64 now = get_clock_now ();
+      LONG64 ts = get_exp_ts ();
+
+      /* Make concessions for unexact realtime clock */
+      if (ts > now)
+	ts = now - 1;
+      exp_cnt = (now - ts + interval - 1) / interval;
+      ts += interval * exp_cnt;
+      set_exp_ts (ts);
+      next = ts - now;
+      if (next <= 0)
+	next = 1;
+    }
+  switch (evp.sigev_notify)
+    {
+    case SIGEV_SIGNAL:
+      {
+	if (arm_overrun_event (exp_cnt))
 	  {
-	    if (arm_overrun_event (exp_cnt))
-	      {
-		debug_printf ("%p timer signal already queued", this);
-		break;
-	      }
-	    siginfo_t si = {0};
-	    si.si_signo = evp.sigev_signo;
-	    si.si_code = SI_TIMER;
-	    si.si_tid = (timer_t) this;
-	    si.si_sigval.sival_ptr = evp.sigev_value.sival_ptr;
-	    debug_printf ("%p sending signal %d", this, evp.sigev_signo);
-	    sig_send (myself_nowait, si);
+	    debug_printf ("%p timer signal already queued", this);
 	    break;
 	  }
-	case SIGEV_THREAD:
+	siginfo_t si = {0};
+	si.si_signo = evp.sigev_signo;
+	si.si_code = SI_TIMER;
+	si.si_tid = (timer_t) this;
+	si.si_sigval.sival_ptr = evp.sigev_value.sival_ptr;
+	debug_printf ("%p sending signal %d", this, evp.sigev_signo);
+	sig_send (myself_nowait, si);
+	break;
+      }
+    case SIGEV_THREAD:
+      {
+	if (arm_overrun_event (exp_cnt))
 	  {
-	    if (arm_overrun_event (exp_cnt))
-	      {
-		debug_printf ("%p timer thread already queued", this);
-		break;
-	      }
-	    pthread_t notify_thread;
-	    debug_printf ("%p starting thread", this);
-	    pthread_attr_t *attr;
-	    pthread_attr_t default_attr;
-	    if (evp.sigev_notify_attributes)
-	      attr = evp.sigev_notify_attributes;
-	    else
-	      {
-		pthread_attr_init(attr = &default_attr);
-		pthread_attr_setdetachstate (attr, PTHREAD_CREATE_DETACHED);
-	      }
-	    int rc = pthread_create (&notify_thread, attr,
-				     notify_thread_wrapper, this);
-	    if (rc)
-	      {
-		debug_printf ("thread creation failed, %E");
-		return 0;
-	      }
+	    debug_printf ("%p timer thread already queued", this);
 	    break;
 	  }
-	}
-      /* one-shot timer? */
-      if (!interval)
-	{
-	  memset (&time_spec, 0, sizeof time_spec);
-	  exp_ts = 0;
-	  overrun_count = OVR_DISARMED;
-	  ReleaseSRWLockExclusive (&srwlock);
-	  goto out;
-	}
-      ReleaseSRWLockExclusive (&srwlock);
-      debug_printf ("looping");
+	pthread_t notify_thread;
+	debug_printf ("%p starting thread", this);
+	pthread_attr_t *attr;
+	pthread_attr_t default_attr;
+	if (evp.sigev_notify_attributes)
+	  attr = evp.sigev_notify_attributes;
+	else
+	  {
+	    pthread_attr_init(attr = &default_attr);
+	    pthread_attr_setdetachstate (attr, PTHREAD_CREATE_DETACHED);
+	  }
+	int rc = pthread_create (&notify_thread, attr,
+				 notify_thread_wrapper, this);
+	if (rc)
+	  debug_printf ("thread creation failed, %E");
+	break;
+      }
     }
-
-out:
-  _my_tls._ctinfo->auto_release ();     /* automatically return the cygthread to the cygthread pool */
-  return 0;
-}
-
-static DWORD
-timer_thread (VOID *x)
-{
-  timer_tracker *tt = ((timer_tracker *) x);
-  return tt->thread_func ();
+  /* one-shot timer? */
+  if (!interval)
+    {
+      memset (&time_spec, 0, sizeof time_spec);
+      exp_ts = 0;
+      overrun_count = OVR_DISARMED;
+    }
+  ReleaseSRWLockExclusive (&srwlock);
+  return next;
 }
 
 int
@@ -298,47 +550,8 @@ timer_tracker::settime (int flags, const itimerspec *new_value,
 	}
       else
 	{
-	  LONG64 ts;
-	  LARGE_INTEGER DueTime;
-	  BOOLEAN Resume;
-	  LONG Period;
-	  NTSTATUS status;
+	  LONG64 ts, due;
 
-	  if (!timer)
-	    {
-	      OBJECT_ATTRIBUTES attr;
-
-	      InitializeObjectAttributes (&attr, NULL, 0, NULL, NULL);
-	      status = NtCreateEvent (&cancel_evt, EVENT_ALL_ACCESS, &attr,
-				      NotificationEvent, FALSE);
-	      if (!NT_SUCCESS (status))
-		{
-		  ret = -geterrno_from_nt_status (status);
-		  __leave;
-		}
-	      status = NtCreateEvent (&sync_thr, EVENT_ALL_ACCESS, &attr,
-				      NotificationEvent, FALSE);
-	      if (!NT_SUCCESS (status))
-		{
-		  NtClose (cancel_evt);
-		  cancel_evt = NULL;
-		  ret = -geterrno_from_nt_status (status);
-		  __leave;
-		}
-	      status = NtCreateTimer (&timer, TIMER_ALL_ACCESS, &attr,
-				      SynchronizationTimer);
-	      if (!NT_SUCCESS (status))
-		{
-		  NtClose (cancel_evt);
-		  NtClose (sync_thr);
-		  cancel_evt = sync_thr = NULL;
-		  ret = -geterrno_from_nt_status (status);
-		  __leave;
-		}
-	    }
-	  ResetEvent (cancel_evt);
-	  ResetEvent (sync_thr);
-	  NtCancelTimer (timer, NULL);
 	  /* Convert incoming itimerspec into 100ns interval and timestamp */
 	  interval = new_value->it_interval.tv_sec * NS100PERSEC
 		      + (new_value->it_interval.tv_nsec
@@ -347,50 +560,28 @@ timer_tracker::settime (int flags, const itimerspec *new_value,
 	  ts = new_value->it_value.tv_sec * NS100PERSEC
 	       + (new_value->it_value.tv_nsec + (NSPERSEC / NS100PERSEC) - 1)
 		 / (NSPERSEC / NS100PERSEC);
+	  /* The timer queue wants the relative due time.  Store the
+	     expiry timestamp absolute in the timer's own clock. */
 	  if (flags & TIMER_ABSTIME)
-	    {
-	      if (clock_id == CLOCK_REALTIME)
-		DueTime.QuadPart = ts + FACTOR;
-	      else /* non-REALTIME clocks require relative DueTime. */
-		{
-		  DueTime.QuadPart = get_clock_now () - ts;
-		  /* If the timestamp was earlier than now, compute number
-		     of expirations and offset DueTime to expire immediately. */
-		  if (DueTime.QuadPart >= 0)
-		    DueTime.QuadPart = -1LL;
-		}
-	    }
+	    due = ts - get_clock_now ();
 	  else
 	    {
-	      /* Keep relative timestamps relative for the timer, but store the
-		 expiry timestamp absolute for the timer thread. */
-	      DueTime.QuadPart = -ts;
+	      due = ts;
 	      ts += get_clock_now ();
 	    }
 	  set_exp_ts (ts);
 	  time_spec = *new_value;
 	  overrun_count_curr = 0;
 	  overrun_count = OVR_DISARMED;
-	  /* Note: Advanced Power Settings -> Sleep -> Allow Wake Timers
-		   since W10 1709 */
-	  Resume = (clock_id == CLOCK_REALTIME_ALARM
-		    || clock_id == CLOCK_BOOTTIME_ALARM);
-	  if (interval > INT_MAX * (NS100PERSEC / MSPERSEC))
-	    Period = 0;
-	  else
-	    Period = (interval + (NS100PERSEC / MSPERSEC) - 1)
-		     / (NS100PERSEC / MSPERSEC);
-	  status = NtSetTimer (timer, &DueTime, NULL, NULL, Resume, Period,
-			       NULL);
-	  if (!NT_SUCCESS (status))
+	  if (!timer_q.arm (this, due, flags & TIMER_ABSTIME))
 	    {
 	      memset (&time_spec, 0, sizeof time_spec);
 	      interval = 0;
 	      exp_ts = 0;
-	      ret = -geterrno_from_nt_status (status);
+	      ReleaseSRWLockExclusive (&srwlock);
+	      ret = -EAGAIN;
 	      __leave;
 	    }
-	  new cygthread (timer_thread, this, "itimer", sync_thr);
 	}
       ReleaseSRWLockExclusive (&srwlock);
       ret = 0;
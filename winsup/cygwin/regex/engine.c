@@ -57,6 +57,10 @@ __FBSDID("$FreeBSD$");
 #define	print	sprint
 #define	at	sat
 #define	match	smat
+#define	boundary sboundary
+#define	dfainit	sdfainit
+#define	dfaintern sdfaintern
+#define	dfastep	sdfastep
 #endif
 #ifdef LNAMES
 #define	stepback lstepback
@@ -68,6 +72,10 @@ __FBSDID("$FreeBSD$");
 #define	print	lprint
 #define	at	lat
 #define	match	lmat
+#define	boundary lboundary
+#define	dfainit	ldfainit
+#define	dfaintern ldfaintern
+#define	dfastep	ldfastep
 #endif
 #ifdef MNAMES
 #define	stepback mstepback
@@ -79,6 +87,10 @@ __FBSDID("$FreeBSD$");
 #define	print	mprint
 #define	at	mat
 #define	match	mmat
+#define	boundary mboundary
+#define	dfainit	mdfainit
+#define	dfaintern mdfaintern
+#define	dfastep	mdfastep
 #endif
 
 /* another structure passed up and down to avoid zillions of parameters */
@@ -97,6 +109,7 @@ struct match {
 	states tmp;		/* temporary */
 	states empty;		/* empty set of states */
 	mbstate_t mbs;		/* multibyte conversion state */
+	struct re_dfa *dfa;	/* DFA cache, NULL if not usable */
 };
 
 /* ========= begin header generated by ./mkh ========= */
@@ -110,6 +123,10 @@ static const char *dissect(struct match *m, const char *start, const char *stop,
 static const char *backref(struct match *m, const char *start, const char *stop, sopno startst, sopno stopst, sopno lev, int);
 static const char *walk(struct match *m, const char *start, const char *stop, sopno startst, sopno stopst, bool fast);
 static states step(struct re_guts *g, sopno start, sopno stop, states bef, wint_t ch, states aft, int sflags);
+static states boundary(struct match *m, sopno startst, sopno stopst, states st, wint_t lastc, wint_t c, int *sflagsp);
+static struct re_dfa *dfainit(struct match *m);
+static int dfaintern(struct match *m, struct re_dfamode *dm, states st, int ctx, states fresh, bool fast);
+static int dfastep(struct match *m, struct re_dfamode *dm, int cur, wint_t lastc, wint_t c, sopno startst, sopno stopst, states st, states fresh, bool fast);
 #define MAX_RECURSION	100
 #define	BOL	(OUT-1)
 #define	EOL	(BOL-1)
@@ -283,6 +300,7 @@ matcher(struct re_guts *g,
 	SETUP(m->empty);
 	CLEAR(m->empty);
 	ZAPSTATE(&m->mbs);
+	m->dfa = dfainit(m);
 
 	/* Adjust start according to moffset, to speed things up */
 	if (dp != NULL && g->moffset > -1) {
@@ -303,6 +321,7 @@ matcher(struct re_guts *g,
 				free((char *)m->pmatch);
 			if (m->lastpos != NULL)
 				free((char *)m->lastpos);
+			dfarelease(m->dfa);
 			STATETEARDOWN(m);
 			return(REG_NOMATCH);
 		}
@@ -328,6 +347,7 @@ matcher(struct re_guts *g,
 			m->pmatch = (regmatch_t *)malloc((m->g->nsub + 1) *
 							sizeof(regmatch_t));
 		if (m->pmatch == NULL) {
+			dfarelease(m->dfa);
 			STATETEARDOWN(m);
 			return(REG_ESPACE);
 		}
@@ -342,6 +362,7 @@ matcher(struct re_guts *g,
 						sizeof(const char *));
 			if (g->nplus > 0 && m->lastpos == NULL) {
 				free(m->pmatch);
+				dfarelease(m->dfa);
 				STATETEARDOWN(m);
 				return(REG_ESPACE);
 			}
@@ -403,6 +424,7 @@ matcher(struct re_guts *g,
 		free((char *)m->pmatch);
 	if (m->lastpos != NULL)
 		free((char *)m->lastpos);
+	dfarelease(m->dfa);
 	STATETEARDOWN(m);
 	return(0);
 }
@@ -854,10 +876,13 @@ walk(struct match *m, const char *start, const char *stop, sopno startst,
 	const char *p = start;
 	wint_t c;
 	wint_t lastc;		/* previous c */
-	wint_t flagch;
-	int i, sflags;
+	int sflags;
 	const char *matchp;	/* last p at which a match ended */
 	size_t clen;
+	bool matched = false;
+	struct re_dfamode *dm = NULL;
+	int cur = -1;		/* DFA state, if >= 0 st is out of date */
+	int t;
 
 	sflags = 0;
 	AT("slow", start, stop, startst, stopst);
@@ -867,6 +892,9 @@ walk(struct match *m, const char *start, const char *stop, sopno startst,
 	st = step(m->g, startst, stopst, st, NOTHING, st, sflags);
 	if (fast)
 		ASSIGN(fresh, st);
+	if (m->dfa != NULL && startst == m->g->firststate+1 &&
+	    stopst == m->g->laststate)
+		dm = dfamode(m->dfa, fast);
 	matchp = NULL;
 	if (start == m->offp || (start == m->beginp && !(m->eflags&REG_NOTBOL)))
 		c = OUT;
@@ -888,69 +916,53 @@ walk(struct match *m, const char *start, const char *stop, sopno startst,
 		} else
 			clen = XMBRTOWC(&c, p, m->endp - p, &m->mbs, BADCHAR);
 
-		if (fast && EQ(st, fresh))
-			matchp = p;
-
-		/* is there an EOL and/or BOL between lastc and c? */
-		flagch = '\0';
-		i = 0;
-		if ( (lastc == '\n' && m->g->cflags&REG_NEWLINE) ||
-				(lastc == OUT && !(m->eflags&REG_NOTBOL)) ) {
-			flagch = BOL;
-			i = m->g->nbol;
-		}
-		if ( (c == '\n' && m->g->cflags&REG_NEWLINE) ||
-				(c == OUT && !(m->eflags&REG_NOTEOL)) ) {
-			flagch = (flagch == BOL) ? BOLEOL : EOL;
-			i += m->g->neol;
-		}
-		if (lastc == OUT && (m->eflags & REG_NOTBOL) == 0) {
-			sflags |= SBOS;
-			/* Step one more for BOS. */
-			i++;
-		}
-		if (c == OUT && (m->eflags & REG_NOTEOL) == 0) {
-			sflags |= SEOS;
-			/* Step one more for EOS. */
-			i++;
+		/*
+		 * Between two ordinary characters, the DFA knows where we
+		 * go without stepping through the strip.
+		 */
+		if (dm != NULL && lastc != OUT && !NONCHAR(c) &&
+		    c < DFA_NCHARS) {
+			if (cur < 0)
+				cur = dfaintern(m, dm, st,
+				    DFACTX(m->g, lastc), fresh, fast);
+			if (fast && dm->ds[cur].fresh)
+				matchp = p;
+			t = dm->ds[cur].trans[c];
+			if (t == DFA_UNKNOWN)
+				t = dfastep(m, dm, cur, lastc, c, startst,
+				    stopst, st, fresh, fast);
+			if (t & DFA_MATCH) {
+				if (fast) {
+					matched = true;
+					break;
+				}
+				matchp = p;
+			}
+			if ((t & DFA_DEAD) || p == stop ||
+			    clen > (size_t)(stop - p))
+				break;
+			cur = DFA_NEXT(t);
+			p += clen;
+			continue;
 		}
-		if (i != 0) {
-			for (; i > 0; i--)
-				st = step(m->g, startst, stopst, st, flagch, st,
-				    sflags);
-			SP("sboleol", st, c);
+		if (cur >= 0) {
+			memcpy(STATEBYTES(st),
+			    dm->sets + cur * m->dfa->setsize,
+			    m->dfa->setsize);
+			cur = -1;
 		}
 
-		/* how about a word boundary? */
-		if ( (flagch == BOL || (lastc != OUT && !ISWORD(lastc))) &&
-					(c != OUT && ISWORD(c)) ) {
-			flagch = BOW;
-		}
-		if ( (lastc != OUT && ISWORD(lastc)) &&
-				(flagch == EOL || (c != OUT && !ISWORD(c))) ) {
-			flagch = EOW;
-		}
-		if (flagch == BOW || flagch == EOW) {
-			st = step(m->g, startst, stopst, st, flagch, st, sflags);
-			SP("sboweow", st, c);
-		}
-		if (lastc != OUT && c != OUT &&
-		    ISWORD(lastc) == ISWORD(c)) {
-			flagch = NWBND;
-		} else if ((lastc == OUT && !ISWORD(c)) ||
-		    (c == OUT && !ISWORD(lastc))) {
-			flagch = NWBND;
-		}
-		if (flagch == NWBND) {
-			st = step(m->g, startst, stopst, st, flagch, st, sflags);
-			SP("snwbnd", st, c);
-		}
+		if (fast && EQ(st, fresh))
+			matchp = p;
+
+		st = boundary(m, startst, stopst, st, lastc, c, &sflags);
 
 		/* are we done? */
 		if (ISSET(st, stopst)) {
-			if (fast)
+			if (fast) {
+				matched = true;
 				break;
-			else
+			} else
 				matchp = p;
 		}
 		if (EQ(st, empty) || p == stop || clen > (size_t)(stop - p))
@@ -973,7 +985,7 @@ walk(struct match *m, const char *start, const char *stop, sopno startst,
 	if (fast) {
 		assert(matchp != NULL);
 		m->coldp = matchp;
-		if (ISSET(st, stopst))
+		if (matched)
 			return (p + XMBRTOWC(NULL, p, stop - p, &m->mbs, 0));
 		else
 			return (NULL);
@@ -981,6 +993,209 @@ walk(struct match *m, const char *start, const char *stop, sopno startst,
 		return (matchp);
 }
 
+/*
+ - boundary - apply the zero-width steps between characters lastc and c
+ == static states boundary(struct match *m, sopno startst, sopno stopst, \
+ ==	states st, wint_t lastc, wint_t c, int *sflagsp);
+ */
+static states
+boundary(struct match *m,
+	sopno startst,
+	sopno stopst,
+	states st,
+	wint_t lastc,
+	wint_t c,
+	int *sflagsp)
+{
+	wint_t flagch;
+	int i, sflags;
+
+	sflags = 0;
+
+	/* is there an EOL and/or BOL between lastc and c? */
+	flagch = '\0';
+	i = 0;
+	if ( (lastc == '\n' && m->g->cflags&REG_NEWLINE) ||
+			(lastc == OUT && !(m->eflags&REG_NOTBOL)) ) {
+		flagch = BOL;
+		i = m->g->nbol;
+	}
+	if ( (c == '\n' && m->g->cflags&REG_NEWLINE) ||
+			(c == OUT && !(m->eflags&REG_NOTEOL)) ) {
+		flagch = (flagch == BOL) ? BOLEOL : EOL;
+		i += m->g->neol;
+	}
+	if (lastc == OUT && (m->eflags & REG_NOTBOL) == 0) {
+		sflags |= SBOS;
+		/* Step one more for BOS. */
+		i++;
+	}
+	if (c == OUT && (m->eflags & REG_NOTEOL) == 0) {
+		sflags |= SEOS;
+		/* Step one more for EOS. */
+		i++;
+	}
+	if (i != 0) {
+		for (; i > 0; i--)
+			st = step(m->g, startst, stopst, st, flagch, st,
+			    sflags);
+		SP("sboleol", st, c);
+	}
+
+	/* how about a word boundary? */
+	if ( (flagch == BOL || (lastc != OUT && !ISWORD(lastc))) &&
+				(c != OUT && ISWORD(c)) ) {
+		flagch = BOW;
+	}
+	if ( (lastc != OUT && ISWORD(lastc)) &&
+			(flagch == EOL || (c != OUT && !ISWORD(c))) ) {
+		flagch = EOW;
+	}
+	if (flagch == BOW || flagch == EOW) {
+		st = step(m->g, startst, stopst, st, flagch, st, sflags);
+		SP("sboweow", st, c);
+	}
+	if (lastc != OUT && c != OUT &&
+	    ISWORD(lastc) == ISWORD(c)) {
+		flagch = NWBND;
+	} else if ((lastc == OUT && !ISWORD(c)) ||
+	    (c == OUT && !ISWORD(lastc))) {
+		flagch = NWBND;
+	}
+	if (flagch == NWBND) {
+		st = step(m->g, startst, stopst, st, flagch, st, sflags);
+		SP("snwbnd", st, c);
+	}
+	*sflagsp = sflags;
+	return (st);
+}
+
+/*
+ - dfainit - claim the DFA cache of the regex for this matcher
+ == static struct re_dfa *dfainit(struct match *m);
+ *
+ * Returns NULL if the DFA can't be used, or another thread is using it.
+ */
+static struct re_dfa *
+dfainit(struct match *m)
+{
+	struct re_guts *g = m->g;
+	struct re_dfa *d, *nd;
+
+	if (g->backrefs || (m->eflags&REG_BACKR))
+		return (NULL);
+	d = __atomic_load_n(&g->dfa, __ATOMIC_ACQUIRE);
+	if (d == NULL) {
+		nd = calloc(1, sizeof(*nd));
+		if (nd == NULL)
+			return (NULL);
+		if (__atomic_compare_exchange_n(&g->dfa, &d, nd, false,
+		    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			d = nd;
+		else
+			free(nd);
+	}
+	if (__atomic_exchange_n(&d->busy, 1, __ATOMIC_ACQUIRE))
+		return (NULL);
+	if (d->rep != DFAREP || d->setsize != STATESIZE(m)) {
+		/* built by another matcher, e.g. after a locale change */
+		dfafree(d->mode[0]);
+		dfafree(d->mode[1]);
+		d->mode[0] = d->mode[1] = NULL;
+		d->rep = DFAREP;
+		d->setsize = STATESIZE(m);
+	}
+	return (d);
+}
+
+/*
+ - dfaintern - find or add the DFA state for set st after a ctx character
+ == static int dfaintern(struct match *m, struct re_dfamode *dm, states st, \
+ ==	int ctx, states fresh, bool fast);
+ */
+static int
+dfaintern(struct match *m,
+	struct re_dfamode *dm,
+	states st,
+	int ctx,
+	states fresh,
+	bool fast)
+{
+	size_t size = m->dfa->setsize;
+	const char *set = STATEBYTES(st);
+	unsigned int h = dfahash(set, size, ctx);
+	struct re_dfastate *ds;
+	int i, n;
+
+	for (i = h & (DFA_HASHSIZE - 1); (n = dm->hash[i]) >= 0;
+	    i = (i + 1) & (DFA_HASHSIZE - 1)) {
+		ds = &dm->ds[n];
+		if (ds->hash == h && ds->ctx == ctx &&
+		    memcmp(dm->sets + n * size, set, size) == 0)
+			return (n);
+	}
+	if (dm->nstates == dm->maxstates && !dfagrow(dm, size)) {
+		dfaflush(dm);
+		i = h & (DFA_HASHSIZE - 1);
+	}
+	n = dm->nstates++;
+	dm->hash[i] = n;
+	ds = &dm->ds[n];
+	ds->hash = h;
+	ds->ctx = ctx;
+	ds->fresh = fast && EQ(st, fresh);
+	memset(ds->trans, 0xff, sizeof(ds->trans));	/* DFA_UNKNOWN */
+	memcpy(dm->sets + n * size, set, size);
+	return (n);
+}
+
+/*
+ - dfastep - compute and remember the transition of DFA state cur on c
+ == static int dfastep(struct match *m, struct re_dfamode *dm, int cur, \
+ ==	wint_t lastc, wint_t c, sopno startst, sopno stopst, states st, \
+ ==	states fresh, bool fast);
+ *
+ * This is the loop body of walk() for ordinary characters.  st is used
+ * as scratch space.
+ */
+static int
+dfastep(struct match *m,
+	struct re_dfamode *dm,
+	int cur,
+	wint_t lastc,
+	wint_t c,
+	sopno startst,
+	sopno stopst,
+	states st,
+	states fresh,
+	bool fast)
+{
+	states empty = m->empty;
+	states tmp = m->tmp;
+	size_t size = m->dfa->setsize;
+	unsigned int gen = dm->gen;
+	int sflags, t;
+
+	memcpy(STATEBYTES(st), dm->sets + cur * size, size);
+	st = boundary(m, startst, stopst, st, lastc, c, &sflags);
+	t = 0;
+	if (ISSET(st, stopst))
+		t |= DFA_MATCH;
+	if (EQ(st, empty))
+		t |= DFA_DEAD;
+	ASSIGN(tmp, st);
+	if (fast)
+		ASSIGN(st, fresh);
+	else
+		ASSIGN(st, empty);
+	st = step(m->g, startst, stopst, tmp, c, st, sflags);
+	t |= dfaintern(m, dm, st, DFACTX(m->g, c), fresh, fast) << 2;
+	/* cur is gone if interning flushed the table */
+	if (dm->gen == gen)
+		dm->ds[cur].trans[c] = t;
+	return (t);
+}
+
 /*
  - step - map set of states reachable before char to set reachable after
  == static states step(struct re_guts *g, sopno start, sopno stop, \
@@ -1216,3 +1431,7 @@ pchar(int ch)
 #undef	print
 #undef	at
 #undef	match
+#undef	boundary
+#undef	dfainit
+#undef	dfaintern
+#undef	dfastep
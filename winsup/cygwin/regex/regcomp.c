@@ -315,6 +315,7 @@ regcomp_internal(regex_t * __restrict preg,
 	g->mlen = 0;
 	g->nsub = 0;
 	g->backrefs = 0;
+	g->dfa = NULL;
 
 	/* do it */
 	EMIT(OEND, 0);
@@ -196,6 +196,52 @@ struct re_guts {
 	size_t nsub;		/* copy of re_nsub */
 	int backrefs;		/* does it use back references? */
 	sopno nplus;		/* how deep does it nest +s? */
+	struct re_dfa *dfa;	/* lazy DFA cache, NULL until first regexec */
+};
+
+/*
+ * Lazy DFA cache for the top-level scans in walk().  A DFA state is a set
+ * of strip states plus the class of the preceding character, which is all
+ * the word boundary and newline tests depend on.  Transitions are filled
+ * in on first use.  The state table starts small and doubles as needed;
+ * when it is at its maximum and full it is flushed.  The fast and the
+ * slow scan get a table each, since the fast one restarts at every
+ * position.  Only one regexec() at a time uses the cache, concurrent
+ * callers run without it.
+ */
+#define	DFA_MINSTATES	8
+#define	DFA_MAXSTATES	128
+#define	DFA_HASHSIZE	(2 * DFA_MAXSTATES)	/* power of 2 */
+#define	DFA_NCHARS	256		/* characters with cached transitions */
+#define	DFA_UNKNOWN	(-1)
+#define	DFA_MATCH	1		/* match ends before the character */
+#define	DFA_DEAD	2		/* no state left before the character */
+#define	DFA_NEXT(t)	((t) >> 2)
+#define	DFA_NL		0		/* classes of the preceding character */
+#define	DFA_WORD	1
+#define	DFA_OTHER	2
+#define	DFACTX(g, c)	((c) == '\n' && (g)->cflags&REG_NEWLINE ? DFA_NL : \
+			 ISWORD(c) ? DFA_WORD : DFA_OTHER)
+
+struct re_dfastate {
+	short trans[DFA_NCHARS];	/* DFA_UNKNOWN or next << 2 | flags */
+	unsigned int hash;
+	unsigned char ctx;	/* DFA_NL, DFA_WORD or DFA_OTHER */
+	unsigned char fresh;	/* set equals a fresh start (fast scan) */
+};
+struct re_dfamode {
+	int nstates;
+	int maxstates;		/* allocated size of ds and sets */
+	unsigned int gen;	/* incremented on every flush */
+	int hash[DFA_HASHSIZE];
+	struct re_dfastate *ds;	/* [maxstates] */
+	char *sets;		/* [maxstates][setsize] */
+};
+struct re_dfa {
+	int busy;
+	int rep;		/* which matcher filled it */
+	size_t setsize;
+	struct re_dfamode *mode[2];	/* slow, fast */
 };
 
 /* misc utilities */
@@ -52,6 +52,7 @@ __FBSDID("$FreeBSD$");
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include <limits.h>
 #include <ctype.h>
 #include <regex.h>
@@ -96,6 +97,89 @@ xmbrtowc_dummy(wint_t *wi,
 	return (1);
 }
 
+/*
+ * Lazy DFA cache helpers independent of the state representation, see
+ * regex2.h and walk() in engine.c.
+ */
+static void
+dfaflush(struct re_dfamode *dm)
+{
+	memset(dm->hash, 0xff, sizeof(dm->hash));
+	dm->nstates = 0;
+	dm->gen++;
+}
+
+/*
+ * Double the state table, up to DFA_MAXSTATES.  On failure the table is
+ * left as it was.
+ */
+static bool
+dfagrow(struct re_dfamode *dm, size_t setsize)
+{
+	int n = dm->maxstates ? 2 * dm->maxstates : DFA_MINSTATES;
+	struct re_dfastate *ds;
+	char *sets;
+
+	if (n > DFA_MAXSTATES)
+		return (false);
+	ds = realloc(dm->ds, n * sizeof(*ds));
+	if (ds == NULL)
+		return (false);
+	dm->ds = ds;
+	sets = realloc(dm->sets, n * setsize);
+	if (sets == NULL)
+		return (false);
+	dm->sets = sets;
+	dm->maxstates = n;
+	return (true);
+}
+
+static void
+dfafree(struct re_dfamode *dm)
+{
+	if (dm != NULL) {
+		free(dm->ds);
+		free(dm->sets);
+		free(dm);
+	}
+}
+
+static struct re_dfamode *
+dfamode(struct re_dfa *d, bool fast)
+{
+	struct re_dfamode *dm = d->mode[fast];
+
+	if (dm == NULL) {
+		dm = calloc(1, sizeof(*dm));
+		if (dm == NULL)
+			return (NULL);
+		if (!dfagrow(dm, d->setsize)) {
+			dfafree(dm);
+			return (NULL);
+		}
+		dfaflush(dm);
+		d->mode[fast] = dm;
+	}
+	return (dm);
+}
+
+static unsigned int
+dfahash(const char *set, size_t size, int ctx)
+{
+	unsigned int h = 2166136261U ^ ctx;	/* FNV-1a */
+
+	while (size-- > 0)
+		h = (h ^ (uch)*set++) * 16777619U;
+	return (h);
+}
+
+static void
+dfarelease(struct re_dfa *d)
+{
+	if (d != NULL)
+		__atomic_store_n(&d->busy, 0, __ATOMIC_RELEASE);
+}
+
 /* macros for manipulating states, small version */
 #define	states1	long		/* for later use in regexec() decision */
 #define	states	states1
@@ -118,6 +202,10 @@ xmbrtowc_dummy(wint_t *wi,
 #define	FWD(dst, src, n)	((dst) |= ((unsigned long)(src)&(here)) << (n))
 #define	BACK(dst, src, n)	((dst) |= ((unsigned long)(src)&(here)) >> (n))
 #define	ISSETBACK(v, n)	(((v) & ((unsigned long)here >> (n))) != 0)
+/* raw bytes of a state set, for the DFA cache */
+#define	STATEBYTES(v)	((char *)&(v))
+#define	STATESIZE(m)	sizeof(states1)
+#define	DFAREP	1
 /* no multibyte support */
 #define	XMBRTOWC	xmbrtowc_dummy
 #define	ZAPSTATE(mbs)	((void)(mbs))
@@ -145,6 +233,9 @@ xmbrtowc_dummy(wint_t *wi,
 #undef	FWD
 #undef	BACK
 #undef	ISSETBACK
+#undef	STATEBYTES
+#undef	STATESIZE
+#undef	DFAREP
 #undef	SNAMES
 #undef	XMBRTOWC
 #undef	ZAPSTATE
@@ -172,6 +263,10 @@ xmbrtowc_dummy(wint_t *wi,
 #define	FWD(dst, src, n)	((dst)[here+(n)] |= (src)[here])
 #define	BACK(dst, src, n)	((dst)[here-(n)] |= (src)[here])
 #define	ISSETBACK(v, n)	((v)[here - (n)])
+/* raw bytes of a state set, for the DFA cache */
+#define	STATEBYTES(v)	(v)
+#define	STATESIZE(m)	((size_t)(m)->g->nstates)
+#define	DFAREP	2
 /* no multibyte support */
 #define	XMBRTOWC	xmbrtowc_dummy
 #define	ZAPSTATE(mbs)	((void)(mbs))
@@ -184,6 +279,8 @@ xmbrtowc_dummy(wint_t *wi,
 #undef	LNAMES
 #undef	XMBRTOWC
 #undef	ZAPSTATE
+#undef	DFAREP
+#define	DFAREP	3
 #define	XMBRTOWC	xmbrtowc
 #define	ZAPSTATE(mbs)	memset((mbs), 0, sizeof(*(mbs)))
 #define	MNAMES
@@ -87,5 +87,14 @@ regfree(regex_t *preg)
 		free(&g->charjump[CHAR_MIN]);
 	if (g->matchjump != NULL)
 		free(g->matchjump);
+	if (g->dfa != NULL) {
+		for (i = 0; i < 2; i++)
+			if (g->dfa->mode[i] != NULL) {
+				free(g->dfa->mode[i]->ds);
+				free(g->dfa->mode[i]->sets);
+				free(g->dfa->mode[i]);
+			}
+		free(g->dfa);
+	}
 	free((char *)g);
 }
@@ -1809,10 +1809,233 @@ peek_socket (select_record *me, bool)
 
 static int start_thread_socket (select_record *, select_stuff *);
 
+/* The AFD poll request, as used by the Winsock provider to implement its
+   own select.  A single request covers any number of sockets, so waiting
+   for many sockets doesn't have to wait for their event objects in
+   chunks of MAXIMUM_WAIT_OBJECTS. */
+#define IOCTL_AFD_POLL			0x00012024
+
+#define AFD_POLL_RECEIVE		0x0001
+#define AFD_POLL_RECEIVE_EXPEDITED	0x0002
+#define AFD_POLL_SEND			0x0004
+#define AFD_POLL_DISCONNECT		0x0008
+#define AFD_POLL_ABORT			0x0010
+#define AFD_POLL_LOCAL_CLOSE		0x0020
+#define AFD_POLL_CONNECT		0x0040
+#define AFD_POLL_ACCEPT			0x0080
+#define AFD_POLL_CONNECT_FAIL		0x0100
+
+typedef struct _AFD_POLL_HANDLE_INFO
+{
+  HANDLE Handle;
+  ULONG Events;
+  NTSTATUS Status;
+} AFD_POLL_HANDLE_INFO, *PAFD_POLL_HANDLE_INFO;
+
+typedef struct _AFD_POLL_INFO
+{
+  LARGE_INTEGER Timeout;
+  ULONG NumberOfHandles;
+  ULONG Exclusive;
+  AFD_POLL_HANDLE_INFO Handles[1];
+} AFD_POLL_INFO, *PAFD_POLL_INFO;
+
+/* The poll requests are sent to a handle of the AFD device opened once per
+   process.  INVALID_HANDLE_VALUE if it couldn't be opened. */
+static NO_COPY HANDLE afd_helper;
+
+static HANDLE
+afd_helper_handle ()
+{
+  if (!afd_helper)
+    {
+      UNICODE_STRING name;
+      OBJECT_ATTRIBUTES attr;
+      IO_STATUS_BLOCK io;
+      NTSTATUS status;
+      HANDLE h;
+
+      RtlInitUnicodeString (&name, L"\\Device\\Afd\\Cygwin");
+      InitializeObjectAttributes (&attr, &name, 0, NULL, NULL);
+      status = NtCreateFile (&h, SYNCHRONIZE, &attr, &io, NULL, 0,
+			     FILE_SHARE_READ | FILE_SHARE_WRITE, FILE_OPEN, 0,
+			     NULL, 0);
+      if (!NT_SUCCESS (status))
+	{
+	  debug_printf ("NtCreateFile (%S), %y", &name, status);
+	  h = INVALID_HANDLE_VALUE;
+	}
+      if (InterlockedCompareExchangePointer (&afd_helper, h, NULL)
+	  && h != INVALID_HANDLE_VALUE)
+	NtClose (h);
+    }
+  return afd_helper == INVALID_HANDLE_VALUE ? NULL : afd_helper;
+}
+
+static ULONG
+afd_poll_events (select_record *me)
+{
+  ULONG events = AFD_POLL_LOCAL_CLOSE;
+
+  if (me->read_selected)
+    events |= AFD_POLL_RECEIVE | AFD_POLL_ACCEPT | AFD_POLL_DISCONNECT
+	      | AFD_POLL_ABORT;
+  if (me->write_selected)
+    events |= AFD_POLL_SEND | AFD_POLL_CONNECT | AFD_POLL_CONNECT_FAIL
+	      | AFD_POLL_ABORT;
+  if (me->except_selected)
+    events |= AFD_POLL_RECEIVE_EXPEDITED;
+  return events;
+}
+
+/* Prepare the AFD poll request for all sockets of this select call.  The
+   sockets of a layered service provider are no AFD handles, so if any of
+   them is involved, the socket events are used as before.  The request
+   buffer is followed by a copy of the input, since AFD overwrites the
+   handle array with the handles it reports. */
+static void
+afd_poll_setup (select_socket_info *si)
+{
+  select_record *s;
+  HANDLE afd;
+  ULONG n = 0;
+
+  for (s = si->start; (s = s->next); )
+    if (s->startup == start_thread_socket)
+      {
+	if (((fhandler_socket_wsock *) s->fh)->need_fixup_before ())
+	  return;
+	++n;
+      }
+  if (!n || !(afd = afd_helper_handle ()))
+    return;
+  if (!_my_tls.locals.select.afdevt
+      && !(_my_tls.locals.select.afdevt = CreateEvent (&sec_none_nih, TRUE,
+						       FALSE, NULL)))
+    return;
+
+  ULONG size = offsetof (AFD_POLL_INFO, Handles)
+	       + n * sizeof (AFD_POLL_HANDLE_INFO);
+  PAFD_POLL_INFO pi = (PAFD_POLL_INFO)
+		      malloc (size + n * sizeof (AFD_POLL_HANDLE_INFO));
+  if (!pi)
+    return;
+  PAFD_POLL_HANDLE_INFO in = (PAFD_POLL_HANDLE_INFO) ((char *) pi + size);
+  n = 0;
+  for (s = si->start; (s = s->next); )
+    if (s->startup == start_thread_socket)
+      {
+	fhandler_socket_wsock *fh = (fhandler_socket_wsock *) s->fh;
+
+	in[n].Handle = (HANDLE) fh->get_socket ();
+	in[n].Events = afd_poll_events (s);
+	in[n++].Status = 0;
+      }
+  si->afd_poll = pi;
+  si->afd_size = size;
+  si->afd_num = n;
+  si->afd_event = _my_tls.locals.select.afdevt;
+}
+
+static int
+afd_handle_cmp (const void *a, const void *b)
+{
+  HANDLE x = ((const AFD_POLL_HANDLE_INFO *) a)->Handle;
+  HANDLE y = ((const AFD_POLL_HANDLE_INFO *) b)->Handle;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Wait for the sockets using a single AFD poll request, and only peek at
+   the sockets AFD reported.  Returns false if the request doesn't work, or
+   if AFD keeps reporting sockets which aren't ready according to their
+   network events.  The caller falls back to the socket events then. */
+static bool
+thread_socket_afd (select_socket_info *si)
+{
+  HANDLE afd = afd_helper_handle ();
+  PAFD_POLL_INFO pi = si->afd_poll;
+  PAFD_POLL_HANDLE_INFO in = (PAFD_POLL_HANDLE_INFO)
+			     ((char *) pi + si->afd_size);
+  HANDLE w4[2] = { si->w4[0], si->afd_event };
+  IO_STATUS_BLOCK io;
+  NTSTATUS status;
+  ULONG reported = 0;
+  bool all = true;
+  int spurious = 0;
+
+  while (true)
+    {
+      bool event = false;
+
+      for (select_record *s = si->start; (s = s->next); )
+	if (s->startup == start_thread_socket)
+	  {
+	    if (!all)
+	      {
+		AFD_POLL_HANDLE_INFO key;
+
+		key.Handle = (HANDLE)
+			     ((fhandler_socket_wsock *) s->fh)->get_socket ();
+		if (!bsearch (&key, pi->Handles, reported, sizeof key,
+			      afd_handle_cmp))
+		  continue;
+	      }
+	    if (peek_socket (s, false))
+	      event = true;
+	  }
+      if (event)
+	return true;
+      if (!all && ++spurious > 2)
+	{
+	  select_printf ("spurious AFD poll results, falling back");
+	  return false;
+	}
+
+      pi->Timeout.QuadPart = LLONG_MAX;
+      pi->NumberOfHandles = si->afd_num;
+      pi->Exclusive = FALSE;
+      memcpy (pi->Handles, in, si->afd_num * sizeof *in);
+      status = NtDeviceIoControlFile (afd, si->afd_event, NULL, NULL, &io,
+				      IOCTL_AFD_POLL, pi, si->afd_size,
+				      pi, si->afd_size);
+      if (status == STATUS_PENDING)
+	switch (WaitForMultipleObjects (2, w4, FALSE, INFINITE))
+	  {
+	  case WAIT_OBJECT_0 + 1:
+	    status = io.Status;
+	    break;
+	  default:	/* Socket event set, or failure. */
+	    {
+	      IO_STATUS_BLOCK cio;
+
+	      NtCancelIoFileEx (afd, &io, &cio);
+	      WaitForSingleObject (si->afd_event, INFINITE);
+	      return true;
+	    }
+	  }
+      if (!NT_SUCCESS (status))
+	{
+	  select_printf ("IOCTL_AFD_POLL, %y", status);
+	  return false;
+	}
+      reported = pi->NumberOfHandles;
+      qsort (pi->Handles, reported, sizeof *pi->Handles, afd_handle_cmp);
+      all = false;
+    }
+}
+
 static DWORD
 thread_socket (void *arg)
 {
   select_socket_info *si = (select_socket_info *) arg;
+
+  if (si->afd_poll && thread_socket_afd (si))
+    {
+      select_printf ("leaving thread_socket");
+      return 0;
+    }
+
   DWORD timeout = (si->num_w4 <= MAXIMUM_WAIT_OBJECTS)
 		  ? INFINITE
 		  : (64 / (roundup2 (si->num_w4, MAXIMUM_WAIT_OBJECTS)
@@ -1946,7 +2169,8 @@ start_thread_socket (select_record *me, select_stuff *stuff)
       }
   stuff->device_specific_socket = si;
   si->start = &stuff->start;
-  select_printf ("stuff_start %p", &stuff->start);
+  afd_poll_setup (si);
+  select_printf ("stuff_start %p, AFD poll %d", &stuff->start, !!si->afd_poll);
   si->thread = new cygthread (thread_socket, si, "socksel");
   me->h = *si->thread;
   return 1;
@@ -1966,6 +2190,8 @@ socket_cleanup (select_record *, select_stuff *stuff)
       si->thread->detach ();
       ResetEvent (si->w4[0]);
     }
+  if (si->afd_poll)
+    free (si->afd_poll);
   delete si;
   stuff->device_specific_socket = NULL;
   select_printf ("returning");
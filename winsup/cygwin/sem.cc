@@ -65,6 +65,128 @@ client_request_sem::client_request_sem (int semid,
   msglen (sizeof (_parameters.in));
 }
 
+client_request_sem::client_request_sem (semop_t op, int semid)
+  : client_request (CYGSERVER_REQUEST_SEM, &_parameters, sizeof (_parameters))
+{
+  _parameters.in.semop = op;
+  ipc_set_proc_info (_parameters.in.ipcblk);
+
+  _parameters.in.ctlargs.semid = semid;
+  _parameters.in.ctlargs.semnum = 0;
+  _parameters.in.ctlargs.cmd = 0;
+  _parameters.in.ctlargs.arg = NULL;
+
+  msglen (sizeof (_parameters.in));
+}
+
+/* Shared sections of the semaphore sets used by this process. */
+static NO_COPY ipc_shmap sem_shmap;
+
+/* Max. number of operations performed without asking cygserver. */
+#define SEMOP_SHARED_MAX 8
+
+/* Perform the operations in the shared section of the set, if they can be
+   done right away and don't need SEM_UNDO.  Returns 0 on success, an
+   errno value on failure, and -1 if cygserver has to handle the call. */
+static int
+semop_shared (int semid, const struct sembuf *sops, size_t nsops)
+{
+  struct sem_shared *sh;
+  void *view;
+  size_t i, j;
+  int error = 0;
+  bool do_wakeup = false;
+
+  for (i = 0; i < nsops; ++i)
+    if ((sops[i].sem_flg & SEM_UNDO) && sops[i].sem_op)
+      return -1;
+  if (!sem_shmap.find (semid, view))
+    {
+      client_request_sem request (client_request_sem::SEMOP_semmap, semid);
+      if (request.make_request () == -1 || request.retval () == -1)
+	sem_shmap.add (semid, NULL);
+      else
+	sem_shmap.add (semid, request.objval ());
+      if (!sem_shmap.find (semid, view))
+	return -1;
+    }
+  if (!(sh = (struct sem_shared *) view))
+    {
+      sem_shmap.release ();
+      return -1;
+    }
+  ipc_shlock (&sh->lock);
+  if (sh->removed)
+    {
+      ipc_shunlock (&sh->lock);
+      sem_shmap.release ();
+      sem_shmap.remove (semid);
+      return -1;
+    }
+  for (i = 0; i < nsops; ++i)
+    if (sops[i].sem_num >= sh->nsems)
+      break;
+  if (i < nsops)
+    error = -1;
+  else
+    {
+      for (i = 0; i < nsops; ++i)
+	{
+	  struct sem *semptr = &sh->base[sops[i].sem_num];
+
+	  if (sops[i].sem_op < 0)
+	    {
+	      if (semptr->semval + sops[i].sem_op < 0)
+		break;
+	      semptr->semval += sops[i].sem_op;
+	      if (semptr->semval == 0 && semptr->semzcnt > 0)
+		do_wakeup = true;
+	    }
+	  else if (sops[i].sem_op == 0)
+	    {
+	      if (semptr->semval != 0)
+		break;
+	    }
+	  else if (semptr->semval + sops[i].sem_op > sh->semvmx)
+	    {
+	      error = ERANGE;
+	      break;
+	    }
+	  else
+	    {
+	      if (semptr->semncnt > 0)
+		do_wakeup = true;
+	      semptr->semval += sops[i].sem_op;
+	    }
+	}
+      if (i < nsops)
+	{
+	  for (j = 0; j < i; ++j)
+	    sh->base[sops[j].sem_num].semval -= sops[j].sem_op;
+	  /* Blocking is up to cygserver. */
+	  if (!error)
+	    error = (sops[i].sem_flg & IPC_NOWAIT) ? EAGAIN : -1;
+	  do_wakeup = false;
+	}
+      else
+	{
+	  pid_t pid = getpid ();
+
+	  for (j = 0; j < nsops; ++j)
+	    sh->base[sops[j].sem_num].sempid = pid;
+	  sh->otime = time (NULL);
+	}
+    }
+  ipc_shunlock (&sh->lock);
+  sem_shmap.release ();
+  if (do_wakeup)
+    {
+      client_request_sem request (client_request_sem::SEMOP_semwakeup, semid);
+      request.make_request ();
+    }
+  return error;
+}
+
 /*
  * XSI semaphore API.  These are exported by the DLL.
  */
@@ -90,8 +212,13 @@ semctl (int semid, int semnum, int cmd, ...)
 	{
 	  syscall_printf ("-1 [%d] = semctl ()", request.error_code ());
 	  set_errno (request.error_code ());
+	  if (request.error_code () == EINVAL
+	      || request.error_code () == EIDRM)
+	    sem_shmap.remove (semid);
 	  __leave;
 	}
+      if (cmd == IPC_RMID || cmd == IPC_SET)
+	sem_shmap.remove (semid);
       return request.retval ();
     }
   __except (EFAULT) {}
@@ -121,11 +248,29 @@ semop (int semid, struct sembuf *sops, size_t nsops)
 		  semid, sops, nsops);
   __try
     {
+      if (nsops > 0 && nsops <= SEMOP_SHARED_MAX)
+	{
+	  struct sembuf lsops[SEMOP_SHARED_MAX];
+
+	  memcpy (lsops, sops, nsops * sizeof *sops);
+	  int error = semop_shared (semid, lsops, nsops);
+	  if (error > 0)
+	    {
+	      syscall_printf ("-1 [%d] = semop ()", error);
+	      set_errno (error);
+	      __leave;
+	    }
+	  if (error == 0)
+	    return 0;
+	}
       client_request_sem request (semid, sops, nsops);
       if (request.make_request () == -1 || request.retval () == -1)
 	{
 	  syscall_printf ("-1 [%d] = semop ()", request.error_code ());
 	  set_errno (request.error_code ());
+	  if (request.error_code () == EINVAL
+	      || request.error_code () == EIDRM)
+	    sem_shmap.remove (semid);
 	  __leave;
 	}
       return request.retval ();
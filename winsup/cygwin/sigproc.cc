@@ -108,12 +108,17 @@ class pending_signals
   sigpacket start;
   SRWLOCK queue_lock;
   bool retry;
+  bool held;
   void lock () { AcquireSRWLockExclusive (&queue_lock); }
   void unlock () { ReleaseSRWLockExclusive (&queue_lock); }
+  /* deliver reads held under the queue lock, so write it under the lock,
+     too.  Only wait_sig writes it, so it may read it without the lock. */
+  void hold (bool h) { lock (); held = h; unlock (); }
 
 public:
   pending_signals (): queue_lock (SRWLOCK_INIT) {}
   void add (sigpacket&);
+  bool deliver (sigpacket&);
   bool pending () {retry = !!start.next; return retry;}
   void clear (int sig, bool need_lock);
   void clear (_cygtls *tls);
@@ -718,6 +723,15 @@ sig_send (_pinfo *p, siginfo_t& si, _cygtls *tls)
     pack.si.si_uid = myself->uid;
   pack.pid = myself->pid;
   pack.sigtls = tls;
+
+  /* Signals to this process don't have to take the detour through the
+     signal pipe and wait_sig if they can be handed to a thread right away. */
+  if (its_me && si.si_signo > 0 && sigq.deliver (pack))
+    {
+      rc = 0;
+      goto out;
+    }
+
   if (wait_for_completion)
     {
       pack.wakeup = CreateEvent (&sec_none_nih, FALSE, FALSE, NULL);
@@ -962,6 +976,8 @@ child_info_spawn::cleanup ()
 	}
       if (type != _CH_SPAWN && moreinfo->myself_pinfo)
 	CloseHandle (moreinfo->myself_pinfo);
+      if (moreinfo->setup.fdmap)
+	cfree (moreinfo->setup.fdmap);
       cfree (moreinfo);
     }
   moreinfo = NULL;
@@ -1331,13 +1347,78 @@ pending_signals::add (sigpacket& pack)
   unlock ();
 }
 
+/* Try to deliver a signal sent from within this process directly to the
+   receiving thread, without queuing it for wait_sig.  This only handles
+   the common case of a caught signal which can be delivered immediately.
+   Everything else, like default actions, stop and continue processing,
+   sigwait, blocked signals or a non-empty queue, returns false and the
+   caller falls back to sending the signal through the signal pipe.
+
+   The queue lock serializes this against the dispatch loop in wait_sig,
+   so setup_handler is never called concurrently for the same thread and
+   a signal never overtakes one already queued. */
+bool
+pending_signals::deliver (sigpacket& pack)
+{
+  int sig = pack.si.si_signo;
+  void *handler = (void *) global_sigs[sig].sa_handler;
+  threadlist_t *tl_entry;
+  _cygtls *tls;
+  bool issig_wait = false;
+  bool delivered = false;
+
+  if (!cygwin_finished_initializing || have_execed
+      || exit_state > ES_EXIT_STARTING || ISSTATE (myself, PID_STOPPED))
+    return false;
+  switch (sig)
+    {
+    case SIGKILL:
+    case SIGSTOP:
+    case SIGCONT:
+    case SIGCHLD:
+    case SIGTSTP:
+    case SIGTTIN:
+    case SIGTTOU:
+      return false;
+    }
+  if (handler == (void *) SIG_DFL || handler == (void *) SIG_IGN
+      || handler == (void *) SIG_ERR)
+    return false;
+
+  if (pack.sigtls)
+    tl_entry = cygheap->find_tls (pack.sigtls);
+  else
+    tl_entry = cygheap->find_tls (sig, issig_wait);
+  if (!tl_entry)
+    return false;
+  tls = tl_entry->thread;
+
+  lock ();
+  if (held || start.next || issig_wait || tls->sig
+      || sigismember (&tls->sigmask, sig)
+      || sigismember (&tls->sigwait_mask, sig))
+    /* Let wait_sig sort it out. */;
+  else if (tls == &_my_tls && !tls->incyg)
+    /* Never try to suspend ourselves. */;
+  else
+    {
+      sigproc_printf ("signal %d, tls %p, delivering directly", sig, tls);
+      if ((HANDLE) *tls)
+	tls->signal_debugger (pack.si);
+      if ((delivered = pack.setup_handler (handler, global_sigs[sig], tls)))
+	myself->rusage_self.ru_nsignals++;
+    }
+  unlock ();
+  cygheap->unlock_tls (tl_entry);
+  return delivered;
+}
+
 /* Process signals by waiting for signal data to arrive in a pipe.
    Set a completion event if one was specified. */
 static void
 wait_sig (VOID *)
 {
   _sig_tls = &_my_tls;
-  bool sig_held = false;
 
   sigproc_printf ("entering ReadFile loop, my_readsig %p, my_sendsig %p",
 		  my_readsig, my_sendsig);
@@ -1455,7 +1536,7 @@ wait_sig (VOID *)
 	  }
 	  break;
 	case __SIGHOLD:
-	  sig_held = true;
+	  sigq.hold (true);
 	  break;
 	case __SIGSETPGRP:
 	  init_console_handler (::cygheap->ctty
@@ -1490,11 +1571,11 @@ wait_sig (VOID *)
 	    sigq.add (pack);
 	  fallthrough;
 	case __SIGNOHOLD:
-	  sig_held = false;
+	  sigq.hold (false);
 	  fallthrough;
 	case __SIGFLUSH:
 	case __SIGFLUSHFAST:
-	  if (!sig_held)
+	  if (!sigq.held)
 	    {
 	      /* Check the queue for signals.  There will always be at least one
 		 thing on the queue if this was a valid signal.  */
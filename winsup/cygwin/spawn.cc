@@ -10,6 +10,8 @@ details. */
 #include <stdlib.h>
 #include <unistd.h>
 #include <process.h>
+#include <spawn.h>
+#include <sys/param.h>
 #include <sys/wait.h>
 #include <wchar.h>
 #include <ctype.h>
@@ -287,7 +289,8 @@ extern DWORD mutex_timeout; /* defined in fhandler_termios.cc */
 int
 child_info_spawn::worker (const char *prog_arg, const char *const *argv,
 			  const char *const envp[], int mode,
-			  int in__stdin, int in__stdout)
+			  int in__stdin, int in__stdout,
+			  const spawn_setup *setup)
 {
   bool rc;
   int res = -1;
@@ -359,6 +362,17 @@ child_info_spawn::worker (const char *prog_arg, const char *const *argv,
 	chtype = _CH_SPAWN;
 
       moreinfo = cygheap_exec_info::alloc ();
+      if (setup)
+	{
+	  moreinfo->setup = *setup;
+	  if (setup->nfds)
+	    {
+	      moreinfo->setup.fdmap = (int *)
+		cmalloc_abort (HEAP_1_EXEC, setup->nfds * sizeof (int));
+	      memcpy (moreinfo->setup.fdmap, setup->fdmap,
+		      setup->nfds * sizeof (int));
+	    }
+	}
 
       /* CreateProcess takes one long string that is the command line (sigh).
 	 We need to quote any argument that has whitespace or embedded "'s.  */
@@ -551,6 +565,8 @@ child_info_spawn::worker (const char *prog_arg, const char *const *argv,
 	  __leave;
 	}
       set (chtype, real_path.iscygexec ());
+      if (setup && (setup->flags & POSIX_SPAWN_SETSIGMASK))
+	sigmask = setup->sigmask;
       __stdin = in__stdin;
       __stdout = in__stdout;
       record_children ();
@@ -617,6 +633,15 @@ child_info_spawn::worker (const char *prog_arg, const char *const *argv,
       int fileno_stdout = in__stdout < 0 ? 1 : in__stdout;
       int fileno_stderr = 2;
 
+      /* Non-Cygwin processes only get the stdio handles of the remapped
+	 fds.  fdmap has at least 3 entries. */
+      if (setup && setup->nfds)
+	{
+	  fileno_stdin = setup->fdmap[0];
+	  fileno_stdout = setup->fdmap[1];
+	  fileno_stderr = setup->fdmap[2];
+	}
+
       if (!iscygwin ())
 	fhandler_pipe::spawn_worker (fileno_stdin, fileno_stdout,
 				     fileno_stderr);
@@ -851,6 +876,10 @@ child_info_spawn::worker (const char *prog_arg, const char *const *argv,
 	      res = -1;
 	      __leave;
 	    }
+	  /* remember() inherited our process group.  The child is still
+	     suspended, so it can't observe the change. */
+	  if (setup && (setup->flags & POSIX_SPAWN_SETPGROUP))
+	    child->pgid = setup->pgroup ?: cygpid;
 	}
 
       /* Start the child running */
@@ -1413,3 +1442,257 @@ __posix_spawn_execvpe (const char *path, char * const *argv, char *const *envp,
   __posix_spawn_sem_release (sem, errno);
   return -1;
 }
+
+/* Action codes as used by newlib's posix_spawn implementation. */
+enum
+{
+  FAE_OPEN,
+  FAE_DUP2,
+  FAE_CLOSE,
+  FAE_CHDIR,
+  FAE_FCHDIR
+};
+
+extern "C" int __posix_spawn_file_actions_next (const posix_spawn_file_actions_t *,
+						void **, int *, int *, int *,
+						const char **, int *, mode_t *);
+
+/* Open the file of an FAE_OPEN action in the parent.  This happens before
+   taking the process lock and with O_NONBLOCK and O_NOCTTY, so neither a
+   FIFO without a peer blocks the parent, nor a tty becomes its controlling
+   tty.  FIFOs, sockets and ttys are left to the fork path, since they'd
+   behave differently than when opened in the child.  Returns the fd, -1
+   with errno set, or -2 if the action has to be performed by a forked
+   child. */
+static int
+nofork_open (const char *path, int oflag, mode_t mode)
+{
+  struct stat st;
+  int fd = open (path, oflag | O_CLOEXEC | O_NOCTTY | O_NONBLOCK, mode);
+
+  if (fd < 0)
+    /* A FIFO opened for writing without a reader. */
+    return get_errno () == ENXIO ? -2 : -1;
+  if (fstat (fd, &st) || S_ISFIFO (st.st_mode) || S_ISSOCK (st.st_mode)
+      || isatty (fd))
+    {
+      close (fd);
+      return -2;
+    }
+  if (!(oflag & O_NONBLOCK))
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) & ~O_NONBLOCK);
+  return fd;
+}
+
+/* POSIX_SPAWN_SETPGROUP may only move the child into an existing process
+   group of the caller's session. */
+static bool
+pgrp_in_session (pid_t pgid)
+{
+  winpids pids ((DWORD) 0);
+
+  for (unsigned i = 0; i < pids.npids; i++)
+    {
+      _pinfo *p = pids[i];
+
+      if (p && p->exists () && p->pgid == pgid && p->sid == myself->sid)
+	return true;
+    }
+  return false;
+}
+
+#define NOFORK_SPAWN_FLAGS (POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF \
+			    | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSID)
+
+/* Called from newlib's posix_spawn to start the child process without
+   forking.  The file actions are replayed on a shadow copy of the fd table.
+   The parent then only lets the fds referenced in the result inherit into
+   the child, and dtable::fixup_after_spawn in the child moves them into
+   place.  Returns -1 if the request has to be handled by a forked child,
+   0 or a POSIX error code otherwise. */
+extern "C" int
+__posix_spawn_nofork (pid_t *pid, const char *path,
+		      const posix_spawn_file_actions_t *fa,
+		      const posix_spawnattr_t *sa,
+		      char * const argv[], char * const envp[],
+		      int use_env_path)
+{
+  spawn_setup setup = {};
+  short flags = 0;
+  void *cookie;
+  int action, fildes, newfildes, oflag;
+  const char *fpath;
+  mode_t fmode;
+  int nfds, nopened = 0;
+  int error = 0;
+
+  if (sa)
+    {
+      posix_spawnattr_getflags (sa, &flags);
+      /* Resetting the user ids and setting scheduling parameters requires
+	 to do it in the child. */
+      if ((flags & ~NOFORK_SPAWN_FLAGS)
+	  || ((flags & POSIX_SPAWN_SETSID) && (flags & POSIX_SPAWN_SETPGROUP)))
+	return -1;
+      setup.flags = flags;
+      posix_spawnattr_getpgroup (sa, &setup.pgroup);
+      if ((flags & POSIX_SPAWN_SETPGROUP) && setup.pgroup
+	  && !pgrp_in_session (setup.pgroup))
+	return EPERM;
+      posix_spawnattr_getsigmask (sa, &setup.sigmask);
+      posix_spawnattr_getsigdefault (sa, &setup.sigdefault);
+    }
+
+  dtable &fdtab = ::cygheap->fdtab;
+
+  /* chdir actions would change the cwd of all threads in the parent. */
+  nfds = 0;
+  if (fa)
+    for (cookie = NULL;
+	 __posix_spawn_file_actions_next (fa, &cookie, &action, &fildes,
+					  &newfildes, &fpath, &oflag, &fmode);
+	 )
+      switch (action)
+	{
+	case FAE_CHDIR:
+	case FAE_FCHDIR:
+	  return -1;
+	case FAE_DUP2:
+	  if (newfildes < 0 || newfildes >= OPEN_MAX)
+	    return EBADF;
+	  nfds = MAX (nfds, newfildes + 1);
+	  fallthrough;
+	default:
+	  if (fildes < 0 || fildes >= OPEN_MAX)
+	    return EBADF;
+	  nfds = MAX (nfds, fildes + 1);
+	  if (action == FAE_OPEN)
+	    ++nopened;
+	  break;
+	}
+
+  /* Open files before taking the process lock, see nofork_open. */
+  int *opened = (int *) alloca ((nopened + 1) * sizeof (int));
+  nopened = 0;
+  if (fa)
+    for (cookie = NULL;
+	 !error
+	 && __posix_spawn_file_actions_next (fa, &cookie, &action, &fildes,
+					     &newfildes, &fpath, &oflag,
+					     &fmode);
+	 )
+      if (action == FAE_OPEN)
+	{
+	  int fd = nofork_open (fpath, oflag, fmode);
+
+	  if (fd >= 0)
+	    opened[nopened++] = fd;
+	  else
+	    error = fd == -2 ? -1 : get_errno ();
+	}
+  if (error)
+    {
+      while (nopened > 0)
+	close (opened[--nopened]);
+      return error;
+    }
+
+  lock_process now;
+  nfds = MAX (nfds, (int) fdtab.size);
+  nfds = MAX (nfds, 3);
+
+  /* fdmap[i] is the parent fd showing up as fd i in the child, keep[i] is
+     false if fd i is close-on-exec in the child. */
+  int *fdmap = (int *) alloca (nfds * sizeof (int));
+  bool *keep = (bool *) alloca (nfds * sizeof (bool));
+  int nused = 0;
+
+  for (int i = 0; i < nfds; i++)
+    {
+      fdmap[i] = fdtab.not_open (i) ? -1 : i;
+      keep[i] = fdmap[i] >= 0 && !fdtab[i]->close_on_exec ();
+    }
+  if (fa)
+    for (cookie = NULL;
+	 !error
+	 && __posix_spawn_file_actions_next (fa, &cookie, &action, &fildes,
+					     &newfildes, &fpath, &oflag,
+					     &fmode);
+	 )
+      switch (action)
+	{
+	case FAE_OPEN:
+	  fdmap[fildes] = opened[nused++];
+	  keep[fildes] = true;
+	  break;
+	case FAE_DUP2:
+	  if (fdmap[fildes] < 0)
+	    error = EBADF;
+	  else
+	    {
+	      fdmap[newfildes] = fdmap[fildes];
+	      keep[newfildes] = true;
+	    }
+	  break;
+	case FAE_CLOSE:
+	  fdmap[fildes] = -1;
+	  break;
+	}
+
+  bool remap = false;
+  for (int i = 0; i < nfds; i++)
+    {
+      if (!keep[i])
+	fdmap[i] = -1;
+      else if (fdmap[i] != i)
+	remap = true;
+    }
+
+  /* Temporarily switch the close-on-exec flag of all fds in the parent so
+     that exactly the fds referenced by fdmap are inherited. */
+  size_t nparent = fdtab.size;
+  bool *toggled = (bool *) alloca (nparent * sizeof (bool));
+  for (size_t p = 0; p < nparent; p++)
+    {
+      toggled[p] = false;
+      if (error || fdtab.not_open (p))
+	continue;
+      bool inherit = false;
+      for (int i = 0; i < nfds && !inherit; i++)
+	inherit = fdmap[i] == (int) p;
+      if (inherit == fdtab[p]->close_on_exec ())
+	{
+	  fcntl (p, F_SETFD, inherit ? 0 : FD_CLOEXEC);
+	  toggled[p] = true;
+	}
+    }
+
+  if (!error)
+    {
+      const char *prog = path;
+      path_conv buf;
+
+      if (remap)
+	{
+	  setup.nfds = nfds;
+	  setup.fdmap = fdmap;
+	}
+      if (use_env_path)
+	prog = find_exec (path, buf, "PATH", FE_NNF) ?: "";
+      pid_t ret = ch_spawn.worker (prog, (const char * const *) argv,
+				   (const char * const *) (envp ?: environ),
+				   _P_NOWAIT, -1, -1, &setup);
+      if (ret < 0)
+	error = get_errno ();
+      else if (pid)
+	*pid = ret;
+    }
+
+  for (size_t p = 0; p < nparent; p++)
+    if (toggled[p])
+      fcntl (p, F_SETFD, fdtab[p]->close_on_exec () ? 0 : FD_CLOEXEC);
+  now.release ();
+  while (nopened > 0)
+    close (opened[--nopened]);
+  return error;
+}
@@ -0,0 +1,499 @@
+/* splice.cc: splice, tee and vmsplice
+
+This file is part of Cygwin.
+
+This software is a copyrighted work licensed under the terms of the
+Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
+details. */
+
+#include "winsup.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include "cygerrno.h"
+#include "security.h"
+#include "path.h"
+#include "fhandler.h"
+#include "select.h"
+#include "dtable.h"
+#include "cygheap.h"
+#include "cygtls.h"
+#include "sigproc.h"
+
+/* Windows has no way to move data from one handle to another without
+   passing it through user memory, so these calls copy, but as little as
+   possible:
+
+   - A regular file is mapped and written to the pipe right from the view,
+     so it doesn't have to be read into a buffer first.
+
+   - tee peeks at the data in the input pipe, so it stays in there.
+
+   - Everything else is read into a buffer of up to SPLICE_BUFSIZ bytes and
+     written out from there.  An input pipe is only peeked at, and only the
+     data actually written is removed from it afterwards, so nothing gets
+     lost if the output takes less than offered or fails.
+
+   As on Linux, a call transfers as much as is available at once, which
+   may be less than requested. */
+#define SPLICE_BUFSIZ	(1024 * 1024)
+
+static inline bool
+is_pipe (fhandler_base *fh)
+{
+  return fh->ispipe () || fh->get_device () == FH_FIFO;
+}
+
+/* Return the number of bytes available in the read side of a pipe, waiting
+   for data unless nonblock is set.  Returns 0 at EOF, -1 on error. */
+static ssize_t
+pipe_wait_data (fhandler_base *fh, bool nonblock)
+{
+  while (true)
+    {
+      DWORD avail;
+
+      if (!PeekNamedPipe (fh->get_handle (), NULL, 0, NULL, &avail, NULL))
+	{
+	  if (GetLastError () == ERROR_BROKEN_PIPE)
+	    return 0;
+	  __seterrno ();
+	  return -1;
+	}
+      if (avail)
+	return avail;
+      if (nonblock)
+	{
+	  set_errno (EAGAIN);
+	  return -1;
+	}
+      switch (cygwait (fh->get_select_sem (), 1))
+	{
+	case WAIT_CANCELED:
+	  pthread::static_cancel_self ();
+	  /* NOTREACHED */
+	case WAIT_SIGNALED:
+	  set_errno (EINTR);
+	  return -1;
+	default:
+	  break;
+	}
+    }
+}
+
+/* Don't offer more to a nonblocking write side of a pipe than it can take
+   right away.  Returns false if it's full. */
+static bool
+pipe_limit_write (int fd, fhandler_base *fh, bool nonblock, size_t &len)
+{
+  if (fh->get_device () != FH_PIPEW || !(nonblock || fh->is_nonblocking ()))
+    return true;
+
+  ssize_t space = pipe_data_available (fd, fh, fh->get_handle (), PDA_WRITE);
+  if (!space)
+    {
+      set_errno (EAGAIN);
+      return false;
+    }
+  if (space > 0 && (size_t) space < len)
+    len = space;
+  return true;
+}
+
+/* Write len bytes of buf to fh, at *off if off is given.  Returns the number
+   of bytes written, or -1 if nothing could be written. */
+static ssize_t
+splice_write (fhandler_base *fh, loff_t *off, const char *buf, size_t len)
+{
+  size_t done = 0;
+
+  while (done < len)
+    {
+      ssize_t ret = off ? fh->pwrite ((void *) (buf + done), len - done,
+				      *off + done)
+			: fh->write (buf + done, len - done);
+      if (ret <= 0)
+	break;
+      done += ret;
+    }
+  if (off)
+    *off += done;
+  return done ?: -1;
+}
+
+/* Write up to len bytes of the regular file in, starting at offset off,
+   right from a view of the file.  Returns false if the file can't be
+   mapped, so the caller falls back to reading it. */
+static bool
+splice_mapped (fhandler_base *in, off_t off, fhandler_base *out,
+	       loff_t *off_out, size_t len, ssize_t &res)
+{
+  NTSTATUS status;
+  IO_STATUS_BLOCK io;
+  FILE_STANDARD_INFORMATION fsi;
+  HANDLE section;
+  LARGE_INTEGER offset;
+  SIZE_T viewsize;
+  PVOID addr = NULL;
+
+  status = NtQueryInformationFile (in->get_handle (), &io, &fsi, sizeof fsi,
+				   FileStandardInformation);
+  if (!NT_SUCCESS (status) || fsi.Directory)
+    return false;
+  if (off >= fsi.EndOfFile.QuadPart)
+    {
+      res = 0;
+      return true;
+    }
+  len = MIN (len, (size_t) (fsi.EndOfFile.QuadPart - off));
+  status = NtCreateSection (&section, SECTION_MAP_READ | SECTION_QUERY, NULL,
+			    NULL, PAGE_READONLY, SEC_COMMIT, in->get_handle ());
+  if (!NT_SUCCESS (status))
+    {
+      debug_printf ("NtCreateSection (%S), status %y",
+		    in->pc.get_nt_native_path (), status);
+      return false;
+    }
+  offset.QuadPart = rounddown (off, (off_t) wincap.allocation_granularity ());
+  viewsize = off - offset.QuadPart + len;
+  status = NtMapViewOfSection (section, NtCurrentProcess (), &addr, 0,
+			       viewsize, &offset, &viewsize, ViewShare, 0,
+			       PAGE_READONLY);
+  if (!NT_SUCCESS (status))
+    {
+      debug_printf ("NtMapViewOfSection (%S), status %y",
+		    in->pc.get_nt_native_path (), status);
+      NtClose (section);
+      return false;
+    }
+  __try
+    {
+      res = splice_write (out, off_out,
+			  (char *) addr + (off - offset.QuadPart), len);
+    }
+  __except (EFAULT)
+    {
+      /* The file shrank under our feet. */
+      res = -1;
+    }
+  __endtry
+  NtUnmapViewOfSection (NtCurrentProcess (), addr);
+  NtClose (section);
+  return true;
+}
+
+/* Write up to len bytes from the pipe in to out without taking them out of
+   the pipe.  If consume is set, remove what has been written from the pipe
+   afterwards, holding the read mutex of the pipe all along, so no other
+   reader in this process gets in between. */
+static ssize_t
+splice_peek (fhandler_base *in, fhandler_base *out, loff_t *off_out,
+	     char *buf, size_t len, bool consume)
+{
+  HANDLE mtx = consume ? ((fhandler_pipe *) in)->get_read_mtx () : NULL;
+  DWORD got;
+  ssize_t res = -1;
+
+  if (mtx)
+    switch (cygwait (mtx, in->is_nonblocking () ? 0 : INFINITE))
+      {
+      case WAIT_OBJECT_0:
+	break;
+      case WAIT_TIMEOUT:
+	set_errno (EAGAIN);
+	return -1;
+      case WAIT_SIGNALED:
+	set_errno (EINTR);
+	return -1;
+      case WAIT_CANCELED:
+	pthread::static_cancel_self ();
+	/* NOTREACHED */
+      default:
+	__seterrno ();
+	return -1;
+      }
+  if (!PeekNamedPipe (in->get_handle (), buf, len, &got, NULL, NULL))
+    __seterrno ();
+  else if (!got)
+    /* Another reader was quicker. */
+    set_errno (EAGAIN);
+  else
+    {
+      res = splice_write (out, off_out, buf, got);
+      if (consume && res > 0)
+	{
+	  size_t n = res;
+	  in->read (buf, n);
+	}
+    }
+  if (mtx)
+    ReleaseMutex (mtx);
+  return res;
+}
+
+extern "C" ssize_t
+splice (int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len,
+	unsigned int flags)
+{
+  ssize_t res = -1;
+  char *buf = NULL;
+
+  pthread_testcancel ();
+
+  __try
+    {
+      cygheap_fdget in (fd_in);
+      if (in < 0)
+	__leave;
+      cygheap_fdget out (fd_out);
+      if (out < 0)
+	__leave;
+
+      if ((in->get_flags () & O_PATH)
+	  || (in->get_flags () & O_ACCMODE) == O_WRONLY
+	  || (out->get_flags () & O_PATH)
+	  || (out->get_flags () & O_ACCMODE) == O_RDONLY)
+	{
+	  set_errno (EBADF);
+	  __leave;
+	}
+      bool in_pipe = is_pipe (in);
+      bool out_pipe = is_pipe (out);
+      if ((!in_pipe && !out_pipe)
+	  || (in_pipe && out_pipe && in->get_ino () == out->get_ino ())
+	  || (out->get_flags () & O_APPEND))
+	{
+	  set_errno (EINVAL);
+	  __leave;
+	}
+      if ((in_pipe && off_in) || (out_pipe && off_out))
+	{
+	  set_errno (ESPIPE);
+	  __leave;
+	}
+      if ((off_in && *off_in < 0) || (off_out && *off_out < 0))
+	{
+	  set_errno (EINVAL);
+	  __leave;
+	}
+      if (!len)
+	{
+	  res = 0;
+	  __leave;
+	}
+
+      syscall_printf ("splice(%d, %p, %d, %p, %lu, %y)",
+		      fd_in, off_in, fd_out, off_out, len, flags);
+
+      bool nonblock = flags & SPLICE_F_NONBLOCK;
+      len = MIN (len, SPLICE_BUFSIZ);
+      if (!pipe_limit_write (fd_out, out, nonblock, len))
+	__leave;
+      bool peek = in->get_device () == FH_PIPER;
+      if (peek)
+	{
+	  ssize_t avail = pipe_wait_data (in, nonblock
+					      || in->is_nonblocking ());
+	  if (avail <= 0)
+	    {
+	      res = avail;
+	      __leave;
+	    }
+	  len = MIN (len, (size_t) avail);
+	}
+      else if (in->get_device () == FH_FS && in->rbinary ())
+	{
+	  off_t pos = off_in ? *off_in : in->lseek (0, SEEK_CUR);
+
+	  if (pos >= 0 && splice_mapped (in, pos, out, off_out, len, res))
+	    {
+	      if (res <= 0)
+		;
+	      else if (off_in)
+		*off_in += res;
+	      else
+		in->lseek (pos + res, SEEK_SET);
+	      __leave;
+	    }
+	}
+
+      if (!(buf = (char *) malloc (len)))
+	{
+	  set_errno (ENOMEM);
+	  __leave;
+	}
+      if (peek)
+	{
+	  res = splice_peek (in, out, off_out, buf, len, true);
+	  __leave;
+	}
+      ssize_t got;
+      if (off_in)
+	got = in->pread (buf, len, *off_in);
+      else
+	{
+	  size_t n = len;
+	  in->read (buf, n);
+	  got = (ssize_t) n;
+	}
+      if (got <= 0)
+	{
+	  res = got;
+	  __leave;
+	}
+      res = splice_write (out, off_out, buf, got);
+      if (off_in)
+	*off_in += MAX (res, 0);
+      else if (res < got && in->get_device () == FH_FS)
+	/* Leave what couldn't be written for the next call. */
+	in->lseek (MAX (res, 0) - got, SEEK_CUR);
+    }
+  __except (EFAULT) {}
+  __endtry
+  free (buf);
+  syscall_printf ("%lR = splice(%d, %p, %d, %p, %lu, %y)",
+		  res, fd_in, off_in, fd_out, off_out, len, flags);
+  return res;
+}
+
+extern "C" ssize_t
+tee (int fd_in, int fd_out, size_t len, unsigned int flags)
+{
+  ssize_t res = -1;
+  char *buf = NULL;
+
+  pthread_testcancel ();
+
+  __try
+    {
+      cygheap_fdget in (fd_in);
+      if (in < 0)
+	__leave;
+      cygheap_fdget out (fd_out);
+      if (out < 0)
+	__leave;
+
+      if ((in->get_flags () & O_ACCMODE) == O_WRONLY
+	  || (out->get_flags () & O_ACCMODE) == O_RDONLY)
+	{
+	  set_errno (EBADF);
+	  __leave;
+	}
+      if (in->get_device () != FH_PIPER || out->get_device () != FH_PIPEW
+	  || in->get_ino () == out->get_ino ())
+	{
+	  set_errno (EINVAL);
+	  __leave;
+	}
+      if (!len)
+	{
+	  res = 0;
+	  __leave;
+	}
+
+      syscall_printf ("tee(%d, %d, %lu, %y)", fd_in, fd_out, len, flags);
+
+      bool nonblock = flags & SPLICE_F_NONBLOCK;
+      len = MIN (len, SPLICE_BUFSIZ);
+      if (!pipe_limit_write (fd_out, out, nonblock, len))
+	__leave;
+      ssize_t avail = pipe_wait_data (in, nonblock || in->is_nonblocking ());
+      if (avail <= 0)
+	{
+	  res = avail;
+	  __leave;
+	}
+      len = MIN (len, (size_t) avail);
+      if (!(buf = (char *) malloc (len)))
+	{
+	  set_errno (ENOMEM);
+	  __leave;
+	}
+      res = splice_peek (in, out, NULL, buf, len, false);
+    }
+  __except (EFAULT) {}
+  __endtry
+  free (buf);
+  syscall_printf ("%lR = tee(%d, %d, %lu, %y)", res, fd_in, fd_out, len,
+		  flags);
+  return res;
+}
+
+/* Data can't be gifted to a Windows pipe, so vmsplice is writev to the
+   write side, and readv from the read side, of a pipe. */
+extern "C" ssize_t
+vmsplice (int fd, const struct iovec *iov, size_t nr_segs, unsigned int flags)
+{
+  ssize_t res = -1;
+
+  pthread_testcancel ();
+
+  __try
+    {
+      cygheap_fdget cfd (fd);
+      if (cfd < 0)
+	__leave;
+
+      if (!cfd->ispipe ())
+	{
+	  set_errno (EBADF);
+	  __leave;
+	}
+      if (nr_segs > IOV_MAX)
+	{
+	  set_errno (EINVAL);
+	  __leave;
+	}
+
+      syscall_printf ("vmsplice(%d, %p, %lu, %y)", fd, iov, nr_segs, flags);
+
+      bool nonblock = flags & SPLICE_F_NONBLOCK;
+      int iovcnt = (int) nr_segs;
+      if (cfd->get_device () == FH_PIPEW)
+	{
+	  ssize_t tot = check_iovec_for_write (iov, iovcnt);
+	  if (tot <= 0)
+	    {
+	      res = tot;
+	      __leave;
+	    }
+	  size_t len = tot;
+	  if (!pipe_limit_write (fd, cfd, nonblock, len))
+	    __leave;
+	  if (len < (size_t) tot)
+	    {
+	      /* Only offer what fits. */
+	      struct iovec *niov = (struct iovec *)
+				   alloca (iovcnt * sizeof *niov);
+	      size_t left = len;
+
+	      for (iovcnt = 0; left > 0; ++iovcnt)
+		{
+		  niov[iovcnt] = iov[iovcnt];
+		  niov[iovcnt].iov_len = MIN (niov[iovcnt].iov_len, left);
+		  left -= niov[iovcnt].iov_len;
+		}
+	      iov = niov;
+	      tot = len;
+	    }
+	  res = cfd->writev (iov, iovcnt, tot);
+	}
+      else
+	{
+	  ssize_t tot = check_iovec_for_read (iov, iovcnt);
+	  if (tot <= 0)
+	    {
+	      res = tot;
+	      __leave;
+	    }
+	  if (nonblock && (res = pipe_wait_data (cfd, true)) <= 0)
+	    __leave;
+	  res = cfd->readv (iov, iovcnt, tot);
+	}
+    }
+  __except (EFAULT) {}
+  __endtry
+  syscall_printf ("%lR = vmsplice(%d, %p, %lu, %y)", res, fd, iov, nr_segs,
+		  flags);
+  return res;
+}
@@ -0,0 +1,452 @@
+/* stackprof.cc: in-process sampling profiler
+
+This file is part of Cygwin.
+
+This software is a copyrighted work licensed under the terms of the
+Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
+details. */
+
+/*
+  Sampling profiler recording full call stacks.
+
+  If the environment variable STACKPROF_OUT_PREFIX is set at process
+  startup, a cygthread periodically suspends every pthread of the process,
+  copies its registers and the top of its stack, and resumes it.  Only
+  then the copy is unwound, since the unwinder takes locks the suspended
+  thread might hold, and the resulting call chain is counted in a table of
+  unique stacks.  STACKPROF_HZ sets the sampling frequency, which defaults
+  to PROF_HZ and is capped at 1000.
+
+  At process exit the table is written to "$STACKPROF_OUT_PREFIX.$pid" in
+  the "folded stacks" format understood by flamegraph.pl, speedscope and
+  pprof's collapsed input: one line per unique stack, frames from the
+  outermost to the innermost separated by semicolons, followed by the
+  sample count.  The first two frames are the program name and the Windows
+  thread id.  Frames are named "module!symbol" if the address can be
+  attributed to an exported symbol, "module+0xoffset" otherwise, so that
+  addr2line can resolve them after the fact.
+
+  The table is only written by the sampling thread and only read after that
+  thread has been stopped, so no locking is necessary.  Samples arriving
+  when the table is full, and threads beyond STACKPROF_SNAPS in a round,
+  are counted as "[dropped]".  Stacks deeper than the copied
+  STACKPROF_STACKCOPY bytes are truncated.
+
+  This is independent of profil(3) and gmon.out, which keep working as
+  before.  Both can be used at the same time.
+*/
+
+#include "winsup.h"
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include "cygerrno.h"
+#include "cygtls.h"
+#include "sigproc.h"
+#include "path.h"
+#include "fhandler.h"
+#include "dtable.h"
+#include "cygheap.h"
+#include "cygthread.h"
+#include "ntdll.h"
+#include "tls_pbuf.h"
+#include "profil.h"
+#include "stackprof.h"
+
+#define STACKPROF_DEPTH		64	/* Max frames recorded per sample */
+#define STACKPROF_SLOTS		4096	/* Max unique stacks, power of 2 */
+#define STACKPROF_MAX_HZ	1000
+#define STACKPROF_SNAPS		64	/* Max threads sampled per round */
+#define STACKPROF_STACKCOPY	(16 * 1024) /* Bytes of stack copied */
+
+extern uint8_t _sigbe;
+extern uint8_t _sigdelayed_end;
+
+struct stackprof_entry
+{
+  uint32_t hash;
+  uint32_t count;
+  DWORD tid;
+  uint32_t depth;
+  UINT_PTR pc[STACKPROF_DEPTH];
+};
+
+/* The state of a thread captured while it was suspended. */
+struct stackprof_snap
+{
+  CONTEXT ctx;
+  DWORD tid;
+  uint32_t nsig;		/* Entries copied from the tls sigstack */
+  UINT_PTR stack_lo;		/* Original address of the stack copy */
+  UINT_PTR stack_len;
+  __tlsstack_t sig[STACKPROF_DEPTH];
+  uint8_t stack[STACKPROF_STACKCOPY];
+};
+
+/* Everything here is NO_COPY.  A forked child starts out with a fresh
+   table and its own sampling thread, see stackprof_init. */
+static NO_COPY struct
+{
+  stackprof_entry *table;
+  stackprof_snap *snaps;
+  uint32_t nsnaps;
+  uint32_t used;
+  uint32_t dropped;
+  DWORD interval;
+  HANDLE quit_evt;
+  HANDLE sync_thr;
+} prof;
+
+/* Move register value R into the stack copy of SNAP if it points into
+   the copied part of the original stack. */
+static inline void
+relocate (stackprof_snap *snap, DWORD64 &r)
+{
+  if (r - snap->stack_lo < snap->stack_len)
+    r += (UINT_PTR) snap->stack - snap->stack_lo;
+}
+
+static void
+relocate_regs (stackprof_snap *snap)
+{
+  PCONTEXT ctx = &snap->ctx;
+
+  relocate (snap, ctx->Rsp);
+  relocate (snap, ctx->Rbp);
+  relocate (snap, ctx->Rbx);
+  relocate (snap, ctx->Rsi);
+  relocate (snap, ctx->Rdi);
+  relocate (snap, ctx->R12);
+  relocate (snap, ctx->R13);
+  relocate (snap, ctx->R14);
+  relocate (snap, ctx->R15);
+}
+
+/* Capture the thread TLS for unwind_snap.  Called with the thread's tls
+   area locked, so this must not allocate memory or acquire any lock the
+   suspended thread might hold. */
+static void
+capture_thread (_cygtls *tls)
+{
+  THREAD_BASIC_INFORMATION tbi;
+  HANDLE h = (HANDLE) *tls;
+  UINT_PTR stack_hi;
+
+  if (prof.nsnaps >= STACKPROF_SNAPS)
+    {
+      ++prof.dropped;
+      return;
+    }
+  if (!h || !NT_SUCCESS (NtQueryInformationThread (h, ThreadBasicInformation,
+						    &tbi, sizeof tbi, NULL)))
+    return;
+  stack_hi = (UINT_PTR) ((PTEB) tbi.TebBaseAddress)->Tib.StackBase;
+
+  stackprof_snap *snap = prof.snaps + prof.nsnaps;
+  if (SuspendThread (h) == (DWORD) -1)
+    return;
+  snap->ctx.ContextFlags = CONTEXT_CONTROL | CONTEXT_INTEGER;
+  if (!GetThreadContext (h, &snap->ctx))
+    {
+      ResumeThread (h);
+      return;
+    }
+  __try
+    {
+      __tlsstack_t *sp = tls->stackptr;
+
+      snap->tid = tls->thread_id;
+      snap->nsig = 0;
+      while (sp > tls->stack && snap->nsig < STACKPROF_DEPTH)
+	snap->sig[STACKPROF_DEPTH - ++snap->nsig] = *--sp;
+      snap->stack_lo = snap->ctx.Rsp;
+      snap->stack_len = 0;
+      if (snap->stack_lo < stack_hi)
+	snap->stack_len = MIN (stack_hi - snap->stack_lo,
+			       STACKPROF_STACKCOPY);
+      memcpy (snap->stack, (void *) snap->stack_lo, snap->stack_len);
+      ++prof.nsnaps;
+    }
+  __except (NO_ERROR) {}
+  __endtry
+  ResumeThread (h);
+}
+
+/* Unwind the stack copy of SNAP, with the thread running again. */
+static uint32_t
+unwind_snap (stackprof_snap *snap, UINT_PTR *pc)
+{
+  PCONTEXT ctx = &snap->ctx;
+  UINT_PTR lo = (UINT_PTR) snap->stack;
+  UINT_PTR hi = lo + snap->stack_len;
+  /* The sigstack entries are stored at the end of sig, newest last. */
+  __tlsstack_t *sig = snap->sig + STACKPROF_DEPTH;
+  __tlsstack_t *sig_end = sig - snap->nsig;
+  uint32_t depth = 0;
+
+  relocate_regs (snap);
+  __try
+    {
+      while (depth < STACKPROF_DEPTH && ctx->Rip)
+	{
+	  pc[depth++] = ctx->Rip;
+	  if (ctx->Rsp < lo || ctx->Rsp + sizeof (ULONG_PTR) > hi)
+	    break;
+	  /* _sigbe and sigdelayed don't have SEH unwinding data, so virtually
+	     unwind the tls sigstack, as in stack_info::walk. */
+	  if (ctx->Rip >= (DWORD64) &_sigbe
+	      && ctx->Rip < (DWORD64) &_sigdelayed_end)
+	    {
+	      if (sig <= sig_end)
+		break;
+	      ctx->Rip = *--sig;
+	      continue;
+	    }
+
+	  PRUNTIME_FUNCTION f;
+	  ULONG64 imagebase;
+	  DWORD64 establisher;
+	  PVOID hdl;
+
+	  f = RtlLookupFunctionEntry (ctx->Rip, &imagebase, NULL);
+	  if (f)
+	    RtlVirtualUnwind (0, imagebase, ctx->Rip, f, ctx, &hdl,
+			      &establisher, NULL);
+	  else
+	    {
+	      ctx->Rip = *(ULONG_PTR *) ctx->Rsp;
+	      ctx->Rsp += 8;
+	    }
+	  /* Registers restored from the copy hold original stack addresses. */
+	  relocate_regs (snap);
+	}
+    }
+  __except (NO_ERROR) {}
+  __endtry
+  return depth;
+}
+
+static void
+record_sample (DWORD tid, UINT_PTR *pc, uint32_t depth)
+{
+  /* FNV-1a over the thread id and the call chain. */
+  uint32_t hash = 2166136261U ^ tid;
+  for (uint32_t i = 0; i < depth; ++i)
+    hash = (hash ^ (uint32_t) (pc[i] ^ (pc[i] >> 32))) * 16777619U;
+
+  for (uint32_t n = 0, i = hash; n < STACKPROF_SLOTS; ++n, ++i)
+    {
+      stackprof_entry *e = prof.table + (i & (STACKPROF_SLOTS - 1));
+      if (!e->count)
+	{
+	  /* Keep the table at most 7/8 full to keep probe chains short. */
+	  if (prof.used >= STACKPROF_SLOTS - STACKPROF_SLOTS / 8)
+	    break;
+	  e->hash = hash;
+	  e->tid = tid;
+	  e->depth = depth;
+	  memcpy (e->pc, pc, depth * sizeof *pc);
+	  e->count = 1;
+	  ++prof.used;
+	  return;
+	}
+      if (e->hash == hash && e->tid == tid && e->depth == depth
+	  && !memcmp (e->pc, pc, depth * sizeof *pc))
+	{
+	  ++e->count;
+	  return;
+	}
+    }
+  ++prof.dropped;
+}
+
+static DWORD
+stackprof_thread (VOID *)
+{
+  UINT_PTR pc[STACKPROF_DEPTH];
+
+  while (WaitForSingleObject (prof.quit_evt, prof.interval) == WAIT_TIMEOUT)
+    {
+      /* Unwind only after sample_threads released the threads' tls areas,
+	 a thread running again may wait for them while holding a lock the
+	 unwinder needs. */
+      prof.nsnaps = 0;
+      cygheap->sample_threads (capture_thread);
+      for (uint32_t i = 0; i < prof.nsnaps; ++i)
+	{
+	  uint32_t depth = unwind_snap (prof.snaps + i, pc);
+	  if (depth)
+	    record_sample (prof.snaps[i].tid, pc, depth);
+	}
+    }
+  return 0;
+}
+
+void
+stackprof_init ()
+{
+  const char *hz;
+  unsigned long rate = PROF_HZ;
+
+  if (!getenv ("STACKPROF_OUT_PREFIX"))
+    return;
+  if ((hz = getenv ("STACKPROF_HZ")) && (rate = strtoul (hz, NULL, 10)) == 0)
+    rate = PROF_HZ;
+  if (rate > STACKPROF_MAX_HZ)
+    rate = STACKPROF_MAX_HZ;
+  prof.interval = 1000 / rate;
+
+  prof.table = (stackprof_entry *)
+	       VirtualAlloc (NULL, STACKPROF_SLOTS * sizeof (stackprof_entry),
+			     MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+  prof.snaps = (stackprof_snap *)
+	       VirtualAlloc (NULL, STACKPROF_SNAPS * sizeof (stackprof_snap),
+			     MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+  if (!prof.table || !prof.snaps)
+    {
+      debug_printf ("VirtualAlloc, %E");
+      if (prof.table)
+	VirtualFree (prof.table, 0, MEM_RELEASE);
+      if (prof.snaps)
+	VirtualFree (prof.snaps, 0, MEM_RELEASE);
+      prof.table = NULL;
+      prof.snaps = NULL;
+      return;
+    }
+  prof.quit_evt = CreateEvent (&sec_none_nih, TRUE, FALSE, NULL);
+  prof.sync_thr = CreateEvent (&sec_none_nih, TRUE, FALSE, NULL);
+  if (!prof.quit_evt || !prof.sync_thr)
+    {
+      debug_printf ("CreateEvent, %E");
+      if (prof.quit_evt)
+	CloseHandle (prof.quit_evt);
+      VirtualFree (prof.table, 0, MEM_RELEASE);
+      VirtualFree (prof.snaps, 0, MEM_RELEASE);
+      prof.table = NULL;
+      prof.snaps = NULL;
+      return;
+    }
+  new cygthread (stackprof_thread, NULL, "stackprof", prof.sync_thr);
+  debug_printf ("sampling every %u ms", prof.interval);
+}
+
+/* Describe the code address PC in BUF, using the loaded module list the
+   same way as prettyprint_va in exceptions.cc does. */
+static void
+frame_name (char *buf, UINT_PTR pc)
+{
+  PLIST_ENTRY head = &NtCurrentTeb()->Peb->Ldr->InMemoryOrderModuleList;
+  for (PLIST_ENTRY x = head->Flink; x != head; x = x->Flink)
+    {
+      PLDR_DATA_TABLE_ENTRY mod = CONTAINING_RECORD (x, LDR_DATA_TABLE_ENTRY,
+						     InMemoryOrderLinks);
+      UINT_PTR base = (UINT_PTR) mod->DllBase;
+      if (pc < base || pc >= base + mod->SizeOfImage)
+	continue;
+
+      /* Find the closest exported symbol below PC. */
+      DWORD rva = pc - base;
+      const char *sym = NULL;
+      DWORD sym_rva = 0;
+      PIMAGE_NT_HEADERS nt = (PIMAGE_NT_HEADERS)
+			     (base + ((PIMAGE_DOS_HEADER) base)->e_lfanew);
+      PIMAGE_DATA_DIRECTORY dir = nt->OptionalHeader.DataDirectory
+				  + IMAGE_DIRECTORY_ENTRY_EXPORT;
+      if (dir->VirtualAddress && dir->Size)
+	{
+	  PIMAGE_EXPORT_DIRECTORY exp = (PIMAGE_EXPORT_DIRECTORY)
+					(base + dir->VirtualAddress);
+	  PDWORD funcs = (PDWORD) (base + exp->AddressOfFunctions);
+	  PDWORD names = (PDWORD) (base + exp->AddressOfNames);
+	  PWORD ords = (PWORD) (base + exp->AddressOfNameOrdinals);
+	  for (DWORD i = 0; i < exp->NumberOfNames; ++i)
+	    {
+	      DWORD f = funcs[ords[i]];
+	      /* Skip forwarders, which point into the export directory. */
+	      if (f >= dir->VirtualAddress
+		  && f < dir->VirtualAddress + dir->Size)
+		continue;
+	      if (f <= rva && f > sym_rva)
+		{
+		  sym_rva = f;
+		  sym = (const char *) (base + names[i]);
+		}
+	    }
+	}
+      if (sym)
+	__small_sprintf (buf, "%S!%s", &mod->BaseDllName, sym);
+      else
+	__small_sprintf (buf, "%S+0x%x", &mod->BaseDllName, rva);
+      return;
+    }
+  __small_sprintf (buf, "0x%X", pc);
+}
+
+static void
+write_line (int fd, char *buf, char *&p, const char *str)
+{
+  size_t len = strlen (str);
+  if (p + len >= buf + NT_MAX_PATH)
+    {
+      write (fd, buf, p - buf);
+      p = buf;
+    }
+  p = stpcpy (p, str);
+}
+
+/* Stop sampling and write the profile.  Called early in do_exit while
+   the process is still fully functional. */
+void
+stackprof_exit ()
+{
+  if (!prof.table)
+    return;
+  SetEvent (prof.quit_evt);
+  WaitForSingleObject (prof.sync_thr, INFINITE);
+  CloseHandle (prof.quit_evt);
+  CloseHandle (prof.sync_thr);
+
+  tmp_pathbuf tp;
+  char *buf = tp.c_get ();
+  char *name = tp.c_get ();
+  char *p = buf;
+  char frame[NT_MAX_PATH / 16];
+  const char *prefix = getenv ("STACKPROF_OUT_PREFIX");
+  const char *prog = program_invocation_short_name ?: "?";
+
+  __small_sprintf (name, "%s.%d", prefix && *prefix ? prefix : "stackprof.out",
+		   myself->pid);
+  int fd = open (name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    debug_printf ("open(%s), %E", name);
+  else
+    {
+      for (stackprof_entry *e = prof.table;
+	   e < prof.table + STACKPROF_SLOTS; ++e)
+	if (e->count)
+	  {
+	    __small_sprintf (frame, "%s;%u", prog, e->tid);
+	    write_line (fd, buf, p, frame);
+	    for (uint32_t i = e->depth; i-- > 0; )
+	      {
+		write_line (fd, buf, p, ";");
+		frame_name (frame, e->pc[i]);
+		write_line (fd, buf, p, frame);
+	      }
+	    __small_sprintf (frame, " %u\n", e->count);
+	    write_line (fd, buf, p, frame);
+	  }
+      if (prof.dropped)
+	{
+	  __small_sprintf (frame, "%s;[dropped] %u\n", prog, prof.dropped);
+	  write_line (fd, buf, p, frame);
+	}
+      write (fd, buf, p - buf);
+      close (fd);
+    }
+  VirtualFree (prof.table, 0, MEM_RELEASE);
+  VirtualFree (prof.snaps, 0, MEM_RELEASE);
+  prof.table = NULL;
+  prof.snaps = NULL;
+}
@@ -39,6 +39,8 @@ strace::activate (bool isfork)
       __small_sprintf (buf, "cYg%8x %lx %d",
 		       _STRACE_INTERFACE_ACTIVATE_ADDR, &_active, isfork);
       OutputDebugString (buf);
+      if (ring ())
+	ring_init ();
       if (_active)
 	{
 	  char pidbuf[80];
@@ -238,6 +240,291 @@ strace::write_childpid (pid_t pid)
   OutputDebugString (buf);
 }
 
+/* Binary ring buffer tracing, requested by strace --ring.  See the
+   description of the shared section in sys/strace.h. */
+static NO_COPY __strace_ring_hdr *ring_hdr;
+static NO_COPY DWORD ring_tls = TLS_OUT_OF_INDEXES;
+
+/* Create the shared section and hand it over to strace.  On failure, or if
+   strace didn't take it, fall back to text output. */
+void
+strace::ring_init ()
+{
+  char buf[40];
+  HANDLE h;
+
+  ring_tls = TlsAlloc ();
+  if (ring_tls == TLS_OUT_OF_INDEXES)
+    goto err;
+  h = CreateFileMapping (INVALID_HANDLE_VALUE, &sec_none_nih, PAGE_READWRITE,
+			 0, sizeof (__strace_ring_hdr), NULL);
+  if (!h)
+    goto err;
+  ring_hdr = (__strace_ring_hdr *) MapViewOfFile (h, FILE_MAP_WRITE, 0, 0, 0);
+  if (!ring_hdr)
+    {
+      CloseHandle (h);
+      goto err;
+    }
+  ring_hdr->magic = _STRACE_RING_MAGIC;
+  ring_hdr->version = _STRACE_RING_VERSION;
+  sys_wcstombs (ring_hdr->progname, sizeof ring_hdr->progname,
+		wcsrchr (global_progname, L'\\') + 1);
+  /* strace duplicates the handle and sets the mask while we wait. */
+  __small_sprintf (buf, "cYg%8x %lx", _STRACE_RING_SECTION, h);
+  OutputDebugString (buf);
+  CloseHandle (h);
+  if (ring_hdr->mask)
+    return;
+  UnmapViewOfFile (ring_hdr);
+  ring_hdr = NULL;
+err:
+  _active &= ~_STRACE_RING_ACTIVE;
+}
+
+/* Return the index of string S in the string table, adding it if
+   necessary.  Format strings get their arguments classified on the way,
+   function names are stored in the form vsprntf prints them. */
+static USHORT
+ring_str (const char *s, bool isfmt, bool isfunc)
+{
+  ULONG64 addr = (ULONG64) s;
+  ULONG hash = (ULONG) ((addr >> 3) * 2654435761U);
+
+  if (!s)
+    return _STRACE_RING_NOSTR;
+  for (ULONG i = 0; i < 16; i++)
+    {
+      ULONG idx = (hash + i) & (_STRACE_RING_STRINGS - 1);
+      __strace_ring_str *e = &ring_hdr->str[idx];
+
+      if (e->addr
+	  || InterlockedCompareExchange64 ((volatile LONG64 *) &e->addr,
+					   addr, 0))
+	{
+	  if (e->addr != addr)
+	    continue;
+	  /* Another thread may still be filling in the entry.  Don't wait
+	     for it, it might be the thread a signal handler interrupted. */
+	  if (!e->ready)
+	    return _STRACE_RING_NOSTR;
+	  MemoryBarrier ();
+	  return idx;
+	}
+      if (isfunc)
+	{
+	  char tmp[strlen (s) + 3];
+	  getfunc (tmp, s);
+	  strncpy (e->str, tmp, _STRACE_RING_STRLEN - 1);
+	}
+      else
+	strncpy (e->str, s, _STRACE_RING_STRLEN - 1);
+      /* Same syntax as __small_vsprintf. */
+      for (const char *f = s; isfmt && (f = strchr (f, '%'))
+			      && e->nargs < _STRACE_RING_ARGS; )
+	{
+	  if (*++f == '%')
+	    {
+	      ++f;
+	      continue;
+	    }
+	  if (*f == '+')
+	    ++f;
+	  f += strspn (f, "0123456789l_");
+	  switch (*f++)
+	    {
+	    case '.':
+	      f += strspn (f, "0123456789");
+	      if (*f != 's')
+		{
+		  f = *f ? f + 1 : NULL;
+		  break;
+		}
+	      ++f;
+	      fallthrough;
+	    case 's':
+	      e->argtype[e->nargs++] = _STRACE_ARG_STR;
+	      break;
+	    case 'W':
+	      e->argtype[e->nargs++] = _STRACE_ARG_WSTR;
+	      break;
+	    case 'S':
+	      e->argtype[e->nargs++] = _STRACE_ARG_USTR;
+	      break;
+	    case 'E':
+	    case 'P':
+	      break;
+	    case '\0':
+	      f = NULL;
+	      break;
+	    default:
+	      e->argtype[e->nargs++] = _STRACE_ARG_INT;
+	      break;
+	    }
+	  if (!f)
+	    break;
+	}
+      MemoryBarrier ();
+      e->ready = 1;
+      return idx;
+    }
+  InterlockedIncrement64 (&ring_hdr->nostr_dropped);
+  return _STRACE_RING_NOSTR;
+}
+
+/* Copy LEN bytes of a string argument into the record's data area. */
+static ULONG64
+ring_copy (__strace_ring_rec *rec, ULONG &off, const void *p, size_t len)
+{
+  ULONG64 ret;
+
+  if (!p)
+    return _STRACE_RING_NULL;
+  if (len > _STRACE_RING_DATA - off)
+    len = _STRACE_RING_DATA - off;
+  memcpy (rec->data + off, p, len);
+  ret = ((ULONG64) off << 16) | len;
+  off += len;
+  return ret;
+}
+
+/* Thread TID has exited, or didn't exist in the first place. */
+static bool
+ring_owner_dead (LONG tid)
+{
+  HANDLE h = OpenThread (SYNCHRONIZE, FALSE, tid);
+  bool ret;
+
+  if (!h)
+    return GetLastError () == ERROR_INVALID_PARAMETER;
+  ret = WaitForSingleObject (h, 0) == WAIT_OBJECT_0;
+  CloseHandle (h);
+  return ret;
+}
+
+/* Find a free ring for the calling thread.  Rings are given back by
+   ring_release when a Cygwin thread exits.  If all of them are in use,
+   take over the ring of a thread which exited without releasing it.
+   head and tail are left alone, so strace reads on where it stopped. */
+static __strace_ring *
+ring_claim ()
+{
+  LONG tid = GetCurrentThreadId ();
+  __strace_ring *r = NULL;
+
+  for (ULONG i = 0; i < _STRACE_RING_THREADS; i++)
+    if (!ring_hdr->ring[i].owner
+	&& !InterlockedCompareExchange (&ring_hdr->ring[i].owner, tid, 0))
+      {
+	r = &ring_hdr->ring[i];
+	break;
+      }
+  for (ULONG i = 0; !r && i < _STRACE_RING_THREADS; i++)
+    {
+      LONG owner = ring_hdr->ring[i].owner;
+
+      if (owner && ring_owner_dead (owner)
+	  && InterlockedCompareExchange (&ring_hdr->ring[i].owner, tid, owner)
+	     == owner)
+	r = &ring_hdr->ring[i];
+    }
+  if (r)
+    TlsSetValue (ring_tls, r);
+  return r;
+}
+
+/* Called from _cygtls::remove.  Give the calling thread's ring back. */
+void
+strace::ring_release ()
+{
+  __strace_ring *r;
+
+  if (ring_hdr && (r = (__strace_ring *) TlsGetValue (ring_tls)))
+    {
+      TlsSetValue (ring_tls, NULL);
+      InterlockedExchange (&r->owner, 0);
+    }
+}
+
+/* Append a record to the calling thread's ring.  No locking and no
+   formatting.  The record is reserved before it's filled, so a signal
+   handler tracing in between gets its own slot.  strace stops reading at
+   the first record not yet marked complete. */
+void
+strace::ring_write (unsigned category, const char *func, const char *fmt,
+		    va_list ap)
+{
+  DWORD err = GetLastError ();
+  unsigned mask = ring_hdr->mask;
+
+  if (!(mask & category)
+      && (!(mask & _STRACE_ALL) || (category & _STRACE_NOTALL)))
+    return;
+
+  __strace_ring *r = (__strace_ring *) TlsGetValue (ring_tls);
+  if (!r && !(r = ring_claim ()))
+    {
+      InterlockedIncrement64 (&ring_hdr->nothread_dropped);
+      SetLastError (err);
+      return;
+    }
+  ULONG64 idx = r->head;
+  if (idx - r->tail >= _STRACE_RING_RECORDS)
+    {
+      ++r->dropped;
+      SetLastError (err);
+      return;
+    }
+  r->head = idx + 1;
+
+  __strace_ring_rec *rec = &r->rec[idx & (_STRACE_RING_RECORDS - 1)];
+  USHORT fidx = ring_str (fmt, true, false);
+  ULONG off = 0;
+
+  rec->usecs = lmicrosec = microseconds ();
+  rec->category = category;
+  rec->tid = GetCurrentThreadId ();
+  rec->fmt = fidx;
+  rec->func = ring_str (func, false, true);
+  rec->tname = ring_str (mythreadname (), false, false);
+  rec->winerr = err;
+  rec->errnum = get_errno ();
+  if (myself && myself->pid)
+    ring_hdr->pid = myself->pid;
+  for (ULONG i = 0;
+       fidx != _STRACE_RING_NOSTR && i < ring_hdr->str[fidx].nargs; i++)
+    switch (ring_hdr->str[fidx].argtype[i])
+      {
+      case _STRACE_ARG_STR:
+	{
+	  const char *p = va_arg (ap, const char *);
+	  rec->args[i] = ring_copy (rec, off, p,
+				    p ? strnlen (p, _STRACE_RING_DATA) : 0);
+	}
+	break;
+      case _STRACE_ARG_WSTR:
+	{
+	  PWCHAR p = va_arg (ap, PWCHAR);
+	  rec->args[i] = ring_copy (rec, off, p, p ? sizeof (WCHAR)
+				    * wcsnlen (p, _STRACE_RING_DATA / 2) : 0);
+	}
+	break;
+      case _STRACE_ARG_USTR:
+	{
+	  PUNICODE_STRING p = va_arg (ap, PUNICODE_STRING);
+	  rec->args[i] = ring_copy (rec, off, p ? p->Buffer : NULL,
+				    p ? p->Length : 0);
+	}
+	break;
+      default:
+	rec->args[i] = va_arg (ap, ULONG64);
+	break;
+      }
+  MemoryBarrier ();
+  rec->seq = idx + 1;
+  SetLastError (err);
+}
+
 /* Printf function used when tracing system calls.
    Warning: DO NOT SET ERRNO HERE! */
 static NO_COPY muto strace_buf_guard;
@@ -249,6 +536,13 @@ strace::vprntf (unsigned category, const char *func, const char *fmt, va_list ap
   DWORD err = GetLastError ();
   int len;
 
+#ifndef NOSTRACE
+  if (ring_hdr && !(category & _STRACE_SYSTEM) && ring ())
+    {
+      ring_write (category, func, fmt, ap);
+      return;
+    }
+#endif
   strace_buf_guard.init ("smallprint_buf")->acquire ();
   /* Creating buffer on Windows process heap to drop stack pressure and
      keeping our .bss small. */
@@ -146,7 +146,10 @@ dup_finish (int oldfd, int newfd, int flags)
   int res;
   if ((res = cygheap->fdtab.dup3 (oldfd, newfd, flags | O_EXCL)) == newfd)
     {
-      cygheap_fdget (newfd)->inc_refcnt ();
+      /* dup3 leaves taking the fd table's reference to the caller.  This
+	 can't go through cygheap_fdget, which only finds fhandlers already
+	 referenced. */
+      cygheap->fdtab[newfd]->inc_refcnt ();
       cygheap->fdtab.unlock ();	/* dup3 exits with lock set on success */
     }
   return res;
@@ -241,6 +241,8 @@ tty::init ()
   term_code_page = 0;
   fwd_last_time = 0;
   fwd_not_empty = false;
+  fwd_bytes = fwd_reads = fwd_plain_reads = 0;
+  fwd_time = fwd_max_time = 0;
   pcon_start = false;
   pcon_start_pid = 0;
   pcon_cap_checked = false;
@@ -11,6 +11,7 @@ details. */
 #include "tz_posixrules.h"
 #include <cygwin/version.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <sys/_tz_structs.h>
 
 static NO_COPY SRWLOCK tzset_guard = SRWLOCK_INIT;
@@ -35,14 +36,23 @@ static NO_COPY SRWLOCK tzset_guard = SRWLOCK_INIT;
 #define _DIAGASSERT(X)
 
 // Supply this Cygwin-specific function in advance of its use in localtime.c
+// It's called by every localtime(), mktime() and strftime() if TZ is unset,
+// so only ask Windows again if the last answer is more than a second old.
+// Called under __lcl_lock.
 static char *
-tzgetwintzi (char *wildabbr, char *outbuf)
+tzgetwintzi (char *wildabbr)
 {
+    static NO_COPY char outbuf[512];
+    static NO_COPY ULONGLONG last_tick;
     TIME_ZONE_INFORMATION tzi;
     char *cp, *dst;
     wchar_t *wsrc;
     div_t d;
+    ULONGLONG tick = GetTickCount64 ();
 
+    if (*outbuf && tick - last_tick < 1000)
+	return outbuf;
+    last_tick = tick;
     GetTimeZoneInformation (&tzi);
     dst = cp = outbuf;
     for (wsrc = tzi.StandardName; *wsrc; wsrc++)
@@ -114,12 +124,52 @@ tzgetwintzi (char *wildabbr, char *outbuf)
 #include "private.h"
 #include "tzfile.h"
 
+// Modification time of the zone file loaded for the local time zone.  tzset()
+// compares it against the file to pick up a tzdata update without a change
+// of TZ; implicit tzset calls from localtime() et al. don't, to avoid a stat
+// per conversion.  Called under __lcl_lock.
+static NO_COPY struct timespec tzfile_mtim;
+
+static void
+tzfile_stat (const char *name, struct timespec *ts)
+{
+    char path[sizeof TZDIR + NAME_MAX + 1];
+    struct stat st;
+
+    ts->tv_sec = ts->tv_nsec = 0;
+    if (*name == ':')
+	++name;
+    if (!*name)
+	return;
+    if (*name != '/')
+      {
+	if (strlen (name) > NAME_MAX)
+	    return;
+	stpcpy (stpcpy (stpcpy (path, TZDIR), "/"), name);
+	name = path;
+      }
+    if (!stat (name, &st))
+	*ts = st.st_mtim;
+}
+
+static bool
+tzfile_changed (const char *name)
+{
+    struct timespec ts;
+
+    tzfile_stat (name, &ts);
+    return ts.tv_sec != tzfile_mtim.tv_sec || ts.tv_nsec != tzfile_mtim.tv_nsec;
+}
+
 /* Some NetBSD differences were too difficult to work around..
    so #include a patched copy of localtime.c rather than the NetBSD original.
    Here is a list of the patches...
    (1) fix an erroneous decl of tzdirslash size (flagged by g++)
    (2) add conditional call to Cygwin's tzgetwintzi() from tzsetlcl()
    (3) add Cygwin's historical "posixrules" support to tzloadbody()
+   (4) cache the transition interval and local day of the last conversion
+       in localsub() and use it for a mktime() fast path
+   (5) make tzset() reload the zone file if it changed, see tzfile_changed()
 */
 #include "localtime.patched.c"
 
@@ -0,0 +1,203 @@
+/* chacha20.c: known-answer test of the ChaCha20 generator behind
+   /dev/urandom, getrandom(2) and arc4random(3).
+
+   The keystream function is checked against the test vectors of RFC 8439.
+   It only needs the C library, so this part also runs on a Linux host:
+
+     cc -I winsup/cygwin/local_includes winsup/testsuite/winsup.api/chacha20.c
+
+   On Cygwin, the interfaces using it are checked, too, including that a
+   forked child doesn't continue the keystream of its parent. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chacha20.h"
+#ifdef __CYGWIN__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/wait.h>
+#endif
+
+struct kat
+{
+  const char *name;
+  uint8_t key[CHACHA20_KEYSIZE];
+  uint8_t nonce[CHACHA20_NONCESIZE];
+  uint32_t counter;
+  uint8_t block[CHACHA20_BLOCKSIZE];
+};
+
+static const struct kat kats[] =
+{
+  {
+    "RFC 8439 2.3.2",
+    { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+      0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+      0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+      0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f },
+    { 0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x4a,
+      0x00, 0x00, 0x00, 0x00 },
+    1,
+    { 0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15,
+      0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+      0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03,
+      0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+      0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09,
+      0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+      0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9,
+      0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e }
+  },
+  {
+    "RFC 8439 A.1 #1",
+    { 0 },
+    { 0 },
+    0,
+    { 0x76, 0xb8, 0xe0, 0xad, 0xa0, 0xf1, 0x3d, 0x90,
+      0x40, 0x5d, 0x6a, 0xe5, 0x53, 0x86, 0xbd, 0x28,
+      0xbd, 0xd2, 0x19, 0xb8, 0xa0, 0x8d, 0xed, 0x1a,
+      0xa8, 0x36, 0xef, 0xcc, 0x8b, 0x77, 0x0d, 0xc7,
+      0xda, 0x41, 0x59, 0x7c, 0x51, 0x57, 0x48, 0x8d,
+      0x77, 0x24, 0xe0, 0x3f, 0xb8, 0xd8, 0x4a, 0x37,
+      0x6a, 0x43, 0xb8, 0xf4, 0x15, 0x18, 0xa1, 0x1c,
+      0xc3, 0x87, 0xb6, 0x69, 0xb2, 0xee, 0x65, 0x86 }
+  },
+  {
+    "RFC 8439 A.1 #2",
+    { 0 },
+    { 0 },
+    1,
+    { 0x9f, 0x07, 0xe7, 0xbe, 0x55, 0x51, 0x38, 0x7a,
+      0x98, 0xba, 0x97, 0x7c, 0x73, 0x2d, 0x08, 0x0d,
+      0xcb, 0x0f, 0x29, 0xa0, 0x48, 0xe3, 0x65, 0x69,
+      0x12, 0xc6, 0x53, 0x3e, 0x32, 0xee, 0x7a, 0xed,
+      0x29, 0xb7, 0x21, 0x76, 0x9c, 0xe6, 0x4e, 0x43,
+      0xd5, 0x71, 0x33, 0xb0, 0x74, 0xd8, 0x39, 0xd5,
+      0x31, 0xed, 0x1f, 0x28, 0x51, 0x0a, 0xfb, 0x45,
+      0xac, 0xe1, 0x0a, 0x1f, 0x4b, 0x79, 0x4d, 0x6f }
+  },
+};
+
+int
+check_kats ()
+{
+  uint8_t out[2 * CHACHA20_BLOCKSIZE];
+  int ret = 0;
+  size_t i;
+
+  for (i = 0; i < sizeof kats / sizeof *kats; i++)
+    {
+      const struct kat *k = &kats[i];
+
+      chacha20_keystream (out, 1, k->key, k->counter, k->nonce);
+      if (memcmp (out, k->block, CHACHA20_BLOCKSIZE))
+	{
+	  printf ("%s: wrong keystream block\n", k->name);
+	  ret = 1;
+	}
+      /* The same block has to come out as the second one of a run
+	 starting one block earlier. */
+      if (k->counter > 0)
+	{
+	  chacha20_keystream (out, 2, k->key, k->counter - 1, k->nonce);
+	  if (memcmp (out + CHACHA20_BLOCKSIZE, k->block, CHACHA20_BLOCKSIZE))
+	    {
+	      printf ("%s: wrong keystream block in a run\n", k->name);
+	      ret = 1;
+	    }
+	}
+    }
+  return ret;
+}
+
+#ifdef __CYGWIN__
+int
+all_zero (const uint8_t *p, size_t len)
+{
+  while (len-- > 0)
+    if (*p++)
+      return 0;
+  return 1;
+}
+
+int
+check_interfaces ()
+{
+  uint8_t a[32], b[32];
+  int fd, pfd[2], status, ret = 0;
+  pid_t pid;
+
+  if (getrandom (a, sizeof a, 0) != sizeof a
+      || getrandom (b, sizeof b, 0) != sizeof b
+      || all_zero (a, sizeof a) || !memcmp (a, b, sizeof a))
+    {
+      printf ("getrandom: bad result\n");
+      ret = 1;
+    }
+
+  fd = open ("/dev/urandom", O_RDONLY);
+  if (fd < 0 || read (fd, a, 16) != 16 || read (fd, b, 16) != 16
+      || all_zero (a, 16) || !memcmp (a, b, 16))
+    {
+      printf ("/dev/urandom: bad result\n");
+      ret = 1;
+    }
+  if (fd >= 0)
+    close (fd);
+
+  memset (a, 0, sizeof a);
+  memset (b, 0, sizeof b);
+  arc4random_buf (a, sizeof a);
+  arc4random_buf (b, sizeof b);
+  if (all_zero (a, sizeof a) || !memcmp (a, b, sizeof a))
+    {
+      printf ("arc4random_buf: bad result\n");
+      ret = 1;
+    }
+
+  /* Both processes continue from the same buffered state, unless the
+     child reseeds. */
+  getrandom (a, 1, 0);
+  if (pipe (pfd))
+    {
+      perror ("pipe");
+      return 1;
+    }
+  pid = fork ();
+  if (pid < 0)
+    {
+      perror ("fork");
+      return 1;
+    }
+  if (pid == 0)
+    {
+      getrandom (b, sizeof b, 0);
+      write (pfd[1], b, sizeof b);
+      _exit (0);
+    }
+  getrandom (a, sizeof a, 0);
+  if (read (pfd[0], b, sizeof b) != sizeof b || !memcmp (a, b, sizeof a))
+    {
+      printf ("fork: child repeats the keystream of its parent\n");
+      ret = 1;
+    }
+  waitpid (pid, &status, 0);
+  close (pfd[0]);
+  close (pfd[1]);
+  return ret;
+}
+#endif
+
+int
+main ()
+{
+  int ret = check_kats ();
+
+#ifdef __CYGWIN__
+  ret |= check_interfaces ();
+#endif
+  if (!ret)
+    printf ("chacha20: all tests passed\n");
+  return ret;
+}
@@ -0,0 +1,113 @@
+/* dupfd.c: check that descriptors created by dup(2), dup2(2), dup3(2) and
+   fcntl(2) F_DUPFD are usable, and stay usable after the original is
+   closed. */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+int ret = 0;
+
+void
+fail (const char *what)
+{
+  printf ("%s: %s\n", what, strerror (errno));
+  ret = 1;
+}
+
+/* Write through wfd, read back through rfd. */
+int
+roundtrip (int rfd, int wfd)
+{
+  char buf[8];
+
+  return write (wfd, "dupfd", 5) == 5 && read (rfd, buf, sizeof buf) == 5
+	 && !memcmp (buf, "dupfd", 5);
+}
+
+void
+check (const char *what, int rfd, int wfd, int cloexec)
+{
+  int fdflags = fcntl (wfd, F_GETFD);
+
+  if (fdflags < 0 || !!(fdflags & FD_CLOEXEC) != cloexec)
+    fail (what);
+  else if (!roundtrip (rfd, wfd))
+    fail (what);
+}
+
+int
+main ()
+{
+  int pfd[2], fd, other[2];
+
+  if (pipe (pfd) || pipe (other))
+    {
+      fail ("pipe");
+      return 1;
+    }
+
+  fd = dup (pfd[1]);
+  if (fd < 0)
+    fail ("dup");
+  else
+    check ("dup", pfd[0], fd, 0);
+  close (fd);
+
+  /* dup2 to a free fd, to an open fd and to itself. */
+  if (dup2 (pfd[1], 20) != 20)
+    fail ("dup2 to free fd");
+  else
+    check ("dup2 to free fd", pfd[0], 20, 0);
+  if (dup2 (pfd[1], other[1]) != other[1])
+    fail ("dup2 to open fd");
+  else
+    check ("dup2 to open fd", pfd[0], other[1], 0);
+  if (dup2 (20, 20) != 20)
+    fail ("dup2 to itself");
+  else
+    check ("dup2 to itself", pfd[0], 20, 0);
+  close (20);
+
+  if (dup3 (pfd[1], 21, O_CLOEXEC) != 21)
+    fail ("dup3");
+  else
+    check ("dup3", pfd[0], 21, 1);
+  errno = 0;
+  if (dup3 (21, 21, 0) != -1 || errno != EINVAL)
+    fail ("dup3 to itself");
+
+  fd = fcntl (pfd[1], F_DUPFD, 30);
+  if (fd < 30)
+    fail ("F_DUPFD");
+  else
+    check ("F_DUPFD", pfd[0], fd, 0);
+  close (fd);
+  fd = fcntl (pfd[1], F_DUPFD_CLOEXEC, 30);
+  if (fd < 30)
+    fail ("F_DUPFD_CLOEXEC");
+  else
+    check ("F_DUPFD_CLOEXEC", pfd[0], fd, 1);
+  close (fd);
+
+  /* The duplicate outlives the original. */
+  close (pfd[1]);
+  check ("dup3 after closing the original", pfd[0], 21, 1);
+  close (21);
+  errno = 0;
+  if (write (21, "x", 1) != -1 || errno != EBADF)
+    fail ("write to closed duplicate");
+  close (other[1]);
+  errno = 0;
+  if (write (other[1], "x", 1) != -1 || errno != EBADF)
+    fail ("write to closed dup2 target");
+
+  close (pfd[0]);
+  close (other[0]);
+  if (!ret)
+    printf ("dupfd: all tests passed\n");
+  return ret;
+}
@@ -0,0 +1,152 @@
+/* mmapspeed.c: measure how mmap bookkeeping scales with the number of
+   mappings.
+
+   For each count, COUNT anonymous MAP_NORESERVE pages are mapped one by
+   one.  Then up to FAULTS of them are touched in random order, each first
+   access committing the page in the fault handler, and read back.  Finally
+   all pages are protected with PROT_NONE and unmapped, again in random
+   order.  The average time per call is reported for each step.
+
+   Usage: mmapspeed [-v] [count...]
+   Default counts are 1000 10000 100000. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define FAULTS 1000
+
+int verbose = 0;
+
+double
+now ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+void
+shuffle (int *idx, int count)
+{
+  int i;
+
+  for (i = 0; i < count; ++i)
+    idx[i] = i;
+  for (i = count - 1; i > 0; --i)
+    {
+      int j = rand () % (i + 1);
+      int t = idx[i];
+
+      idx[i] = idx[j];
+      idx[j] = t;
+    }
+}
+
+int
+run (int count)
+{
+  char **maps = calloc (count, sizeof *maps);
+  int *idx = malloc (count * sizeof *idx);
+  int i, faults = count < FAULTS ? count : FAULTS, ret = 0;
+  size_t pagesize = getpagesize ();
+  double start, t_map, t_fault, t_prot, t_unmap;
+
+  if (!maps || !idx)
+    {
+      fprintf (stderr, "out of memory\n");
+      return 1;
+    }
+
+  start = now ();
+  for (i = 0; i < count; ++i)
+    {
+      maps[i] = mmap (NULL, pagesize, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (maps[i] == MAP_FAILED)
+	{
+	  fprintf (stderr, "mmap #%d: %s\n", i, strerror (errno));
+	  count = i;
+	  ret = 1;
+	  break;
+	}
+    }
+  t_map = now () - start;
+  if (verbose)
+    printf ("  %d pages mapped\n", count);
+
+  shuffle (idx, count);
+  if (faults > count)
+    faults = count;
+  start = now ();
+  for (i = 0; i < faults; ++i)
+    maps[idx[i]][idx[i] % pagesize] = (char) idx[i];
+  t_fault = now () - start;
+  for (i = 0; i < faults; ++i)
+    if (maps[idx[i]][idx[i] % pagesize] != (char) idx[i])
+      {
+	fprintf (stderr, "mapping #%d: wrong data\n", idx[i]);
+	ret = 1;
+	break;
+      }
+
+  start = now ();
+  for (i = 0; i < count; ++i)
+    if (mprotect (maps[idx[i]], pagesize, PROT_NONE))
+      {
+	fprintf (stderr, "mprotect #%d: %s\n", idx[i], strerror (errno));
+	ret = 1;
+	break;
+      }
+  t_prot = now () - start;
+
+  shuffle (idx, count);
+  start = now ();
+  for (i = 0; i < count; ++i)
+    if (munmap (maps[idx[i]], pagesize))
+      {
+	fprintf (stderr, "munmap #%d: %s\n", idx[i], strerror (errno));
+	ret = 1;
+      }
+  t_unmap = now () - start;
+
+  if (count > 0)
+    printf ("%6d mappings: mmap %6.2f us, fault %6.2f us, "
+	    "mprotect %6.2f us, munmap %6.2f us\n", count, t_map / count,
+	    faults ? t_fault / faults : 0.0, t_prot / count, t_unmap / count);
+  free (maps);
+  free (idx);
+  return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+  static const int counts[] = { 1000, 10000, 100000 };
+  int opt, i, ret = 0;
+
+  while ((opt = getopt (argc, argv, "v")) != -1)
+    switch (opt)
+      {
+      case 'v':
+	verbose = 1;
+	break;
+      default:
+	fprintf (stderr, "Usage: %s [-v] [count...]\n", argv[0]);
+	return 1;
+      }
+
+  srand (time (NULL));
+  if (optind < argc)
+    for (i = optind; i < argc; ++i)
+      ret |= run (atoi (argv[i]));
+  else
+    for (i = 0; i < (int) (sizeof counts / sizeof *counts); ++i)
+      ret |= run (counts[i]);
+  return ret;
+}
@@ -0,0 +1,186 @@
+/* pipespeed.c: measure the throughput of big writes to a pipe.
+
+   A child process writes SIZE megabytes to a pipe in blocks of BLOCK
+   kilobytes, and the parent reads them in blocks of the same size and
+   checks that the data arrives in order.  This is done with the default
+   pipe size and with each size given via F_SETPIPE_SZ.
+
+   Usage: pipespeed [-v] [-s size] [-b block] [pipesize...]
+   Default pipe sizes are 256K, 1M and 8M. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+int verbose = 0;
+size_t total = 64 << 20;
+size_t block = 1 << 20;
+
+double
+now ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+void
+fill (unsigned char *buf, size_t off, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; ++i)
+    buf[i] = (off + i) * 7 + ((off + i) >> 12);
+}
+
+void
+writer (int fd)
+{
+  unsigned char *buf = malloc (block);
+  size_t off = 0;
+
+  while (off < total)
+    {
+      size_t len = total - off < block ? total - off : block;
+      ssize_t ret;
+
+      fill (buf, off, len);
+      ret = write (fd, buf, len);
+      if (ret <= 0)
+	{
+	  perror ("write");
+	  _exit (1);
+	}
+      off += ret;
+    }
+  _exit (0);
+}
+
+int
+run (int size)
+{
+  unsigned char *buf, *exp;
+  int pfd[2], status, ret = 0;
+  size_t off = 0;
+  double start;
+  pid_t pid;
+
+  if (pipe (pfd))
+    {
+      perror ("pipe");
+      return 1;
+    }
+  if (size > 0)
+    {
+      int got;
+
+      if (fcntl (pfd[1], F_SETPIPE_SZ, size) < size
+	  || (got = fcntl (pfd[1], F_GETPIPE_SZ)) < size)
+	{
+	  fprintf (stderr, "F_SETPIPE_SZ %d: %s\n", size, strerror (errno));
+	  return 1;
+	}
+      size = got;
+    }
+  else
+    size = fcntl (pfd[1], F_GETPIPE_SZ);
+
+  buf = malloc (block);
+  exp = malloc (block);
+  if (!buf || !exp)
+    {
+      fprintf (stderr, "out of memory\n");
+      return 1;
+    }
+  start = now ();
+  pid = fork ();
+  if (pid < 0)
+    {
+      perror ("fork");
+      return 1;
+    }
+  if (pid == 0)
+    {
+      close (pfd[0]);
+      writer (pfd[1]);
+    }
+  close (pfd[1]);
+  while (off < total)
+    {
+      ssize_t len = read (pfd[0], buf, block);
+
+      if (len <= 0)
+	{
+	  fprintf (stderr, "read at offset %zu: %s\n", off,
+		   len ? strerror (errno) : "unexpected EOF");
+	  ret = 1;
+	  break;
+	}
+      fill (exp, off, len);
+      if (memcmp (buf, exp, len))
+	{
+	  fprintf (stderr, "pipe size %d: wrong data at offset %zu\n",
+		   size, off);
+	  ret = 1;
+	  break;
+	}
+      if (verbose)
+	printf ("  %zd bytes at offset %zu\n", len, off);
+      off += len;
+    }
+  close (pfd[0]);
+  waitpid (pid, &status, 0);
+  if (!WIFEXITED (status) || WEXITSTATUS (status))
+    ret = 1;
+  if (!ret)
+    printf ("pipe size %8d: %8.1f MB/s\n", size,
+	    total / (now () - start));
+  free (buf);
+  free (exp);
+  return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+  static const int sizes[] = { 256 << 10, 1 << 20, 8 << 20 };
+  int opt, i, ret = 0;
+
+  while ((opt = getopt (argc, argv, "vs:b:")) != -1)
+    switch (opt)
+      {
+      case 'v':
+	verbose = 1;
+	break;
+      case 's':
+	total = (size_t) atoi (optarg) << 20;
+	break;
+      case 'b':
+	block = (size_t) atoi (optarg) << 10;
+	break;
+      default:
+	fprintf (stderr, "Usage: %s [-v] [-s size] [-b block] [pipesize...]\n",
+		 argv[0]);
+	return 1;
+      }
+  if (!total || !block)
+    {
+      fprintf (stderr, "size and block must be positive\n");
+      return 1;
+    }
+
+  ret |= run (0);
+  if (optind < argc)
+    for (i = optind; i < argc; ++i)
+      ret |= run (atoi (argv[i]));
+  else
+    for (i = 0; i < (int) (sizeof sizes / sizeof *sizes); ++i)
+      ret |= run (sizes[i]);
+  return ret;
+}
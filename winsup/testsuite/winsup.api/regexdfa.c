@@ -0,0 +1,421 @@
+/* regexdfa.c: differential test of regexec(3) against a reference matcher.
+
+   Random patterns are built as small syntax trees, printed as ERE or BRE,
+   and matched against random subjects both by regexec and by a simple
+   set-based matcher working on the tree.  The overall match, leftmost
+   and longest, must be the same.  Each compiled regex is used for many
+   subjects, long ones included, so the DFA cache of the matcher fills up,
+   is reused and gets flushed.  Patterns have word boundaries and are
+   compiled with REG_ICASE, too, since the DFA states of the matcher depend
+   on the word context and on case folding.
+
+   The reference matcher only needs the C library, so the test also runs
+   on a Linux host, where it is checked against glibc, without word
+   boundaries:
+
+     cc winsup/testsuite/winsup.api/regexdfa.c
+
+   Usage: regexdfa [iterations [seed]] */
+
+#include <ctype.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXSUBJ 256
+#define MAXNODES 256
+#define SUBJECTS 20
+
+#ifdef __CYGWIN__
+#define WORDBOUNDS 1
+#else
+/* glibc gets word boundaries in repetitions wrong, "(\<a)+" matches "aa". */
+#define WORDBOUNDS 0
+#endif
+
+enum { N_SET, N_CAT, N_ALT, N_REP, N_BOL, N_EOL, N_BOW, N_EOW };
+
+struct node
+{
+  int type;
+  int atom;			/* N_SET */
+  int min, max;			/* N_REP, max -1 is unbounded */
+  struct node *l, *r;
+};
+
+/* Written the same in ERE and BRE.  A set matches the characters in chars,
+   or with negate set, all others except newline under REG_NEWLINE. */
+static const struct
+{
+  const char *text;
+  const char *chars;
+  int negate;
+} atoms[] =
+{
+  { "a", "a", 0 },
+  { "b", "b", 0 },
+  { "A", "A", 0 },
+  { "x", "x", 0 },
+  { " ", " ", 0 },
+  { "\n", "\n", 0 },
+  { ".", "", 1 },
+  { "[ab]", "ab", 0 },
+  { "[aB]", "aB", 0 },
+  { "[^a]", "a", 1 },
+  { "[^B]", "B", 1 },
+  { "[0-9]", "0", 0 },
+  { "[[:alpha:]]", "abxzAB", 0 },
+  { "[[:space:]]", " \n", 0 },
+};
+#define NATOMS ((int) (sizeof atoms / sizeof *atoms))
+
+static const char subject_chars[] = "aaabbxzAABb 0_\n";
+
+static struct node pool[MAXNODES];
+static int npool;
+
+/* The case being tested. */
+static int ere, cflags, eflags, wordbounds;
+static const char *subj;
+static int len;
+
+struct node *
+mknode (int type, struct node *l, struct node *r)
+{
+  struct node *n = &pool[npool++];
+
+  memset (n, 0, sizeof *n);
+  n->type = type;
+  n->l = l;
+  n->r = r;
+  return n;
+}
+
+/* A set with a word boundary, \< before or \> after it.  The matcher
+   takes the zero-width steps between two characters in a fixed order,
+   BOL and EOL before BOW and EOW, and each only once, so "\>$" or
+   "\<\<" never match.  Keeping a set next to each word boundary, and
+   not adding $ to such patterns, avoids these. */
+struct node *
+wordbound (struct node *set)
+{
+  wordbounds = 1;
+  if (rand () % 2)
+    return mknode (N_CAT, mknode (N_BOW, NULL, NULL), set);
+  return mknode (N_CAT, set, mknode (N_EOW, NULL, NULL));
+}
+
+struct node *
+gen (int depth)
+{
+  struct node *n;
+  int k = depth > 0 ? rand () % 10 : 0;
+
+  if (npool > MAXNODES - 8)
+    k = 0;
+  switch (k)
+    {
+    case 0:
+    case 1:
+    case 2:
+      n = mknode (N_SET, NULL, NULL);
+      n->atom = rand () % NATOMS;
+      return WORDBOUNDS && rand () % 4 == 0 ? wordbound (n) : n;
+    case 3:
+    case 4:
+    case 5:
+      n = mknode (N_CAT, gen (depth - 1), NULL);
+      n->r = gen (depth - 1);
+      return n;
+    case 6:
+      if (ere)
+	{
+	  n = mknode (N_ALT, gen (depth - 1), NULL);
+	  n->r = gen (depth - 1);
+	  return n;
+	}
+      /*FALLTHRU*/
+    default:
+      n = mknode (N_REP, gen (depth - 1), NULL);
+      switch (rand () % (ere ? 4 : 2))
+	{
+	case 0:			/* * */
+	  n->min = 0;
+	  n->max = -1;
+	  break;
+	case 1:			/* {m,n} */
+	  n->min = rand () % 3;
+	  n->max = n->min + 1 + rand () % 2;
+	  break;
+	case 2:			/* + */
+	  n->min = 1;
+	  n->max = -1;
+	  break;
+	default:		/* ? */
+	  n->min = 0;
+	  n->max = 1;
+	  break;
+	}
+      return n;
+    }
+}
+
+void
+render (struct node *n, char *buf)
+{
+  switch (n->type)
+    {
+    case N_SET:
+      strcat (buf, atoms[n->atom].text);
+      break;
+    case N_BOL:
+      strcat (buf, "^");
+      break;
+    case N_EOL:
+      strcat (buf, "$");
+      break;
+    case N_BOW:
+      strcat (buf, "\\<");
+      break;
+    case N_EOW:
+      strcat (buf, "\\>");
+      break;
+    case N_CAT:
+      for (struct node *c = n->l; c; c = c == n->l ? n->r : NULL)
+	if (c->type == N_ALT)
+	  {
+	    strcat (buf, "(");
+	    render (c, buf);
+	    strcat (buf, ")");
+	  }
+	else
+	  render (c, buf);
+      break;
+    case N_ALT:
+      render (n->l, buf);
+      strcat (buf, "|");
+      render (n->r, buf);
+      break;
+    case N_REP:
+      if (n->l->type == N_SET)
+	render (n->l, buf);
+      else
+	{
+	  strcat (buf, ere ? "(" : "\\(");
+	  render (n->l, buf);
+	  strcat (buf, ere ? ")" : "\\)");
+	}
+      if (n->min == 0 && n->max == -1)
+	strcat (buf, "*");
+      else if (ere && n->min == 1 && n->max == -1)
+	strcat (buf, "+");
+      else if (ere && n->min == 0 && n->max == 1)
+	strcat (buf, "?");
+      else
+	sprintf (buf + strlen (buf), ere ? "{%d,%d}" : "\\{%d,%d\\}",
+		 n->min, n->max);
+      break;
+    }
+}
+
+int
+setmatch (int atom, int c)
+{
+  const char *chars = atoms[atom].chars;
+  int in = c && (strchr (chars, c)
+		 || ((cflags & REG_ICASE)
+		     && (strchr (chars, tolower (c))
+			 || strchr (chars, toupper (c)))));
+
+  if (atoms[atom].negate)
+    return !in && !(c == '\n' && (cflags & REG_NEWLINE));
+  return in;
+}
+
+int
+isword (int c)
+{
+  return isalnum (c) || c == '_';
+}
+
+/* Sets of subject positions. */
+#define WORDS ((MAXSUBJ + 64) / 64)
+typedef unsigned long long posset[WORDS];
+
+#define ISSET(set, p) ((set)[(p) / 64] & (1ULL << ((p) % 64)))
+#define SET(set, p) ((set)[(p) / 64] |= 1ULL << ((p) % 64))
+
+static posset reach[MAXNODES][MAXSUBJ + 1];
+
+void
+addset (posset dst, const posset src)
+{
+  for (int w = 0; w < WORDS; w++)
+    dst[w] |= src[w];
+}
+
+/* Compute reach[N][S], the positions at which N can stop matching when
+   started at S, for all S. */
+void
+ends (struct node *n)
+{
+  posset *r = reach[n - pool], *lr, cur, next, seen;
+  int s, p, i, any;
+
+  memset (r, 0, (len + 1) * sizeof *r);
+  if (n->l)
+    ends (n->l);
+  if (n->r)
+    ends (n->r);
+  lr = n->l ? reach[n->l - pool] : NULL;
+  for (s = 0; s <= len; s++)
+    switch (n->type)
+      {
+      case N_SET:
+	if (s < len && setmatch (n->atom, (unsigned char) subj[s]))
+	  SET (r[s], s + 1);
+	break;
+      case N_BOL:
+	if ((s == 0 && !(eflags & REG_NOTBOL))
+	    || ((cflags & REG_NEWLINE) && s > 0 && subj[s - 1] == '\n'))
+	  SET (r[s], s);
+	break;
+      case N_EOL:
+	if ((s == len && !(eflags & REG_NOTEOL))
+	    || ((cflags & REG_NEWLINE) && s < len && subj[s] == '\n'))
+	  SET (r[s], s);
+	break;
+      case N_BOW:
+	if (s < len && isword ((unsigned char) subj[s])
+	    && (s > 0 ? !isword ((unsigned char) subj[s - 1])
+		: !(eflags & REG_NOTBOL)))
+	  SET (r[s], s);
+	break;
+      case N_EOW:
+	if (s > 0 && isword ((unsigned char) subj[s - 1])
+	    && (s < len ? !isword ((unsigned char) subj[s])
+		: !(eflags & REG_NOTEOL)))
+	  SET (r[s], s);
+	break;
+      case N_CAT:
+	for (p = s; p <= len; p++)
+	  if (ISSET (lr[s], p))
+	    addset (r[s], reach[n->r - pool][p]);
+	break;
+      case N_ALT:
+	addset (r[s], lr[s]);
+	addset (r[s], reach[n->r - pool][s]);
+	break;
+      case N_REP:
+	/* Once min is reached, a position seen before can't lead anywhere
+	   new, so drop it.  That also ends unbounded repetitions. */
+	memset (cur, 0, sizeof cur);
+	memset (seen, 0, sizeof seen);
+	SET (cur, s);
+	for (i = 0;; i++)
+	  {
+	    any = 0;
+	    for (int w = 0; w < WORDS; w++)
+	      {
+		if (i >= n->min)
+		  {
+		    cur[w] &= ~seen[w];
+		    seen[w] |= cur[w];
+		    r[s][w] |= cur[w];
+		  }
+		any |= !!cur[w];
+	      }
+	    if (i == n->max || !any)
+	      break;
+	    memset (next, 0, sizeof next);
+	    for (p = s; p <= len; p++)
+	      if (ISSET (cur, p))
+		addset (next, lr[p]);
+	    memcpy (cur, next, sizeof cur);
+	  }
+	break;
+      }
+}
+
+int
+refmatch (struct node *root, regmatch_t *m)
+{
+  int start, p;
+
+  ends (root);
+  for (start = 0; start <= len; start++)
+    for (p = len; p >= start; p--)
+      if (ISSET (reach[root - pool][start], p))
+	{
+	  m->rm_so = start;
+	  m->rm_eo = p;
+	  return 0;
+	}
+  return REG_NOMATCH;
+}
+
+int
+main (int argc, char **argv)
+{
+  long iterations = argc > 1 ? atol (argv[1]) : 2000;
+  char pat[4096], buf[MAXSUBJ + 1];
+  long it, tested = 0, fails = 0;
+  int i, j, err;
+
+  srand (argc > 2 ? atoi (argv[2]) : 1);
+  for (it = 0; it < iterations; it++)
+    {
+      struct node *root, *expr;
+      regex_t re;
+
+      ere = rand () % 3 != 0;
+      cflags = (ere ? REG_EXTENDED : 0) | (rand () % 3 ? 0 : REG_ICASE)
+	       | (rand () % 3 ? 0 : REG_NEWLINE);
+      npool = 0;
+      wordbounds = 0;
+      expr = gen (rand () % 8 ? 3 : 6);
+      root = rand () % 3 ? expr
+			 : mknode (N_CAT, mknode (N_BOL, NULL, NULL), expr);
+      if (rand () % 3 == 0 && !wordbounds)
+	root = mknode (N_CAT, root, mknode (N_EOL, NULL, NULL));
+      pat[0] = '\0';
+      render (root, pat);
+      if ((err = regcomp (&re, pat, cflags)))
+	{
+	  regerror (err, &re, buf, sizeof buf);
+	  printf ("regcomp \"%s\" cflags %#x: %s\n", pat, cflags, buf);
+	  ++fails;
+	  continue;
+	}
+      for (i = 0; i < SUBJECTS; i++)
+	{
+	  regmatch_t m, r;
+	  int ret, rret;
+
+	  len = rand () % (i < SUBJECTS / 2 ? 16 : MAXSUBJ);
+	  for (j = 0; j < len; j++)
+	    buf[j] = subject_chars[rand () % (sizeof subject_chars - 1)];
+	  buf[len] = '\0';
+	  subj = buf;
+	  eflags = (rand () % 4 ? 0 : REG_NOTBOL) | (rand () % 4 ? 0 : REG_NOTEOL);
+	  ret = regexec (&re, subj, 1, &m, eflags);
+	  rret = refmatch (root, &r);
+	  ++tested;
+	  if (ret != rret
+	      || (!ret && (m.rm_so != r.rm_so || m.rm_eo != r.rm_eo)))
+	    {
+	      if (++fails <= 10)
+		printf ("\"%s\" cflags %#x eflags %#x subject \"%s\": "
+			"regexec %d %d,%d, reference %d %d,%d\n", pat, cflags,
+			eflags, subj, ret, ret ? -1 : (int) m.rm_so,
+			ret ? -1 : (int) m.rm_eo, rret, rret ? -1 : (int) r.rm_so,
+			rret ? -1 : (int) r.rm_eo);
+	    }
+	}
+      regfree (&re);
+    }
+  if (fails)
+    printf ("regexdfa: %ld of %ld cases failed\n", fails, tested);
+  return fails != 0;
+}
@@ -0,0 +1,83 @@
+/* regexspeed.c: measure regexec(3) on long subjects.
+
+   Each pattern is compiled once and run ROUNDS times over a random 4K
+   subject which it doesn't match, so every call scans the whole subject.
+   The first call, which has to build the matcher's DFA cache, is reported
+   separately from the average of the others.  The patterns have no
+   literal string regexec could search for first.
+
+   Usage: regexspeed [rounds] */
+
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define SUBJLEN 4096
+#define ROUNDS 1000
+
+static const struct
+{
+  const char *pattern;
+  int cflags;
+} pats[] =
+{
+  { "[0-9]+[xyz]", REG_EXTENDED },
+  { "(a|b)*[kl][0-9]", REG_EXTENDED },
+  { "([a-e]+ )+[0-9]", REG_EXTENDED },
+  { "[[:alpha:]]+[[:digit:]]", REG_EXTENDED },
+  { "^[a-j]*[q-z]$", REG_EXTENDED | REG_NEWLINE },
+  { "\\([a-e][f-j]\\)*[0-9]", 0 },
+  { "[a-e]+[0-9]", REG_EXTENDED | REG_ICASE },
+};
+
+double
+now ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int
+main (int argc, char **argv)
+{
+  static const char chars[] = "abcdefghij klmnop\n";
+  static char subj[SUBJLEN + 1];
+  int rounds = argc > 1 ? atoi (argv[1]) : ROUNDS;
+  int i, p, ret = 0;
+  double start, t_first, t_rest;
+
+  if (rounds < 2)
+    rounds = 2;
+  srand (1);
+  for (i = 0; i < SUBJLEN; i++)
+    subj[i] = chars[rand () % (sizeof chars - 1)];
+  for (p = 0; p < (int) (sizeof pats / sizeof *pats); p++)
+    {
+      regex_t re;
+
+      if (regcomp (&re, pats[p].pattern, pats[p].cflags))
+	{
+	  fprintf (stderr, "regcomp \"%s\" failed\n", pats[p].pattern);
+	  ret = 1;
+	  continue;
+	}
+      start = now ();
+      if (regexec (&re, subj, 0, NULL, 0) != REG_NOMATCH)
+	{
+	  fprintf (stderr, "\"%s\" matched\n", pats[p].pattern);
+	  ret = 1;
+	}
+      t_first = now () - start;
+      start = now ();
+      for (i = 1; i < rounds; i++)
+	regexec (&re, subj, 0, NULL, 0);
+      t_rest = (now () - start) / (rounds - 1);
+      printf ("%-28s first %8.2f us, then %8.2f us, %6.1f MB/s\n",
+	      pats[p].pattern, t_first, t_rest, SUBJLEN / t_rest);
+      regfree (&re);
+    }
+  return ret;
+}
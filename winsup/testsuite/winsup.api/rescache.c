@@ -0,0 +1,260 @@
+/* rescache.c: check the answer cache of the resolver.
+
+   Two stub name servers on 127.0.0.1 run in threads and count the queries
+   they get.  Names under pos.test have an A record with a TTL of 4 seconds
+   and no AAAA record.  Names under nx.test don't exist.  Negative answers
+   carry a SOA record with a minimum TTL of 4 seconds.
+
+   Checks that positive answers, NXDOMAIN and NODATA are answered from the
+   cache, that names are compared case-insensitively and ignoring a final
+   dot, that a resolver asking another server doesn't get these answers,
+   that a cache hit has its TTL reduced by the time spent in the cache,
+   and that entries expire after their TTL. */
+
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <resolv.h>
+
+#define TTL 4
+
+int ret = 0;
+int srv[2];
+volatile int queries;
+
+/* Read the question name of MSG as a lowercase dotted string into NAME.
+   Return the length of the question, or -1. */
+int
+question (const unsigned char *msg, int len, char *name)
+{
+  int off = HFIXEDSZ, n = 0;
+
+  while (off < len && msg[off])
+    {
+      int l = msg[off++];
+
+      if (l > 63 || off + l > len || n + l + 2 > NS_MAXDNAME)
+	return -1;
+      if (n)
+	name[n++] = '.';
+      while (l--)
+	{
+	  unsigned char c = msg[off++];
+
+	  name[n++] = c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c;
+	}
+    }
+  name[n] = '\0';
+  if (off + 1 + QFIXEDSZ > len)
+    return -1;
+  return off + 1 + QFIXEDSZ - HFIXEDSZ;
+}
+
+unsigned char *
+put16 (unsigned char *p, unsigned v)
+{
+  *p++ = v >> 8;
+  *p++ = v;
+  return p;
+}
+
+unsigned char *
+put32 (unsigned char *p, unsigned v)
+{
+  return put16 (put16 (p, v >> 16), v);
+}
+
+int
+suffix (const char *name, const char *domain)
+{
+  size_t n = strlen (name), d = strlen (domain);
+
+  return n > d && name[n - d - 1] == '.' && !strcmp (name + n - d, domain);
+}
+
+void *
+server (void *arg)
+{
+  int s = *(int *) arg;
+  unsigned char q[PACKETSZ], a[PACKETSZ], *p;
+  char name[NS_MAXDNAME];
+  struct sockaddr_in from;
+  socklen_t fromlen;
+  int len, qlen, type, rcode, an, ns;
+
+  for (;;)
+    {
+      fromlen = sizeof from;
+      len = recvfrom (s, q, sizeof q, 0, (struct sockaddr *) &from,
+		      &fromlen);
+      if (len < 0)
+	return NULL;
+      if (len < HFIXEDSZ || (qlen = question (q, len, name)) < 0)
+	continue;
+      type = (q[HFIXEDSZ + qlen - 4] << 8) | q[HFIXEDSZ + qlen - 3];
+      ++queries;
+
+      rcode = NOERROR;
+      an = ns = 0;
+      if (suffix (name, "pos.test") && type == T_A)
+	an = 1;
+      else if (suffix (name, "pos.test"))
+	ns = 1;
+      else
+	{
+	  rcode = NXDOMAIN;
+	  ns = 1;
+	}
+      memcpy (a, q, 2);					/* id */
+      p = put16 (a + 2, 0x8180 | rcode);		/* QR RD RA */
+      p = put16 (p, 1);
+      p = put16 (p, an);
+      p = put16 (p, ns);
+      p = put16 (p, 0);
+      memcpy (p, q + HFIXEDSZ, qlen);
+      p += qlen;
+      if (an)
+	{
+	  p = put16 (p, 0xc000 | HFIXEDSZ);		/* the question name */
+	  p = put16 (p, T_A);
+	  p = put16 (p, C_IN);
+	  p = put32 (p, TTL);
+	  p = put16 (p, 4);
+	  p = put32 (p, 0x0a000001);
+	}
+      if (ns)
+	{
+	  p = put16 (p, 0xc000 | HFIXEDSZ);
+	  p = put16 (p, T_SOA);
+	  p = put16 (p, C_IN);
+	  p = put32 (p, 300);
+	  p = put16 (p, 2 + 5 * 4);
+	  *p++ = 0;					/* mname */
+	  *p++ = 0;					/* rname */
+	  p = put32 (p, 1);				/* serial */
+	  p = put32 (p, 3600);				/* refresh */
+	  p = put32 (p, 600);				/* retry */
+	  p = put32 (p, 86400);				/* expire */
+	  p = put32 (p, TTL);				/* minimum */
+	}
+      sendto (s, a, p - a, 0, (struct sockaddr *) &from, fromlen);
+    }
+}
+
+/* TTL of the first answer record. */
+long
+answer_ttl (const unsigned char *msg, int len)
+{
+  char name[NS_MAXDNAME];
+  int off = HFIXEDSZ + question (msg, len, name) + 2 + 2 * 2;
+
+  if (off + 4 > len)
+    return -1;
+  return ((long) msg[off] << 24) | (msg[off + 1] << 16) | (msg[off + 2] << 8)
+	 | msg[off + 3];
+}
+
+/* Query NAME and check the result against EXPECT (a length > 0 for an
+   answer, or the expected h_errno) and the number of queries the server
+   must have seen by now. */
+int
+query (res_state st, const char *what, const char *name, int type,
+       int expect, int nqueries, unsigned char *ans)
+{
+  int len = res_nquery (st, name, C_IN, type, ans, PACKETSZ);
+
+  if (expect == NETDB_SUCCESS ? len <= 0
+      : len != -1 || st->res_h_errno != expect)
+    {
+      printf ("%s: res_nquery (%s) returned %d, h_errno %d\n", what, name,
+	      len, st->res_h_errno);
+      ret = 1;
+    }
+  else if (queries != nqueries)
+    {
+      printf ("%s: %d queries sent, expected %d\n", what, queries, nqueries);
+      ret = 1;
+    }
+  return len;
+}
+
+int
+main ()
+{
+  struct __res_state st, st2;
+  struct sockaddr_in sin[2];
+  socklen_t sinlen;
+  unsigned char ans[PACKETSZ];
+  pthread_t thr;
+  long ttl;
+  int i, len;
+
+  for (i = 0; i < 2; i++)
+    {
+      srv[i] = socket (AF_INET, SOCK_DGRAM, 0);
+      memset (&sin[i], 0, sizeof sin[i]);
+      sin[i].sin_family = AF_INET;
+      sin[i].sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+      sinlen = sizeof sin[i];
+      if (srv[i] < 0
+	  || bind (srv[i], (struct sockaddr *) &sin[i], sizeof sin[i])
+	  || getsockname (srv[i], (struct sockaddr *) &sin[i], &sinlen)
+	  || pthread_create (&thr, NULL, server, &srv[i]))
+	{
+	  printf ("stub server: %s\n", strerror (errno));
+	  return 1;
+	}
+    }
+
+  /* Use the stub servers instead of the DnsQuery hook, if any. */
+  memset (&st, 0, sizeof st);
+  res_ninit (&st);
+  st.qhook = NULL;
+  st.nscount = 1;
+  st.nsaddr_list[0] = sin[0];
+  st.retry = 1;
+  st2 = st;
+  st2.nsaddr_list[0] = sin[1];
+
+  len = query (&st, "miss", "a.pos.test", T_A, NETDB_SUCCESS, 1, ans);
+  if (len > 0 && answer_ttl (ans, len) != TTL)
+    {
+      printf ("miss: TTL %ld, expected %d\n", answer_ttl (ans, len), TTL);
+      ret = 1;
+    }
+  query (&st, "hit", "a.pos.test", T_A, NETDB_SUCCESS, 1, ans);
+  query (&st, "hit, case", "A.Pos.TEST", T_A, NETDB_SUCCESS, 1, ans);
+  query (&st, "hit, final dot", "a.pos.test.", T_A, NETDB_SUCCESS, 1, ans);
+  query (&st, "other type", "a.pos.test", T_AAAA, NO_DATA, 2, ans);
+  query (&st, "NODATA hit", "a.pos.test", T_AAAA, NO_DATA, 2, ans);
+  query (&st, "NXDOMAIN", "b.nx.test", T_A, HOST_NOT_FOUND, 3, ans);
+  query (&st, "NXDOMAIN hit", "B.nx.test.", T_A, HOST_NOT_FOUND, 3, ans);
+  query (&st2, "other server", "a.pos.test", T_A, NETDB_SUCCESS, 4, ans);
+  query (&st2, "other server hit", "a.pos.test", T_A, NETDB_SUCCESS, 4, ans);
+
+  sleep (1);
+  len = query (&st, "aged hit", "a.pos.test", T_A, NETDB_SUCCESS, 4, ans);
+  ttl = len > 0 ? answer_ttl (ans, len) : -1;
+  if (len > 0 && (ttl >= TTL || ttl < 0))
+    {
+      printf ("aged hit: TTL %ld, expected less than %d\n", ttl, TTL);
+      ret = 1;
+    }
+
+  sleep (TTL);
+  query (&st, "expired", "a.pos.test", T_A, NETDB_SUCCESS, 5, ans);
+  query (&st, "NODATA expired", "a.pos.test", T_AAAA, NO_DATA, 6, ans);
+  query (&st, "NXDOMAIN expired", "b.nx.test", T_A, HOST_NOT_FOUND, 7, ans);
+  query (&st, "hit after expiry", "a.pos.test", T_A, NETDB_SUCCESS, 7, ans);
+
+  close (srv[0]);
+  close (srv[1]);
+  return ret;
+}
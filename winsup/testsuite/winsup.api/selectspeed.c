@@ -0,0 +1,205 @@
+/* selectspeed.c: measure how poll(2) on sockets scales with their number.
+
+   For each number of sockets, N UDP sockets are bound to the loopback
+   interface.  poll(2) waits for all of them while another thread sends a
+   datagram to a random one, and the time from sending to poll returning
+   is reported, along with the time of a poll(2) which doesn't wait.
+
+   Usage: selectspeed [-v] [-i iterations] [count...]
+   Default counts are 10 100 1000 10000. */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+int verbose = 0;
+int iterations = 10;
+
+struct pollfd *pfd;
+struct sockaddr_in *addr;
+int sender;
+int target;
+double sent_at;
+sem_t go;
+sem_t done;
+
+double
+now ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+void *
+send_thread (void *arg)
+{
+  struct timespec delay = { 0, 2000000 };
+
+  while (sem_wait (&go) == 0 && target >= 0)
+    {
+      /* Give the main thread time to block in poll. */
+      nanosleep (&delay, NULL);
+      sent_at = now ();
+      if (sendto (sender, "x", 1, 0, (struct sockaddr *) &addr[target],
+		  sizeof addr[target]) != 1)
+	perror ("sendto");
+      sem_post (&done);
+    }
+  return NULL;
+}
+
+int
+run (int n)
+{
+  struct rlimit rl;
+  double wake = 0, scan = 0;
+  pthread_t thr;
+  char c;
+  int i, ret = 0;
+
+  if (n < 1)
+    return 1;
+  getrlimit (RLIMIT_NOFILE, &rl);
+  if (rl.rlim_cur < (rlim_t) n + 64)
+    {
+      rl.rlim_cur = n + 64;
+      if (rl.rlim_max < rl.rlim_cur)
+	rl.rlim_max = rl.rlim_cur;
+      if (setrlimit (RLIMIT_NOFILE, &rl))
+	{
+	  perror ("setrlimit");
+	  return 1;
+	}
+    }
+  pfd = (struct pollfd *) calloc (n, sizeof *pfd);
+  addr = (struct sockaddr_in *) calloc (n, sizeof *addr);
+  if (!pfd || !addr)
+    {
+      fprintf (stderr, "out of memory\n");
+      return 1;
+    }
+  for (i = 0; i < n; ++i)
+    {
+      socklen_t len = sizeof addr[i];
+
+      addr[i].sin_family = AF_INET;
+      addr[i].sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+      pfd[i].fd = socket (AF_INET, SOCK_DGRAM, 0);
+      pfd[i].events = POLLIN;
+      if (pfd[i].fd < 0
+	  || bind (pfd[i].fd, (struct sockaddr *) &addr[i], sizeof addr[i])
+	  || getsockname (pfd[i].fd, (struct sockaddr *) &addr[i], &len))
+	{
+	  fprintf (stderr, "socket %d of %d: %s\n", i, n, strerror (errno));
+	  n = i;
+	  ret = 1;
+	  goto out;
+	}
+    }
+
+  sem_init (&go, 0, 0);
+  sem_init (&done, 0, 0);
+  pthread_create (&thr, NULL, send_thread, NULL);
+  for (i = 0; i < iterations; ++i)
+    {
+      double start;
+      int ready, k;
+
+      target = rand () % n;
+      sem_post (&go);
+      ready = poll (pfd, n, 5000);
+      wake += now () - sent_at;
+      sem_wait (&done);
+      if (ready != 1 || pfd[target].revents != POLLIN)
+	{
+	  fprintf (stderr, "%d sockets: poll returned %d, socket %d revents "
+		   "%#x\n", n, ready, target, pfd[target].revents);
+	  ret = 1;
+	  break;
+	}
+
+      start = now ();
+      ready = poll (pfd, n, 0);
+      scan += now () - start;
+      for (k = 0; k < n; ++k)
+	if (pfd[k].revents && k != target)
+	  {
+	    fprintf (stderr, "%d sockets: socket %d revents %#x\n",
+		     n, k, pfd[k].revents);
+	    ret = 1;
+	  }
+      if (ready != 1 || recv (pfd[target].fd, &c, 1, 0) != 1)
+	ret = 1;
+      if (ret)
+	break;
+      if (verbose)
+	printf ("  socket %d ok\n", target);
+    }
+  target = -1;
+  sem_post (&go);
+  pthread_join (thr, NULL);
+  sem_destroy (&go);
+  sem_destroy (&done);
+
+  if (!ret)
+    printf ("%6d sockets: wakeup %9.1f us, non-blocking poll %9.1f us\n",
+	    n, wake / iterations, scan / iterations);
+out:
+  for (i = 0; i < n; ++i)
+    close (pfd[i].fd);
+  free (pfd);
+  free (addr);
+  return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+  static const int counts[] = { 10, 100, 1000, 10000 };
+  int opt, i, ret = 0;
+
+  while ((opt = getopt (argc, argv, "vi:")) != -1)
+    switch (opt)
+      {
+      case 'v':
+	verbose = 1;
+	break;
+      case 'i':
+	iterations = atoi (optarg);
+	break;
+      default:
+	fprintf (stderr,
+		 "Usage: %s [-v] [-i iterations] [count...]\n", argv[0]);
+	return 1;
+      }
+  if (iterations < 1)
+    iterations = 1;
+
+  sender = socket (AF_INET, SOCK_DGRAM, 0);
+  if (sender < 0)
+    {
+      perror ("socket");
+      return 1;
+    }
+  srand (time (NULL));
+  if (optind < argc)
+    for (i = optind; i < argc; ++i)
+      ret |= run (atoi (argv[i]));
+  else
+    for (i = 0; i < (int) (sizeof counts / sizeof *counts); ++i)
+      ret |= run (counts[i]);
+  close (sender);
+  return ret;
+}
@@ -0,0 +1,201 @@
+/* splice.c: check splice(2), tee(2) and vmsplice(2) between pipes and
+   files. */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define FSIZE (3 * 1024 * 1024 + 123)
+
+int ret = 0;
+
+void
+fail (const char *what)
+{
+  printf ("%s: %s\n", what, strerror (errno));
+  ret = 1;
+}
+
+unsigned char
+pattern (size_t off)
+{
+  return off * 13 + (off >> 10);
+}
+
+/* Read len bytes from fd and compare them with the pattern at off. */
+int
+check_pattern (int fd, size_t off, size_t len)
+{
+  unsigned char buf[4096];
+
+  while (len > 0)
+    {
+      ssize_t n = read (fd, buf, len < sizeof buf ? len : sizeof buf);
+      ssize_t i;
+
+      if (n <= 0)
+	return 0;
+      for (i = 0; i < n; ++i)
+	if (buf[i] != pattern (off + i))
+	  return 0;
+      off += n;
+      len -= n;
+    }
+  return 1;
+}
+
+void
+test_file_to_pipe (const char *name)
+{
+  unsigned char *buf = malloc (FSIZE);
+  int fd, pfd[2];
+  loff_t off;
+  size_t i;
+  ssize_t n;
+
+  for (i = 0; i < FSIZE; ++i)
+    buf[i] = pattern (i);
+  fd = open (name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0 || write (fd, buf, FSIZE) != FSIZE || pipe (pfd))
+    {
+      fail ("file setup");
+      return;
+    }
+  free (buf);
+
+  /* With an offset, the file position stays where it is. */
+  off = 70000;
+  n = splice (fd, &off, pfd[1], NULL, 1000, 0);
+  if (n != 1000 || off != 71000 || lseek (fd, 0, SEEK_CUR) != FSIZE
+      || !check_pattern (pfd[0], 70000, 1000))
+    fail ("splice from file at offset");
+
+  /* Without an offset, the file position advances.  Don't fill the pipe,
+     the data is read back only afterwards. */
+  lseek (fd, FSIZE - 5000, SEEK_SET);
+  n = splice (fd, NULL, pfd[1], NULL, 8192, 0);
+  if (n != 5000 || lseek (fd, 0, SEEK_CUR) != FSIZE
+      || !check_pattern (pfd[0], FSIZE - 5000, 5000))
+    fail ("splice from file position");
+
+  /* At EOF. */
+  if (splice (fd, NULL, pfd[1], NULL, 8192, 0) != 0)
+    fail ("splice at EOF");
+
+  /* Pipe to file, at an offset. */
+  if (write (pfd[1], "spliced", 7) != 7)
+    fail ("write to pipe");
+  off = 100;
+  n = splice (pfd[0], NULL, fd, &off, 100, 0);
+  if (n != 7 || off != 107 || pread (fd, buf = malloc (7), 7, 100) != 7
+      || memcmp (buf, "spliced", 7))
+    fail ("splice to file");
+  free (buf);
+
+  /* Offsets aren't allowed on pipes. */
+  off = 0;
+  errno = 0;
+  if (splice (pfd[0], &off, fd, NULL, 100, 0) != -1 || errno != ESPIPE)
+    fail ("splice with pipe offset");
+  errno = 0;
+  if (splice (fd, NULL, fd, NULL, 100, 0) != -1 || errno != EINVAL)
+    fail ("splice without pipe");
+
+  close (pfd[0]);
+  close (pfd[1]);
+  close (fd);
+  unlink (name);
+}
+
+void
+test_pipes ()
+{
+  int a[2], b[2];
+  char buf[64];
+  struct iovec iov[3];
+  ssize_t n;
+
+  if (pipe (a) || pipe (b))
+    {
+      fail ("pipe");
+      return;
+    }
+
+  /* vmsplice into the first pipe. */
+  iov[0].iov_base = "hello";
+  iov[0].iov_len = 5;
+  iov[1].iov_base = ", ";
+  iov[1].iov_len = 2;
+  iov[2].iov_base = "world";
+  iov[2].iov_len = 5;
+  if (vmsplice (a[1], iov, 3, 0) != 12)
+    fail ("vmsplice to pipe");
+
+  /* tee leaves the data in the first pipe. */
+  n = tee (a[0], b[1], sizeof buf, 0);
+  if (n != 12 || read (b[0], buf, sizeof buf) != 12
+      || memcmp (buf, "hello, world", 12))
+    fail ("tee");
+
+  /* splice moves it. */
+  n = splice (a[0], NULL, b[1], NULL, sizeof buf, 0);
+  if (n != 12 || read (b[0], buf, sizeof buf) != 12
+      || memcmp (buf, "hello, world", 12))
+    fail ("splice between pipes");
+
+  /* Nothing left. */
+  errno = 0;
+  if (splice (a[0], NULL, b[1], NULL, sizeof buf, SPLICE_F_NONBLOCK) != -1
+      || errno != EAGAIN)
+    fail ("splice from empty pipe");
+  errno = 0;
+  if (tee (a[0], b[1], sizeof buf, SPLICE_F_NONBLOCK) != -1
+      || errno != EAGAIN)
+    fail ("tee from empty pipe");
+
+  /* vmsplice from the read side. */
+  if (write (a[1], "abcdef", 6) != 6)
+    fail ("write to pipe");
+  memset (buf, 0, sizeof buf);
+  iov[0].iov_base = buf;
+  iov[0].iov_len = 2;
+  iov[1].iov_base = buf + 10;
+  iov[1].iov_len = 10;
+  if (vmsplice (a[0], iov, 2, 0) != 6 || memcmp (buf, "ab", 2)
+      || memcmp (buf + 10, "cdef", 4))
+    fail ("vmsplice from pipe");
+
+  errno = 0;
+  if (tee (a[0], a[1], sizeof buf, 0) != -1 || errno != EINVAL)
+    fail ("tee to the same pipe");
+  errno = 0;
+  if (tee (a[1], b[1], sizeof buf, 0) != -1 || errno != EBADF)
+    fail ("tee from write side");
+
+  /* EOF once the writer is gone. */
+  close (a[1]);
+  if (splice (a[0], NULL, b[1], NULL, sizeof buf, 0) != 0)
+    fail ("splice at EOF");
+
+  close (a[0]);
+  close (b[0]);
+  close (b[1]);
+}
+
+int
+main ()
+{
+  char name[] = "splice.XXXXXX";
+
+  close (mkstemp (name));
+  test_file_to_pipe (name);
+  test_pipes ();
+  if (!ret)
+    printf ("splice: all tests passed\n");
+  return ret;
+}
@@ -12,6 +12,7 @@ details. */
 #include <winternl.h>
 #define cygwin_internal cygwin_internal_dontuse
 #include <stdio.h>
+#include <ctype.h>
 #include <fcntl.h>
 #include <io.h>
 #include <getopt.h>
@@ -47,6 +48,7 @@ static int new_window;
 static long flush_period;
 static int include_hex;
 static int quiet = -1;
+static int ring;
 
 static unsigned char strace_active = 1;
 static int processes;
@@ -65,9 +67,15 @@ struct child_list
   char nfields;
   long long start_time;
   DWORD last_usecs;
+  HANDLE ring_section;
+  __strace_ring_hdr *ring;
+  long long ring_dropped[_STRACE_RING_THREADS];
+  long long ring_nothread;
+  long long ring_nostr;
   struct child_list *next;
     child_list ():id (0), hproc (NULL), saw_stars (0), nfields (0),
-    start_time (0), last_usecs (0), next (NULL)
+    start_time (0), last_usecs (0), ring_section (NULL), ring (NULL),
+    ring_dropped (), ring_nothread (0), ring_nostr (0), next (NULL)
   {
   }
 };
@@ -153,6 +161,10 @@ remove_child (DWORD id)
       {
 	child_list *c1 = c->next;
 	c->next = c1->next;
+	if (c1->ring)
+	  UnmapViewOfFile (c1->ring);
+	if (c1->ring_section)
+	  CloseHandle (c1->ring_section);
 	free (c1);
 	if (!quiet)
 	  fprintf (stderr, "Windows process %lu detached\n", id);
@@ -457,6 +469,309 @@ syst (long long t)
   return &st;
 }
 
+static void output_line (child_list *, char *, unsigned long long, unsigned,
+			 FILE *);
+
+/* Take over the ring section of a process traced with --ring.  Setting
+   the mask tells the process that we're reading it. */
+static void
+attach_ring (child_list *child, HANDLE h, unsigned mask)
+{
+  HANDLE section;
+  __strace_ring_hdr *hdr;
+
+  if (!DuplicateHandle (child->hproc, h, GetCurrentProcess (), &section,
+			0, FALSE, DUPLICATE_SAME_ACCESS))
+    {
+      warn (0, "couldn't get ring section from process %lu, "
+	       "windows error %lu", child->id, GetLastError ());
+      return;
+    }
+  hdr = (__strace_ring_hdr *) MapViewOfFile (section, FILE_MAP_WRITE, 0, 0,
+					     sizeof (__strace_ring_hdr));
+  if (!hdr || hdr->magic != _STRACE_RING_MAGIC
+      || hdr->version != _STRACE_RING_VERSION)
+    {
+      warn (0, "unsupported ring section in process %lu", child->id);
+      if (hdr)
+	UnmapViewOfFile (hdr);
+      CloseHandle (section);
+      return;
+    }
+  hdr->mask = mask;
+  child->ring_section = section;
+  child->ring = hdr;
+}
+
+/* Format the message of ring record REC the way __small_vsprintf in the
+   Cygwin DLL would have done it.  Returns a pointer to the trailing NUL. */
+static char *
+ring_format (char *dst, char *end, __strace_ring_hdr *hdr,
+	     __strace_ring_rec *rec)
+{
+  __strace_ring_str *fe = NULL;
+  const char *fmt;
+  unsigned argn = 0;
+  long long Rval = 0;
+
+  if (rec->fmt < _STRACE_RING_STRINGS && hdr->str[rec->fmt].ready)
+    fe = &hdr->str[rec->fmt];
+  if (!fe)
+    return dst + snprintf (dst, end - dst, "(format string lost)");
+  fmt = fe->str;
+  while (*fmt && dst < end - 32)
+    {
+      int len = 0;
+      char pad = ' ';
+      bool l_opt = false, lower = false, sign = false;
+      int prec = -1;
+      unsigned long long val = 0;
+      char c;
+
+      if (*fmt != '%')
+	{
+	  *dst++ = *fmt++;
+	  continue;
+	}
+      if (*++fmt == '%')
+	{
+	  *dst++ = *fmt++;
+	  continue;
+	}
+      if (*fmt == '+')
+	{
+	  sign = true;
+	  ++fmt;
+	}
+      for (;; ++fmt)
+	if (*fmt == '0' && !len)
+	  pad = '0';
+	else if (*fmt >= '0' && *fmt <= '9')
+	  len = len * 10 + *fmt - '0';
+	else if (*fmt == 'l')
+	  l_opt = true;
+	else if (*fmt == '_')
+	  lower = true;
+	else
+	  break;
+      if (!(c = *fmt++))
+	break;
+      if (c == '.')
+	{
+	  prec = strtol (fmt, (char **) &fmt, 10);
+	  if (*fmt != 's')
+	    {
+	      if (*fmt)
+		++fmt;
+	      continue;
+	    }
+	  ++fmt;
+	  c = 's';
+	}
+      if (c != 'E' && c != 'P')
+	{
+	  if (argn >= fe->nargs)
+	    {
+	      *dst++ = '?';
+	      continue;
+	    }
+	  val = rec->args[argn++];
+	}
+      char nfmt[16], *nf = nfmt;
+      *nf++ = '%';
+      if (sign)
+	*nf++ = '+';
+      if (pad == '0')
+	*nf++ = '0';
+      nf = stpcpy (nf, "*ll");
+      switch (c)
+	{
+	case 'c':
+	  *dst++ = (char) val;
+	  continue;
+	case 'C':
+	  {
+	    WCHAR wc = (WCHAR) val;
+	    dst += WideCharToMultiByte (CP_UTF8, 0, &wc, 1, dst, 8, NULL,
+					NULL);
+	  }
+	  continue;
+	case 'E':
+	  dst += snprintf (dst, end - dst, "Win32 error %*u", len,
+			   rec->winerr);
+	  continue;
+	case 'R':
+	  Rval = l_opt ? (long long) val : (long long) (int) val;
+	  val = Rval;
+	  c = 'd';
+	  break;
+	case 'd':
+	  if (!l_opt)
+	    val = (long long) (int) val;
+	  break;
+	case 'u':
+	case 'o':
+	case 'x':
+	  if (!l_opt)
+	    val = (unsigned int) val;
+	  break;
+	case 'y':
+	  if (!l_opt)
+	    val = (unsigned int) val;
+	  fallthrough;
+	case 'p':
+	case 'Y':
+	  dst = stpcpy (dst, "0x");
+	  c = 'x';
+	  break;
+	case 'D':
+	  c = 'd';
+	  break;
+	case 'U':
+	case 'O':
+	case 'X':
+	  c = tolower (c);
+	  break;
+	case 'P':
+	  dst += snprintf (dst, end - dst, "%s", hdr->progname);
+	  continue;
+	case 's':
+	case 'W':
+	case 'S':
+	  if (val == _STRACE_RING_NULL)
+	    dst += snprintf (dst, end - dst, "(null)");
+	  else
+	    {
+	      unsigned off = (val >> 16) & 0xffff;
+	      unsigned slen = val & 0xffff;
+
+	      if (off > _STRACE_RING_DATA || slen > _STRACE_RING_DATA - off)
+		slen = 0;
+	      if (c == 's')
+		{
+		  if (prec >= 0 && (unsigned) prec < slen)
+		    slen = prec;
+		  if (slen > (size_t) (end - dst - 1))
+		    slen = end - dst - 1;
+		  memcpy (dst, rec->data + off, slen);
+		  dst += slen;
+		}
+	      else
+		dst += WideCharToMultiByte (CP_UTF8, 0,
+					    (PWCHAR) (rec->data + off),
+					    slen / sizeof (WCHAR), dst,
+					    end - dst - 1, NULL, NULL);
+	    }
+	  continue;
+	default:
+	  *dst++ = '?';
+	  *dst++ = c;
+	  continue;
+	}
+      /* Numeric conversion.  __small_vsprintf prints upper case hex digits
+	 unless the '_' flag is given. */
+      *nf++ = (c == 'x' && !lower) ? 'X' : c;
+      *nf = '\0';
+      dst += snprintf (dst, end - dst, nfmt, len, val);
+    }
+  if (dst > end - 1)
+    dst = end - 1;
+  if (Rval < 0)
+    dst += snprintf (dst, end - dst, ", errno %d", rec->errnum);
+  if (dst > end - 1)
+    dst = end - 1;
+  *dst = '\0';
+  return dst;
+}
+
+static void
+report_ring_drops (child_list *child, FILE *ofile)
+{
+  __strace_ring_hdr *hdr = child->ring;
+
+  for (int i = 0; i < _STRACE_RING_THREADS; i++)
+    if (hdr->ring[i].dropped != child->ring_dropped[i])
+      {
+	fprintf (ofile, "--- Process %lu thread %lu dropped %lld records\n",
+		 child->id, (unsigned long) hdr->ring[i].owner,
+		 hdr->ring[i].dropped - child->ring_dropped[i]);
+	child->ring_dropped[i] = hdr->ring[i].dropped;
+      }
+  if (hdr->nothread_dropped != child->ring_nothread)
+    {
+      fprintf (ofile, "--- Process %lu dropped %lld records of threads "
+		      "without a ring\n", child->id,
+	       hdr->nothread_dropped - child->ring_nothread);
+      child->ring_nothread = hdr->nothread_dropped;
+    }
+  if (hdr->nostr_dropped != child->ring_nostr)
+    {
+      fprintf (ofile, "--- Process %lu string table full, %lld strings "
+		      "lost\n", child->id,
+	       hdr->nostr_dropped - child->ring_nostr);
+      child->ring_nostr = hdr->nostr_dropped;
+    }
+}
+
+/* Format and print all complete records in the rings of CHILD.  Records
+   are printed per thread, so lines of different threads may appear out of
+   order relative to each other. */
+static void
+drain_ring (child_list *child, unsigned mask, FILE *ofile)
+{
+  __strace_ring_hdr *hdr = child->ring;
+  static char buf[32 + 4096];
+  __strace_ring_rec rec;
+
+  /* Rings are given back when their thread exits, so a free ring may be
+     followed by rings in use, and may still hold records. */
+  for (int i = 0; i < _STRACE_RING_THREADS; i++)
+    {
+      __strace_ring *r = &hdr->ring[i];
+      unsigned long long tail = r->tail;
+
+      while (tail != r->head)
+	{
+	  __strace_ring_rec *rp = &r->rec[tail & (_STRACE_RING_RECORDS - 1)];
+	  if (rp->seq != tail + 1)
+	    break;
+	  MemoryBarrier ();
+	  memcpy (&rec, (void *) rp, sizeof rec);
+	  r->tail = ++tail;
+
+	  /* Skip headroom for output_line, see there. */
+	  char *s = buf + 32, *p;
+	  const char *tname = rec.tname < _STRACE_RING_STRINGS
+			      && hdr->str[rec.tname].ready
+			      ? hdr->str[rec.tname].str : "unknown";
+	  const char *func = rec.func < _STRACE_RING_STRINGS
+			     && hdr->str[rec.func].ready
+			     ? hdr->str[rec.func].str : "";
+	  char pidbuf[16];
+	  if (hdr->pid)
+	    sprintf (pidbuf, "%d", hdr->pid);
+	  else
+	    sprintf (pidbuf, "(%lu)", child->id);
+	  p = s + sprintf (s, "%7lld [%s] %s %s %s", rec.usecs, tname,
+			   hdr->progname, pidbuf, func);
+	  p = ring_format (p, buf + sizeof buf - 2, hdr, &rec);
+	  while (p > s && p[-1] == '\n')
+	    --p;
+	  strcpy (p, "\n");
+	  output_line (child, s, rec.category, mask, ofile);
+	}
+    }
+  report_ring_drops (child, ofile);
+}
+
+static void
+drain_rings (unsigned mask, FILE *ofile)
+{
+  for (child_list *c = &children; (c = c->next) != NULL;)
+    if (c->ring)
+      drain_ring (c, mask, ofile);
+}
+
 static void
 handle_output_debug_string (DWORD id, LPVOID p, unsigned mask, FILE *ofile)
 {
@@ -494,7 +809,8 @@ handle_output_debug_string (DWORD id, LPVOID p, unsigned mask, FILE *ofile)
   else
     {
       special = len;
-      if (special == _STRACE_INTERFACE_ACTIVATE_ADDR || special == _STRACE_CHILD_PID)
+      if (special == _STRACE_INTERFACE_ACTIVATE_ADDR
+	  || special == _STRACE_CHILD_PID || special == _STRACE_RING_SECTION)
 	len = 17;
     }
 
@@ -524,6 +840,12 @@ handle_output_debug_string (DWORD id, LPVOID p, unsigned mask, FILE *ofile)
       return;
     }
 
+  if (special == _STRACE_RING_SECTION)
+    {
+      attach_ring (child, (HANDLE) n, mask);
+      return;
+    }
+
   if (special == _STRACE_INTERFACE_ACTIVATE_ADDR)
     {
       s = strtok (NULL, " ");
@@ -536,6 +858,16 @@ handle_output_debug_string (DWORD id, LPVOID p, unsigned mask, FILE *ofile)
       return;
     }
 
+  output_line (child, s, n, mask, ofile);
+}
+
+/* Print one trace line S of category N, which is of the form
+   "usecs [thread] program pid function: message".  S must be preceded by
+   at least 20 bytes of writable space for the timestamp rewriting below. */
+static void
+output_line (child_list *child, char *s, unsigned long long n, unsigned mask,
+	     FILE *ofile)
+{
   char *origs = s;
 
   if (mask & n)
@@ -715,9 +1047,12 @@ proc_child (unsigned mask, FILE *ofile, pid_t pid)
   last_time = time (NULL);
   while (1)
     {
-      BOOL debug_event = WaitForDebugEvent (&ev, 1000);
+      BOOL debug_event = WaitForDebugEvent (&ev, ring ? 50 : 1000);
       DWORD status = DBG_CONTINUE;
 
+      if (ring)
+	drain_rings (mask, ofile);
+
       if (bufsize && flush_period > 0 &&
 	  (cur_time = time (NULL)) >= last_time + flush_period)
 	{
@@ -786,6 +1121,8 @@ proc_child (unsigned mask, FILE *ofile, pid_t pid)
 	    fprintf (ofile, "--- Process %s exited with status 0x%lx\n",
 		     cygwin_pid (ev.dwProcessId), ev.u.ExitProcess.dwExitCode);
 	  res = ev.u.ExitProcess.dwExitCode;
+	  if (ring)
+	    drain_rings (mask, ofile);
 	  remove_child (ev.dwProcessId);
 	  break;
 
@@ -995,6 +1332,10 @@ Trace system calls and signals\n\
   -o, --output=FILENAME        set output file to FILENAME\n\
   -p, --pid=n                  attach to executing program with cygwin pid n\n\
   -q, --quiet                  suppress messages about attaching, detaching, etc.\n\
+  -r, --ring                   let the traced process store binary records\n\
+			       in memory, formatted by strace.  Much lower\n\
+			       overhead, but records may be dropped if\n\
+			       strace can't keep up\n\
   -S, --flush-period=PERIOD    flush buffered strace output every PERIOD secs\n\
   -t, --timestamp              use an absolute hh:mm:ss timestamp insted of \n\
 			       the default microsecond timestamp.  Implies -d\n\
@@ -1052,6 +1393,7 @@ struct option longopts[] = {
   {"no-delta", no_argument, NULL, 'd'},
   {"pid", required_argument, NULL, 'p'},
   {"quiet", no_argument, NULL, 'q'},
+  {"ring", no_argument, NULL, 'r'},
   {"timestamp", no_argument, NULL, 't'},
   {"toggle", no_argument, NULL, 'T'},
   {"trace-children", no_argument, NULL, 'f'},
@@ -1061,7 +1403,7 @@ struct option longopts[] = {
   {NULL, 0, NULL, 0}
 };
 
-static const char *const opts = "+b:dehHfm:no:p:qS:tTuVw";
+static const char *const opts = "+b:dehHfm:no:p:qrS:tTuVw";
 
 static void
 print_version ()
@@ -1156,6 +1498,9 @@ character #%d.\n", optarg, (int) (endptr - optarg), endptr);
 	else
 	  sawquiet ^= 1;
 	break;
+      case 'r':
+	ring ^= 1;
+	break;
       case 'S':
 	flush_period = strtoul (optarg, NULL, 10);
 	break;
@@ -1201,6 +1546,9 @@ character #%d.\n", optarg, (int) (endptr - optarg), endptr);
   if (!mask)
     mask = _STRACE_ALL;
 
+  if (ring)
+    strace_active |= _STRACE_RING_ACTIVE;
+
   if (!ofile)
     ofile = stdout;
 